@@ -0,0 +1,355 @@
+/**
+ * aec.c — acoustic/line echo canceller (ausock_aec)
+ *
+ * Every agent frame handed to rh() (far end) is kept in a history
+ * ring; every caller frame out of wh() (near end) has the agent's
+ * echo estimated from that history and subtracted, on the scheduler
+ * thread, before the caller audio goes anywhere else.
+ *
+ * Two stages:
+ *
+ *   - bulk delay: the echo path through baresip's jitter buffer, the
+ *     codec and the phone network delays the echo by tens to hundreds
+ *     of ms.  Coarse 4 ms energy envelopes of both ends are
+ *     cross-correlated over AEC_SEARCH_MS of lag; a lag that wins
+ *     AEC_DELAY_VOTES estimates in a row becomes the delay.
+ *
+ *   - NLMS: a normalised-LMS FIR filter of ausock_aec ms sits on the
+ *     far history at that delay and models the echo path itself.
+ *     Adaptation freezes while the caller talks over the agent
+ *     (Geigel test), so double talk does not pull the filter off, and
+ *     a filter that makes things worse is reset.
+ *
+ * Linear stage only, there is no residual echo suppressor.  Far and
+ * near frames of one tick arrive in a fixed order, whichever it is,
+ * so the delay search absorbs it.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include <re.h>
+
+#include "ausock.h"
+
+#define AEC_HISTORY_MS   640    /* far-end audio kept; > search + tail */
+#define AEC_SEARCH_MS    400    /* longest bulk delay looked for */
+#define AEC_WINDOW_MS    240    /* near-end envelope correlated */
+#define AEC_BLOCK_MS     4      /* envelope resolution */
+#define AEC_DELAY_VOTES  3      /* estimates in a row to move the delay */
+#define AEC_MIN_CORR     0.5    /* weakest envelope match trusted */
+#define AEC_MU           0.5    /* NLMS step size */
+#define AEC_FAR_MIN      64.0   /* far mean |x| below this: no adaptation */
+
+struct aec {
+	uint32_t srate;
+	uint32_t sampc;        /* per frame */
+
+	/* far-end history, absolute sample positions mod hist */
+	float   *far;
+	uint32_t hist;         /* power of two */
+	uint64_t fpos;         /* far samples written */
+
+	/* coarse envelopes for the delay search, per block */
+	float   *fenv;         /* far, aligned with far[] */
+	float   *nenv;         /* near, last nwin blocks */
+	uint32_t block;        /* samples per block */
+	uint32_t nblk;         /* blocks in fenv ring */
+	uint32_t nwin;
+	uint32_t npos;         /* near blocks written */
+	uint32_t maxlag;       /* in blocks */
+	uint32_t cand;         /* candidate lag, blocks */
+	uint32_t votes;
+
+	/* NLMS */
+	float   *w;
+	int16_t *out;          /* one frame of echo-cancelled output */
+	uint32_t taps;
+	uint32_t delay;        /* bulk delay, samples */
+	double   xpow;         /* ||x||^2 over the taps, running */
+	bool     active;       /* a delay has been found */
+};
+
+static void aec_destructor(void *data)
+{
+	struct aec *aec = data;
+
+	mem_deref(aec->far);
+	mem_deref(aec->fenv);
+	mem_deref(aec->nenv);
+	mem_deref(aec->w);
+	mem_deref(aec->out);
+}
+
+static uint32_t pow2_at_least(uint32_t n)
+{
+	uint32_t p = 1;
+
+	while (p < n)
+		p <<= 1;
+
+	return p;
+}
+
+/** tail_ms: echo path length the NLMS filter models */
+int aec_alloc(struct aec **aecp, uint32_t srate, uint32_t sampc,
+	      uint32_t tail_ms)
+{
+	struct aec *aec;
+	int err = 0;
+
+	if (!aecp || !srate || !sampc || !tail_ms)
+		return EINVAL;
+
+	aec = mem_zalloc(sizeof(*aec), aec_destructor);
+	if (!aec)
+		return ENOMEM;
+
+	aec->srate  = srate;
+	aec->sampc  = sampc;
+	aec->taps   = srate * tail_ms / 1000;
+	aec->hist   = pow2_at_least(srate * AEC_HISTORY_MS / 1000 +
+				    aec->taps);
+	aec->block  = srate * AEC_BLOCK_MS / 1000;
+	aec->nblk   = aec->hist / aec->block;
+	aec->nwin   = AEC_WINDOW_MS / AEC_BLOCK_MS;
+	aec->maxlag = AEC_SEARCH_MS / AEC_BLOCK_MS;
+
+	if (!aec->block || aec->nwin + aec->maxlag > aec->nblk ||
+	    sampc % aec->block) {
+		err = EINVAL;
+		goto out;
+	}
+
+	aec->far  = mem_zalloc(aec->hist * sizeof(float), NULL);
+	aec->fenv = mem_zalloc(aec->nblk * sizeof(float), NULL);
+	aec->nenv = mem_zalloc(aec->nwin * sizeof(float), NULL);
+	aec->w    = mem_zalloc(aec->taps * sizeof(float), NULL);
+	aec->out  = mem_zalloc(sampc * sizeof(int16_t), NULL);
+	if (!aec->far || !aec->fenv || !aec->nenv || !aec->w || !aec->out)
+		err = ENOMEM;
+
+ out:
+	if (err)
+		mem_deref(aec);
+	else
+		*aecp = aec;
+
+	return err;
+}
+
+/** Forget the echo path, e.g. for a new call on the channel */
+void aec_reset(struct aec *aec)
+{
+	memset(aec->far, 0, aec->hist * sizeof(float));
+	memset(aec->fenv, 0, aec->nblk * sizeof(float));
+	memset(aec->nenv, 0, aec->nwin * sizeof(float));
+	memset(aec->w, 0, aec->taps * sizeof(float));
+
+	aec->fpos   = 0;
+	aec->npos   = 0;
+	aec->cand   = 0;
+	aec->votes  = 0;
+	aec->delay  = 0;
+	aec->xpow   = 0;
+	aec->active = false;
+}
+
+static float block_env(const int16_t *sampv, uint32_t n)
+{
+	float sum = 0;
+
+	for (uint32_t i = 0; i < n; i++)
+		sum += fabsf((float)sampv[i]);
+
+	return sum / n;
+}
+
+/** Agent frame handed to rh(), or NULL for a tick without agent audio */
+void aec_far(struct aec *aec, const int16_t *sampv, size_t sampc)
+{
+	const uint32_t mask = aec->hist - 1;
+
+	if (sampc != aec->sampc)
+		return;
+
+	for (uint32_t i = 0; i < sampc; i++)
+		aec->far[(aec->fpos + i) & mask] = sampv ? sampv[i] : 0;
+
+	for (uint32_t b = 0; b < sampc / aec->block; b++) {
+		uint64_t blk = aec->fpos / aec->block + b;
+
+		aec->fenv[blk % aec->nblk] = sampv ?
+			block_env(sampv + b * aec->block, aec->block) : 0;
+	}
+
+	aec->fpos += sampc;
+}
+
+/**
+ * Bulk delay search: correlate the near envelope window with the far
+ * envelope at every lag up to maxlag, in blocks behind the window.
+ */
+static void delay_search(struct aec *aec)
+{
+	const uint64_t fblk = aec->fpos / aec->block;  /* far "now" */
+	double nn = 0, best = AEC_MIN_CORR;
+	uint32_t lag, bestlag = 0;
+	bool found = false;
+
+	if (aec->npos < aec->nwin || fblk < aec->nwin + aec->maxlag)
+		return;
+
+	for (uint32_t k = 0; k < aec->nwin; k++)
+		nn += (double)aec->nenv[k] * aec->nenv[k];
+
+	if (nn <= 0)
+		return;
+
+	for (lag = 0; lag <= aec->maxlag; lag++) {
+		double nf = 0, ff = 0, c;
+
+		for (uint32_t k = 0; k < aec->nwin; k++) {
+			/* k-th block of the window, oldest first */
+			uint32_t nk = (aec->npos + k) % aec->nwin;
+			uint64_t fk = fblk - aec->nwin - lag + k;
+			double f = aec->fenv[fk % aec->nblk];
+
+			nf += aec->nenv[nk] * f;
+			ff += f * f;
+		}
+
+		if (ff <= 0)
+			continue;
+
+		c = nf / sqrt(nn * ff);
+		if (c > best) {
+			best    = c;
+			bestlag = lag;
+			found   = true;
+		}
+	}
+
+	if (!found)
+		return;
+
+	if (bestlag + 1 >= aec->cand && bestlag <= aec->cand + 1) {
+		if (++aec->votes < AEC_DELAY_VOTES)
+			return;
+	} else {
+		aec->cand  = bestlag;
+		aec->votes = 1;
+		return;
+	}
+
+	/* taps start a quarter tail before the estimate */
+	lag = bestlag * aec->block;
+	lag = lag > aec->taps / 4 ? lag - aec->taps / 4 : 0;
+
+	if (!aec->active || lag + aec->taps / 4 < aec->delay ||
+	    lag > aec->delay + aec->taps / 4) {
+		memset(aec->w, 0, aec->taps * sizeof(float));
+		aec->delay  = lag;
+		aec->active = true;
+	}
+}
+
+/** Caller frame out of wh(): the agent's echo is subtracted in place */
+void aec_near(struct aec *aec, int16_t *sampv, size_t sampc)
+{
+	const uint32_t mask = aec->hist - 1;
+	const uint32_t taps = aec->taps;
+	double  dpow = 0, epow = 0;
+	float   farmax = 0, nearmax = 0, farsum = 0;
+	int16_t *out = aec->out;
+	uint64_t x0;
+	bool adapt;
+
+	if (sampc != aec->sampc)
+		return;
+
+	for (uint32_t b = 0; b < sampc / aec->block; b++) {
+		aec->nenv[aec->npos % aec->nwin] =
+			block_env(sampv + b * aec->block, aec->block);
+		++aec->npos;
+	}
+
+	delay_search(aec);
+
+	if (!aec->active || aec->fpos < sampc + aec->delay + taps)
+		return;
+
+	/* far sample lined up with near sample 0, before the bulk delay */
+	x0 = aec->fpos - sampc - aec->delay;
+
+	for (uint32_t j = 0; j < taps + sampc; j++) {
+		float v = fabsf(aec->far[(x0 + sampc - 1 - j) & mask]);
+
+		farsum += v;
+		if (v > farmax)
+			farmax = v;
+	}
+	for (uint32_t i = 0; i < sampc; i++) {
+		float v = fabsf((float)sampv[i]);
+
+		if (v > nearmax)
+			nearmax = v;
+	}
+
+	/* Geigel: echo comes back at least 6 dB down, louder is the caller */
+	adapt = farsum / (taps + sampc) >= AEC_FAR_MIN &&
+		nearmax <= 0.5f * farmax;
+
+	aec->xpow = 0;
+	for (uint32_t j = 0; j < taps; j++) {
+		float x = aec->far[(x0 - j) & mask];
+
+		aec->xpow += (double)x * x;
+	}
+
+	for (uint32_t i = 0; i < sampc; i++) {
+		const uint64_t xi = x0 + i;
+		float y = 0, e;
+
+		for (uint32_t j = 0; j < taps; j++)
+			y += aec->w[j] * aec->far[(xi - j) & mask];
+
+		e = (float)sampv[i] - y;
+
+		if (adapt) {
+			const float g = (float)(AEC_MU /
+						(aec->xpow + 1e3 * taps));
+
+			for (uint32_t j = 0; j < taps; j++)
+				aec->w[j] += g * e * aec->far[(xi - j) & mask];
+		}
+
+		/* slide ||x||^2 by one sample */
+		{
+			float xin  = aec->far[(xi + 1) & mask];
+			float xout = aec->far[(xi + 1 - taps) & mask];
+
+			aec->xpow += (double)xin * xin - (double)xout * xout;
+			if (aec->xpow < 0)
+				aec->xpow = 0;
+		}
+
+		dpow += (double)sampv[i] * sampv[i];
+		epow += (double)e * e;
+
+		if (e > 32767.0f)
+			e = 32767.0f;
+		else if (e < -32768.0f)
+			e = -32768.0f;
+
+		out[i] = (int16_t)lrintf(e);
+	}
+
+	/* diverged: worse than doing nothing */
+	if (epow > 2.0 * dpow + 1.0) {
+		memset(aec->w, 0, taps * sizeof(float));
+		return;
+	}
+
+	memcpy(sampv, out, sampc * sizeof(int16_t));
+}
@@ -1,53 +1,422 @@
 /**
- * ausock.c — baresip audio module using a Unix domain socket
+ * ausock.c — baresip audio module using Unix domain sockets
  *
  * Bridges baresip audio with an external process (Ruby AudioBridge)
- * via a single full-duplex Unix stream socket.
+ * via full-duplex Unix stream sockets.
  *
- * Audio format: raw S16LE samples (baresip internal format)
+ * Audio format: raw S16LE samples (baresip internal format), or
+ *               G.711 u-law when ausock_format is "pcmu"
  * Socket protocol: full-duplex byte stream
  *   - C writes caller audio (auplay wh → socket)
  *   - C reads  agent audio  (socket → ausrc rh)
  *
- * The module creates a listening socket at /tmp/ausock.sock (or
- * AUSOCK_PATH env) on load.  The external process connects once;
- * both directions share the single fd.
+ * Each socket is a channel, keyed by the device string baresip passes
+ * to src_alloc/play_alloc ("ausock,<path>" → "<path>").  The ausrc and
+ * auplay of one call open the same device and therefore share one
+ * channel; calls configured with different devices get independent
+ * sockets, so a single baresip process can carry many calls at once.
+ *
+ * The default channel at /tmp/ausock.sock (or AUSOCK_PATH env) is
+ * created on module load and used when the device is empty.  Other
+ * channels are created on first use and removed with their last call.
+ *
+ * Threads: rh() and wh() of every source and player run on one
+ * scheduler thread (sched.c) that ticks on an absolute monotonic
+ * clock, so cadence does not degrade and the thread count does not
+ * grow with the number of calls.  Socket I/O (accept, reads, hangup)
+ * runs in libre's main loop; the scheduler only ever does
+ * non-blocking sends.
+ *
+ * Agent audio is read off the socket into a lock-free frame ring
+ * (ausock_buffer / AUSOCK_BUFFER_MS, default 200 ms); the paced rh()
+ * tick only ever dequeues from that ring, so a slow or partial socket
+ * read can never push it off cadence.
+ *
+ * With ausock_format pcmu (or AUSOCK_FORMAT=pcmu) the socket carries
+ * one u-law byte per sample instead of S16LE: the module encodes
+ * caller audio after wh() and decodes agent audio before it enters
+ * the ring, halving socket traffic and sparing the client a codec.
+ *
+ * With ausock_transport shm (or AUSOCK_TRANSPORT=shm) audio bypasses
+ * the socket entirely: on connect the client receives a shared
+ * mapping with one frame ring per direction plus two doorbell fds
+ * (see ausock_shm.h), and the socket is kept only to detect hangup.
+ * Frames go straight from wh() into shared memory and from shared
+ * memory into rh(), with no read()/write() per frame.
+ *
+ * With ausock_protocol framed (or AUSOCK_PROTOCOL=framed) the stream
+ * socket carries length-prefixed messages instead of bare audio (see
+ * ausock_proto.h): audio frames with sequence numbers and capture
+ * timestamps, plus in-band FLUSH, MARK and STATS requests from the
+ * client and UNDERRUN notices from the module.
+ *
+ * With ausock_bargein <ms> on a framed channel, caller frames are
+ * checked against the agent audio being played (bargein.c).  When the
+ * caller talks over the agent for that long, the agent is faded out
+ * at once, its queued audio is dropped and a BARGEIN message tells the
+ * client, whose FLUSH reply marks where fresh agent audio begins.
+ *
+ * With ausock_vad tag or dtx on a framed channel, caller frames go
+ * through an energy VAD (vad.c) before they are sent:
+ * talkspurts are bracketed by VAD messages and their frames flagged.
+ * dtx additionally withholds the frames between talkspurts, so the
+ * client (and whatever it forwards caller audio to) only sees speech,
+ * plus a SILENCE notice once a second.
+ *
+ * With ausock_aec <tail ms>, the agent audio going to rh() is the
+ * reference of an echo canceller (aec.c), and every caller frame out
+ * of wh() has the agent's echo removed before anything else sees it:
+ * barge-in, VAD and the client all get echo-cancelled caller audio.
+ *
+ * With ausock_inrate <Hz> (s16le over the stream transport) the client
+ * writes agent audio at that rate instead of the call's, e.g. 24 kHz
+ * TTS output as is: every 20 ms frame is converted to the call rate
+ * by a polyphase resampler (resamp.c) as it is read off the socket.
+ * Caller audio keeps the call rate.
+ *
+ * With ausock_playout adaptive, rh() no longer plays agent audio the
+ * moment it arrives and zero-fills when it runs out (playout.c): each
+ * talkspurt is held until the queue reaches a target depth that grows
+ * with late frames and shrinks while the client keeps ahead, and a
+ * gap mid-talkspurt is bridged by repeating the agent's last pitch
+ * period into comfort noise.  Framed clients are told the target in
+ * PLAYOUT messages, so they can write just that far ahead.
+ *
+ * Every channel keeps lock-free cadence counters and latency
+ * histograms (hist.c): how late each tick ran, how long rh()/wh()
+ * took, how deep the agent queue was, resyncs and silence pushed.
+ * The ausock_stats command prints them as JSON, so they can be read
+ * over ctrl_tcp, and with ausock_stats_interval <s> they are also
+ * sent as a module event that often.
+ *
+ * With ausock_transport seqpacket the socket is SOCK_SEQPACKET: every
+ * packet is exactly one frame (raw) or one message (framed), so
+ * nothing is reassembled and a short or long write can never shift
+ * the stream.  Packets are received and a backed-up send queue is
+ * flushed SOCK_BATCH at a time with recvmmsg()/sendmmsg() (Linux;
+ * one call per packet elsewhere).  Raw stream reads are batched too:
+ * one readv() scatters a burst of frames straight into the ring.
+ *
+ * With ausock_record <dir>, every client connection is recorded to a
+ * stereo WAV file in dir (rec.c): caller on the left as it came out
+ * of wh(), agent on the right as it went into rh(), aligned by tick
+ * deadline.  The scheduler only copies frames into a ring; a
+ * background thread does the file I/O.
+ *
+ * With ausock_clips <dir>, the WAV files in dir are loaded once and a
+ * framed client can start and stop them with CLIP messages (mix.c):
+ * the rh() tick mixes them over the agent audio on a few voices, each
+ * with its own gain, ducked under the agent's speech or ducking it.
+ * ausock_comfort_noise <dB> fills the silence in between with noise
+ * that far below full scale.  With ausock_phrases <file>, CLIP names
+ * are also looked up in a phrase cache the client renders ahead of
+ * time with its own voice (phrase.c), played straight out of the
+ * memory-mapped file.
+ *
+ * With ausock_drift <ppm>, agent audio goes through a stretch stage
+ * (drift.c) on its way to rh() that watches how deep the agent queue
+ * runs over time and consumes it up to that many ppm faster or
+ * slower, so a client on a clock of its own cannot make the queue,
+ * and the latency with it, creep over a long call.
+ *
+ * With ausock_tap copy or only, each channel also listens on
+ * <path>.tap for a second consumer, e.g. a local recogniser (tap.c):
+ * it gets every echo-cancelled caller frame as bare S16LE at the call
+ * rate, whichever format and protocol the main socket uses.  With
+ * only, caller audio stops going to the main client while a tap
+ * consumer is connected; barge-in, VAD and the rest of the framed
+ * control traffic still do.
+ *
+ * With ausock_inject yes, each channel also listens on <path>.inject
+ * for a second producer of agent audio, e.g. the local TTS process:
+ * it writes framed AUDIO (at the agent rate) and a MARK after each
+ * utterance, and its frames go into the same ring as the client's,
+ * without passing through the client.  A FLUSH from the client, i.e.
+ * after a barge-in, also drops the rest of the utterance the producer
+ * is in the middle of.  A framed client gets a MARK of seq 0 as the
+ * first frame of each utterance reaches rh().
+ *
+ * With ausock_dtmf yes, every echo-cancelled caller frame also goes
+ * through a Goertzel DTMF detector (dtmf.c).  Each key the caller
+ * presses is reported once, as a DTMF message to a framed client and
+ * as a "dtmf" module event, and its tone is muted from there on, so
+ * neither barge-in nor a recogniser downstream ever hears it.
+ *
+ * With ausock_rt fifo or rr the scheduler thread runs under that
+ * real-time policy at ausock_rt_prio, ausock_cpus pins it to a CPU
+ * set and ausock_mlock yes locks its stack and the frame buffers it
+ * touches into RAM (rt.c).  Ticks that start more than a quarter of
+ * their period late are counted as missed in ausock_stats, next to
+ * the lateness histograms, so the effect can be checked.
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE 1           /* recvmmsg(), sendmmsg() */
+#endif
+
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <poll.h>
 #include <signal.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include <re.h>
+#include <re_atomic.h>
 #include <rem.h>
 #include <baresip.h>
 
-#define DEFAULT_PATH "/tmp/ausock.sock"
+#include "ausock.h"
+#include "ausock_proto.h"
+#include "ausock_shm.h"
+
+#define DEFAULT_PATH      "/tmp/ausock.sock"
+#define DEFAULT_BUFFER_MS 200   /* agent→caller jitter ring depth */
+#define CTL_QUEUE         16    /* FLUSH/MARK waiting for their audio */
+#define VAD_PREROLL       5     /* dtx: frames held back before speech */
+#define VAD_CN_MS         1000  /* dtx: SILENCE notice interval */
+#define SOCK_BATCH        8     /* frames or packets per syscall */
+#define TICK_MISS_DIV     4     /* later than period/4 is a missed tick */
+#define DEFAULT_RT_PRIO   40    /* ausock_rt: below the kernel's IRQ threads */
+
+#ifdef __linux__
+#define HAVE_MMSG 1
+#endif
+
+#ifndef MSG_NOSIGNAL            /* macOS: SO_NOSIGPIPE on the socket */
+#define MSG_NOSIGNAL 0
+#endif
+
+/** Sample encoding on the socket */
+enum sock_fmt {
+	SOCK_FMT_S16LE = 0,
+	SOCK_FMT_PCMU,
+};
+
+/** How audio frames travel between ausock and the client */
+enum transport {
+	TRANSPORT_STREAM = 0,   /* bytes over the Unix socket */
+	TRANSPORT_SHM,          /* shared rings, fds passed on connect */
+	TRANSPORT_SEQPACKET,    /* one frame or message per packet */
+};
+
+/** What the socket carries */
+enum protocol {
+	PROTO_RAW = 0,          /* bare audio bytes */
+	PROTO_FRAMED,           /* ausock_proto.h messages */
+};
+
+/** How rh() paces agent audio */
+enum playout_mode {
+	PLAYOUT_FIXED = 0,      /* play on arrival, silence when dry */
+	PLAYOUT_ADAPTIVE,       /* target depth plus concealment */
+};
+
+/** Who gets caller audio besides the client (ausock_tap) */
+enum tap_mode {
+	TAP_OFF = 0,
+	TAP_COPY,               /* the tap consumer as well */
+	TAP_ONLY,               /* the tap consumer instead, once there */
+};
+
+/** What the VAD does with caller frames (framed protocol only) */
+enum vad_mode {
+	VAD_NONE = 0,
+	VAD_TAG,                /* flag talkspurts, send every frame */
+	VAD_DTX,                /* send talkspurts only */
+};
 
 /* ------------------------------------------------------------------ */
 /*  Module-level state                                                 */
 /* ------------------------------------------------------------------ */
 
+struct ausrc_st;
+
+/** Cadence of one scheduler entry of a channel (ausock_stats) */
+struct tick_metrics {
+	struct hist *late;           /* tick past its deadline, us */
+	struct hist *run;            /* tick duration, us */
+	RE_ATOMIC uint32_t ticks;
+	RE_ATOMIC uint32_t resyncs;  /* fell a period behind, skipped */
+	RE_ATOMIC uint32_t missed;   /* started over TICK_MISS_DIV late */
+};
+
+/**
+ * One listening socket and its connected client.  Reference counted:
+ * each ausrc_st/auplay_st bound to the channel holds a reference.
+ *
+ * Everything except client_fd, shm, rec and the tx queue is only
+ * touched on the main thread; those are also used by the scheduler
+ * and are guarded by mtx.  Counters in stats are atomic.
+ */
+struct chan {
+	struct le le;            /* entry in chanl */
+	char      path[104];     /* device key; fits sockaddr_un.sun_path */
+	int       listen_fd;
+	struct re_fhs *lfhs;     /* listen_fd in the main loop */
+	int       client_fd;
+	struct re_fhs *cfhs;     /* client_fd in the main loop */
+	struct tmr tmr;          /* resumes reading once the ring drains */
+	mtx_t     mtx;           /* protects client_fd, shm, rec, txq */
+	enum sock_fmt fmt;
+	enum transport transport;
+	enum protocol proto;
+	struct shm *shm;         /* shm transport: rings of this client */
+	struct rec *rec;         /* ausock_record: this client's file */
+	struct tap *tap;         /* ausock_tap: <path>.tap, or NULL */
+
+	/* ausock_inject: second producer of agent audio (main loop) */
+	struct {
+		char      path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+		int       listen_fd;
+		struct re_fhs *lfhs;
+		int       fd;            /* producer, -1 if none */
+		struct re_fhs *fhs;
+		struct tmr tmr;          /* resumes reading once the ring drains */
+		struct ausock_msg hdr;   /* message being received */
+		size_t    hdroff;
+		size_t    off;           /* payload bytes read or skipped */
+		uint8_t  *buf;           /* one agent frame */
+		bool      open;          /* AUDIO since the last MARK */
+		bool      cut;           /* dropping the rest of the utterance */
+		bool      first;         /* next frame starts an utterance */
+	} inj;
+	struct ausrc_st *src;    /* stream transport: socket → this ring */
+	uint32_t  srate;         /* frame geometry, set by chan_bind() */
+	uint32_t  sampc;
+	uint32_t  ptime;
+	uint32_t  inrate;        /* agent audio from the client */
+	uint32_t  insampc;
+
+	/* framed protocol: message being received (main loop) */
+	struct ausock_msg rxhdr;
+	size_t    rxhdroff;
+	size_t    rxoff;         /* payload bytes read or skipped */
+	uint8_t   rxctl[AUSOCK_CTL_MAX];
+
+	/* seqpacket: one batch of received packets (main loop) */
+	struct {
+		uint8_t  *buf;         /* SOCK_BATCH slots of cap bytes */
+		size_t    cap;         /* largest valid packet + 1 */
+		uint32_t  len[SOCK_BATCH];
+		uint32_t  n;           /* packets in the batch */
+		uint32_t  pos;         /* next one to handle */
+	} rxpkt;
+
+	/* bytes the socket could not take yet, sent before anything new;
+	   seqpacket: whole packets, each after its uint16_t length */
+	uint8_t  *txq;
+	size_t    txlen;
+	size_t    txcap;
+
+	/* barge-in; only touched on the scheduler thread */
+	struct {
+		struct bargein *det;   /* NULL unless ausock_bargein */
+		uint32_t gen;          /* client the state belongs to */
+		uint32_t count;        /* barge-ins fired */
+		uint32_t dropped;      /* agent frames discarded since */
+		bool     discard;      /* dropping agent audio until FLUSH */
+		bool     fade;         /* fade out the next agent frame */
+	} bi;
+
+	/* echo canceller; only touched on the scheduler thread */
+	struct aec *aec;         /* NULL unless ausock_aec */
+	uint32_t    aecgen;      /* client the echo path belongs to */
+
+	/* ausock_stats; recorded on the scheduler, read anywhere */
+	struct {
+		struct tick_metrics src;   /* rh() ticks */
+		struct tick_metrics play;  /* wh() ticks */
+		struct hist *depth;        /* agent frames queued at each rh() */
+		RE_ATOMIC uint32_t silence_idle;  /* no client connected */
+		RE_ATOMIC uint32_t silence_dry;   /* client, no agent audio */
+		RE_ATOMIC uint32_t txq_max;       /* peak bytes unsent, socket */
+	} m;
+
+	RE_ATOMIC bool connected;
+	RE_ATOMIC uint32_t gen;  /* bumped for every new client */
+	struct {
+		RE_ATOMIC uint32_t up_frames;
+		RE_ATOMIC uint32_t up_drops;
+		RE_ATOMIC uint32_t down_frames;
+		RE_ATOMIC uint32_t underruns;
+		RE_ATOMIC uint32_t concealed;
+		RE_ATOMIC uint32_t target;   /* playout depth, frames */
+		RE_ATOMIC int32_t  drift;    /* clock drift estimate, ppm */
+		RE_ATOMIC uint32_t inj_frames;   /* agent frames injected */
+		RE_ATOMIC uint32_t inj_utterances;
+		RE_ATOMIC uint32_t inj_cut;      /* injected frames dropped */
+		RE_ATOMIC uint32_t dtmf_keys;    /* keys the caller pressed */
+	} stats;
+};
+
 static struct ausrc  *mod_ausrc;
 static struct auplay *mod_auplay;
 
-static int   listen_fd = -1;
-static int   client_fd = -1;
-static mtx_t sock_mtx;
-static char  sock_path[256];
+static struct list  chanl;     /* all open channels */
+static mtx_t        chanl_mtx; /* protects chanl */
+static struct chan *def_chan;  /* AUSOCK_PATH, open while loaded */
+static bool         cmds_on;   /* cmdv registered */
+static char         def_path[104];
+static uint32_t     buffer_ms = DEFAULT_BUFFER_MS;
+static enum sock_fmt sock_fmt  = SOCK_FMT_S16LE;
+static enum transport transport = TRANSPORT_STREAM;
+static enum protocol protocol   = PROTO_RAW;
+static uint32_t     bargein_ms;  /* 0: no barge-in detection */
+static uint32_t     aec_ms;      /* echo tail; 0: no echo canceller */
+static uint32_t     inrate;      /* agent audio rate; 0: the call's */
+static enum vad_mode vad_mode  = VAD_NONE;
+static enum playout_mode playout_mode = PLAYOUT_FIXED;
+static uint32_t     stats_interval;  /* s between stats events; 0: off */
+static struct tmr   stats_tmr;
+static char         rec_dir[256];    /* ausock_record; empty: off */
+static struct clips *clips;          /* ausock_clips; NULL: none */
+static struct phrases *phrases;      /* ausock_phrases; NULL: none */
+static uint32_t     cn_db;           /* comfort noise below 0 dBFS; 0: off */
+static uint32_t     drift_max;       /* ausock_drift, ppm; 0: off */
+static enum tap_mode tap_mode = TAP_OFF;
+static bool         inject;          /* ausock_inject */
+static bool         dtmf_on;         /* ausock_dtmf */
+static struct mqueue *dtmf_mq;       /* keys on their way to main */
 
 /* ------------------------------------------------------------------ */
 /*  Per-instance state                                                 */
 /* ------------------------------------------------------------------ */
 
+/** FLUSH or MARK queued behind the agent audio that preceded it */
+struct src_ctl {
+	uint64_t target;            /* frames_in when it arrived */
+	uint64_t arg;               /* MARK: client payload, echoed */
+	uint32_t seq;
+	uint32_t gen;               /* client it came from */
+	uint8_t  type;
+	uint8_t  arglen;
+};
+
 struct ausrc_st {
-	bool           run;
-	thrd_t         thread;
+	struct sched_ent *ent;      /* rh() tick */
+	struct chan   *ch;
+	struct ring   *ring;        /* agent frames waiting for rh() */
+	struct ring   *ctlq;        /* framed: struct src_ctl */
+	uint8_t       *rxbuf;       /* socket-format staging frame */
+	size_t         rxoff;       /* bytes of the frame read so far */
+	struct resamp *rs;          /* NULL unless inrate != srate */
+	uint32_t       rsgen;       /* client the filter state belongs to */
+	uint64_t       frames_in;   /* committed to ring (main loop) */
+	uint64_t       frames_out;  /* taken from ring (scheduler) */
+	RE_ATOMIC uint64_t dropto;  /* frames_in when a client left */
+	bool           playing;     /* last tick had agent audio */
+	struct playout *po;         /* NULL unless ausock_playout adaptive */
+	uint32_t       pogen;       /* client the playout state belongs to */
+	uint32_t       potarget;    /* target last reported, frames */
+	struct mix    *mix;         /* NULL without clips or comfort noise */
+	struct drift  *drift;       /* NULL unless ausock_drift */
+	uint32_t       driftgen;    /* client the drift state belongs to */
+	uint32_t       resyncs;     /* of ent, already counted */
+	int16_t       *buf;         /* frame handed to rh() */
 	ausrc_read_h  *rh;
 	ausrc_error_h *errh;
 	void          *arg;
@@ -57,8 +426,32 @@ struct ausrc_st {
 };
 
 struct auplay_st {
-	bool            run;
-	thrd_t          thread;
+	struct sched_ent *ent;      /* wh() tick */
+	struct chan    *ch;
+	int16_t        *buf;        /* frame filled by wh() */
+	uint8_t        *txbuf;      /* socket-format frame (pcmu) */
+	uint32_t        seq;        /* framed: next AUDIO seq */
+	uint32_t        resyncs;    /* of ent, already counted */
+
+	/* ausock_vad; only touched on the scheduler thread */
+	struct vad     *vad;        /* NULL unless ausock_vad */
+	uint32_t        vadgen;     /* client the state belongs to */
+	bool            speech;     /* caller in a talkspurt */
+	int             level;      /* of the last frame, dBFS */
+	uint32_t        suppressed; /* frames never sent (dtx) */
+	uint64_t        cn_us;      /* next SILENCE notice (dtx) */
+	struct {
+		uint8_t  *buf;          /* VAD_PREROLL frames, dtx only */
+		uint32_t  seq[VAD_PREROLL];
+		uint64_t  ts[VAD_PREROLL];
+		uint32_t  pos;          /* next slot to fill */
+		uint32_t  n;            /* frames held */
+	} hold;
+
+	/* ausock_dtmf; only touched on the scheduler thread */
+	struct dtmf    *dtmf;       /* NULL unless ausock_dtmf */
+	uint32_t        dtmfgen;    /* client the state belongs to */
+
 	auplay_write_h *wh;
 	void           *arg;
 	uint32_t        ptime;
@@ -66,379 +459,3093 @@ struct auplay_st {
 	uint32_t        srate;
 };
 
+static int src_read(struct ausrc_st *st, int fd);
+static int src_fill(struct ausrc_st *st, int fd);
+static void src_commit(struct ausrc_st *st, uint8_t *slot,
+		       const uint8_t *frame);
+static int src_ctl_push(struct ausrc_st *st, const struct ausock_msg *hdr,
+			const uint8_t *payload);
+static void inject_listen(struct chan *ch);
+static void inject_close(struct chan *ch);
+static void metrics_reset(struct chan *ch);
+static void metrics_tick(struct tick_metrics *tm, struct sched_ent *ent,
+			 uint32_t *seen, uint64_t now);
+
 /* ------------------------------------------------------------------ */
-/*  Socket helpers                                                     */
+/*  Helpers                                                            */
 /* ------------------------------------------------------------------ */
 
-static int setup_listen(const char *path)
+/**
+ * Read a numeric module setting: environment variable first (like
+ * AUSOCK_PATH), then the baresip config file, then the default.
+ */
+static uint32_t conf_u32(const char *name, const char *env, uint32_t def)
 {
-	struct sockaddr_un addr;
-	int fd;
+	const char *val = getenv(env);
+	uint32_t num;
 
-	unlink(path);
+	if (val && *val)
+		return (uint32_t)strtoul(val, NULL, 10);
 
-	fd = socket(AF_UNIX, SOCK_STREAM, 0);
-	if (fd < 0)
-		return errno;
+	if (0 == conf_get_u32(conf_cur(), name, &num))
+		return num;
 
-	/* non-blocking so accept() in get_client() never blocks */
-	fcntl(fd, F_SETFL, O_NONBLOCK);
+	return def;
+}
 
-	memset(&addr, 0, sizeof(addr));
-	addr.sun_family = AF_UNIX;
-	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+/** String variant of conf_u32(); leaves buf untouched if unset */
+static void conf_str(const char *name, const char *env,
+		     char *buf, size_t size)
+{
+	const char *val = getenv(env);
 
-	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
-	    listen(fd, 5) < 0) {
-		int err = errno;
-		close(fd);
-		return err;
+	if (val && *val) {
+		strncpy(buf, val, size - 1);
+		buf[size - 1] = '\0';
+		return;
 	}
 
-	listen_fd = fd;
-	strncpy(sock_path, path, sizeof(sock_path) - 1);
-	return 0;
+	(void)conf_get_str(conf_cur(), name, buf, size);
 }
 
-/**
- * Return the connected client fd, accepting a new connection
- * if none exists.  Returns -1 if no client is connected.
- */
-static int get_client(void)
+/** Bytes one sample occupies on the socket */
+static size_t sock_sampsz(const struct chan *ch)
 {
-	int fd;
+	return ch->fmt == SOCK_FMT_PCMU ? 1 : sizeof(int16_t);
+}
 
-	mtx_lock(&sock_mtx);
-	fd = client_fd;
-	mtx_unlock(&sock_mtx);
+/** Bytes of one agent frame as the client writes it */
+static size_t sock_inbytes(const struct chan *ch)
+{
+	return ch->insampc * sock_sampsz(ch);
+}
 
-	if (fd >= 0)
-		return fd;
+static void pcmu_encode(uint8_t *dst, const int16_t *src, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		dst[i] = g711_pcm2ulaw(src[i]);
+}
 
-	/* try non-blocking accept */
-	fd = accept(listen_fd, NULL, NULL);
-	if (fd < 0)
-		return -1;
+static void pcmu_decode(int16_t *dst, const uint8_t *src, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		dst[i] = g711_ulaw2pcm(src[i]);
+}
 
-	/* make the data socket blocking */
-	fcntl(fd, F_SETFL, 0);
+/**
+ * Read from a non-blocking socket until *off reaches len.  Returns 0
+ * once complete, EAGAIN if the socket ran dry first, another error on
+ * hangup.
+ */
+static int sock_read(int fd, void *buf, size_t len, size_t *off)
+{
+	while (*off < len) {
+		ssize_t n = read(fd, (uint8_t *)buf + *off, len - *off);
 
-#ifdef SO_NOSIGPIPE          /* macOS */
-	{
-		int val = 1;
-		setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE,
-			   &val, sizeof(val));
-	}
-#endif
+		if (n == 0)
+			return ECONNRESET;
+		if (n < 0)
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ?
+				EAGAIN : errno;
 
-	mtx_lock(&sock_mtx);
-	if (client_fd >= 0) {
-		/* race: another thread accepted first */
-		close(fd);
-		fd = client_fd;
-	} else {
-		client_fd = fd;
+		*off += (size_t)n;
 	}
-	mtx_unlock(&sock_mtx);
 
-	return fd;
+	return 0;
 }
 
-static void drop_client(int fd)
+/** sock_read() variant that throws the bytes away */
+static int sock_skip(int fd, size_t len, size_t *off)
 {
-	mtx_lock(&sock_mtx);
-	if (client_fd == fd) {
-		close(fd);
-		client_fd = -1;
+	uint8_t junk[256];
+
+	while (*off < len) {
+		size_t want = len - *off;
+		size_t got  = 0;
+		int err;
+
+		if (want > sizeof(junk))
+			want = sizeof(junk);
+
+		err = sock_read(fd, junk, want, &got);
+		*off += got;
+		if (err)
+			return err;
 	}
-	mtx_unlock(&sock_mtx);
-}
 
-static uint64_t clock_us(void)
-{
-	struct timespec ts;
-	clock_gettime(CLOCK_MONOTONIC, &ts);
-	return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+	return 0;
 }
 
 /* ------------------------------------------------------------------ */
-/*  ausrc — audio source (agent → caller)                             */
-/*                                                                     */
-/*  A thread reads S16LE frames from the socket and pushes them into   */
-/*  baresip's encode pipeline via rh().                                */
+/*  Channels — sending, from either thread                             */
 /* ------------------------------------------------------------------ */
 
-static int src_thread(void *arg)
+/** Push out queued bytes; caller holds ch->mtx */
+static void tx_flush(struct chan *ch)
 {
-	struct ausrc_st *st = arg;
-	const size_t nbytes = st->sampc * sizeof(int16_t);
-	const uint64_t ptime_us = st->ptime * 1000;
-	uint64_t next_frame;
-	int16_t *buf;
-
-	buf = mem_zalloc(nbytes, NULL);
-	if (!buf)
-		return thrd_error;
-
-	next_frame = clock_us();
-
-	while (st->run) {
-		struct auframe af;
-		uint64_t now;
-		int fd = get_client();
-
-		if (fd >= 0) {
-			struct pollfd pfd = {
-				.fd = fd, .events = POLLIN
-			};
-
-			/* Wait for data but no longer than until our
-			   next frame boundary so rh() stays on cadence */
-			now = clock_us();
-			int timeout_ms = 0;
-			if (next_frame > now)
-				timeout_ms = (int)((next_frame - now) / 1000);
-
-			int ret = poll(&pfd, 1, timeout_ms);
-
-			if (ret > 0 && (pfd.revents & POLLIN)) {
-				size_t off = 0;
-
-				while (off < nbytes) {
-					ssize_t n = read(fd,
-							 (char *)buf + off,
-							 nbytes - off);
-					if (n <= 0) {
-						drop_client(fd);
-						memset((char *)buf + off, 0,
-						       nbytes - off);
-						break;
-					}
-					off += (size_t)n;
-				}
-			} else {
-				/* no data yet — push silence */
-				memset(buf, 0, nbytes);
-			}
-		} else {
-			/* no client yet */
-			memset(buf, 0, nbytes);
-		}
+	ssize_t n;
 
-		/* pace rh() on a monotonic clock */
-		next_frame += ptime_us;
-		now = clock_us();
-		if (next_frame > now)
-			usleep((unsigned)(next_frame - now));
-		else
-			next_frame = now;  /* fell behind, reset */
+	if (!ch->txlen)
+		return;
 
-		auframe_init(&af, AUFMT_S16LE, buf,
-			     st->sampc, st->srate, 1);
-		st->rh(&af, st->arg);
-	}
+	n = send(ch->client_fd, ch->txq, ch->txlen,
+		 MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (n <= 0)
+		return;
 
-	mem_deref(buf);
-	return thrd_success;
+	memmove(ch->txq, ch->txq + n, ch->txlen - (size_t)n);
+	ch->txlen -= (size_t)n;
 }
 
-static void src_destructor(void *data)
+/**
+ * seqpacket: push out queued packets, SOCK_BATCH per sendmmsg();
+ * caller holds ch->mtx
+ */
+static void pkt_flush(struct chan *ch)
 {
-	struct ausrc_st *st = data;
+	size_t off = 0;
 
-	st->run = false;
-	thrd_join(st->thread, NULL);
+	while (off < ch->txlen) {
+		struct iovec iov[SOCK_BATCH];
+		uint32_t n = 0, sent = 0;
+		size_t pos = off;
+
+		for (; n < SOCK_BATCH && pos < ch->txlen; n++) {
+			uint16_t len;
+
+			memcpy(&len, ch->txq + pos, sizeof(len));
+			iov[n].iov_base = ch->txq + pos + sizeof(len);
+			iov[n].iov_len  = len;
+			pos += sizeof(len) + len;
+		}
+
+#ifdef HAVE_MMSG
+		{
+			struct mmsghdr msgv[SOCK_BATCH];
+			int r;
+
+			memset(msgv, 0, sizeof(msgv));
+			for (uint32_t i = 0; i < n; i++) {
+				msgv[i].msg_hdr.msg_iov    = &iov[i];
+				msgv[i].msg_hdr.msg_iovlen = 1;
+			}
+
+			r = sendmmsg(ch->client_fd, msgv, n,
+				     MSG_DONTWAIT | MSG_NOSIGNAL);
+			sent = r > 0 ? (uint32_t)r : 0;
+		}
+#else
+		while (sent < n &&
+		       send(ch->client_fd, iov[sent].iov_base,
+			    iov[sent].iov_len,
+			    MSG_DONTWAIT | MSG_NOSIGNAL) >= 0)
+			++sent;
+#endif
+		for (uint32_t i = 0; i < sent; i++)
+			off += sizeof(uint16_t) + iov[i].iov_len;
+		if (sent < n)
+			break;
+	}
+
+	memmove(ch->txq, ch->txq + off, ch->txlen - off);
+	ch->txlen -= off;
 }
 
-static int src_alloc(struct ausrc_st **stp, const struct ausrc *as,
-		     struct ausrc_prm *prm, const char *device,
-		     ausrc_read_h *rh, ausrc_error_h *errh, void *arg)
+/** Append src minus its first skip bytes; returns the skip left over */
+static size_t tx_append(struct chan *ch, const void *src, size_t len,
+			size_t skip)
 {
-	struct ausrc_st *st;
-	int err;
-	(void)as;
-	(void)device;
+	if (skip >= len)
+		return skip - len;
 
-	st = mem_zalloc(sizeof(*st), src_destructor);
-	if (!st)
-		return ENOMEM;
+	memcpy(ch->txq + ch->txlen, (const uint8_t *)src + skip, len - skip);
+	ch->txlen += len - skip;
 
-	st->rh    = rh;
-	st->errh  = errh;
-	st->arg   = arg;
-	st->srate = prm->srate;
-	st->ptime = prm->ptime;
-	st->sampc = prm->srate * prm->ch * prm->ptime / 1000;
-	st->run   = true;
+	return 0;
+}
 
-	err = thread_create_name(&st->thread, "ausock_src",
-				 src_thread, st);
-	if (err) {
-		mem_deref(st);
-		return err;
+/**
+ * seqpacket: send one message as one packet, behind whatever is
+ * queued.  A packet goes out whole or not at all, so one the socket
+ * cannot take now is queued whole; caller holds ch->mtx.
+ */
+static int pkt_send(struct chan *ch, const struct ausock_msg *hdr,
+		    const void *data, size_t len)
+{
+	const size_t hlen = hdr ? sizeof(*hdr) : 0;
+	const uint16_t plen = (uint16_t)(hlen + len);
+	struct iovec iov[2];
+	struct msghdr msg;
+
+	pkt_flush(ch);
+
+	if (!ch->txlen) {
+		iov[0].iov_base = (void *)hdr;
+		iov[0].iov_len  = hlen;
+		iov[1].iov_base = (void *)data;
+		iov[1].iov_len  = len;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov    = hdr ? iov : iov + 1;
+		msg.msg_iovlen = hdr ? 2 : 1;
+
+		if (sendmsg(ch->client_fd, &msg,
+			    MSG_DONTWAIT | MSG_NOSIGNAL) >= 0)
+			return 0;
 	}
 
-	*stp = st;
+	if (ch->txlen + sizeof(plen) + plen > ch->txcap)
+		return ENOBUFS;
+
+	tx_append(ch, &plen, sizeof(plen), 0);
+	tx_append(ch, hdr, hlen, 0);
+	tx_append(ch, data, len, 0);
+
 	return 0;
 }
 
-/* ------------------------------------------------------------------ */
-/*  auplay — audio player (caller → agent)                            */
-/*                                                                     */
-/*  A thread pulls decoded S16LE frames from baresip via wh() and      */
-/*  writes them to the socket.                                         */
-/* ------------------------------------------------------------------ */
-
-static int play_thread(void *arg)
+/**
+ * Send one message — header plus payload, or bare audio when hdr is
+ * NULL — without blocking.  Whatever the socket cannot take now is
+ * queued and goes out ahead of the next message, so messages are
+ * never cut short.  If the queue is backed up past txcap the message
+ * is dropped: the client is not reading, and live audio must not pile
+ * up.
+ *
+ * Returns 0 once the message is sent or queued, ENOTCONN without a
+ * client, ENOBUFS if it was dropped.
+ */
+static int chan_send(struct chan *ch, const struct ausock_msg *hdr,
+		     const void *data, size_t len)
 {
-	struct auplay_st *st = arg;
-	const size_t nbytes = st->sampc * sizeof(int16_t);
-	const uint64_t ptime_us = st->ptime * 1000;
-	uint64_t next_frame;
-	int16_t *buf;
-
-	buf = mem_zalloc(nbytes, NULL);
-	if (!buf)
-		return thrd_error;
-
-	next_frame = clock_us();
-
-	while (st->run) {
-		struct auframe af;
-		uint64_t now;
-		int fd;
-
-		auframe_init(&af, AUFMT_S16LE, buf,
-			     st->sampc, st->srate, 1);
-
-		/* pull decoded audio from baresip */
-		st->wh(&af, st->arg);
-
-		fd = get_client();
-		if (fd >= 0) {
-			size_t off = 0;
-
-			while (off < nbytes) {
-				ssize_t n = write(fd,
-						  (char *)buf + off,
-						  nbytes - off);
-				if (n <= 0) {
-					drop_client(fd);
-					break;
-				}
-				off += (size_t)n;
-			}
+	const size_t hlen = hdr ? sizeof(*hdr) : 0;
+	struct iovec iov[2];
+	struct msghdr msg;
+	size_t skip;
+	ssize_t n;
+	int err = 0;
+
+	mtx_lock(&ch->mtx);
+
+	if (ch->client_fd < 0) {
+		err = ENOTCONN;
+		goto out;
+	}
+
+	if (ch->transport == TRANSPORT_SEQPACKET) {
+		err = pkt_send(ch, hdr, data, len);
+		goto out;
+	}
+
+	tx_flush(ch);
+
+	if (ch->txlen) {
+		if (ch->txlen + hlen + len > ch->txcap) {
+			err = ENOBUFS;
+			goto out;
 		}
 
-		/* sleep until next 20 ms boundary (drift-free) */
-		next_frame += ptime_us;
-		now = clock_us();
-		if (next_frame > now)
-			usleep((unsigned)(next_frame - now));
-		else
-			next_frame = now;  /* fell behind, reset */
+		tx_append(ch, hdr, hlen, 0);
+		tx_append(ch, data, len, 0);
+		goto out;
 	}
 
-	mem_deref(buf);
-	return thrd_success;
+	iov[0].iov_base = (void *)hdr;
+	iov[0].iov_len  = hlen;
+	iov[1].iov_base = (void *)data;
+	iov[1].iov_len  = len;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov    = hdr ? iov : iov + 1;
+	msg.msg_iovlen = hdr ? 2 : 1;
+
+	/* errors other than a full buffer surface as hangup on read */
+	n = sendmsg(ch->client_fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (n < 0)
+		n = 0;
+
+	skip = tx_append(ch, hdr, hlen, (size_t)n);
+	tx_append(ch, data, len, skip);
+
+ out:
+	if (ch->txlen > re_atomic_rlx(&ch->m.txq_max))
+		re_atomic_rlx_set(&ch->m.txq_max, (uint32_t)ch->txlen);
+
+	mtx_unlock(&ch->mtx);
+	return err;
 }
 
-static void play_destructor(void *data)
+/** Framed protocol: send one message of the given type */
+static int chan_msg(struct chan *ch, uint8_t type, uint32_t seq,
+		    uint64_t ts, const void *data, size_t len)
 {
-	struct auplay_st *st = data;
+	struct ausock_msg hdr;
 
-	st->run = false;
-	thrd_join(st->thread, NULL);
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.type = type;
+	hdr.len  = (uint16_t)len;
+	hdr.seq  = seq;
+	hdr.ts   = ts;
+
+	return chan_send(ch, &hdr, data, len);
 }
 
-static int play_alloc(struct auplay_st **stp, const struct auplay *ap,
-		      struct auplay_prm *prm, const char *device,
-		      auplay_write_h *wh, void *arg)
+/* ------------------------------------------------------------------ */
+/*  Channels — main loop side                                          */
+/* ------------------------------------------------------------------ */
+
+/** A non-blocking Unix socket listening at path, replacing any file */
+static int listen_unix(const char *path, int type, int *fdp)
 {
-	struct auplay_st *st;
-	int err;
-	(void)ap;
-	(void)device;
+	struct sockaddr_un addr;
+	int fd;
 
-	st = mem_zalloc(sizeof(*st), play_destructor);
-	if (!st)
-		return ENOMEM;
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return ENAMETOOLONG;
 
-	st->wh    = wh;
-	st->arg   = arg;
-	st->srate = prm->srate;
-	st->ptime = prm->ptime;
-	st->sampc = prm->srate * prm->ch * prm->ptime / 1000;
-	st->run   = true;
+	unlink(path);
 
-	err = thread_create_name(&st->thread, "ausock_play",
-				 play_thread, st);
-	if (err) {
-		mem_deref(st);
+	fd = socket(AF_UNIX, type, 0);
+	if (fd < 0)
+		return errno;
+
+	/* non-blocking so a spurious wakeup never stalls the main loop */
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(fd, 5) < 0) {
+		int err = errno;
+		close(fd);
 		return err;
 	}
 
-	*stp = st;
+	*fdp = fd;
 	return 0;
 }
 
-/* ------------------------------------------------------------------ */
-/*  Module entry points                                                */
-/* ------------------------------------------------------------------ */
+static int setup_listen(struct chan *ch)
+{
+	return listen_unix(ch->path, ch->transport == TRANSPORT_SEQPACKET ?
+			   SOCK_SEQPACKET : SOCK_STREAM, &ch->listen_fd);
+}
 
-static int module_init(void)
+static void listen_handler(int flags, void *arg);
+
+static int chan_accepting(struct chan *ch)
 {
-	const char *path;
+	return fd_listen(&ch->lfhs, ch->listen_fd, FD_READ,
+			 listen_handler, ch);
+}
+
+/**
+ * ausock_record: open the recording of a new client,
+ * <dir>/<channel>-<date>-<time>-<n>.wav.  NULL if recording is off or
+ * the file cannot be created; the call goes on either way.
+ */
+static struct rec *rec_start(struct chan *ch)
+{
+	const char *name = strrchr(ch->path, '/');
+	char file[512], when[32];
+	struct rec *rec = NULL;
+	struct tm tm;
+	time_t now;
+	size_t len;
 	int err;
 
-	signal(SIGPIPE, SIG_IGN);
+	if (!rec_dir[0])
+		return NULL;
 
-	err = mtx_init(&sock_mtx, mtx_plain);
-	if (err != thrd_success)
-		return ENOMEM;
+	name = name ? name + 1 : ch->path;
+	len  = strlen(name);
+	if (len > 5 && 0 == strcmp(name + len - 5, ".sock"))
+		len -= 5;
 
-	path = getenv("AUSOCK_PATH");
-	if (!path || !*path)
-		path = DEFAULT_PATH;
+	now = time(NULL);
+	localtime_r(&now, &tm);
+	strftime(when, sizeof(when), "%Y%m%d-%H%M%S", &tm);
 
-	err = setup_listen(path);
+	re_snprintf(file, sizeof(file), "%s/%b-%s-%u.wav", rec_dir,
+		    name, len, when, re_atomic_rlx(&ch->gen));
+
+	err = rec_alloc(&rec, file, ch->srate, ch->sampc, ch->ptime);
 	if (err) {
-		mtx_destroy(&sock_mtx);
-		return err;
+		warning("ausock: %s: cannot record to %s (%m)\n",
+			ch->path, file, err);
+		return NULL;
 	}
 
-	err  = ausrc_register(&mod_ausrc, baresip_ausrcl(),
-			      "ausock", src_alloc);
-	err |= auplay_register(&mod_auplay, baresip_auplayl(),
-				"ausock", play_alloc);
+	module_event("ausock", "record", NULL, NULL, "%s", file);
 
-	if (err) {
-		mod_ausrc  = mem_deref(mod_ausrc);
-		mod_auplay = mem_deref(mod_auplay);
-	}
+	return rec;
+}
 
-	return err;
+/** Finish a client's recording, off the scheduler thread */
+static void rec_finish(struct chan *ch, struct rec *rec)
+{
+	int err;
+
+	if (!rec)
+		return;
+
+	err = rec_close(rec);
+	if (err)
+		warning("ausock: %s: recording failed (%m)\n", ch->path, err);
+	else
+		info("ausock: %s: recorded %.1f s (%u frames lost)\n",
+		     ch->path, rec_seconds(rec), rec_lost(rec));
+
+	mem_deref(rec);
 }
 
-static int module_close(void)
+static void drop_client(struct chan *ch)
 {
-	mod_ausrc  = mem_deref(mod_ausrc);
-	mod_auplay = mem_deref(mod_auplay);
+	struct rec *rec;
+
+	ch->cfhs = fd_close(ch->cfhs);
+	tmr_cancel(&ch->tmr);
+
+	mtx_lock(&ch->mtx);
+	if (ch->client_fd >= 0)
+		close(ch->client_fd);
+	ch->client_fd = -1;
+	ch->shm = mem_deref(ch->shm);
+	rec = ch->rec;
+	ch->rec = NULL;
+	ch->txlen = 0;
+	mtx_unlock(&ch->mtx);
+
+	re_atomic_rlx_set(&ch->connected, false);
+
+	rec_finish(ch, rec);
+
+	/* discard the partial frame or message */
+	ch->rxhdroff  = 0;
+	ch->rxoff     = 0;
+	ch->rxpkt.n   = 0;
+	ch->rxpkt.pos = 0;
+	if (ch->src)
+		ch->src->rxoff = 0;
+
+	/* and the frames it queued: the scheduler owns the ring's read
+	   side, so it drops them on its next tick */
+	if (ch->src && ch->src->ring)
+		re_atomic_rlx_set(&ch->src->dropto, ch->src->frames_in);
+
+	if (chan_accepting(ch))
+		warning("ausock: %s: cannot accept new clients\n", ch->path);
+}
+
+/** Read and discard whatever the client sent; error on hangup */
+static int drain(int fd)
+{
+	uint8_t junk[256];
+
+	for (;;) {
+		ssize_t n = read(fd, junk, sizeof(junk));
 
-	if (client_fd >= 0) {
-		close(client_fd);
-		client_fd = -1;
+		if (n == 0)
+			return ECONNRESET;
+		if (n < 0)
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ?
+				0 : errno;
 	}
+}
 
-	if (listen_fd >= 0) {
-		close(listen_fd);
-		listen_fd = -1;
+/** Framed: a HELLO from the client must match the channel */
+static int hello_check(const struct chan *ch, const uint8_t *data,
+		       size_t len)
+{
+	struct ausock_hello hello;
+
+	if (len < sizeof(hello))
+		return EPROTO;
+
+	memcpy(&hello, data, sizeof(hello));
+
+	if (hello.magic != AUSOCK_PROTO_MAGIC ||
+	    hello.version != AUSOCK_PROTO_VERSION)
+		return EPROTO;
+
+	if (hello.fmt != (ch->fmt == SOCK_FMT_PCMU ?
+			  AUSOCK_FMT_PCMU : AUSOCK_FMT_S16LE) ||
+	    hello.srate != ch->srate ||
+	    hello.frame_bytes != ch->sampc * sock_sampsz(ch) ||
+	    hello.in_srate != ch->inrate ||
+	    hello.in_frame_bytes != sock_inbytes(ch)) {
+		warning("ausock: %s: client expects %u Hz frames of %u bytes"
+			" (agent %u Hz / %u), channel has %u Hz / %u"
+			" (agent %u Hz / %u)\n", ch->path,
+			hello.srate, hello.frame_bytes,
+			hello.in_srate, hello.in_frame_bytes,
+			ch->srate, (unsigned)(ch->sampc * sock_sampsz(ch)),
+			ch->inrate, (unsigned)sock_inbytes(ch));
+		return EPROTO;
 	}
 
-	if (sock_path[0])
-		unlink(sock_path);
+	return 0;
+}
+
+static void hello_fill(const struct chan *ch, struct ausock_hello *hp)
+{
+	struct ausock_hello hello;
+
+	memset(&hello, 0, sizeof(hello));
+	hello.magic       = AUSOCK_PROTO_MAGIC;
+	hello.version     = AUSOCK_PROTO_VERSION;
+	hello.fmt         = ch->fmt == SOCK_FMT_PCMU ?
+			    AUSOCK_FMT_PCMU : AUSOCK_FMT_S16LE;
+	hello.ch          = 1;
+	hello.srate       = ch->srate;
+	hello.ptime       = (uint16_t)ch->ptime;
+	hello.frame_bytes = (uint16_t)(ch->sampc * sock_sampsz(ch));
+	hello.in_srate    = ch->inrate;
+	hello.in_frame_bytes = (uint16_t)sock_inbytes(ch);
+
+	*hp = hello;
+}
+
+static void hello_send(struct chan *ch)
+{
+	struct ausock_hello hello;
+
+	hello_fill(ch, &hello);
+
+	(void)chan_msg(ch, AUSOCK_MSG_HELLO, 0, sched_now(),
+		       &hello, sizeof(hello));
+}
+
+static void stats_send(struct chan *ch, uint32_t seq)
+{
+	struct ausock_stats st;
+
+	memset(&st, 0, sizeof(st));
+	st.up_frames   = re_atomic_rlx(&ch->stats.up_frames);
+	st.up_drops    = re_atomic_rlx(&ch->stats.up_drops);
+	st.down_frames = re_atomic_rlx(&ch->stats.down_frames);
+	st.underruns   = re_atomic_rlx(&ch->stats.underruns);
+	st.target      = re_atomic_rlx(&ch->stats.target);
+	st.concealed   = re_atomic_rlx(&ch->stats.concealed);
+
+	if (ch->src && ch->src->ring) {
+		st.queued   = ring_count(ch->src->ring);
+		st.capacity = ring_capacity(ch->src->ring);
+	}
+
+	(void)chan_msg(ch, AUSOCK_MSG_STATS, seq, sched_now(),
+		       &st, sizeof(st));
+}
+
+static void clip_reply(struct chan *ch, uint32_t seq, uint8_t voice,
+		       uint8_t event)
+{
+	struct ausock_clip clip;
+
+	memset(&clip, 0, sizeof(clip));
+	clip.voice = voice;
+	clip.event = event;
+
+	(void)chan_msg(ch, AUSOCK_MSG_CLIP, seq, sched_now(),
+		       &clip, sizeof(clip));
+}
+
+/**
+ * Framed: start or stop a clip.  The mixer picks it up on its next
+ * tick; one that is not loaded is answered straight away.
+ */
+static int clip_handle(struct chan *ch, const struct ausock_msg *hdr)
+{
+	struct ausock_clip clip;
+	struct mix_play p;
+	int err;
+
+	if (hdr->len != sizeof(clip))
+		return EPROTO;
+
+	memcpy(&clip, ch->rxctl, sizeof(clip));
+	clip.name[sizeof(clip.name) - 1] = '\0';
+
+	if (clip.voice >= AUSOCK_CLIP_VOICES)
+		return EPROTO;
+
+	memset(&p, 0, sizeof(p));
+	p.seq     = hdr->seq;
+	p.gen     = re_atomic_rlx(&ch->gen);
+	p.voice   = clip.voice;
+	p.flags   = clip.flags;
+	p.gain_db = clip.gain_db;
+	p.duck_db = clip.duck_db;
+
+	if (!ch->src || !ch->src->mix ||
+	    (clip.name[0] &&
+	     clips_get(clips, &p.pcm, clip.name, ch->src->srate) &&
+	     phrases_get(phrases, &p.pcm, clip.name, ch->src->srate))) {
+		clip_reply(ch, hdr->seq, clip.voice, AUSOCK_CLIP_UNKNOWN);
+		return 0;
+	}
+
+	/* ENOSPC: retried once the tick has taken the queue */
+	err = mix_play(ch->src->mix, &p);
+	if (err)
+		mem_deref(p.pcm);
+
+	return err;
+}
+
+/** Framed: act on a complete control message */
+static int msg_handle(struct chan *ch, const struct ausock_msg *hdr)
+{
+	switch (hdr->type) {
+
+	case AUSOCK_MSG_HELLO:
+		return hello_check(ch, ch->rxctl, hdr->len);
+
+	case AUSOCK_MSG_FLUSH:
+	case AUSOCK_MSG_MARK:
+		/* what the producer still sends of this utterance is stale */
+		if (hdr->type == AUSOCK_MSG_FLUSH && ch->inj.open)
+			ch->inj.cut = true;
+
+		if (ch->src)
+			return src_ctl_push(ch->src, hdr, ch->rxctl);
+
+		/* no agent audio to wait for: answer straight away */
+		(void)chan_msg(ch, hdr->type, hdr->seq, sched_now(),
+			       hdr->type == AUSOCK_MSG_MARK ? ch->rxctl : NULL,
+			       hdr->type == AUSOCK_MSG_MARK && hdr->len >= 8 ?
+			       8 : 0);
+		return 0;
+
+	case AUSOCK_MSG_STATS:
+		stats_send(ch, hdr->seq);
+		return 0;
+
+	case AUSOCK_MSG_CLIP:
+		return clip_handle(ch, hdr);
+
+	default:
+		return 0;   /* only ever sent by ausock */
+	}
+}
+
+static bool msg_is_ctl(uint8_t type)
+{
+	return type == AUSOCK_MSG_HELLO || type == AUSOCK_MSG_FLUSH ||
+	       type == AUSOCK_MSG_MARK  || type == AUSOCK_MSG_STATS ||
+	       type == AUSOCK_MSG_UNDERRUN || type == AUSOCK_MSG_CLIP;
+}
+
+/**
+ * Framed: consume messages until the socket runs dry.  A message that
+ * cannot be taken yet (ring or control queue full) stays half-read and
+ * ENOSPC is returned, exactly like a full ring in raw mode.
+ */
+static int msg_fill(struct chan *ch)
+{
+	const struct ausock_msg *hdr = &ch->rxhdr;
+	const int fd = ch->client_fd;
+	int err;
+
+	for (;;) {
+		err = sock_read(fd, &ch->rxhdr, sizeof(ch->rxhdr),
+				&ch->rxhdroff);
+		if (err)
+			break;
+
+		if (hdr->type == AUSOCK_MSG_AUDIO &&
+		    hdr->len != sock_inbytes(ch)) {
+			err = EPROTO;
+			break;
+		}
+
+		if (hdr->type == AUSOCK_MSG_AUDIO && ch->src) {
+			err = src_read(ch->src, fd);
+		} else if (msg_is_ctl(hdr->type)) {
+			if (hdr->len > sizeof(ch->rxctl)) {
+				err = EPROTO;
+				break;
+			}
+
+			err = sock_read(fd, ch->rxctl, hdr->len, &ch->rxoff);
+			if (!err)
+				err = msg_handle(ch, hdr);
+		} else {
+			err = sock_skip(fd, hdr->len, &ch->rxoff);
+		}
+
+		if (err)
+			break;
+
+		ch->rxhdroff = 0;
+		ch->rxoff    = 0;
+	}
+
+	return err == EAGAIN ? 0 : err;
+}
+
+/** seqpacket: one agent frame, straight into the ring */
+static int pkt_audio(struct chan *ch, const uint8_t *frame)
+{
+	uint8_t *slot;
+
+	/* no source bound yet: nowhere to play it */
+	if (!ch->src)
+		return 0;
+
+	slot = ring_write_ptr(ch->src->ring);
+	if (!slot)
+		return ENOSPC;
+
+	src_commit(ch->src, slot, frame);
+
+	return 0;
+}
+
+/** seqpacket: act on one whole packet */
+static int pkt_handle(struct chan *ch, const uint8_t *pkt, size_t len)
+{
+	struct ausock_msg hdr;
+	const uint8_t *payload = pkt + sizeof(hdr);
+
+	if (ch->proto == PROTO_RAW)
+		return len == sock_inbytes(ch) ? pkt_audio(ch, pkt) : EPROTO;
+
+	if (len < sizeof(hdr))
+		return EPROTO;
+
+	memcpy(&hdr, pkt, sizeof(hdr));
+	if (hdr.len != len - sizeof(hdr))
+		return EPROTO;
+
+	if (hdr.type == AUSOCK_MSG_AUDIO) {
+		if (hdr.len != sock_inbytes(ch))
+			return EPROTO;
+
+		return pkt_audio(ch, payload);
+	}
+
+	if (!msg_is_ctl(hdr.type))
+		return 0;
+
+	if (hdr.len > sizeof(ch->rxctl))
+		return EPROTO;
+
+	memcpy(ch->rxctl, payload, hdr.len);
+
+	return msg_handle(ch, &hdr);
+}
+
+/**
+ * seqpacket: receive the next batch of up to SOCK_BATCH packets.
+ * Returns EAGAIN if there are none, another error on hangup or on a
+ * packet too long to be valid.
+ */
+static int pkt_recv(struct chan *ch)
+{
+	const size_t cap = ch->rxpkt.cap;
+	uint32_t n = 0;
+
+	ch->rxpkt.n   = 0;
+	ch->rxpkt.pos = 0;
+
+#ifdef HAVE_MMSG
+	{
+		struct mmsghdr msgv[SOCK_BATCH];
+		struct iovec iov[SOCK_BATCH];
+		int r;
+
+		memset(msgv, 0, sizeof(msgv));
+		for (uint32_t i = 0; i < SOCK_BATCH; i++) {
+			iov[i].iov_base = ch->rxpkt.buf + i * cap;
+			iov[i].iov_len  = cap;
+			msgv[i].msg_hdr.msg_iov    = &iov[i];
+			msgv[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		r = recvmmsg(ch->client_fd, msgv, SOCK_BATCH, MSG_DONTWAIT,
+			     NULL);
+		if (r < 0)
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ?
+				EAGAIN : errno;
+
+		for (; n < (uint32_t)r; n++)
+			ch->rxpkt.len[n] = msgv[n].msg_len;
+	}
+#else
+	for (; n < SOCK_BATCH; n++) {
+		ssize_t r = recv(ch->client_fd, ch->rxpkt.buf + n * cap,
+				 cap, MSG_DONTWAIT);
+
+		if (r < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				return errno;
+			if (!n)
+				return EAGAIN;
+			break;
+		}
+
+		ch->rxpkt.len[n] = (uint32_t)r;
+		if (!r)
+			break;
+	}
+#endif
+
+	/* an empty packet is the hangup, as an empty read on a stream */
+	for (uint32_t i = 0; i < n; i++) {
+		if (!ch->rxpkt.len[i])
+			return ECONNRESET;
+		if (ch->rxpkt.len[i] >= cap)
+			return EPROTO;
+	}
+
+	if (!n)
+		return ECONNRESET;
+
+	ch->rxpkt.n = n;
+
+	return 0;
+}
+
+/**
+ * seqpacket: handle packets until the socket runs dry.  Packets of a
+ * batch that cannot be taken yet (ring or control queue full) wait in
+ * it and ENOSPC is returned, the same backpressure as on a stream.
+ */
+static int pkt_fill(struct chan *ch)
+{
+	int err;
+
+	for (;;) {
+		while (ch->rxpkt.pos < ch->rxpkt.n) {
+			const uint32_t i = ch->rxpkt.pos;
+
+			err = pkt_handle(ch, ch->rxpkt.buf + i * ch->rxpkt.cap,
+					 ch->rxpkt.len[i]);
+			if (err)
+				return err;
+
+			++ch->rxpkt.pos;
+		}
+
+		err = pkt_recv(ch);
+		if (err)
+			return err == EAGAIN ? 0 : err;
+	}
+}
+
+static void client_handler(int flags, void *arg);
+
+static void read_resume(void *arg)
+{
+	struct chan *ch = arg;
+
+	if (fd_listen(&ch->cfhs, ch->client_fd, FD_READ,
+		      client_handler, ch)) {
+		drop_client(ch);
+		return;
+	}
+
+	/* seqpacket: packets already received would wait for the next
+	   one to arrive */
+	if (ch->rxpkt.pos < ch->rxpkt.n)
+		client_handler(FD_READ, ch);
+}
+
+static void client_handler(int flags, void *arg)
+{
+	struct chan *ch = arg;
+	int err;
+	(void)flags;
+
+	/* without a source (or with shm) raw sockets only carry hangup;
+	   seqpacket has no packet buffer before the first bind */
+	if (ch->transport == TRANSPORT_SEQPACKET && ch->rxpkt.buf)
+		err = pkt_fill(ch);
+	else if (ch->transport == TRANSPORT_STREAM &&
+		 ch->proto == PROTO_FRAMED)
+		err = msg_fill(ch);
+	else if (ch->transport == TRANSPORT_STREAM && ch->src)
+		err = src_fill(ch->src, ch->client_fd);
+	else
+		err = drain(ch->client_fd);
+
+	if (err == ENOSPC) {
+		/* ring full: leave data in the socket so the writer
+		   feels backpressure, and look again after a frame */
+		ch->cfhs = fd_close(ch->cfhs);
+		tmr_start(&ch->tmr, ch->ptime ? ch->ptime : 20,
+			  read_resume, ch);
+	} else if (err) {
+		if (err == EPROTO)
+			warning("ausock: %s: protocol error from client,"
+				" dropping it\n", ch->path);
+		drop_client(ch);
+	}
+}
+
+/** Create the shm rings for a new client and hand them over */
+static int client_shm(struct chan *ch, int fd, struct shm **shmp)
+{
+	uint32_t nframes = ch->ptime ? buffer_ms / ch->ptime : 0;
+	int err;
+
+	err = shm_alloc(shmp, ch->srate, ch->sampc * sock_sampsz(ch),
+			nframes ? nframes : 1);
+	if (err)
+		return err;
+
+	err = shm_send(*shmp, fd);
+	if (err)
+		*shmp = mem_deref(*shmp);
+
+	return err;
+}
+
+static void listen_handler(int flags, void *arg)
+{
+	struct chan *ch = arg;
+	struct shm *shm = NULL;
+	struct rec *rec;
+	int fd;
+	(void)flags;
+
+	fd = accept(ch->listen_fd, NULL, NULL);
+	if (fd < 0)
+		return;
+
+	/* reads happen here, sends on the scheduler: neither may block */
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+
+#ifdef SO_NOSIGPIPE          /* macOS */
+	{
+		int val = 1;
+		setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE,
+			   &val, sizeof(val));
+	}
+#endif
+
+	if (ch->transport == TRANSPORT_SHM) {
+		int err = client_shm(ch, fd, &shm);
+		if (err) {
+			warning("ausock: %s: shm setup failed (%m)\n",
+				ch->path, err);
+			close(fd);
+			return;
+		}
+	}
+
+	re_atomic_rlx_add(&ch->gen, 1);
+	re_atomic_rlx_set(&ch->stats.up_frames, 0);
+	re_atomic_rlx_set(&ch->stats.up_drops, 0);
+	re_atomic_rlx_set(&ch->stats.down_frames, 0);
+	re_atomic_rlx_set(&ch->stats.underruns, 0);
+	re_atomic_rlx_set(&ch->stats.concealed, 0);
+	re_atomic_rlx_set(&ch->stats.dtmf_keys, 0);
+	metrics_reset(ch);
+
+	rec = rec_start(ch);
+
+	mtx_lock(&ch->mtx);
+	ch->client_fd = fd;
+	ch->shm       = shm;
+	ch->rec       = rec;
+	mtx_unlock(&ch->mtx);
+
+	re_atomic_rlx_set(&ch->connected, true);
+
+	if (ch->proto == PROTO_FRAMED)
+		hello_send(ch);
+
+	/* one client at a time; later connections wait in the backlog */
+	ch->lfhs = fd_close(ch->lfhs);
+
+	if (fd_listen(&ch->cfhs, fd, FD_READ, client_handler, ch))
+		drop_client(ch);
+}
+
+/** Release what chan_setup() allocated; the next bind starts over */
+static void chan_unbind(struct chan *ch)
+{
+	rt_unlock(ch->txq, ch->txcap);
+	ch->txq         = mem_deref(ch->txq);
+	ch->txcap       = 0;
+	ch->rxpkt.buf   = mem_deref(ch->rxpkt.buf);
+	ch->bi.det      = mem_deref(ch->bi.det);
+	ch->aec         = mem_deref(ch->aec);
+	ch->m.src.late  = mem_deref(ch->m.src.late);
+	ch->m.src.run   = mem_deref(ch->m.src.run);
+	ch->m.play.late = mem_deref(ch->m.play.late);
+	ch->m.play.run  = mem_deref(ch->m.play.run);
+	ch->m.depth     = mem_deref(ch->m.depth);
+	ch->sampc       = 0;
+}
+
+static void chan_destructor(void *data)
+{
+	struct chan *ch = data;
+
+	mtx_lock(&chanl_mtx);
+	list_unlink(&ch->le);
+	mtx_unlock(&chanl_mtx);
+
+	tmr_cancel(&ch->tmr);
+	ch->cfhs = fd_close(ch->cfhs);
+	ch->lfhs = fd_close(ch->lfhs);
+
+	if (ch->client_fd >= 0)
+		close(ch->client_fd);
+
+	mem_deref(ch->shm);
+	mem_deref(ch->tap);
+	inject_close(ch);
+	rec_finish(ch, ch->rec);
+	chan_unbind(ch);
+
+	if (ch->listen_fd >= 0) {
+		close(ch->listen_fd);
+		unlink(ch->path);
+	}
+
+	mtx_destroy(&ch->mtx);
+}
+
+/** ausock_tap: listen at <path>.tap; the call goes on without it */
+static void chan_tap(struct chan *ch)
+{
+	char path[sizeof(ch->path) + 4];
+	int err;
+
+	if (re_snprintf(path, sizeof(path), "%s.tap", ch->path) < 0)
+		err = ENAMETOOLONG;
+	else
+		err = tap_alloc(&ch->tap, path);
+
+	if (err)
+		warning("ausock: %s: no tap socket (%m)\n", ch->path, err);
+}
+
+/**
+ * Look up the channel for a device, creating its listening socket on
+ * first use.  Returns a new reference in *chp.
+ *
+ * Device strings are socket paths; an empty device selects the
+ * default channel.  Allocation and release happen on baresip's main
+ * thread, so a channel found in the list is never mid-destruction.
+ */
+static int chan_get(struct chan **chp, const char *device)
+{
+	const char *path = str_isset(device) ? device : def_path;
+	struct chan *ch = NULL;
+	struct le *le;
+	int err;
+
+	if (strlen(path) >= sizeof(ch->path))
+		return ENAMETOOLONG;
+
+	mtx_lock(&chanl_mtx);
+	LIST_FOREACH(&chanl, le) {
+		struct chan *c = le->data;
+
+		if (0 == strcmp(c->path, path)) {
+			ch = mem_ref(c);
+			break;
+		}
+	}
+	mtx_unlock(&chanl_mtx);
+
+	if (ch) {
+		*chp = ch;
+		return 0;
+	}
+
+	ch = mem_zalloc(sizeof(*ch), NULL);
+	if (!ch)
+		return ENOMEM;
+
+	ch->listen_fd = -1;
+	ch->client_fd = -1;
+	ch->inj.listen_fd = -1;
+	ch->inj.fd    = -1;
+	ch->fmt       = sock_fmt;
+	ch->transport = transport;
+	ch->proto     = protocol;
+	strncpy(ch->path, path, sizeof(ch->path) - 1);
+	tmr_init(&ch->tmr);
+	tmr_init(&ch->inj.tmr);
+
+	if (mtx_init(&ch->mtx, mtx_plain) != thrd_success) {
+		mem_deref(ch);
+		return ENOMEM;
+	}
+
+	err = setup_listen(ch);
+	if (err) {
+		mtx_destroy(&ch->mtx);
+		mem_deref(ch);
+		return err;
+	}
+
+	/* destructor only once fully set up, so it can undo everything */
+	mem_destructor(ch, chan_destructor);
+
+	if (tap_mode != TAP_OFF)
+		chan_tap(ch);
+
+	mtx_lock(&chanl_mtx);
+	list_append(&chanl, &ch->le, ch);
+	mtx_unlock(&chanl_mtx);
+
+	*chp = ch;
+	return 0;
+}
+
+/**
+ * Record the frame geometry of a source or player opened on the
+ * channel and start accepting clients.  Any rate works with s16le
+ * (16000 for wideband calls), pcmu is 8000 only.  The shm rings are
+ * sized from the geometry, so with the shm transport every user of a
+ * channel must agree on it.
+ */
+/** First bind: the channel's buffers, sized for the call's frames */
+static int chan_setup(struct chan *ch, uint32_t srate, uint32_t sampc,
+		      uint32_t ptime)
+{
+	int err;
+
+	/* room for two frames plus a few control messages, and the
+	   lengths of seqpacket packets */
+	ch->txcap = 2 * (sizeof(struct ausock_msg) +
+			 sampc * sock_sampsz(ch)) +
+		    4 * (sizeof(struct ausock_msg) + AUSOCK_CTL_MAX) +
+		    6 * sizeof(uint16_t);
+	ch->txq = mem_zalloc(ch->txcap, NULL);
+	if (!ch->txq)
+		return ENOMEM;
+
+	rt_lock(ch->txq, ch->txcap);
+
+	if (hist_alloc(&ch->m.src.late) || hist_alloc(&ch->m.src.run) ||
+	    hist_alloc(&ch->m.play.late) ||
+	    hist_alloc(&ch->m.play.run) || hist_alloc(&ch->m.depth))
+		return ENOMEM;
+
+	if (bargein_ms && ch->proto == PROTO_FRAMED) {
+		err = bargein_alloc(&ch->bi.det, ptime, bargein_ms);
+		if (err)
+			return err;
+	}
+
+	if (aec_ms) {
+		err = aec_alloc(&ch->aec, srate, sampc, aec_ms);
+		if (err)
+			return err;
+	}
+
+	ch->srate   = srate;
+	ch->sampc   = sampc;
+	ch->ptime   = ptime;
+	ch->inrate  = inrate ? inrate : srate;
+	ch->insampc = ch->inrate * ptime / 1000;
+
+	if (ch->transport == TRANSPORT_SEQPACKET) {
+		size_t max = sock_inbytes(ch) > AUSOCK_CTL_MAX ?
+			     sock_inbytes(ch) : AUSOCK_CTL_MAX;
+
+		ch->rxpkt.cap = sizeof(struct ausock_msg) + max + 1;
+		ch->rxpkt.buf = mem_zalloc(SOCK_BATCH * ch->rxpkt.cap, NULL);
+		if (!ch->rxpkt.buf)
+			return ENOMEM;
+	}
+
+	/* the producer needs the geometry for its HELLO */
+	if (inject)
+		inject_listen(ch);
+
+	return 0;
+}
+
+static int chan_bind(struct chan *ch, uint32_t srate, uint32_t sampc,
+		     uint32_t ptime)
+{
+	/* G.711 is narrowband; wideband channels carry s16le */
+	if (ch->fmt == SOCK_FMT_PCMU && srate != 8000) {
+		warning("ausock: %s: pcmu format needs 8000 Hz, not %u "
+			"(use s16le for wideband)\n", ch->path, srate);
+		return EINVAL;
+	}
+
+	if (!ch->sampc) {
+		int err = chan_setup(ch, srate, sampc, ptime);
+
+		if (err) {
+			chan_unbind(ch);
+			return err;
+		}
+	} else if (ch->transport == TRANSPORT_SHM &&
+		   (ch->srate != srate || ch->sampc != sampc)) {
+		warning("ausock: %s: shm transport needs one frame size "
+			"per channel\n", ch->path);
+		return EINVAL;
+	}
+
+	if (ch->lfhs || ch->client_fd >= 0)
+		return 0;
+
+	return chan_accepting(ch);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Channels — scheduler side                                          */
+/* ------------------------------------------------------------------ */
+
+/**
+ * shm transport: new reference to the connected client's rings, or
+ * NULL if no client is connected.  Callers hold it only for one
+ * frame, so a hangup frees the rings promptly.
+ */
+static struct shm *chan_shm(struct chan *ch)
+{
+	struct shm *shm;
+
+	mtx_lock(&ch->mtx);
+	shm = mem_ref(ch->shm);
+	mtx_unlock(&ch->mtx);
+
+	return shm;
+}
+
+/**
+ * ausock_record: queue one frame of a leg for the client's recording,
+ * placed by the deadline of the tick that produced it
+ */
+static void chan_record(struct chan *ch, enum rec_leg leg,
+			const struct sched_ent *ent, const int16_t *sampv,
+			size_t sampc)
+{
+	struct rec *rec;
+
+	if (!rec_dir[0])
+		return;
+
+	mtx_lock(&ch->mtx);
+	rec = mem_ref(ch->rec);
+	mtx_unlock(&ch->mtx);
+
+	rec_frame(rec, leg, sched_due(ent), sampv, sampc);
+	mem_deref(rec);
+}
+
+/** Start barge-in state afresh whenever a new client has connected */
+static void bargein_sync(struct chan *ch)
+{
+	const uint32_t gen = re_atomic_rlx(&ch->gen);
+
+	if (ch->bi.gen == gen)
+		return;
+
+	ch->bi.gen     = gen;
+	ch->bi.count   = 0;
+	ch->bi.dropped = 0;
+	ch->bi.discard = false;
+	ch->bi.fade    = false;
+	bargein_reset(ch->bi.det);
+}
+
+/**
+ * Caller frame from wh(): if it completes a barge-in, tell the client
+ * and stop the agent.  Agent audio is discarded from here until the
+ * client's FLUSH arrives; both happen on this thread, so the FLUSH
+ * can never be seen before the discard starts.
+ */
+static void bargein_check(struct chan *ch, const int16_t *sampv,
+			  size_t sampc)
+{
+	struct ausock_bargein ev;
+	int level;
+
+	bargein_sync(ch);
+
+	if (ch->bi.discard || !bargein_near(ch->bi.det, sampv, sampc, &level))
+		return;
+
+	ev.level     = (int16_t)level;
+	ev.speech_ms = (uint16_t)bargein_ms;
+
+	if (chan_msg(ch, AUSOCK_MSG_BARGEIN, ch->bi.count + 1, sched_now(),
+		     &ev, sizeof(ev)))
+		return;   /* nobody to tell, nobody to flush */
+
+	++ch->bi.count;
+	ch->bi.dropped = 0;
+	ch->bi.discard = true;
+	ch->bi.fade    = true;
+}
+
+/* ------------------------------------------------------------------ */
+/*  ausrc — audio source (agent → caller)                             */
+/*                                                                     */
+/*  The main loop moves frames from the socket into a lock-free ring;  */
+/*  a scheduler tick dequeues one frame per ptime and pushes it into   */
+/*  baresip's encode pipeline via rh().                                */
+/* ------------------------------------------------------------------ */
+
+/** u-law and other rates are staged, then converted into the slot */
+static bool src_staged(const struct ausrc_st *st)
+{
+	return st->ch->fmt == SOCK_FMT_PCMU || st->rs;
+}
+
+/**
+ * Main loop: one whole agent frame in socket format (already in the
+ * slot for call-rate S16LE) goes into the ring slot and is committed
+ */
+static void src_commit(struct ausrc_st *st, uint8_t *slot,
+		       const uint8_t *frame)
+{
+	if (st->ch->fmt == SOCK_FMT_PCMU) {
+		pcmu_decode((int16_t *)(void *)slot, frame, st->sampc);
+	} else if (st->rs) {
+		const uint32_t gen = re_atomic_rlx(&st->ch->gen);
+
+		if (st->rsgen != gen) {
+			resamp_reset(st->rs);
+			st->rsgen = gen;
+		}
+
+		resamp_frame(st->rs, (int16_t *)(void *)slot,
+			     (const int16_t *)(const void *)frame);
+	} else if (frame != slot) {
+		memcpy(slot, frame, sock_inbytes(st->ch));
+	}
+
+	ring_write_commit(st->ring);
+	++st->frames_in;
+}
+
+/**
+ * Main loop: read the rest of the current frame into the ring.
+ * Returns 0 once it is committed, EAGAIN if the socket ran dry first,
+ * ENOSPC if the ring is full, another error on hangup.
+ */
+static int src_read(struct ausrc_st *st, int fd)
+{
+	const bool stage = src_staged(st);
+	uint8_t *slot = ring_write_ptr(st->ring);
+	int err;
+
+	if (!slot)
+		return ENOSPC;
+
+	/* call-rate S16LE lands straight in the ring slot */
+	err = sock_read(fd, stage ? st->rxbuf : slot, sock_inbytes(st->ch),
+			&st->rxoff);
+	if (err)
+		return err;
+
+	src_commit(st, slot, stage ? st->rxbuf : slot);
+	st->rxoff = 0;
+
+	return 0;
+}
+
+/**
+ * Main loop, raw protocol: move whole frames from the socket into the
+ * ring, up to SOCK_BATCH per syscall.  Call-rate S16LE is scattered
+ * straight into the free slots with readv(); other formats are read
+ * into the staging buffer in one go and converted frame by frame.  A
+ * partial frame stays behind (rxoff) until the rest arrives.  Returns
+ * ENOSPC once the ring is full, another error on hangup.
+ */
+static int src_fill(struct ausrc_st *st, int fd)
+{
+	const size_t fb = sock_inbytes(st->ch);
+	const bool stage = src_staged(st);
+
+	for (;;) {
+		void *slotv[SOCK_BATCH];
+		struct iovec iov[SOCK_BATCH];
+		uint32_t n, iovc, done;
+		size_t want, got;
+		ssize_t r;
+
+		n = ring_write_ptrs(st->ring, slotv, SOCK_BATCH);
+		if (!n)
+			return ENOSPC;
+
+		if (stage) {
+			iov[0].iov_base = st->rxbuf + st->rxoff;
+			iov[0].iov_len  = n * fb - st->rxoff;
+			iovc = 1;
+		} else {
+			for (uint32_t i = 0; i < n; i++) {
+				iov[i].iov_base = slotv[i];
+				iov[i].iov_len  = fb;
+			}
+			iov[0].iov_base = (uint8_t *)slotv[0] + st->rxoff;
+			iov[0].iov_len  = fb - st->rxoff;
+			iovc = n;
+		}
+
+		want = n * fb - st->rxoff;
+
+		r = readv(fd, iov, (int)iovc);
+		if (r == 0)
+			return ECONNRESET;
+		if (r < 0)
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ?
+				0 : errno;
+
+		got  = st->rxoff + (size_t)r;
+		done = (uint32_t)(got / fb);
+
+		for (uint32_t i = 0; i < done; i++)
+			src_commit(st, slotv[i], stage ?
+				   st->rxbuf + i * fb : slotv[i]);
+
+		st->rxoff = got % fb;
+		if (stage && done && st->rxoff)
+			memmove(st->rxbuf, st->rxbuf + done * fb, st->rxoff);
+
+		/* a short read drained the socket */
+		if ((size_t)r < want)
+			return 0;
+	}
+}
+
+/**
+ * Main loop, framed protocol: queue a FLUSH or MARK behind the agent
+ * frames received before it.  ENOSPC if the queue is full.
+ */
+static int src_ctl_push(struct ausrc_st *st, const struct ausock_msg *hdr,
+			const uint8_t *payload)
+{
+	struct src_ctl *c = ring_write_ptr(st->ctlq);
+
+	if (!c)
+		return ENOSPC;
+
+	memset(c, 0, sizeof(*c));
+	c->target = st->frames_in;
+	c->seq    = hdr->seq;
+	c->gen    = re_atomic_rlx(&st->ch->gen);
+	c->type   = hdr->type;
+
+	if (hdr->type == AUSOCK_MSG_MARK && hdr->len >= sizeof(c->arg)) {
+		memcpy(&c->arg, payload, sizeof(c->arg));
+		c->arglen = sizeof(c->arg);
+	}
+
+	ring_write_commit(st->ctlq);
+	return 0;
+}
+
+/** Scheduler: answer a FLUSH/MARK, unless its client has gone since */
+static void src_ctl_reply(struct ausrc_st *st, const struct src_ctl *c,
+			  const void *data, size_t len)
+{
+	if (c->gen != re_atomic_rlx(&st->ch->gen))
+		return;
+
+	(void)chan_msg(st->ch, c->type, c->seq, sched_now(), data, len);
+}
+
+/**
+ * Scheduler: apply queued FLUSH/MARK whose audio has been reached.  A
+ * FLUSH drops every frame still queued ahead of it; a MARK is echoed
+ * once the last frame ahead of it has gone to rh().
+ */
+static void src_ctl_run(struct ausrc_st *st)
+{
+	const struct src_ctl *c;
+
+	while ((c = ring_read_ptr(st->ctlq))) {
+
+		if (c->type == AUSOCK_MSG_FLUSH) {
+			uint32_t dropped = 0;
+
+			/* all frames up to target were committed first */
+			while (st->frames_out < c->target &&
+			       ring_read_ptr(st->ring)) {
+				ring_read_commit(st->ring);
+				++st->frames_out;
+				++dropped;
+			}
+
+			/* and the tail of the frame before them */
+			if (st->drift)
+				drift_flush(st->drift);
+
+			/* the client's answer to a barge-in: fresh audio
+			   follows, and the drop count covers the discard */
+			if (st->ch->bi.discard && c->gen == st->ch->bi.gen) {
+				dropped += st->ch->bi.dropped;
+				st->ch->bi.dropped = 0;
+				st->ch->bi.discard = false;
+			}
+
+			src_ctl_reply(st, c, &dropped, sizeof(dropped));
+		} else if (st->frames_out >= c->target) {
+			src_ctl_reply(st, c, &c->arg, c->arglen);
+		} else {
+			break;
+		}
+
+		ring_read_commit(st->ctlq);
+	}
+}
+
+/** Next agent frame from the socket-fed ring; false if none is ready */
+static bool src_ring_frame(struct ausrc_st *st, int16_t *buf)
+{
+	const void *frame = ring_read_ptr(st->ring);
+
+	if (!frame)
+		return false;
+
+	memcpy(buf, frame, st->sampc * sizeof(int16_t));
+	ring_read_commit(st->ring);
+	++st->frames_out;
+
+	return true;
+}
+
+/** Next agent frame from the shm down ring; false if none is ready */
+static bool src_shm_frame(struct ausrc_st *st, int16_t *buf)
+{
+	struct shm *shm = chan_shm(st->ch);
+	struct ausock_shm *map = shm_map(shm);
+	const uint8_t *frame;
+
+	frame = map ? ausock_shm_read_ptr(map, &map->down) : NULL;
+	if (frame) {
+		if (st->ch->fmt == SOCK_FMT_PCMU)
+			pcmu_decode(buf, frame, st->sampc);
+		else
+			memcpy(buf, frame, st->sampc * sizeof(int16_t));
+
+		ausock_shm_read_commit(&map->down);
+		shm_notify_down(shm);
+	}
+
+	mem_deref(shm);
+	return frame != NULL;
+}
+
+/**
+ * Scheduler, after a barge-in: agent audio is dropped until the
+ * client's FLUSH.  The first frame is faded out rather than cut, so
+ * the agent stops without a click.  Returns true if buf holds it.
+ */
+static bool src_discard(struct ausrc_st *st, int16_t *buf)
+{
+	struct chan *ch = st->ch;
+	bool faded = false;
+
+	if (ch->bi.fade && src_ring_frame(st, buf)) {
+		bargein_fade(buf, st->sampc);
+		faded = true;
+	}
+	ch->bi.fade = false;
+
+	while (ch->bi.discard && ring_read_ptr(st->ring)) {
+
+		/* a FLUSH queued behind this frame is visible now */
+		src_ctl_run(st);
+		if (!ch->bi.discard)
+			break;
+
+		ring_read_commit(st->ring);
+		++st->frames_out;
+		++ch->bi.dropped;
+	}
+
+	return faded;
+}
+
+/** Agent frames queued ahead of rh() */
+static uint32_t src_depth(struct ausrc_st *st)
+{
+	struct shm *shm;
+	struct ausock_shm *map;
+	uint32_t n;
+
+	if (st->ring)
+		return ring_count(st->ring);
+
+	shm = chan_shm(st->ch);
+	map = shm_map(shm);
+	n   = map ? ausock_shm_count(&map->down) : 0;
+	mem_deref(shm);
+
+	return n;
+}
+
+/** Start playout state afresh whenever a new client has connected */
+static void src_playout_sync(struct ausrc_st *st)
+{
+	const uint32_t gen = re_atomic_rlx(&st->ch->gen);
+
+	if (st->pogen == gen)
+		return;
+
+	st->pogen = gen;
+	playout_reset(st->po);
+	st->potarget = playout_target(st->po);
+	re_atomic_rlx_set(&st->ch->stats.target, st->potarget);
+}
+
+/**
+ * Scheduler, ausock_playout adaptive: the next agent frame once the
+ * talkspurt has buffered up to the target.  A silent head frame may
+ * be skipped first to shed depth the client has kept ahead of it for
+ * a while (socket ring only; the shm ring is the client's to fill).
+ */
+static bool src_playout_frame(struct ausrc_st *st, int16_t *buf)
+{
+	const uint32_t depth = src_depth(st);
+	const void *head;
+
+	if (!playout_ready(st->po, depth))
+		return false;
+
+	head = st->ring ? ring_read_ptr(st->ring) : NULL;
+	if (playout_drop(st->po, head, depth)) {
+		ring_read_commit(st->ring);
+		++st->frames_out;
+	}
+
+	if (st->ring)
+		return src_ring_frame(st, buf);
+	else
+		return src_shm_frame(st, buf);
+}
+
+/** Scheduler: publish a changed playout target, telling a framed client */
+static void src_playout_report(struct ausrc_st *st)
+{
+	struct chan *ch = st->ch;
+	struct ausock_playout ev;
+	const uint32_t target = playout_target(st->po);
+
+	if (target == st->potarget)
+		return;
+
+	st->potarget = target;
+	re_atomic_rlx_set(&ch->stats.target, target);
+
+	if (ch->proto != PROTO_FRAMED)
+		return;
+
+	ev.target_ms = (uint16_t)(target * st->ptime);
+	ev.depth_ms  = (uint16_t)(src_depth(st) * st->ptime);
+	ev.concealed = re_atomic_rlx(&ch->stats.concealed);
+
+	(void)chan_msg(ch, AUSOCK_MSG_PLAYOUT, target, sched_now(),
+		       &ev, sizeof(ev));
+}
+
+/** Scheduler: the next agent frame from wherever the client puts it */
+static bool src_pull(int16_t *buf, void *arg)
+{
+	struct ausrc_st *st = arg;
+
+	if (st->po)
+		return src_playout_frame(st, buf);
+	else if (st->ring)
+		return src_ring_frame(st, buf);
+	else
+		return src_shm_frame(st, buf);
+}
+
+/** New client, new setpoint: drop what was held for the last one */
+static void src_drift_sync(struct ausrc_st *st)
+{
+	const uint32_t gen = re_atomic_rlx(&st->ch->gen);
+
+	if (st->driftgen == gen)
+		return;
+
+	st->driftgen = gen;
+	drift_reset(st->drift);
+}
+
+/**
+ * Scheduler: drop the frames a client that has gone left in the ring.
+ * Frames it committed may only show up on a later tick, so this runs
+ * every tick until frames_out has caught up.
+ */
+static void src_ring_drop(struct ausrc_st *st)
+{
+	const uint64_t dropto = re_atomic_rlx(&st->dropto);
+	bool dropped = false;
+
+	while (st->frames_out < dropto && ring_read_ptr(st->ring)) {
+		ring_read_commit(st->ring);
+		++st->frames_out;
+		dropped = true;
+	}
+
+	if (!dropped)
+		return;
+
+	if (st->drift)
+		drift_flush(st->drift);
+	if (st->po)
+		playout_stop(st->po);
+}
+
+/** Scheduler: one frame per ptime into baresip */
+static void src_tick(void *arg)
+{
+	struct ausrc_st *st = arg;
+	struct chan *ch = st->ch;
+	const uint64_t start = sched_now();
+	struct auframe af;
+	bool got, concealed = false, mixed = false;
+
+	metrics_tick(&ch->m.src, st->ent, &st->resyncs, start);
+	hist_record(ch->m.depth, st->ring ? ring_count(st->ring) :
+		    src_depth(st));
+
+	if (ch->bi.det)
+		bargein_sync(ch);
+	if (st->po)
+		src_playout_sync(st);
+	if (st->mix)
+		mix_sync(st->mix, re_atomic_rlx(&ch->gen));
+	if (st->drift)
+		src_drift_sync(st);
+	if (st->ring)
+		src_ring_drop(st);
+
+	/* a barge-in since the last tick silences the clips too */
+	if (st->mix && ch->bi.fade)
+		mix_interrupt(st->mix);
+
+	if (st->ctlq)
+		src_ctl_run(st);     /* a FLUSH must act before the dequeue */
+
+	if (ch->bi.discard)
+		got = src_discard(st, st->buf);
+	else if (st->drift)
+		got = drift_frame(st->drift, st->buf, src_pull, st);
+	else
+		got = src_pull(st->buf, st);
+
+	if (st->drift) {
+		if (ch->bi.discard)
+			drift_flush(st->drift);
+
+		drift_update(st->drift, src_depth(st),
+			     st->po ? playout_target(st->po) : 0,
+			     got && !ch->bi.discard);
+		re_atomic_rlx_set(&ch->stats.drift, drift_ppm(st->drift));
+	}
+
+	if (got) {
+		if (st->po && !ch->bi.discard)
+			playout_played(st->po, st->buf);
+
+		re_atomic_rlx_add(&ch->stats.down_frames, 1);
+		st->playing = true;
+	} else {
+		/* running dry on purpose after a barge-in is no underrun */
+		if (st->playing && !ch->bi.discard) {
+			uint32_t n = re_atomic_rlx_add(&ch->stats.underruns,
+						       1) + 1;
+
+			if (ch->proto == PROTO_FRAMED)
+				(void)chan_msg(ch, AUSOCK_MSG_UNDERRUN, n,
+					       sched_now(), NULL, 0);
+		}
+		st->playing = false;
+
+		/* bridge the gap with the agent's own voice, or silence */
+		if (st->po && !ch->bi.discard)
+			concealed = playout_conceal(st->po, st->buf);
+
+		if (concealed) {
+			re_atomic_rlx_add(&ch->stats.concealed, 1);
+		} else {
+			memset(st->buf, 0, st->sampc * sizeof(int16_t));
+			re_atomic_rlx_add(re_atomic_rlx(&ch->connected) ?
+					  &ch->m.silence_dry :
+					  &ch->m.silence_idle, 1);
+		}
+	}
+
+	/* a barge-in ends the talkspurt, nothing left to conceal */
+	if (st->po && ch->bi.discard)
+		playout_stop(st->po);
+
+	if (st->mix)
+		mixed = mix_frame(st->mix, st->buf, got || concealed);
+
+	/* the caller hears (and echoes) the clips as well */
+	if (ch->bi.det)
+		bargein_far(ch->bi.det, got || concealed || mixed ?
+			    st->buf : NULL, st->sampc);
+	if (ch->aec)
+		aec_far(ch->aec, got || concealed || mixed ? st->buf : NULL,
+			st->sampc);
+
+	if (st->po)
+		src_playout_report(st);
+
+	chan_record(ch, REC_AGENT, st->ent, st->buf, st->sampc);
+
+	auframe_init(&af, AUFMT_S16LE, st->buf, st->sampc, st->srate, 1);
+	st->rh(&af, st->arg);
+
+	if (st->ctlq)
+		src_ctl_run(st);     /* MARKs reached by this frame */
+
+	hist_record(ch->m.src.run, (uint32_t)(sched_now() - start));
+}
+
+/** Scheduler: a clip voice has ended, tell the framed client */
+static void src_mix_event(uint8_t voice, uint32_t seq, uint8_t event,
+			  void *arg)
+{
+	struct ausrc_st *st = arg;
+
+	if (st->ch->proto == PROTO_FRAMED)
+		clip_reply(st->ch, seq, voice, event);
+}
+
+static void src_destructor(void *data)
+{
+	struct ausrc_st *st = data;
+
+	/* once the entry is gone no tick can touch st */
+	mem_deref(st->ent);
+
+	if (st->ch && st->ch->src == st)
+		st->ch->src = NULL;
+
+	rt_unlock(st->buf, st->sampc * sizeof(int16_t));
+	mem_deref(st->buf);
+	if (st->rxbuf)
+		rt_unlock(st->rxbuf, SOCK_BATCH * sock_inbytes(st->ch));
+	mem_deref(st->rxbuf);
+	mem_deref(st->rs);
+	mem_deref(st->po);
+	mem_deref(st->mix);
+	mem_deref(st->drift);
+	mem_deref(st->ctlq);
+	mem_deref(st->ring);
+	mem_deref(st->ch);
+}
+
+static int src_alloc(struct ausrc_st **stp, const struct ausrc *as,
+		     struct ausrc_prm *prm, const char *device,
+		     ausrc_read_h *rh, ausrc_error_h *errh, void *arg)
+{
+	struct ausrc_st *st;
+	uint32_t nframes;
+	int err;
+	(void)as;
+
+	if (!prm->ptime)
+		return EINVAL;
+
+	st = mem_zalloc(sizeof(*st), src_destructor);
+	if (!st)
+		return ENOMEM;
+
+	err = chan_get(&st->ch, device);
+	if (err)
+		goto out;
+
+	st->rh    = rh;
+	st->errh  = errh;
+	st->arg   = arg;
+	st->srate = prm->srate;
+	st->ptime = prm->ptime;
+	st->sampc = prm->srate * prm->ch * prm->ptime / 1000;
+
+	st->buf = mem_zalloc(st->sampc * sizeof(int16_t), NULL);
+	if (!st->buf) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	rt_lock(st->buf, st->sampc * sizeof(int16_t));
+
+	/* the shm transport brings its own ring */
+	if (st->ch->transport != TRANSPORT_SHM) {
+		nframes = buffer_ms / st->ptime;
+		err = ring_alloc(&st->ring, st->sampc * sizeof(int16_t),
+				 nframes ? nframes : 1);
+		if (err)
+			goto out;
+	}
+
+	if (st->ch->proto == PROTO_FRAMED) {
+		err = ring_alloc(&st->ctlq, sizeof(struct src_ctl),
+				 CTL_QUEUE);
+		if (err)
+			goto out;
+	}
+
+	err = chan_bind(st->ch, st->srate, st->sampc, st->ptime);
+	if (err)
+		goto out;
+
+	/* the client's frame size is known once the channel is bound;
+	   a raw stream stages a whole batch */
+	if (st->ring) {
+		st->rxbuf = mem_zalloc(SOCK_BATCH * sock_inbytes(st->ch), NULL);
+		if (!st->rxbuf) {
+			err = ENOMEM;
+			goto out;
+		}
+
+		rt_lock(st->rxbuf, SOCK_BATCH * sock_inbytes(st->ch));
+	}
+
+	if (st->ring && st->ch->inrate != st->srate) {
+		err = resamp_alloc(&st->rs, st->ch->inrate, st->srate,
+				   st->ch->insampc, st->sampc);
+		if (err)
+			goto out;
+
+		st->rsgen = re_atomic_rlx(&st->ch->gen);
+	}
+
+	if (playout_mode == PLAYOUT_ADAPTIVE) {
+		/* sized like the ring, or the shm ring a client brings */
+		nframes = buffer_ms / st->ptime;
+		err = playout_alloc(&st->po, st->srate, st->sampc, st->ptime,
+				    nframes ? nframes : 1);
+		if (err)
+			goto out;
+
+		st->pogen    = re_atomic_rlx(&st->ch->gen);
+		st->potarget = playout_target(st->po);
+		re_atomic_rlx_set(&st->ch->stats.target, st->potarget);
+	}
+
+	if (clips || phrases || cn_db) {
+		err = mix_alloc(&st->mix, st->srate, st->sampc, st->ptime,
+				cn_db, src_mix_event, st);
+		if (err)
+			goto out;
+
+		mix_sync(st->mix, re_atomic_rlx(&st->ch->gen));
+	}
+
+	if (drift_max) {
+		err = drift_alloc(&st->drift, st->srate, st->sampc,
+				  st->ptime, drift_max);
+		if (err)
+			goto out;
+
+		st->driftgen = re_atomic_rlx(&st->ch->gen);
+	}
+
+	if (!st->ch->src)
+		st->ch->src = st;
+
+	err = sched_add(&st->ent, st->ptime, src_tick, st);
+
+ out:
+	if (err)
+		mem_deref(st);
+	else
+		*stp = st;
+
+	return err;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Injection — agent audio from a second producer (ausock_inject)     */
+/*                                                                     */
+/*  The producer connects to <path>.inject, gets the channel's HELLO   */
+/*  and writes framed messages: AUDIO frames of in_frame_bytes, which  */
+/*  go into the source's ring like the client's, and a MARK after each */
+/*  utterance.  Everything runs in the main loop.                      */
+/* ------------------------------------------------------------------ */
+
+static void inject_handler(int flags, void *arg);
+
+/** Forget the producer; its partial message goes with it */
+static void inject_drop(struct chan *ch)
+{
+	ch->inj.fhs = fd_close(ch->inj.fhs);
+	tmr_cancel(&ch->inj.tmr);
+
+	if (ch->inj.fd >= 0)
+		close(ch->inj.fd);
+
+	ch->inj.fd     = -1;
+	ch->inj.hdroff = 0;
+	ch->inj.off    = 0;
+	ch->inj.open   = false;
+	ch->inj.cut    = false;
+	ch->inj.first  = false;
+}
+
+static void inject_resume(void *arg)
+{
+	struct chan *ch = arg;
+
+	if (fd_listen(&ch->inj.fhs, ch->inj.fd, FD_READ,
+		      inject_handler, ch))
+		inject_drop(ch);
+}
+
+/**
+ * Main loop: queue a MARK behind the first frame of an inject
+ * utterance, so a framed client hears when it reached rh() and can
+ * time its turn to the caller's ear.  seq 0 is never a client's own;
+ * the payload is the producer's ts of the frame.  With the queue full
+ * the utterance just goes untimed.
+ */
+static void inject_mark(struct ausrc_st *st, uint64_t ts)
+{
+	struct src_ctl *c;
+
+	if (!st->ctlq || !(c = ring_write_ptr(st->ctlq)))
+		return;
+
+	memset(c, 0, sizeof(*c));
+	c->target = st->frames_in;
+	c->arg    = ts;
+	c->arglen = sizeof(c->arg);
+	c->seq    = 0;
+	c->gen    = re_atomic_rlx(&st->ch->gen);
+	c->type   = AUSOCK_MSG_MARK;
+
+	ring_write_commit(st->ctlq);
+}
+
+/**
+ * One AUDIO payload, read whole before it is given a ring slot, so a
+ * full ring leaves it in inj.buf rather than half in the socket.
+ */
+static int inject_audio(struct chan *ch)
+{
+	struct ausrc_st *st = ch->src;
+	uint8_t *slot;
+	int err;
+
+	err = sock_read(ch->inj.fd, ch->inj.buf, sock_inbytes(ch),
+			&ch->inj.off);
+	if (err)
+		return err;
+
+	if (!ch->inj.open) {
+		ch->inj.open  = true;
+		ch->inj.first = true;
+	}
+
+	/* cut short by the client, or no source to play it */
+	if (ch->inj.cut || !st || !st->ring) {
+		ch->inj.first = false;
+		re_atomic_rlx_add(&ch->stats.inj_cut, 1);
+		return 0;
+	}
+
+	slot = ring_write_ptr(st->ring);
+	if (!slot)
+		return ENOSPC;
+
+	src_commit(st, slot, ch->inj.buf);
+	re_atomic_rlx_add(&ch->stats.inj_frames, 1);
+
+	if (ch->inj.first) {
+		ch->inj.first = false;
+		inject_mark(st, ch->inj.hdr.ts);
+	}
+
+	return 0;
+}
+
+/** Consume messages until the socket runs dry, like msg_fill() */
+static int inject_fill(struct chan *ch)
+{
+	const struct ausock_msg *hdr = &ch->inj.hdr;
+	const int fd = ch->inj.fd;
+	int err;
+
+	for (;;) {
+		err = sock_read(fd, &ch->inj.hdr, sizeof(ch->inj.hdr),
+				&ch->inj.hdroff);
+		if (err)
+			break;
+
+		if (hdr->type == AUSOCK_MSG_AUDIO) {
+			if (hdr->len != sock_inbytes(ch)) {
+				err = EPROTO;
+				break;
+			}
+
+			err = inject_audio(ch);
+		} else {
+			err = sock_skip(fd, hdr->len, &ch->inj.off);
+
+			/* the end of an utterance, and of any cut */
+			if (!err && hdr->type == AUSOCK_MSG_MARK) {
+				if (ch->inj.open)
+					re_atomic_rlx_add(
+						&ch->stats.inj_utterances, 1);
+				ch->inj.open = false;
+				ch->inj.cut  = false;
+			}
+		}
+
+		if (err)
+			break;
+
+		ch->inj.hdroff = 0;
+		ch->inj.off    = 0;
+	}
+
+	return err == EAGAIN ? 0 : err;
+}
+
+static void inject_handler(int flags, void *arg)
+{
+	struct chan *ch = arg;
+	int err;
+	(void)flags;
+
+	err = inject_fill(ch);
+
+	if (err == ENOSPC) {
+		/* backpressure, exactly as for the client */
+		ch->inj.fhs = fd_close(ch->inj.fhs);
+		tmr_start(&ch->inj.tmr, ch->ptime, inject_resume, ch);
+	} else if (err) {
+		if (err == EPROTO)
+			warning("ausock: %s: protocol error from producer,"
+				" dropping it\n", ch->inj.path);
+		else
+			info("ausock: %s: producer left\n", ch->inj.path);
+		inject_drop(ch);
+	}
+}
+
+static void inject_accept(int flags, void *arg)
+{
+	struct chan *ch = arg;
+	struct {
+		struct ausock_msg   hdr;
+		struct ausock_hello hello;
+	} msg;
+	int fd;
+	(void)flags;
+
+	fd = accept(ch->inj.listen_fd, NULL, NULL);
+	if (fd < 0)
+		return;
+
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+
+#ifdef SO_NOSIGPIPE          /* macOS */
+	{
+		int val = 1;
+		setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &val, sizeof(val));
+	}
+#endif
+
+	/* a restarted producer replaces the old one */
+	if (ch->inj.fd >= 0)
+		inject_drop(ch);
+
+	ch->inj.fd = fd;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.hdr.type = AUSOCK_MSG_HELLO;
+	msg.hdr.len  = sizeof(msg.hello);
+	msg.hdr.ts   = sched_now();
+	hello_fill(ch, &msg.hello);
+
+	/* a fresh socket always has room for it */
+	if (send(fd, &msg, sizeof(msg), MSG_DONTWAIT | MSG_NOSIGNAL) !=
+	    (ssize_t)sizeof(msg) ||
+	    fd_listen(&ch->inj.fhs, fd, FD_READ, inject_handler, ch)) {
+		inject_drop(ch);
+		return;
+	}
+
+	re_atomic_rlx_set(&ch->stats.inj_frames, 0);
+	re_atomic_rlx_set(&ch->stats.inj_utterances, 0);
+	re_atomic_rlx_set(&ch->stats.inj_cut, 0);
+
+	info("ausock: %s: producer connected\n", ch->inj.path);
+}
+
+/**
+ * Main thread, once the channel has its geometry: listen at
+ * <path>.inject.  The call goes on without it if that fails.
+ */
+static void inject_listen(struct chan *ch)
+{
+	int err;
+
+	ch->inj.buf = mem_zalloc(sock_inbytes(ch), NULL);
+	if (!ch->inj.buf) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	if (re_snprintf(ch->inj.path, sizeof(ch->inj.path), "%s.inject",
+			ch->path) < 0) {
+		ch->inj.path[0] = '\0';
+		err = ENAMETOOLONG;
+		goto out;
+	}
+
+	err = listen_unix(ch->inj.path, SOCK_STREAM, &ch->inj.listen_fd);
+	if (err)
+		goto out;
+
+	err = fd_listen(&ch->inj.lfhs, ch->inj.listen_fd, FD_READ,
+			inject_accept, ch);
+
+ out:
+	if (err)
+		warning("ausock: %s: no inject socket (%m)\n", ch->path, err);
+}
+
+static void inject_close(struct chan *ch)
+{
+	inject_drop(ch);
+	ch->inj.lfhs = fd_close(ch->inj.lfhs);
+
+	if (ch->inj.listen_fd >= 0) {
+		close(ch->inj.listen_fd);
+		unlink(ch->inj.path);
+	}
+
+	ch->inj.buf = mem_deref(ch->inj.buf);
+}
+
+/* ------------------------------------------------------------------ */
+/*  auplay — audio player (caller → agent)                            */
+/*                                                                     */
+/*  A scheduler tick pulls one decoded S16LE frame from baresip via    */
+/*  wh() and sends it to the socket without blocking (chan_send()).    */
+/* ------------------------------------------------------------------ */
+
+/** Caller frame out of wh(): take the agent's echo out first */
+static void play_aec(struct auplay_st *st, int16_t *sampv)
+{
+	struct chan *ch = st->ch;
+	const uint32_t gen = re_atomic_rlx(&ch->gen);
+
+	if (!ch->aec)
+		return;
+
+	if (ch->aecgen != gen) {
+		ch->aecgen = gen;
+		aec_reset(ch->aec);
+	}
+
+	aec_near(ch->aec, sampv, st->sampc);
+}
+
+/** A key the scheduler saw, on its way to module_event() */
+struct dtmf_note {
+	char     path[104];
+	char     key;
+};
+
+/** Main loop: the "dtmf" event, "<key>,<channel path>" */
+static void dtmf_handler(int id, void *data, void *arg)
+{
+	struct dtmf_note *note = data;
+	(void)id;
+	(void)arg;
+
+	module_event("ausock", "dtmf", NULL, NULL, "%c,%s",
+		     note->key, note->path);
+	mem_deref(note);
+}
+
+/**
+ * Caller frame after echo cancellation: look for a key.  One that
+ * went down is reported to a framed client at once and handed to the
+ * main loop for the module event; the frames of its tone are muted.
+ */
+static void play_dtmf(struct auplay_st *st, int16_t *sampv, uint64_t ts)
+{
+	struct chan *ch = st->ch;
+	const uint32_t gen = re_atomic_rlx(&ch->gen);
+	struct dtmf_note *note;
+	struct ausock_dtmf ev;
+	int level = VAD_SILENCE_DB;
+	char key;
+
+	if (!st->dtmf)
+		return;
+
+	if (st->dtmfgen != gen) {
+		st->dtmfgen = gen;
+		dtmf_reset(st->dtmf);
+	}
+
+	key = dtmf_frame(st->dtmf, sampv, st->sampc, &level);
+
+	if (dtmf_held(st->dtmf))
+		memset(sampv, 0, st->sampc * sizeof(int16_t));
+
+	if (!key)
+		return;
+
+	re_atomic_rlx_add(&ch->stats.dtmf_keys, 1);
+
+	if (ch->proto == PROTO_FRAMED) {
+		memset(&ev, 0, sizeof(ev));
+		ev.key   = (uint8_t)key;
+		ev.level = (int16_t)level;
+
+		(void)chan_msg(ch, AUSOCK_MSG_DTMF,
+			       re_atomic_rlx(&ch->stats.dtmf_keys), ts,
+			       &ev, sizeof(ev));
+	}
+
+	/* a key is rare enough to allocate for */
+	note = mem_zalloc(sizeof(*note), NULL);
+	if (!note)
+		return;
+
+	strncpy(note->path, ch->path, sizeof(note->path) - 1);
+	note->key = key;
+
+	if (mqueue_push(dtmf_mq, 0, note))
+		mem_deref(note);
+}
+
+/** ausock_tap only: caller audio is the tap consumer's alone */
+static bool chan_tapped(const struct chan *ch)
+{
+	return tap_mode == TAP_ONLY && tap_connected(ch->tap);
+}
+
+/**
+ * shm transport: pull one frame from baresip straight into the next
+ * free up slot (S16LE) or encode it there (u-law).  With no client,
+ * or a client that has stopped draining, the frame is dropped —
+ * caller audio is live and must not queue up.
+ */
+static void play_shm_frame(struct auplay_st *st)
+{
+	struct shm *shm = chan_shm(st->ch);
+	struct ausock_shm *map = shm_map(shm);
+	struct auframe af;
+	uint8_t *slot;
+
+	slot = map ? ausock_shm_write_ptr(map, &map->up) : NULL;
+
+	auframe_init(&af, AUFMT_S16LE,
+		     (slot && !st->txbuf) ? (void *)slot : (void *)st->buf,
+		     st->sampc, st->srate, 1);
+	st->wh(&af, st->arg);
+	chan_record(st->ch, REC_CALLER, st->ent, af.sampv, st->sampc);
+	play_aec(st, af.sampv);
+	play_dtmf(st, af.sampv, sched_now());
+	tap_frame(st->ch->tap, af.sampv, st->sampc);
+
+	/* an uncommitted slot is simply written again next tick */
+	if (slot && !chan_tapped(st->ch)) {
+		if (st->txbuf)
+			pcmu_encode(slot, st->buf, st->sampc);
+
+		ausock_shm_write_commit(&map->up);
+		shm_notify_up(shm);
+	}
+
+	mem_deref(shm);
+}
+
+static void play_count(struct chan *ch, int err)
+{
+	if (!err)
+		re_atomic_rlx_add(&ch->stats.up_frames, 1);
+	else if (err == ENOBUFS)
+		re_atomic_rlx_add(&ch->stats.up_drops, 1);
+}
+
+static void play_audio(struct auplay_st *st, uint32_t seq, uint64_t ts,
+		       uint8_t flags, const uint8_t *frame, size_t nbytes)
+{
+	struct ausock_msg hdr;
+
+	/* the VAD messages still go out, just not the audio */
+	if (chan_tapped(st->ch))
+		return;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.type  = AUSOCK_MSG_AUDIO;
+	hdr.flags = flags;
+	hdr.len   = (uint16_t)nbytes;
+	hdr.seq   = seq;
+	hdr.ts    = ts;
+
+	play_count(st->ch, chan_send(st->ch, &hdr, frame, nbytes));
+}
+
+/** Start VAD state afresh whenever a new client has connected */
+static void vad_sync(struct auplay_st *st)
+{
+	const uint32_t gen = re_atomic_rlx(&st->ch->gen);
+
+	if (st->vadgen == gen)
+		return;
+
+	st->vadgen     = gen;
+	st->speech     = false;
+	st->suppressed = 0;
+	st->cn_us      = 0;
+	st->hold.pos   = 0;
+	st->hold.n     = 0;
+	vad_reset(st->vad);
+}
+
+static void vad_notify(struct auplay_st *st, uint8_t event, uint32_t seq,
+		       uint64_t ts)
+{
+	struct ausock_vad ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.event      = event;
+	ev.dtx        = st->hold.buf != NULL;
+	ev.level      = (int16_t)st->level;
+	ev.suppressed = st->suppressed;
+
+	(void)chan_msg(st->ch, AUSOCK_MSG_VAD, seq, ts, &ev, sizeof(ev));
+}
+
+/** dtx: keep a silent frame back in case it turns out to be onset */
+static void hold_push(struct auplay_st *st, uint32_t seq, uint64_t ts,
+		      const uint8_t *frame, size_t nbytes)
+{
+	const uint32_t i = st->hold.pos;
+
+	if (st->hold.n == VAD_PREROLL)
+		++st->suppressed;   /* the oldest one is never sent */
+	else
+		++st->hold.n;
+
+	memcpy(st->hold.buf + i * nbytes, frame, nbytes);
+	st->hold.seq[i] = seq;
+	st->hold.ts[i]  = ts;
+	st->hold.pos    = (i + 1) % VAD_PREROLL;
+}
+
+/** dtx: send the held frames, oldest first, as a talkspurt starts */
+static void hold_flush(struct auplay_st *st, size_t nbytes)
+{
+	uint32_t i = (st->hold.pos + VAD_PREROLL - st->hold.n) % VAD_PREROLL;
+
+	for (; st->hold.n; --st->hold.n, i = (i + 1) % VAD_PREROLL)
+		play_audio(st, st->hold.seq[i], st->hold.ts[i], 0,
+			   st->hold.buf + i * nbytes, nbytes);
+}
+
+/**
+ * framed: one caller frame as AUDIO.  With ausock_vad it goes
+ * through the energy VAD first (on the S16LE samples in st->buf): talkspurt
+ * edges are announced, and with dtx silent frames are held back and
+ * only the last VAD_PREROLL of them are sent, ahead of the speech.
+ */
+static void play_framed(struct auplay_st *st, const uint8_t *frame,
+			size_t nbytes, uint64_t ts)
+{
+	const uint32_t seq = st->seq++;
+	bool speech;
+
+	if (!st->vad) {
+		play_audio(st, seq, ts, 0, frame, nbytes);
+		return;
+	}
+
+	vad_sync(st);
+	speech = vad_frame(st->vad, st->buf, st->sampc, &st->level);
+
+	if (speech != st->speech) {
+		st->speech = speech;
+		vad_notify(st, speech ? AUSOCK_VAD_START : AUSOCK_VAD_STOP,
+			   seq, ts);
+		if (speech && st->hold.buf)
+			hold_flush(st, nbytes);
+		st->cn_us = ts + VAD_CN_MS * 1000;
+	}
+
+	if (speech || !st->hold.buf) {
+		play_audio(st, seq, ts, speech ? AUSOCK_AUDIO_SPEECH : 0,
+			   frame, nbytes);
+		return;
+	}
+
+	hold_push(st, seq, ts, frame, nbytes);
+
+	if (ts >= st->cn_us) {
+		vad_notify(st, AUSOCK_VAD_SILENCE, seq, ts);
+		st->cn_us = ts + VAD_CN_MS * 1000;
+	}
+}
+
+/** Scheduler: one frame per ptime out of baresip */
+static void play_tick(void *arg)
+{
+	struct auplay_st *st = arg;
+	struct chan *ch = st->ch;
+	const uint8_t *out = (const uint8_t *)st->buf;
+	const size_t nbytes = st->sampc * sock_sampsz(ch);
+	const uint64_t ts = sched_now();
+	struct auframe af;
+
+	metrics_tick(&ch->m.play, st->ent, &st->resyncs, ts);
+
+	if (ch->transport == TRANSPORT_SHM) {
+		play_shm_frame(st);
+		hist_record(ch->m.play.run, (uint32_t)(sched_now() - ts));
+		return;
+	}
+
+	auframe_init(&af, AUFMT_S16LE, st->buf, st->sampc, st->srate, 1);
+
+	/* pull decoded audio from baresip */
+	st->wh(&af, st->arg);
+	chan_record(ch, REC_CALLER, st->ent, st->buf, st->sampc);
+	play_aec(st, st->buf);
+	play_dtmf(st, st->buf, ts);
+	tap_frame(ch->tap, st->buf, st->sampc);
+
+	if (ch->bi.det)
+		bargein_check(ch, st->buf, st->sampc);
+
+	if (st->txbuf) {
+		pcmu_encode(st->txbuf, st->buf, st->sampc);
+		out = st->txbuf;
+	}
+
+	if (ch->proto == PROTO_FRAMED)
+		play_framed(st, out, nbytes, ts);
+	else if (!chan_tapped(ch))
+		play_count(ch, chan_send(ch, NULL, out, nbytes));
+
+	hist_record(ch->m.play.run, (uint32_t)(sched_now() - ts));
+}
+
+static void play_destructor(void *data)
+{
+	struct auplay_st *st = data;
+
+	/* once the entry is gone no tick can touch st */
+	mem_deref(st->ent);
+
+	mem_deref(st->dtmf);
+	mem_deref(st->hold.buf);
+	mem_deref(st->vad);
+	rt_unlock(st->txbuf, st->sampc);
+	mem_deref(st->txbuf);
+	rt_unlock(st->buf, st->sampc * sizeof(int16_t));
+	mem_deref(st->buf);
+	mem_deref(st->ch);
+}
+
+static int play_alloc(struct auplay_st **stp, const struct auplay *ap,
+		      struct auplay_prm *prm, const char *device,
+		      auplay_write_h *wh, void *arg)
+{
+	struct auplay_st *st;
+	int err;
+	(void)ap;
+
+	if (!prm->ptime)
+		return EINVAL;
+
+	st = mem_zalloc(sizeof(*st), play_destructor);
+	if (!st)
+		return ENOMEM;
+
+	err = chan_get(&st->ch, device);
+	if (err)
+		goto out;
+
+	st->wh    = wh;
+	st->arg   = arg;
+	st->srate = prm->srate;
+	st->ptime = prm->ptime;
+	st->sampc = prm->srate * prm->ch * prm->ptime / 1000;
+
+	st->buf = mem_zalloc(st->sampc * sizeof(int16_t), NULL);
+	if (!st->buf) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	rt_lock(st->buf, st->sampc * sizeof(int16_t));
+
+	if (st->ch->fmt == SOCK_FMT_PCMU) {
+		st->txbuf = mem_zalloc(st->sampc, NULL);
+		if (!st->txbuf) {
+			err = ENOMEM;
+			goto out;
+		}
+
+		rt_lock(st->txbuf, st->sampc);
+	}
+
+	if (vad_mode != VAD_NONE) {
+		err = vad_alloc(&st->vad, st->ptime);
+		if (err)
+			goto out;
+	}
+
+	if (vad_mode == VAD_DTX) {
+		st->hold.buf = mem_zalloc(VAD_PREROLL * st->sampc *
+					  sock_sampsz(st->ch), NULL);
+		if (!st->hold.buf) {
+			err = ENOMEM;
+			goto out;
+		}
+	}
+
+	if (dtmf_on) {
+		err = dtmf_alloc(&st->dtmf, st->srate, st->sampc);
+		if (err)
+			goto out;
+	}
+
+	err = chan_bind(st->ch, st->srate, st->sampc, st->ptime);
+	if (err)
+		goto out;
+
+	err = sched_add(&st->ent, st->ptime, play_tick, st);
+
+ out:
+	if (err)
+		mem_deref(st);
+	else
+		*stp = st;
+
+	return err;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Metrics — ausock_stats command and stats events                    */
+/* ------------------------------------------------------------------ */
+
+/** Main loop: a new client starts with fresh numbers */
+static void metrics_reset(struct chan *ch)
+{
+	hist_reset(ch->m.src.late);
+	hist_reset(ch->m.src.run);
+	hist_reset(ch->m.play.late);
+	hist_reset(ch->m.play.run);
+	hist_reset(ch->m.depth);
+
+	re_atomic_rlx_set(&ch->m.src.ticks, 0);
+	re_atomic_rlx_set(&ch->m.src.resyncs, 0);
+	re_atomic_rlx_set(&ch->m.src.missed, 0);
+	re_atomic_rlx_set(&ch->m.play.ticks, 0);
+	re_atomic_rlx_set(&ch->m.play.resyncs, 0);
+	re_atomic_rlx_set(&ch->m.play.missed, 0);
+	re_atomic_rlx_set(&ch->m.silence_idle, 0);
+	re_atomic_rlx_set(&ch->m.silence_dry, 0);
+	re_atomic_rlx_set(&ch->m.txq_max, 0);
+}
+
+/**
+ * Scheduler, at the start of a tick: how late it runs, whether that
+ * missed its deadline, and whether the scheduler had to skip a
+ * deadline of this entry since the last one (seen is the entry's
+ * resync count already accounted for).
+ */
+static void metrics_tick(struct tick_metrics *tm, struct sched_ent *ent,
+			 uint32_t *seen, uint64_t now)
+{
+	const uint64_t due = sched_due(ent);
+	const uint32_t resyncs = sched_resyncs(ent);
+	const uint64_t late = now > due ? now - due : 0;
+
+	hist_record(tm->late, (uint32_t)late);
+	re_atomic_rlx_add(&tm->ticks, 1);
+
+	if (late * TICK_MISS_DIV > sched_period(ent))
+		re_atomic_rlx_add(&tm->missed, 1);
+
+	if (resyncs != *seen) {
+		re_atomic_rlx_add(&tm->resyncs, resyncs - *seen);
+		*seen = resyncs;
+	}
+}
+
+static int tick_print(struct re_printf *pf, const struct tick_metrics *tm)
+{
+	int err;
+
+	err  = re_hprintf(pf, "\"ticks\":%u,\"resyncs\":%u,\"missed\":%u,"
+			  "\"late_us\":",
+			  re_atomic_rlx(&tm->ticks),
+			  re_atomic_rlx(&tm->resyncs),
+			  re_atomic_rlx(&tm->missed));
+	err |= hist_print(pf, tm->late);
+	err |= re_hprintf(pf, ",\"run_us\":");
+	err |= hist_print(pf, tm->run);
+
+	return err;
+}
+
+static int chan_print(struct re_printf *pf, struct chan *ch)
+{
+	int err;
+
+	err  = re_hprintf(pf, "{\"path\":\"%s\",\"connected\":%s,"
+			  "\"ptime\":%u,\"src\":{",
+			  ch->path,
+			  re_atomic_rlx(&ch->connected) ? "true" : "false",
+			  ch->ptime);
+	err |= tick_print(pf, &ch->m.src);
+	err |= re_hprintf(pf, ",\"depth\":");
+	err |= hist_print(pf, ch->m.depth);
+	err |= re_hprintf(pf, ",\"frames\":%u,\"silence_idle\":%u,"
+			  "\"silence_dry\":%u,\"underruns\":%u,"
+			  "\"concealed\":%u,\"target\":%u,\"drift_ppm\":%d,"
+			  "\"inject\":{\"frames\":%u,\"utterances\":%u,"
+			  "\"cut\":%u}},\"play\":{",
+			  re_atomic_rlx(&ch->stats.down_frames),
+			  re_atomic_rlx(&ch->m.silence_idle),
+			  re_atomic_rlx(&ch->m.silence_dry),
+			  re_atomic_rlx(&ch->stats.underruns),
+			  re_atomic_rlx(&ch->stats.concealed),
+			  re_atomic_rlx(&ch->stats.target),
+			  re_atomic_rlx(&ch->stats.drift),
+			  re_atomic_rlx(&ch->stats.inj_frames),
+			  re_atomic_rlx(&ch->stats.inj_utterances),
+			  re_atomic_rlx(&ch->stats.inj_cut));
+	err |= tick_print(pf, &ch->m.play);
+	err |= re_hprintf(pf, ",\"frames\":%u,\"drops\":%u,"
+			  "\"txq_max\":%u,\"tap\":{\"connected\":%s,"
+			  "\"frames\":%u,\"drops\":%u},\"dtmf\":%u}}",
+			  re_atomic_rlx(&ch->stats.up_frames),
+			  re_atomic_rlx(&ch->stats.up_drops),
+			  re_atomic_rlx(&ch->m.txq_max),
+			  tap_connected(ch->tap) ? "true" : "false",
+			  tap_frames(ch->tap), tap_drops(ch->tap),
+			  re_atomic_rlx(&ch->stats.dtmf_keys));
+
+	return err;
+}
+
+/** {"rt":{...},"channels":[...]}, one object per open channel */
+static int stats_print(struct re_printf *pf, void *arg)
+{
+	struct le *le;
+	int err;
+	(void)arg;
+
+	err  = re_hprintf(pf, "{");
+	err |= rt_print(pf);
+	err |= re_hprintf(pf, ",\"channels\":[");
+
+	mtx_lock(&chanl_mtx);
+	LIST_FOREACH(&chanl, le) {
+		if (le != list_head(&chanl))
+			err |= re_hprintf(pf, ",");
+		err |= chan_print(pf, le->data);
+	}
+	mtx_unlock(&chanl_mtx);
+
+	err |= re_hprintf(pf, "]}");
+
+	return err;
+}
+
+static int cmd_stats(struct re_printf *pf, void *arg)
+{
+	return stats_print(pf, arg);
+}
+
+static void stats_timeout(void *arg)
+{
+	(void)arg;
+
+	tmr_start(&stats_tmr, stats_interval * 1000, stats_timeout, NULL);
+	module_event("ausock", "stats", NULL, NULL, "%H", stats_print, NULL);
+}
+
+static const struct cmd cmdv[] = {
+	{"ausock_stats", 0, 0, "ausock counters and latency (JSON)",
+	 cmd_stats},
+};
+
+/* ------------------------------------------------------------------ */
+/*  Module entry points                                                */
+/* ------------------------------------------------------------------ */
+
+static int module_close(void);
+
+static int module_init(void)
+{
+	char fmt[16] = "s16le";
+	char tp[16]  = "stream";
+	char proto[16] = "raw";
+	char vad[16]   = "none";
+	char playout[16] = "fixed";
+	char tap[16]     = "off";
+	char inj[16]     = "no";
+	char dtmf[16]    = "no";
+	char rt[16]      = "off";
+	char cpus[64]    = "";
+	char mlock[16]   = "no";
+	char clip_dir[256] = "";
+	char phrase_file[256] = "";
+	const char *path;
+	int err;
+
+	path = getenv("AUSOCK_PATH");
+	if (!path || !*path)
+		path = DEFAULT_PATH;
+
+	strncpy(def_path, path, sizeof(def_path) - 1);
+
+	buffer_ms = conf_u32("ausock_buffer", "AUSOCK_BUFFER_MS",
+			     DEFAULT_BUFFER_MS);
+
+	conf_str("ausock_format", "AUSOCK_FORMAT", fmt, sizeof(fmt));
+	if (0 == strcmp(fmt, "pcmu")) {
+		sock_fmt = SOCK_FMT_PCMU;
+	} else if (0 != strcmp(fmt, "s16le")) {
+		warning("ausock: unknown ausock_format '%s'\n", fmt);
+		return EINVAL;
+	}
+
+	conf_str("ausock_transport", "AUSOCK_TRANSPORT", tp, sizeof(tp));
+	if (0 == strcmp(tp, "shm")) {
+		transport = TRANSPORT_SHM;
+	} else if (0 == strcmp(tp, "seqpacket")) {
+		transport = TRANSPORT_SEQPACKET;
+	} else if (0 != strcmp(tp, "stream")) {
+		warning("ausock: unknown ausock_transport '%s'\n", tp);
+		return EINVAL;
+	}
+
+	conf_str("ausock_protocol", "AUSOCK_PROTOCOL", proto, sizeof(proto));
+	if (0 == strcmp(proto, "framed")) {
+		protocol = PROTO_FRAMED;
+	} else if (0 != strcmp(proto, "raw")) {
+		warning("ausock: unknown ausock_protocol '%s'\n", proto);
+		return EINVAL;
+	}
+
+	bargein_ms = conf_u32("ausock_bargein", "AUSOCK_BARGEIN_MS", 0);
+	if (bargein_ms && protocol != PROTO_FRAMED) {
+		warning("ausock: ausock_bargein needs ausock_protocol framed,"
+			" barge-in detection is off\n");
+		bargein_ms = 0;
+	}
+
+	conf_str("ausock_vad", "AUSOCK_VAD", vad, sizeof(vad));
+	if (0 == strcmp(vad, "tag")) {
+		vad_mode = VAD_TAG;
+	} else if (0 == strcmp(vad, "dtx")) {
+		vad_mode = VAD_DTX;
+	} else if (0 != strcmp(vad, "none")) {
+		warning("ausock: unknown ausock_vad '%s'\n", vad);
+		return EINVAL;
+	}
+	if (vad_mode != VAD_NONE && protocol != PROTO_FRAMED) {
+		warning("ausock: ausock_vad needs ausock_protocol framed,"
+			" the energy VAD is off\n");
+		vad_mode = VAD_NONE;
+	}
+
+	aec_ms = conf_u32("ausock_aec", "AUSOCK_AEC_MS", 0);
+
+	conf_str("ausock_playout", "AUSOCK_PLAYOUT", playout,
+		 sizeof(playout));
+	if (0 == strcmp(playout, "adaptive")) {
+		playout_mode = PLAYOUT_ADAPTIVE;
+	} else if (0 != strcmp(playout, "fixed")) {
+		warning("ausock: unknown ausock_playout '%s'\n", playout);
+		return EINVAL;
+	}
+
+	inrate = conf_u32("ausock_inrate", "AUSOCK_INRATE", 0);
+	if (inrate && (sock_fmt != SOCK_FMT_S16LE ||
+		       transport == TRANSPORT_SHM)) {
+		warning("ausock: ausock_inrate needs ausock_format s16le"
+			" and a socket transport (stream or seqpacket)\n");
+		return EINVAL;
+	}
+
+	if (protocol == PROTO_FRAMED && transport == TRANSPORT_SHM) {
+		warning("ausock: ausock_protocol framed needs"
+			" ausock_transport stream or seqpacket\n");
+		return EINVAL;
+	}
+
+	stats_interval = conf_u32("ausock_stats_interval",
+				  "AUSOCK_STATS_INTERVAL", 0);
+
+	conf_str("ausock_record", "AUSOCK_RECORD", rec_dir, sizeof(rec_dir));
+
+	cn_db = conf_u32("ausock_comfort_noise", "AUSOCK_COMFORT_NOISE", 0);
+
+	drift_max = conf_u32("ausock_drift", "AUSOCK_DRIFT", 0);
+	if (drift_max > 10000) {
+		warning("ausock: ausock_drift %u ppm is over 1 %%\n",
+			drift_max);
+		return EINVAL;
+	}
+
+	conf_str("ausock_tap", "AUSOCK_TAP", tap, sizeof(tap));
+	if (0 == strcmp(tap, "copy")) {
+		tap_mode = TAP_COPY;
+	} else if (0 == strcmp(tap, "only")) {
+		tap_mode = TAP_ONLY;
+	} else if (0 != strcmp(tap, "off")) {
+		warning("ausock: unknown ausock_tap '%s'\n", tap);
+		return EINVAL;
+	}
+
+	conf_str("ausock_inject", "AUSOCK_INJECT", inj, sizeof(inj));
+	if (0 == strcmp(inj, "yes")) {
+		inject = true;
+	} else if (0 != strcmp(inj, "no")) {
+		warning("ausock: unknown ausock_inject '%s'\n", inj);
+		return EINVAL;
+	}
+	if (inject && (sock_fmt != SOCK_FMT_S16LE ||
+		       transport == TRANSPORT_SHM)) {
+		warning("ausock: ausock_inject needs ausock_format s16le"
+			" and a socket transport, no inject socket\n");
+		inject = false;
+	}
+
+	conf_str("ausock_dtmf", "AUSOCK_DTMF", dtmf, sizeof(dtmf));
+	if (0 == strcmp(dtmf, "yes")) {
+		dtmf_on = true;
+	} else if (0 != strcmp(dtmf, "no")) {
+		warning("ausock: unknown ausock_dtmf '%s'\n", dtmf);
+		return EINVAL;
+	}
+
+	conf_str("ausock_rt", "AUSOCK_RT", rt, sizeof(rt));
+	conf_str("ausock_cpus", "AUSOCK_CPUS", cpus, sizeof(cpus));
+	conf_str("ausock_mlock", "AUSOCK_MLOCK", mlock, sizeof(mlock));
+	if (0 != strcmp(mlock, "yes") && 0 != strcmp(mlock, "no")) {
+		warning("ausock: unknown ausock_mlock '%s'\n", mlock);
+		return EINVAL;
+	}
+
+	/* before anything that allocates frame buffers */
+	err = rt_init(rt, conf_u32("ausock_rt_prio", "AUSOCK_RT_PRIO",
+				   DEFAULT_RT_PRIO),
+		      cpus, 0 == strcmp(mlock, "yes"));
+	if (err)
+		return err;
+
+	conf_str("ausock_clips", "AUSOCK_CLIPS", clip_dir, sizeof(clip_dir));
+
+	conf_str("ausock_phrases", "AUSOCK_PHRASES", phrase_file,
+		 sizeof(phrase_file));
+
+	signal(SIGPIPE, SIG_IGN);
+
+	list_init(&chanl);
+
+	if (mtx_init(&chanl_mtx, mtx_plain) != thrd_success)
+		return ENOMEM;
+
+	/* from here on a failure undoes it all through module_close() */
+	tmr_init(&stats_tmr);
+
+	if (dtmf_on) {
+		err = mqueue_alloc(&dtmf_mq, dtmf_handler, NULL);
+		if (err)
+			goto out;
+	}
+
+	if (clip_dir[0]) {
+		err = clips_load(&clips, clip_dir);
+		if (err) {
+			warning("ausock: no clips loaded from %s (%m)\n",
+				clip_dir, err);
+			err = 0;  /* the module runs without them */
+		}
+		else {
+			info("ausock: %u clips loaded from %s\n",
+			     clips_count(clips), clip_dir);
+		}
+
+		if (clips && protocol != PROTO_FRAMED)
+			warning("ausock: ausock_clips needs ausock_protocol"
+				" framed to be played\n");
+	}
+
+	if (phrase_file[0]) {
+		err = phrases_alloc(&phrases, phrase_file);
+		if (err)
+			goto out;
+
+		if (protocol != PROTO_FRAMED)
+			warning("ausock: ausock_phrases needs ausock_protocol"
+				" framed to be played\n");
+	}
+
+	err = sched_init();
+	if (err)
+		goto out;
+
+	err = chan_get(&def_chan, def_path);
+	if (err)
+		goto out;
+
+	err = ausrc_register(&mod_ausrc, baresip_ausrcl(),
+			     "ausock", src_alloc);
+	if (err)
+		goto out;
+
+	err = auplay_register(&mod_auplay, baresip_auplayl(),
+			      "ausock", play_alloc);
+	if (err)
+		goto out;
+
+	err = cmd_register(baresip_commands(), cmdv, RE_ARRAY_SIZE(cmdv));
+	if (err)
+		goto out;
+	cmds_on = true;
+
+	if (stats_interval)
+		tmr_start(&stats_tmr, stats_interval * 1000, stats_timeout,
+			  NULL);
+
+ out:
+	if (err)
+		module_close();
+
+	return err;
+}
+
+/** Also undoes a module_init() that failed part-way */
+static int module_close(void)
+{
+	tmr_cancel(&stats_tmr);
+	if (cmds_on)
+		cmd_unregister(baresip_commands(), cmdv);
+	cmds_on = false;
+
+	mod_ausrc  = mem_deref(mod_ausrc);
+	mod_auplay = mem_deref(mod_auplay);
+
+	def_chan = mem_deref(def_chan);
+	clips    = mem_deref(clips);
+	phrases  = mem_deref(phrases);
+	dtmf_mq  = mem_deref(dtmf_mq);
 
-	mtx_destroy(&sock_mtx);
+	sched_close();
+	mtx_destroy(&chanl_mtx);
 
 	return 0;
 }
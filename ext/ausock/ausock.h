@@ -0,0 +1,269 @@
+/**
+ * ausock.h — internal interfaces shared by the ausock module sources
+ */
+
+/* ------------------------------------------------------------------ */
+/*  ring.c — lock-free single-producer/single-consumer frame ring      */
+/* ------------------------------------------------------------------ */
+
+struct ring;
+
+int         ring_alloc(struct ring **rp, size_t frame_bytes,
+		       uint32_t nframes);
+void       *ring_write_ptr(struct ring *r);
+uint32_t    ring_write_ptrs(struct ring *r, void **slotv, uint32_t max);
+void        ring_write_commit(struct ring *r);
+const void *ring_read_ptr(struct ring *r);
+void        ring_read_commit(struct ring *r);
+uint32_t    ring_count(struct ring *r);
+uint32_t    ring_capacity(const struct ring *r);
+
+
+/* ------------------------------------------------------------------ */
+/*  shm.c — shared-memory double ring (ausock_transport shm)           */
+/* ------------------------------------------------------------------ */
+
+struct shm;
+struct ausock_shm;
+
+int                shm_alloc(struct shm **shmp, uint32_t srate,
+			     size_t frame_bytes, uint32_t nframes);
+int                shm_send(const struct shm *shm, int sock);
+struct ausock_shm *shm_map(const struct shm *shm);
+void               shm_notify_up(struct shm *shm);
+void               shm_notify_down(struct shm *shm);
+
+
+/* ------------------------------------------------------------------ */
+/*  sched.c — shared real-time tick for all sources and players        */
+/* ------------------------------------------------------------------ */
+
+struct sched_ent;
+
+typedef void (sched_h)(void *arg);
+
+int  sched_init(void);
+void sched_close(void);
+int  sched_add(struct sched_ent **entp, uint32_t ptime, sched_h *h,
+	       void *arg);
+uint64_t sched_now(void);
+uint64_t sched_due(const struct sched_ent *e);
+uint64_t sched_period(const struct sched_ent *e);
+uint32_t sched_resyncs(struct sched_ent *e);
+
+
+/* ------------------------------------------------------------------ */
+/*  rt.c — real-time policy, CPU pinning and mlock for the tick thread */
+/* ------------------------------------------------------------------ */
+
+int  rt_init(const char *policy, uint32_t prio, const char *cpus,
+	     bool lock);
+void rt_thread(void);
+void rt_thread_exit(void);
+void rt_lock(const void *p, size_t len);
+void rt_unlock(const void *p, size_t len);
+int  rt_print(struct re_printf *pf);
+
+
+/* ------------------------------------------------------------------ */
+/*  bargein.c — caller-over-agent speech detector (ausock_bargein)     */
+/* ------------------------------------------------------------------ */
+
+struct bargein;
+
+int  bargein_alloc(struct bargein **bip, uint32_t ptime,
+		   uint32_t speech_ms);
+void bargein_reset(struct bargein *bi);
+void bargein_far(struct bargein *bi, const int16_t *sampv, size_t sampc);
+bool bargein_near(struct bargein *bi, const int16_t *sampv, size_t sampc,
+		  int *levelp);
+void bargein_fade(int16_t *sampv, size_t sampc);
+
+
+/* ------------------------------------------------------------------ */
+/*  vad.c — caller energy VAD (ausock_vad)                             */
+/* ------------------------------------------------------------------ */
+
+#define VAD_SILENCE_DB -96   /* vad_level() of digital silence */
+
+struct vad;
+
+int  vad_alloc(struct vad **vadp, uint32_t ptime);
+void vad_reset(struct vad *vad);
+bool vad_frame(struct vad *vad, const int16_t *sampv, size_t sampc,
+	       int *levelp);
+int  vad_level(const int16_t *sampv, size_t sampc);
+
+
+/* ------------------------------------------------------------------ */
+/*  aec.c — echo canceller on the caller leg (ausock_aec)              */
+/* ------------------------------------------------------------------ */
+
+struct aec;
+
+int  aec_alloc(struct aec **aecp, uint32_t srate, uint32_t sampc,
+	       uint32_t tail_ms);
+void aec_reset(struct aec *aec);
+void aec_far(struct aec *aec, const int16_t *sampv, size_t sampc);
+void aec_near(struct aec *aec, int16_t *sampv, size_t sampc);
+
+
+/* ------------------------------------------------------------------ */
+/*  resamp.c — polyphase resampler for agent audio (ausock_inrate)     */
+/* ------------------------------------------------------------------ */
+
+struct resamp;
+
+int  resamp_alloc(struct resamp **rsp, uint32_t inrate, uint32_t outrate,
+		  uint32_t insampc, uint32_t outsampc);
+void resamp_reset(struct resamp *rs);
+void resamp_frame(struct resamp *rs, int16_t *dst, const int16_t *src);
+
+
+/* ------------------------------------------------------------------ */
+/*  playout.c — adaptive playout and concealment (ausock_playout)      */
+/* ------------------------------------------------------------------ */
+
+struct playout;
+
+int      playout_alloc(struct playout **pop, uint32_t srate,
+		       uint32_t sampc, uint32_t ptime, uint32_t max_frames);
+void     playout_reset(struct playout *po);
+uint32_t playout_target(const struct playout *po);
+void     playout_stop(struct playout *po);
+bool     playout_ready(struct playout *po, uint32_t depth);
+bool     playout_drop(struct playout *po, const int16_t *sampv,
+		      uint32_t depth);
+void     playout_played(struct playout *po, int16_t *sampv);
+bool     playout_conceal(struct playout *po, int16_t *sampv);
+
+
+/* ------------------------------------------------------------------ */
+/*  hist.c — lock-free latency histograms (ausock_stats)               */
+/* ------------------------------------------------------------------ */
+
+struct hist;
+struct re_printf;
+
+int      hist_alloc(struct hist **hp);
+void     hist_reset(struct hist *h);
+void     hist_record(struct hist *h, uint32_t v);
+uint32_t hist_quantile(const struct hist *h, double q);
+uint64_t hist_count(const struct hist *h);
+int      hist_print(struct re_printf *pf, const struct hist *h);
+
+
+/* ------------------------------------------------------------------ */
+/*  rec.c — two-leg call recorder to stereo WAV (ausock_record)        */
+/* ------------------------------------------------------------------ */
+
+enum rec_leg {
+	REC_CALLER = 0,   /* left channel */
+	REC_AGENT  = 1,   /* right channel */
+};
+
+struct rec;
+
+int      rec_alloc(struct rec **recp, const char *path, uint32_t srate,
+		   uint32_t sampc, uint32_t ptime);
+void     rec_frame(struct rec *rec, enum rec_leg leg, uint64_t ts,
+		   const int16_t *sampv, size_t sampc);
+int      rec_close(struct rec *rec);
+double   rec_seconds(const struct rec *rec);
+uint32_t rec_lost(const struct rec *rec);
+
+
+/* ------------------------------------------------------------------ */
+/*  mix.c — clips, ducking and comfort noise over agent audio          */
+/* ------------------------------------------------------------------ */
+
+struct clips;
+struct clip_pcm;
+struct mix;
+
+/** A CLIP request on its way from the main loop to the tick */
+struct mix_play {
+	struct clip_pcm *pcm;   /* NULL: stop the voice */
+	uint32_t seq;
+	uint32_t gen;           /* client it came from */
+	uint8_t  voice;
+	uint8_t  flags;         /* AUSOCK_CLIP_* */
+	int8_t   gain_db;
+	uint8_t  duck_db;
+};
+
+typedef void (mix_event_h)(uint8_t voice, uint32_t seq, uint8_t event,
+			   void *arg);
+
+int      clips_load(struct clips **clp, const char *dir);
+uint32_t clips_count(const struct clips *cl);
+int      clips_get(struct clips *cl, struct clip_pcm **pcmp,
+		   const char *name, uint32_t srate);
+struct clip_pcm *clip_pcm_map(uint32_t srate, const int16_t *sampv,
+			      size_t n, void *owner);
+int      mix_alloc(struct mix **mixp, uint32_t srate, uint32_t sampc,
+		   uint32_t ptime, uint32_t cn_db, mix_event_h *eh,
+		   void *arg);
+int      mix_play(struct mix *mix, const struct mix_play *p);
+void     mix_sync(struct mix *mix, uint32_t gen);
+void     mix_interrupt(struct mix *mix);
+bool     mix_frame(struct mix *mix, int16_t *sampv, bool agent);
+
+
+/* ------------------------------------------------------------------ */
+/*  phrase.c — pre-rendered phrases from a memory-mapped file          */
+/* ------------------------------------------------------------------ */
+
+struct phrases;
+
+int      phrases_alloc(struct phrases **php, const char *path);
+uint32_t phrases_count(const struct phrases *ph);
+int      phrases_get(struct phrases *ph, struct clip_pcm **pcmp,
+		     const char *name, uint32_t srate);
+
+
+/* ------------------------------------------------------------------ */
+/*  drift.c — clock-drift compensation for agent audio                 */
+/* ------------------------------------------------------------------ */
+
+struct drift;
+
+/** Next whole agent frame into sampv; false if there is none */
+typedef bool (drift_pull_h)(int16_t *sampv, void *arg);
+
+int      drift_alloc(struct drift **dp, uint32_t srate, uint32_t sampc,
+		     uint32_t ptime, uint32_t max_ppm);
+void     drift_flush(struct drift *d);
+void     drift_reset(struct drift *d);
+uint32_t drift_held(const struct drift *d);
+int32_t  drift_ppm(const struct drift *d);
+bool     drift_frame(struct drift *d, int16_t *out, drift_pull_h *pull,
+		     void *arg);
+void     drift_update(struct drift *d, uint32_t depth, uint32_t target,
+		      bool got);
+
+
+/* ------------------------------------------------------------------ */
+/*  tap.c — raw caller audio to a second consumer (ausock_tap)         */
+/* ------------------------------------------------------------------ */
+
+struct tap;
+
+int      tap_alloc(struct tap **tapp, const char *path);
+bool     tap_connected(const struct tap *tap);
+void     tap_frame(struct tap *tap, const int16_t *sampv, size_t sampc);
+uint32_t tap_frames(const struct tap *tap);
+uint32_t tap_drops(const struct tap *tap);
+
+
+/* ------------------------------------------------------------------ */
+/*  dtmf.c — in-band DTMF detection on the caller leg (ausock_dtmf)    */
+/* ------------------------------------------------------------------ */
+
+struct dtmf;
+
+int  dtmf_alloc(struct dtmf **dp, uint32_t srate, uint32_t sampc);
+void dtmf_reset(struct dtmf *d);
+char dtmf_frame(struct dtmf *d, const int16_t *sampv, size_t sampc,
+		int *levelp);
+bool dtmf_held(const struct dtmf *d);
@@ -0,0 +1,242 @@
+/**
+ * ausock_proto.h — framed socket protocol (ausock_protocol framed)
+ *
+ * With the default raw protocol the socket is an unframed byte stream
+ * of audio.  With ausock_protocol framed every message on the socket,
+ * in both directions, is a 16-byte header followed by len payload
+ * bytes.  All fields are in host byte order (little-endian on every
+ * platform ausock runs on); timestamps are CLOCK_MONOTONIC in
+ * microseconds, the clock both processes on the box share.
+ *
+ *   HELLO    ausock → client, first message after accept; payload is
+ *            struct ausock_hello.  A client may send one back to
+ *            assert the geometry it expects; a mismatch drops it.
+ *   AUDIO    one whole frame in the socket format, anything else is a
+ *            protocol error.  ausock → client: len = frame_bytes, seq
+ *            counts caller frames, ts is when wh() produced it.
+ *            client → ausock: len = in_frame_bytes (agent audio at
+ *            in_srate, which differs from srate with ausock_inrate);
+ *            seq and ts are the client's own.
+ *   FLUSH    client → ausock: discard the agent audio queued before
+ *            it.  Echoed with the client's seq once applied; payload
+ *            is the uint32_t number of frames dropped.
+ *   MARK     client → ausock: payload is an optional uint64_t of the
+ *            client's choosing (typically its send time).  Echoed with
+ *            the same seq and payload once the last frame queued
+ *            before it has been handed to baresip; ts is that moment.
+ *   STATS    client → ausock with no payload; answered with a STATS
+ *            carrying struct ausock_stats.
+ *   UNDERRUN ausock → client each time agent audio runs dry while it
+ *            was playing; seq counts underruns.
+ *   BARGEIN  ausock → client when the caller starts talking over agent
+ *            audio (ausock_bargein); payload is struct ausock_bargein.
+ *            ausock has already faded out and dropped the queued agent
+ *            audio, and keeps dropping whatever arrives until the
+ *            client's next FLUSH, which marks where new audio starts.
+ *   VAD      ausock → client with ausock_vad (an energy VAD, not a
+ *            speech classifier): payload is struct
+ *            ausock_vad.  START and STOP bracket each caller
+ *            talkspurt; caller AUDIO inside one carries
+ *            AUSOCK_AUDIO_SPEECH.  With ausock_vad dtx, AUDIO outside
+ *            talkspurts is not sent at all.  A START is followed by
+ *            the few frames held back before it, so the onset of
+ *            speech is never lost.  During silence a SILENCE notice
+ *            (comfort noise marker) goes out once a second.  seq
+ *            numbers keep counting every caller frame, so a gap in
+ *            them is suppressed silence.
+ *   PLAYOUT  ausock → client with ausock_playout adaptive, each time
+ *            the playout target changes; seq is the new target in
+ *            frames, payload is struct ausock_playout.  Agent audio
+ *            kept that far ahead of rh() plays without gaps.
+ *   CLIP     client → ausock: start a clip loaded from ausock_clips
+ *            on one of AUSOCK_CLIP_VOICES voices, mixed over the agent
+ *            audio, or stop the voice (empty name); payload is struct
+ *            ausock_clip.  A clip replaces whatever the voice played.
+ *            ausock → client when a voice ends, with the seq of the
+ *            CLIP that started it; event says why.  A clip that is
+ *            not loaded is answered at once with AUSOCK_CLIP_UNKNOWN.
+ *   DTMF     ausock → client with ausock_dtmf, once per key the caller
+ *            presses, as it goes down; seq counts keys, ts is when
+ *            wh() produced the frame that completed it, payload is
+ *            struct ausock_dtmf.
+ *
+ * With ausock_transport seqpacket every message is exactly one
+ * packet, so the header and payload must go out in one send.
+ *
+ * The inject socket (<path>.inject, ausock_inject) speaks the same
+ * messages over a stream, whatever the main socket uses.  ausock
+ * sends HELLO on accept; the producer sends AUDIO exactly as a client
+ * would, and a MARK after each utterance.  Such a MARK is not echoed:
+ * it only ends the stretch of audio a client FLUSH may cut short.
+ * Everything else from the producer is skipped.  Instead, once the
+ * first frame of each utterance has been handed to baresip, a framed
+ * client gets a MARK with seq 0, which none of its own marks has,
+ * carrying the producer's ts of that frame.
+ *
+ * Control messages are handled in stream order, so a FLUSH or MARK
+ * always refers to exactly the AUDIO frames written before it.
+ * Unknown types are skipped, so newer clients can talk to older
+ * modules.  Payloads of control messages are at most AUSOCK_CTL_MAX
+ * bytes.
+ *
+ * This header is free of libre so the Ruby side can mirror it.
+ */
+
+#include <stdint.h>
+
+#define AUSOCK_PROTO_MAGIC    0x4b535541u   /* "AUSK" little-endian */
+#define AUSOCK_PROTO_VERSION  2u
+#define AUSOCK_CTL_MAX        64
+
+enum ausock_msg_type {
+	AUSOCK_MSG_HELLO    = 1,
+	AUSOCK_MSG_AUDIO    = 2,
+	AUSOCK_MSG_FLUSH    = 3,
+	AUSOCK_MSG_MARK     = 4,
+	AUSOCK_MSG_STATS    = 5,
+	AUSOCK_MSG_UNDERRUN = 6,
+	AUSOCK_MSG_BARGEIN  = 7,
+	AUSOCK_MSG_VAD      = 8,
+	AUSOCK_MSG_PLAYOUT  = 9,
+	AUSOCK_MSG_CLIP     = 10,
+	AUSOCK_MSG_DTMF     = 11,
+};
+
+/** ausock_msg flags of caller AUDIO */
+enum {
+	AUSOCK_AUDIO_SPEECH = 1 << 0,   /* inside an energy talkspurt (ausock_vad) */
+};
+
+enum ausock_vad_event {
+	AUSOCK_VAD_STOP    = 0,
+	AUSOCK_VAD_START   = 1,
+	AUSOCK_VAD_SILENCE = 2,   /* still silent; dtx comfort noise */
+};
+
+#define AUSOCK_CLIP_VOICES 4
+#define AUSOCK_CLIP_NAME   24   /* name bytes, NUL included */
+
+/** ausock_clip flags */
+enum {
+	AUSOCK_CLIP_LOOP = 1 << 0,   /* repeat until stopped */
+	AUSOCK_CLIP_DUCK = 1 << 1,   /* drop by duck_db while the agent talks */
+	AUSOCK_CLIP_OVER = 1 << 2,   /* drop the agent by duck_db meanwhile */
+	AUSOCK_CLIP_KEEP = 1 << 3,   /* keep playing through a barge-in */
+};
+
+enum ausock_clip_event {
+	AUSOCK_CLIP_DONE    = 0,   /* played to the end */
+	AUSOCK_CLIP_STOPPED = 1,   /* stopped or replaced by the client */
+	AUSOCK_CLIP_BARGEIN = 2,   /* cut off by a barge-in */
+	AUSOCK_CLIP_UNKNOWN = 3,   /* no such clip loaded */
+};
+
+/** Socket sample formats as carried in HELLO */
+enum ausock_proto_fmt {
+	AUSOCK_FMT_S16LE = 0,
+	AUSOCK_FMT_PCMU  = 1,
+};
+
+/** Header preceding every message */
+struct ausock_msg {
+	uint8_t  type;          /* enum ausock_msg_type */
+	uint8_t  flags;         /* AUSOCK_AUDIO_* on AUDIO, else 0 */
+	uint16_t len;           /* payload bytes that follow */
+	uint32_t seq;
+	uint64_t ts;            /* CLOCK_MONOTONIC, us */
+};
+
+struct ausock_hello {
+	uint32_t magic;         /* AUSOCK_PROTO_MAGIC */
+	uint16_t version;       /* AUSOCK_PROTO_VERSION */
+	uint8_t  fmt;           /* enum ausock_proto_fmt */
+	uint8_t  ch;            /* channels */
+	uint32_t srate;
+	uint16_t ptime;         /* ms per frame */
+	uint16_t frame_bytes;   /* caller AUDIO payload size */
+	uint32_t in_srate;      /* agent AUDIO rate (ausock_inrate) */
+	uint16_t in_frame_bytes;/* agent AUDIO payload size */
+	uint16_t reserved;
+};
+
+struct ausock_stats {
+	uint32_t up_frames;     /* caller frames sent to the client */
+	uint32_t up_drops;      /* caller frames dropped, client not reading */
+	uint32_t down_frames;   /* agent frames handed to baresip */
+	uint32_t underruns;
+	uint32_t queued;        /* agent frames waiting to play */
+	uint32_t capacity;      /* agent frames the queue can hold */
+	uint32_t target;        /* playout target, frames (0: fixed) */
+	uint32_t concealed;     /* agent frames concealed (adaptive) */
+};
+
+struct ausock_bargein {
+	int16_t  level;         /* caller level that triggered it, dBFS */
+	uint16_t speech_ms;     /* caller speech detected before it fired */
+};
+
+struct ausock_vad {
+	uint8_t  event;         /* enum ausock_vad_event */
+	uint8_t  dtx;           /* 1: silent frames are not being sent */
+	int16_t  level;         /* caller level, dBFS */
+	uint32_t suppressed;    /* caller frames not sent so far (dtx) */
+};
+
+struct ausock_playout {
+	uint16_t target_ms;     /* agent audio to keep queued */
+	uint16_t depth_ms;      /* agent audio queued right now */
+	uint32_t concealed;     /* agent frames concealed so far */
+};
+
+struct ausock_clip {
+	uint8_t  voice;         /* < AUSOCK_CLIP_VOICES */
+	uint8_t  flags;         /* AUSOCK_CLIP_* */
+	int8_t   gain_db;       /* level of the clip */
+	uint8_t  duck_db;       /* attenuation while ducking (DUCK, OVER) */
+	uint8_t  event;         /* ausock → client: enum ausock_clip_event */
+	uint8_t  reserved[3];
+	char     name[AUSOCK_CLIP_NAME];  /* file name without .wav */
+};
+
+/*
+ * Phrase cache file (ausock_phrases): clips rendered ahead of time by
+ * the client (bin/phrases), played by CLIP name like the WAV clips.
+ * A header, count entries, then the S16LE mono samples each entry
+ * points at, 2-byte aligned.  All little-endian.  The file is replaced
+ * whole (rename), never written in place.
+ */
+#define AUSOCK_PHRASE_MAGIC   "AUPHRASE"
+#define AUSOCK_PHRASE_VERSION 1
+
+struct ausock_phrase_hdr {
+	char     magic[8];      /* AUSOCK_PHRASE_MAGIC, no NUL */
+	uint32_t version;       /* AUSOCK_PHRASE_VERSION */
+	uint32_t count;         /* entries that follow */
+	uint64_t reserved;
+};
+
+struct ausock_phrase_ent {
+	char     name[AUSOCK_CLIP_NAME];  /* as sent in ausock_clip */
+	uint32_t srate;         /* of the samples, the call's rate */
+	uint32_t samples;
+	uint64_t offset;        /* of the first sample, from file start */
+};
+
+struct ausock_dtmf {
+	uint8_t  key;           /* '0'-'9', '*', '#' or 'A'-'D' */
+	uint8_t  reserved;
+	int16_t  level;         /* of the tone pair, dBFS */
+};
+
+_Static_assert(sizeof(struct ausock_msg) == 16, "ausock_msg is 16 bytes");
+_Static_assert(sizeof(struct ausock_hello) == 24, "ausock_hello is 24 bytes");
+_Static_assert(sizeof(struct ausock_stats) == 32, "ausock_stats is 32 bytes");
+_Static_assert(sizeof(struct ausock_bargein) == 4, "ausock_bargein is 4 bytes");
+_Static_assert(sizeof(struct ausock_vad) == 8, "ausock_vad is 8 bytes");
+_Static_assert(sizeof(struct ausock_playout) == 8, "ausock_playout is 8 bytes");
+_Static_assert(sizeof(struct ausock_clip) == 32, "ausock_clip is 32 bytes");
+_Static_assert(sizeof(struct ausock_dtmf) == 4, "ausock_dtmf is 4 bytes");
+_Static_assert(sizeof(struct ausock_phrase_hdr) == 24,
+	       "ausock_phrase_hdr is 24 bytes");
+_Static_assert(sizeof(struct ausock_phrase_ent) == 40,
+	       "ausock_phrase_ent is 40 bytes");
@@ -0,0 +1,114 @@
+/**
+ * ausock_shm.h — shared-memory transport layout
+ *
+ * With ausock_transport shm, each channel exports one shared mapping
+ * holding two single-producer/single-consumer frame rings:
+ *
+ *   up   — caller → agent; ausock auplay produces, client consumes
+ *   down — agent → caller; client produces, ausock ausrc consumes
+ *
+ * The mapping and two doorbell fds are passed to the client over the
+ * channel socket right after it connects, one SCM_RIGHTS message
+ * each, in this order:
+ *
+ *   1. region fd (memfd / shm object; mmap the whole fstat size)
+ *   2. up doorbell   — readable after ausock commits an up frame
+ *   3. down doorbell — readable after ausock consumes a down frame
+ *
+ * Doorbells are eventfds on Linux and pipe read ends elsewhere; a
+ * client drains either with a non-blocking read of up to 8 bytes.
+ * The socket stays open only to signal hangup.
+ *
+ * Frames carry the channel's socket format (S16LE or u-law).  The
+ * indices are published with release/acquire ordering, exactly like
+ * ring.c, and one slot is always left empty.
+ *
+ * This header is free of libre so the Ruby extension can include it.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define AUSOCK_SHM_MAGIC    0x4d535541u   /* "AUSM" little-endian */
+#define AUSOCK_SHM_VERSION  1u
+
+/** One ring's indices and geometry; indices on separate cache lines */
+struct ausock_shm_ring {
+	uint32_t head;          /* next slot to write (producer) */
+	uint8_t  pad0[60];
+	uint32_t tail;          /* next slot to read  (consumer) */
+	uint8_t  pad1[60];
+	uint32_t frame_bytes;
+	uint32_t size;          /* slots (capacity + 1) */
+	uint32_t offset;        /* slot 0, from the start of the region */
+	uint8_t  pad2[52];
+};
+
+/** Region header; slot data follows */
+struct ausock_shm {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;          /* total mapping size in bytes */
+	uint32_t srate;
+	uint8_t  pad[48];
+	struct ausock_shm_ring up;
+	struct ausock_shm_ring down;
+};
+
+
+static inline uint8_t *ausock_shm_slot(struct ausock_shm *shm,
+				       const struct ausock_shm_ring *r,
+				       uint32_t idx)
+{
+	return (uint8_t *)shm + r->offset + (size_t)idx * r->frame_bytes;
+}
+
+/** Producer: slot to fill next, or NULL if the ring is full */
+static inline uint8_t *ausock_shm_write_ptr(struct ausock_shm *shm,
+					    struct ausock_shm_ring *r)
+{
+	uint32_t head = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+	uint32_t next = (head + 1) % r->size;
+
+	if (next == __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	return ausock_shm_slot(shm, r, head);
+}
+
+/** Producer: publish the slot returned by ausock_shm_write_ptr() */
+static inline void ausock_shm_write_commit(struct ausock_shm_ring *r)
+{
+	uint32_t head = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&r->head, (head + 1) % r->size, __ATOMIC_RELEASE);
+}
+
+/** Consumer: oldest filled slot, or NULL if the ring is empty */
+static inline uint8_t *ausock_shm_read_ptr(struct ausock_shm *shm,
+					   struct ausock_shm_ring *r)
+{
+	uint32_t tail = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+
+	if (tail == __atomic_load_n(&r->head, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	return ausock_shm_slot(shm, r, tail);
+}
+
+/** Consumer: release the slot returned by ausock_shm_read_ptr() */
+static inline void ausock_shm_read_commit(struct ausock_shm_ring *r)
+{
+	uint32_t tail = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&r->tail, (tail + 1) % r->size, __ATOMIC_RELEASE);
+}
+
+/** Number of filled slots */
+static inline uint32_t ausock_shm_count(struct ausock_shm_ring *r)
+{
+	uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	uint32_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+
+	return (head + r->size - tail) % r->size;
+}
@@ -0,0 +1,124 @@
+/**
+ * bargein.c — detects the caller talking over agent audio
+ *
+ * Fed every agent frame as it goes to rh() (far end) and every caller
+ * frame as it comes out of wh() (near end), on the scheduler thread.
+ * A caller frame counts as speech when, while agent audio is playing,
+ *
+ *   - its mean power (vad_level()) is at least BARGEIN_LEVEL_DB, and
+ *   - its peak exceeds half the largest agent peak of the last
+ *     BARGEIN_TAIL frames (Geigel double-talk test: line echo of the
+ *     agent comes back at least 6 dB down, so anything louder is the
+ *     caller, not the echo).
+ *
+ * Enough consecutive speech frames (ausock_bargein ms) fire a
+ * barge-in.  Two passes over each frame and no allocation, so it is
+ * cheap enough to run on every tick.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <re.h>
+
+#include "ausock.h"
+
+#define BARGEIN_TAIL      16    /* agent peaks kept, frames: echo tail */
+#define BARGEIN_LEVEL_DB  -36   /* quietest caller frame that counts */
+
+struct bargein {
+	uint32_t far[BARGEIN_TAIL];   /* agent frame peaks, ring */
+	uint32_t farpos;
+	bool     playing;             /* last agent frame had audio */
+	uint32_t speech;              /* consecutive caller speech frames */
+	uint32_t need;                /* speech frames that fire */
+};
+
+static uint32_t frame_peak(const int16_t *sampv, size_t sampc)
+{
+	uint32_t peak = 0;
+
+	for (size_t i = 0; i < sampc; i++) {
+		uint32_t v = (uint32_t)abs(sampv[i]);
+
+		if (v > peak)
+			peak = v;
+	}
+
+	return peak;
+}
+
+/** speech_ms of caller speech over agent audio fires a barge-in */
+int bargein_alloc(struct bargein **bip, uint32_t ptime, uint32_t speech_ms)
+{
+	struct bargein *bi;
+
+	if (!bip || !ptime || !speech_ms)
+		return EINVAL;
+
+	bi = mem_zalloc(sizeof(*bi), NULL);
+	if (!bi)
+		return ENOMEM;
+
+	bi->need = (speech_ms + ptime - 1) / ptime;
+
+	*bip = bi;
+	return 0;
+}
+
+/** Forget all history, e.g. for a new client */
+void bargein_reset(struct bargein *bi)
+{
+	memset(bi->far, 0, sizeof(bi->far));
+	bi->farpos  = 0;
+	bi->playing = false;
+	bi->speech  = 0;
+}
+
+/** Agent frame handed to rh(), or NULL for a tick without agent audio */
+void bargein_far(struct bargein *bi, const int16_t *sampv, size_t sampc)
+{
+	bi->far[bi->farpos] = sampv ? frame_peak(sampv, sampc) : 0;
+	bi->farpos  = (bi->farpos + 1) % BARGEIN_TAIL;
+	bi->playing = sampv != NULL;
+}
+
+/**
+ * Caller frame out of wh().  Returns true when it completes a
+ * barge-in, with the caller's level in dBFS in *levelp.
+ */
+bool bargein_near(struct bargein *bi, const int16_t *sampv, size_t sampc,
+		  int *levelp)
+{
+	uint32_t far_max = 0;
+	bool speech = false;
+	int level = VAD_SILENCE_DB;
+
+	if (bi->playing) {
+		for (size_t i = 0; i < BARGEIN_TAIL; i++) {
+			if (bi->far[i] > far_max)
+				far_max = bi->far[i];
+		}
+
+		level  = vad_level(sampv, sampc);
+		speech = level >= BARGEIN_LEVEL_DB &&
+			 2 * frame_peak(sampv, sampc) > far_max;
+	}
+
+	bi->speech = speech ? bi->speech + 1 : 0;
+	if (bi->speech < bi->need)
+		return false;
+
+	bi->speech = 0;
+	*levelp = level;
+
+	return true;
+}
+
+/** Ramp a frame linearly down to silence, so a cut does not click */
+void bargein_fade(int16_t *sampv, size_t sampc)
+{
+	for (size_t i = 0; i < sampc; i++)
+		sampv[i] = (int16_t)((int32_t)sampv[i] *
+				     (int32_t)(sampc - i) / (int32_t)sampc);
+}
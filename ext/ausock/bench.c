@@ -0,0 +1,666 @@
+/**
+ * bench.c — standalone ausock benchmark (make bench)
+ *
+ * Links the module sources into a small program that stands in for
+ * baresip: it brings up libre and libbaresip, runs the module's init
+ * and opens N calls' worth of ausrc + auplay through the regular
+ * baresip audio API, each call on its own channel
+ * (/tmp/ausock-bench-<i>.sock).  A synthetic client thread per channel
+ * connects and writes every caller frame straight back as agent audio,
+ * like an agent that answers instantly.
+ *
+ * wh() stamps each caller frame with its index; when the echo comes
+ * back through rh(), the time since that wh() is the loopback latency:
+ * socket send, client, socket read, ring and the wait for the next
+ * rh() tick.  The intervals between successive rh() and wh() calls of
+ * a call give cadence jitter (distance from ptime), and process CPU
+ * time minus the client threads' own is the module's cost per call.
+ * The first second is warm-up and is not measured.
+ *
+ *   ausock_bench [-n calls] [-r srate] [-p ptime] [-d seconds]
+ *                [-j max_p99_jitter_us]
+ *
+ * With -j the exit status is 1 when the p99 cadence jitter of either
+ * direction exceeds the limit, to catch regressions in CI.  Other
+ * module settings come from the usual AUSOCK_* variables; the stamps
+ * need the s16le format, a socket transport (stream or seqpacket) and
+ * no ausock_inrate.
+ */
+
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <re.h>
+#include <re_atomic.h>
+#include <rem.h>
+#include <baresip.h>
+
+#include "ausock.h"
+#include "ausock_proto.h"
+
+#define BENCH_MAX_CALLS  256
+#define BENCH_WARMUP_MS  1000
+#define BENCH_STAMP      0x7e57    /* first sample of a stamped frame */
+#define BENCH_SLOTS      256       /* wh() send times kept per call */
+
+extern const struct mod_export exports;
+
+struct bench_call {
+	struct ausrc_st *src;
+	struct auplay_st *play;
+	char path[64];
+
+	/* scheduler thread */
+	uint32_t idx;                   /* next caller frame index */
+	uint64_t sent[BENCH_SLOTS];     /* wh() time of frame idx % SLOTS */
+	uint64_t last_rh, last_wh;
+	double phase;
+	RE_ATOMIC uint32_t echoed;
+	RE_ATOMIC uint32_t unstamped;   /* rh() frames without a stamp */
+
+	/* client thread */
+	thrd_t thread;
+	bool thread_ok;
+	bool framed;
+	bool packet;                    /* seqpacket: a message per packet */
+	RE_ATOMIC bool connected;
+	double cpu;                     /* client thread CPU, s */
+};
+
+static struct {
+	uint32_t ncalls;
+	uint32_t srate;
+	uint32_t ptime;
+	uint32_t seconds;
+	uint32_t max_jitter;           /* -j, us; 0 = no limit */
+	struct bench_call *callv;
+
+	/* one writer (the scheduler) for all, so they can be shared */
+	struct hist *rh_jitter;
+	struct hist *wh_jitter;
+	struct hist *loopback;
+
+	RE_ATOMIC bool measuring;
+	RE_ATOMIC bool running;
+	struct tmr tmr;
+	struct rusage ru0;
+	uint64_t t0;
+} bench = {
+	.ncalls  = 1,
+	.srate   = 8000,
+	.ptime   = 20,
+	.seconds = 10,
+};
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static double rusage_s(const struct rusage *ru)
+{
+	return ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6 +
+	       ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+}
+
+/** Distance of one tick interval from ptime, us */
+static void cadence(struct hist *h, uint64_t *last, uint64_t now)
+{
+	const uint64_t period = bench.ptime * 1000;
+
+	if (*last && re_atomic_rlx(&bench.measuring)) {
+		uint64_t dt = now - *last;
+
+		hist_record(h, (uint32_t)(dt > period ? dt - period :
+					  period - dt));
+	}
+
+	*last = now;
+}
+
+/* Scheduler: a caller frame is due, stamp it */
+static void bench_wh(struct auframe *af, void *arg)
+{
+	struct bench_call *c = arg;
+	const uint64_t now = now_us();
+	int16_t *sampv = af->sampv;
+
+	cadence(bench.wh_jitter, &c->last_wh, now);
+
+	/* a 440 Hz tone keeps VAD, AEC and barge-in on realistic paths */
+	for (size_t i = 0; i < af->sampc; i++) {
+		sampv[i] = (int16_t)(3000 * sin(c->phase));
+		c->phase += 2 * M_PI * 440 / bench.srate;
+	}
+	c->phase = fmod(c->phase, 2 * M_PI);
+
+	sampv[0] = BENCH_STAMP;
+	sampv[1] = (int16_t)(c->idx & 0xffff);
+	sampv[2] = (int16_t)(c->idx >> 16);
+
+	c->sent[c->idx % BENCH_SLOTS] = now;
+	++c->idx;
+}
+
+/* Scheduler: agent audio for baresip; the echo of an earlier wh() */
+static void bench_rh(struct auframe *af, void *arg)
+{
+	struct bench_call *c = arg;
+	const uint64_t now = now_us();
+	const int16_t *sampv = af->sampv;
+	uint32_t idx;
+
+	cadence(bench.rh_jitter, &c->last_rh, now);
+
+	if (sampv[0] != BENCH_STAMP) {
+		/* silence before the first echo, or audio the module
+		   altered (resampler, echo canceller) */
+		re_atomic_rlx_add(&c->unstamped, 1);
+		return;
+	}
+
+	idx = (uint16_t)sampv[1] | (uint32_t)(uint16_t)sampv[2] << 16;
+	if (c->idx - idx > BENCH_SLOTS)
+		return;
+
+	re_atomic_rlx_add(&c->echoed, 1);
+
+	if (re_atomic_rlx(&bench.measuring))
+		hist_record(bench.loopback,
+			    (uint32_t)(now - c->sent[idx % BENCH_SLOTS]));
+}
+
+static void bench_errh(int err, const char *str, void *arg)
+{
+	(void)arg;
+
+	warning("bench: ausrc error: %s (%m)\n", str, err);
+}
+
+static int readn(int fd, void *buf, size_t n)
+{
+	uint8_t *p = buf;
+
+	while (n) {
+		struct pollfd pfd = {.fd = fd, .events = POLLIN};
+		ssize_t r;
+
+		if (!re_atomic_rlx(&bench.running))
+			return ECANCELED;
+
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+
+		r = read(fd, p, n);
+		if (r <= 0)
+			return r ? errno : ECONNRESET;
+
+		p += r;
+		n -= (size_t)r;
+	}
+
+	return 0;
+}
+
+static int writen(int fd, const void *buf, size_t n)
+{
+	const uint8_t *p = buf;
+
+	while (n) {
+		ssize_t w = write(fd, p, n);
+
+		if (w < 0)
+			return errno;
+
+		p += w;
+		n -= (size_t)w;
+	}
+
+	return 0;
+}
+
+/* seqpacket: one whole message, header first */
+static int read_packet(int fd, struct ausock_msg *hdr, uint8_t *buf,
+		       size_t size)
+{
+	uint8_t pkt[sizeof(*hdr) + AUSOCK_CTL_MAX + 8192];
+	ssize_t r;
+
+	for (;;) {
+		struct pollfd pfd = {.fd = fd, .events = POLLIN};
+
+		if (!re_atomic_rlx(&bench.running))
+			return ECANCELED;
+
+		if (poll(&pfd, 1, 100) > 0)
+			break;
+	}
+
+	r = recv(fd, pkt, sizeof(pkt), 0);
+	if (r <= 0)
+		return r ? errno : ECONNRESET;
+
+	if ((size_t)r < sizeof(*hdr))
+		return EPROTO;
+
+	memcpy(hdr, pkt, sizeof(*hdr));
+	if (hdr->len != (size_t)r - sizeof(*hdr) || hdr->len > size)
+		return EPROTO;
+
+	memcpy(buf, pkt + sizeof(*hdr), hdr->len);
+
+	return 0;
+}
+
+static int write_msg(const struct bench_call *c, int fd,
+		     const struct ausock_msg *hdr, const uint8_t *buf)
+{
+	struct iovec iov[2] = {
+		{.iov_base = (void *)hdr, .iov_len = sizeof(*hdr)},
+		{.iov_base = (void *)buf, .iov_len = hdr->len},
+	};
+	int err;
+
+	/* header and payload must share one packet */
+	if (c->packet)
+		return writev(fd, iov, 2) < 0 ? errno : 0;
+
+	err = writen(fd, hdr, sizeof(*hdr));
+	if (!err)
+		err = writen(fd, buf, hdr->len);
+
+	return err;
+}
+
+/* Framed protocol: answer every caller AUDIO with an agent AUDIO */
+static int client_framed(struct bench_call *c, int fd)
+{
+	uint8_t buf[AUSOCK_CTL_MAX + 8192];
+	uint32_t seq = 0;
+	int err;
+
+	for (;;) {
+		struct ausock_msg hdr;
+
+		if (c->packet) {
+			err = read_packet(fd, &hdr, buf, sizeof(buf));
+		} else {
+			err = readn(fd, &hdr, sizeof(hdr));
+			if (!err && hdr.len > sizeof(buf))
+				err = EPROTO;
+			if (!err)
+				err = readn(fd, buf, hdr.len);
+		}
+		if (err)
+			return err;
+
+		if (hdr.type == AUSOCK_MSG_HELLO) {
+			const struct ausock_hello *h = (void *)buf;
+
+			if (h->in_frame_bytes != h->frame_bytes) {
+				warning("bench: %s: ausock_inrate is not"
+					" supported\n", c->path);
+				return ENOTSUP;
+			}
+			continue;
+		}
+
+		if (hdr.type != AUSOCK_MSG_AUDIO)
+			continue;
+
+		hdr.flags = 0;
+		hdr.seq   = seq++;
+		hdr.ts    = now_us();
+
+		err = write_msg(c, fd, &hdr, buf);
+		if (err)
+			return err;
+	}
+}
+
+/* Raw protocol: the byte stream (or each packet) goes back as it came */
+static int client_raw(int fd)
+{
+	uint8_t buf[4096];
+
+	for (;;) {
+		struct pollfd pfd = {.fd = fd, .events = POLLIN};
+		ssize_t r;
+		int err;
+
+		if (!re_atomic_rlx(&bench.running))
+			return ECANCELED;
+
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+
+		r = read(fd, buf, sizeof(buf));
+		if (r <= 0)
+			return r ? errno : ECONNRESET;
+
+		err = writen(fd, buf, (size_t)r);
+		if (err)
+			return err;
+	}
+}
+
+static int client_thread(void *arg)
+{
+	struct bench_call *c = arg;
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	struct timespec ts;
+	int fd = -1, err;
+
+	str_ncpy(addr.sun_path, c->path, sizeof(addr.sun_path));
+
+	while (re_atomic_rlx(&bench.running)) {
+		fd = socket(AF_UNIX, c->packet ? SOCK_SEQPACKET : SOCK_STREAM,
+			    0);
+		if (fd < 0)
+			break;
+
+		if (0 == connect(fd, (struct sockaddr *)&addr,
+				 sizeof(addr)))
+			break;
+
+		close(fd);
+		fd = -1;
+		usleep(10000);
+	}
+
+	if (fd < 0)
+		goto out;
+
+	re_atomic_rlx_set(&c->connected, true);
+
+	err = c->framed ? client_framed(c, fd) : client_raw(fd);
+	if (err && err != ECANCELED)
+		warning("bench: %s: client stopped (%m)\n", c->path, err);
+
+	close(fd);
+
+ out:
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	c->cpu = ts.tv_sec + ts.tv_nsec / 1e9;
+
+	return 0;
+}
+
+static void print_hist(const char *name, const struct hist *h)
+{
+	re_printf("  %-18s p50 %6u  p90 %6u  p99 %6u  max %6u us"
+		  "  (n=%u)\n", name,
+		  hist_quantile(h, 0.50), hist_quantile(h, 0.90),
+		  hist_quantile(h, 0.99), hist_quantile(h, 1.0),
+		  (uint32_t)hist_count(h));
+}
+
+static void stop_clients(void)
+{
+	re_atomic_rlx_set(&bench.running, false);
+
+	for (uint32_t i = 0; bench.callv && i < bench.ncalls; i++) {
+		struct bench_call *c = &bench.callv[i];
+
+		if (c->thread_ok)
+			thrd_join(c->thread, NULL);
+		c->thread_ok = false;
+	}
+}
+
+static int report(void)
+{
+	struct rusage ru;
+	const double wall = (now_us() - bench.t0) / 1e6;
+	double client = 0, module;
+	uint32_t sent = 0, echoed = 0, unstamped = 0, connected = 0;
+	uint32_t rh99, wh99;
+
+	getrusage(RUSAGE_SELF, &ru);
+
+	for (uint32_t i = 0; i < bench.ncalls; i++) {
+		struct bench_call *c = &bench.callv[i];
+
+		client    += c->cpu;
+		sent      += c->idx;
+		echoed    += re_atomic_rlx(&c->echoed);
+		unstamped += re_atomic_rlx(&c->unstamped);
+		connected += re_atomic_rlx(&c->connected);
+	}
+
+	/* client CPU covers the whole run, warm-up included */
+	module = rusage_s(&ru) - rusage_s(&bench.ru0) - client;
+	if (module < 0)
+		module = 0;
+
+	re_printf("ausock bench: %u calls (%u connected), %u Hz, %u ms,"
+		  " %.1f s measured\n", bench.ncalls, connected, bench.srate,
+		  bench.ptime, wall);
+	print_hist("rh() jitter", bench.rh_jitter);
+	print_hist("wh() jitter", bench.wh_jitter);
+	print_hist("loopback latency", bench.loopback);
+	re_printf("  %-18s %u of %u caller frames came back,"
+		  " %u agent frames unstamped\n", "frames",
+		  echoed, sent, unstamped);
+	re_printf("  %-18s %.2f %% of a core per call"
+		  " (clients %.2f %% in all)\n", "module cpu",
+		  100 * module / wall / bench.ncalls, 100 * client / wall);
+
+	rh99 = hist_quantile(bench.rh_jitter, 0.99);
+	wh99 = hist_quantile(bench.wh_jitter, 0.99);
+
+	if (bench.max_jitter &&
+	    (rh99 > bench.max_jitter || wh99 > bench.max_jitter)) {
+		re_printf("FAIL: p99 jitter above %u us\n", bench.max_jitter);
+		return 1;
+	}
+
+	return connected == bench.ncalls ? 0 : 1;
+}
+
+static void stop_handler(void *arg)
+{
+	(void)arg;
+
+	re_cancel();
+}
+
+static void warmup_handler(void *arg)
+{
+	(void)arg;
+
+	hist_reset(bench.rh_jitter);
+	hist_reset(bench.wh_jitter);
+	hist_reset(bench.loopback);
+	getrusage(RUSAGE_SELF, &bench.ru0);
+	bench.t0 = now_us();
+	re_atomic_rlx_set(&bench.measuring, true);
+
+	tmr_start(&bench.tmr, bench.seconds * 1000, stop_handler, NULL);
+}
+
+static int open_call(struct bench_call *c, uint32_t i)
+{
+	struct ausrc_prm sprm = {
+		.srate = bench.srate, .ch = 1, .ptime = bench.ptime,
+		.fmt = AUFMT_S16LE,
+	};
+	struct auplay_prm pprm = {
+		.srate = bench.srate, .ch = 1, .ptime = bench.ptime,
+		.fmt = AUFMT_S16LE,
+	};
+	const char *proto = getenv("AUSOCK_PROTOCOL");
+	const char *tp = getenv("AUSOCK_TRANSPORT");
+	int err;
+
+	re_snprintf(c->path, sizeof(c->path), "/tmp/ausock-bench-%u.sock",
+		    i);
+	c->framed = proto && !strcmp(proto, "framed");
+	c->packet = tp && !strcmp(tp, "seqpacket");
+
+	err = ausrc_alloc(&c->src, baresip_ausrcl(), "ausock", &sprm,
+			  c->path, bench_rh, bench_errh, c);
+	if (err)
+		return err;
+
+	err = auplay_alloc(&c->play, baresip_auplayl(), "ausock", &pprm,
+			   c->path, bench_wh, c);
+	if (err)
+		return err;
+
+	err = thread_create_name(&c->thread, "bench_client", client_thread,
+				 c);
+	if (err)
+		return err;
+
+	c->thread_ok = true;
+
+	return 0;
+}
+
+static int check_env(void)
+{
+	const char *fmt = getenv("AUSOCK_FORMAT");
+	const char *tp  = getenv("AUSOCK_TRANSPORT");
+
+	if (fmt && *fmt && strcmp(fmt, "s16le")) {
+		warning("bench: AUSOCK_FORMAT must be s16le\n");
+		return EINVAL;
+	}
+
+	if (tp && *tp && strcmp(tp, "stream") && strcmp(tp, "seqpacket")) {
+		warning("bench: AUSOCK_TRANSPORT must be stream or"
+			" seqpacket\n");
+		return EINVAL;
+	}
+
+	if (getenv("AUSOCK_INRATE") && *getenv("AUSOCK_INRATE")) {
+		warning("bench: AUSOCK_INRATE is not supported\n");
+		return EINVAL;
+	}
+
+	return 0;
+}
+
+static void usage(void)
+{
+	(void)re_fprintf(stderr,
+			 "usage: ausock_bench [-n calls] [-r srate]"
+			 " [-p ptime] [-d seconds] [-j max_p99_jitter_us]\n");
+}
+
+int main(int argc, char *argv[])
+{
+	bool module_up = false;
+	int opt, err, ret = 1;
+
+	while ((opt = getopt(argc, argv, "n:r:p:d:j:h")) != -1) {
+		switch (opt) {
+
+		case 'n': bench.ncalls     = (uint32_t)atoi(optarg); break;
+		case 'r': bench.srate      = (uint32_t)atoi(optarg); break;
+		case 'p': bench.ptime      = (uint32_t)atoi(optarg); break;
+		case 'd': bench.seconds    = (uint32_t)atoi(optarg); break;
+		case 'j': bench.max_jitter = (uint32_t)atoi(optarg); break;
+		default:
+			usage();
+			return 2;
+		}
+	}
+
+	if (!bench.ncalls || bench.ncalls > BENCH_MAX_CALLS ||
+	    !bench.srate || !bench.ptime || !bench.seconds) {
+		usage();
+		return 2;
+	}
+
+	if (check_env())
+		return 2;
+
+	/* a client that hangs up must not end the run */
+	(void)signal(SIGPIPE, SIG_IGN);
+
+	err = libre_init();
+	if (err)
+		return 1;
+
+	err = baresip_init(conf_config());
+	if (err)
+		goto out;
+
+	err = exports.init();
+	if (err)
+		goto out;
+
+	module_up = true;
+
+	err  = hist_alloc(&bench.rh_jitter);
+	err |= hist_alloc(&bench.wh_jitter);
+	err |= hist_alloc(&bench.loopback);
+	if (err)
+		goto out;
+
+	bench.callv = mem_zalloc(bench.ncalls * sizeof(*bench.callv), NULL);
+	if (!bench.callv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	re_atomic_rlx_set(&bench.running, true);
+
+	for (uint32_t i = 0; i < bench.ncalls; i++) {
+		err = open_call(&bench.callv[i], i);
+		if (err) {
+			warning("bench: call %u: %m\n", i, err);
+			goto out;
+		}
+	}
+
+	tmr_init(&bench.tmr);
+	tmr_start(&bench.tmr, BENCH_WARMUP_MS, warmup_handler, NULL);
+
+	err = re_main(NULL);
+	if (err)
+		goto out;
+
+	re_atomic_rlx_set(&bench.measuring, false);
+	stop_clients();
+
+	ret = report();
+
+ out:
+	stop_clients();
+	tmr_cancel(&bench.tmr);
+
+	for (uint32_t i = 0; bench.callv && i < bench.ncalls; i++) {
+		mem_deref(bench.callv[i].src);
+		mem_deref(bench.callv[i].play);
+	}
+
+	if (module_up)
+		exports.close();
+
+	mem_deref(bench.callv);
+	mem_deref(bench.rh_jitter);
+	mem_deref(bench.wh_jitter);
+	mem_deref(bench.loopback);
+
+	baresip_close();
+	libre_close();
+
+	return err ? 1 : ret;
+}
@@ -0,0 +1,315 @@
+/**
+ * drift.c — clock-drift compensation for agent audio (ausock_drift)
+ *
+ * The rh() tick consumes one frame per ptime of the monotonic clock,
+ * whatever clock the client's audio was produced on.  Any difference
+ * shows up as agent queue depth that creeps up (latency) or down
+ * (underruns) over a long call.  This stage sits between the queue
+ * and rh() and consumes agent audio at 1 + ppm/10^6 times the tick
+ * rate, so the queue is held at its setpoint indefinitely.
+ *
+ * Estimate: depth is averaged over each DRIFT_WINDOW_MS window in
+ * which the agent never ran dry.  The client writes whole frames, but
+ * they land at any point between ticks, so the average resolves drift
+ * far finer than a frame.  Its distance from the setpoint drives a
+ * critically damped PI loop with a DRIFT_TAU_S time constant: the
+ * integral converges on the clock drift itself, the proportional part
+ * removes whatever depth the drift has already built up.  The
+ * setpoint is the depth the first windows of a client settle at; with
+ * ausock_playout adaptive it follows the playout target from there.
+ *
+ * Correction: agent samples are read at a fractional position that
+ * advances by 1 + ppm/10^6 per output sample, and interpolated with a
+ * 4-point Hermite spline.  The position carries across frames, so the
+ * stretch is sample-accurate; at the few hundred ppm real clocks
+ * differ by it is far below audible pitch change.  With no correction
+ * the stage passes frames through untouched and holds nothing back.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include <re.h>
+
+#include "ausock.h"
+
+#define DRIFT_WINDOW_MS 1000  /* depth minimum measured over this */
+#define DRIFT_TAU_S     30    /* loop time constant */
+#define DRIFT_SETTLE    3     /* windows before the setpoint is latched */
+#define DRIFT_SMOOTH    0.3   /* weight of a new window in the average */
+
+#define POS_ONE  (1ull << 32)
+#define POS_FRAC (POS_ONE - 1)
+
+struct drift {
+	uint32_t srate;
+	uint32_t sampc;
+	uint32_t ptime;
+	uint32_t max_ppm;
+
+	/* stretch */
+	int16_t *in;           /* one sample of history, then unread audio */
+	uint32_t cap;
+	uint32_t n;            /* samples in in[] */
+	uint64_t pos;          /* read position in in[], 32.32 fixed point */
+	int32_t  ppm;          /* correction being applied */
+
+	/* estimate */
+	double   integ;        /* converges on the drift, ppm */
+	double   avg;          /* smoothed window average, samples */
+	bool     avg_ok;
+	uint64_t wsum;         /* depth summed over this window, samples */
+	uint32_t wticks;
+	bool     wdry;         /* agent ran dry during the window */
+	uint32_t settled;      /* clean windows since the reset */
+	double   setpoint;     /* samples, beyond the playout target */
+	bool     latched;
+};
+
+static void drift_destructor(void *data)
+{
+	struct drift *d = data;
+
+	mem_deref(d->in);
+}
+
+/**
+ * max_ppm: the largest correction, either way (at most 1 %).
+ */
+int drift_alloc(struct drift **dp, uint32_t srate, uint32_t sampc,
+		uint32_t ptime, uint32_t max_ppm)
+{
+	struct drift *d;
+
+	if (!dp || !srate || !sampc || !ptime || !max_ppm || max_ppm > 10000)
+		return EINVAL;
+
+	d = mem_zalloc(sizeof(*d), drift_destructor);
+	if (!d)
+		return ENOMEM;
+
+	d->srate   = srate;
+	d->sampc   = sampc;
+	d->ptime   = ptime;
+	d->max_ppm = max_ppm;
+
+	/* history, up to a frame (+1 %) left over with its lookahead, and
+	   the frame that was pulled to complete it */
+	d->cap = 2 * sampc + sampc / 50 + 8;
+	d->in  = mem_zalloc(d->cap * sizeof(int16_t), NULL);
+	if (!d->in) {
+		mem_deref(d);
+		return ENOMEM;
+	}
+
+	drift_reset(d);
+
+	*dp = d;
+	return 0;
+}
+
+/** Drop the agent audio held back, e.g. on FLUSH or barge-in */
+void drift_flush(struct drift *d)
+{
+	d->in[0] = 0;
+	d->n     = 1;
+	d->pos   = POS_ONE;
+}
+
+/**
+ * For a new client: no held audio and a new setpoint.  The drift
+ * estimate is kept, it belongs to the clocks rather than the client.
+ */
+void drift_reset(struct drift *d)
+{
+	drift_flush(d);
+
+	d->ppm      = (int32_t)lrint(d->integ);
+	d->avg_ok   = false;
+	d->wsum     = 0;
+	d->wticks   = 0;
+	d->wdry     = false;
+	d->settled  = 0;
+	d->latched  = false;
+}
+
+/** Agent samples held back by the stretch, not yet played */
+uint32_t drift_held(const struct drift *d)
+{
+	return d->n - (uint32_t)(d->pos >> 32);
+}
+
+/** The drift estimate, ppm; positive when the client is ahead */
+int32_t drift_ppm(const struct drift *d)
+{
+	return d ? (int32_t)lrint(d->integ) : 0;
+}
+
+static int16_t hermite(const int16_t *x, double t)
+{
+	const double xm1 = x[-1], x0 = x[0], x1 = x[1], x2 = x[2];
+	const double c1  = 0.5 * (x1 - xm1);
+	const double c2  = xm1 - 2.5 * x0 + 2 * x1 - 0.5 * x2;
+	const double c3  = 0.5 * (x2 - xm1) + 1.5 * (x0 - x1);
+	const double y   = ((c3 * t + c2) * t + c1) * t + x0;
+
+	if (y > 32767)
+		return 32767;
+	if (y < -32768)
+		return -32768;
+
+	return (int16_t)lrint(y);
+}
+
+/** Sample at pos; past the end of in[] the last sample repeats */
+static int16_t sample_at(const struct drift *d, uint64_t pos)
+{
+	const uint32_t i = (uint32_t)(pos >> 32);
+	const double t = (double)(pos & POS_FRAC) / POS_ONE;
+	int16_t x[4];
+
+	if (i + 2 < d->n)
+		return t > 0 ? hermite(d->in + i, t) : d->in[i];
+
+	if (i + 1 >= d->n)
+		return d->in[d->n - 1];
+
+	for (uint32_t k = 0; k < 4; k++) {
+		const uint32_t j = i + k - 1;
+
+		x[k] = d->in[j < d->n ? j : d->n - 1];
+	}
+
+	return hermite(x + 1, t);
+}
+
+/**
+ * Scheduler: one frame of agent audio into out, taking as many frames
+ * from pull as the correction needs (usually one, now and then none
+ * or two).  If pull runs dry a few samples short, the last one is
+ * stretched over them; further short, what is held is played out and
+ * the rest of the frame zeroed.  false if there was no agent audio.
+ */
+bool drift_frame(struct drift *d, int16_t *out, drift_pull_h *pull,
+		 void *arg)
+{
+	const uint64_t step = (uint64_t)((int64_t)POS_ONE +
+					 (int64_t)d->ppm *
+					 (int64_t)POS_ONE / 1000000);
+	const uint64_t last = d->pos + (uint64_t)(d->sampc - 1) * step;
+	const bool frac = ((d->pos | step) & POS_FRAC) != 0;
+	const uint32_t need = (uint32_t)(last >> 32) + (frac ? 3 : 1);
+	bool dry = false;
+	uint32_t used;
+	uint64_t pos = d->pos;
+
+	while (d->n < need) {
+		if (d->n + d->sampc > d->cap || !pull(d->in + d->n, arg)) {
+			dry = true;
+			break;
+		}
+		d->n += d->sampc;
+	}
+
+	if (dry && last >> 32 >= d->n + d->sampc / 8) {
+		if (!drift_held(d))
+			return false;
+
+		for (uint32_t k = 0; k < d->sampc; k++, pos += step)
+			out[k] = (pos >> 32) < d->n ? sample_at(d, pos) : 0;
+
+		/* the talkspurt is over, start the next one clean */
+		d->in[0] = d->in[d->n - 1];
+		d->n     = 1;
+		d->pos   = POS_ONE;
+
+		return true;
+	}
+
+	for (uint32_t k = 0; k < d->sampc; k++, pos += step)
+		out[k] = sample_at(d, pos);
+
+	if (pos > (uint64_t)d->n << 32)
+		pos = (uint64_t)d->n << 32;
+
+	/* keep one sample before the read position */
+	used = (uint32_t)(pos >> 32) - 1;
+	memmove(d->in, d->in + used, (d->n - used) * sizeof(int16_t));
+	d->n  -= used;
+	d->pos = pos - (uint64_t)used * POS_ONE;
+
+	return true;
+}
+
+static int32_t clamp_ppm(const struct drift *d, double ppm)
+{
+	if (ppm > d->max_ppm)
+		return (int32_t)d->max_ppm;
+	if (ppm < -(double)d->max_ppm)
+		return -(int32_t)d->max_ppm;
+
+	return (int32_t)lrint(ppm);
+}
+
+/** The PI loop, once per clean window with its average depth m */
+static void drift_window(struct drift *d, double m, uint32_t target)
+{
+	const double kp = 2.0 / DRIFT_TAU_S;
+	const double ki = DRIFT_WINDOW_MS / 1000.0 /
+			  ((double)DRIFT_TAU_S * DRIFT_TAU_S);
+	double e;
+
+	d->avg = d->avg_ok ? d->avg + DRIFT_SMOOTH * (m - d->avg) : m;
+	d->avg_ok = true;
+
+	if (!d->latched) {
+		if (++d->settled < DRIFT_SETTLE)
+			return;
+
+		d->setpoint = d->avg - (double)target * d->sampc;
+		d->latched  = true;
+	}
+
+	/* seconds of audio queued beyond the setpoint */
+	e = (d->avg - d->setpoint - (double)target * d->sampc) / d->srate;
+
+	d->integ += ki * e * 1e6;
+	if (d->integ > d->max_ppm)
+		d->integ = d->max_ppm;
+	if (d->integ < -(double)d->max_ppm)
+		d->integ = -(double)d->max_ppm;
+
+	d->ppm = clamp_ppm(d, kp * e * 1e6 + d->integ);
+}
+
+/**
+ * Scheduler, once per tick after drift_frame(): depth agent frames
+ * still queued, target the playout target in frames (0 without
+ * adaptive playout), got whether agent audio played.
+ */
+void drift_update(struct drift *d, uint32_t depth, uint32_t target,
+		  bool got)
+{
+	const uint32_t window = DRIFT_WINDOW_MS / d->ptime;
+	const uint32_t held = depth * d->sampc + drift_held(d);
+
+	if (!got)
+		d->wdry = true;
+
+	d->wsum += held;
+
+	if (++d->wticks < (window ? window : 1))
+		return;
+
+	if (d->wdry) {
+		/* nothing to learn from, and no error to correct */
+		d->ppm = clamp_ppm(d, d->integ);
+	}
+	else {
+		drift_window(d, (double)d->wsum / d->wticks, target);
+	}
+
+	d->wsum   = 0;
+	d->wticks = 0;
+	d->wdry   = false;
+}
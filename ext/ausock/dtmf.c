@@ -0,0 +1,222 @@
+/**
+ * dtmf.c — in-band DTMF detection on the caller leg (ausock_dtmf)
+ *
+ * Fed every echo-cancelled caller frame on the scheduler thread.  One
+ * Goertzel filter per DTMF frequency, four rows and four columns, runs
+ * over the whole frame, which at 20 ms resolves 50 Hz: enough to tell
+ * the tones of a group apart at any call rate.
+ *
+ * A frame holds a key when the strongest row and column tone are both
+ * at least DTMF_MIN_DB, within the twist limits of each other, each
+ * DTMF_PEAK_DB above the other tones of its group, and together carry
+ * DTMF_PURITY of the frame's energy.  Speech and music fail the last
+ * two tests almost always; the rest are seen off by requiring the
+ * same key in DTMF_HITS frames in a row.  The key is reported once,
+ * as it goes down, and the detector is armed again after DTMF_GAPS
+ * frames without it; dtmf_held() tells the caller to keep the tone
+ * away from the recogniser meanwhile.  One pass over each frame, no
+ * allocation.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include <re.h>
+
+#include "ausock.h"
+
+#define DTMF_MIN_DB      -36    /* weakest tone, dB below a full-scale sine */
+#define DTMF_TWIST_DB    8      /* column tone weaker than the row tone */
+#define DTMF_REVERSE_DB  4      /* row tone weaker than the column tone */
+#define DTMF_PEAK_DB     8      /* over the other tones of the group */
+#define DTMF_PURITY      0.7    /* share of the frame's energy */
+#define DTMF_HITS        2      /* frames that put a key down (40 ms) */
+#define DTMF_GAPS        2      /* frames without it that lift it */
+
+static const double freqv[8] = {
+	697, 770, 852, 941,         /* rows */
+	1209, 1336, 1477, 1633,     /* columns */
+};
+
+static const char keys[4][4] = {
+	{'1', '2', '3', 'A'},
+	{'4', '5', '6', 'B'},
+	{'7', '8', '9', 'C'},
+	{'*', '0', '#', 'D'},
+};
+
+struct dtmf {
+	uint32_t sampc;
+	double   coef[8];      /* 2 cos(2 pi f / srate) */
+	double   min;          /* DTMF_MIN_DB as tone energy in a frame */
+	char     cand;         /* key seen in the last frames */
+	uint32_t hits;         /* frames in a row with cand */
+	char     down;         /* key reported and still held */
+	uint32_t gaps;         /* frames in a row without it */
+};
+
+static double db_ratio(double db)
+{
+	return pow(10.0, db / 10.0);
+}
+
+int dtmf_alloc(struct dtmf **dp, uint32_t srate, uint32_t sampc)
+{
+	const double amp = 32767.0 * pow(10.0, DTMF_MIN_DB / 20.0);
+	struct dtmf *d;
+
+	/* the highest column tone must be well below Nyquist */
+	if (!dp || srate < 8000 || !sampc)
+		return EINVAL;
+
+	d = mem_zalloc(sizeof(*d), NULL);
+	if (!d)
+		return ENOMEM;
+
+	d->sampc = sampc;
+
+	for (size_t i = 0; i < RE_ARRAY_SIZE(freqv); i++)
+		d->coef[i] = 2.0 * cos(2.0 * M_PI * freqv[i] / srate);
+
+	/* a sine of amplitude a carries a^2 N / 2 over N samples */
+	d->min = amp * amp * sampc / 2.0;
+
+	dtmf_reset(d);
+
+	*dp = d;
+	return 0;
+}
+
+/** Forget any key in progress, e.g. for a new client */
+void dtmf_reset(struct dtmf *d)
+{
+	d->cand = 0;
+	d->hits = 0;
+	d->down = 0;
+	d->gaps = 0;
+}
+
+/** Index of the strongest of four tones, if it stands out enough */
+static int group_peak(const double *pv)
+{
+	const double peak = db_ratio(DTMF_PEAK_DB);
+	int best = 0;
+
+	for (int i = 1; i < 4; i++) {
+		if (pv[i] > pv[best])
+			best = i;
+	}
+
+	for (int i = 0; i < 4; i++) {
+		if (i != best && pv[i] * peak > pv[best])
+			return -1;
+	}
+
+	return best;
+}
+
+/** The key the frame holds, 0 for none */
+static char frame_key(const struct dtmf *d, const int16_t *sampv,
+		      size_t sampc, double *tonep)
+{
+	double s1[8] = {0}, s2[8] = {0}, pv[8];
+	double energy = 0;
+	int row, col;
+
+	for (size_t n = 0; n < sampc; n++) {
+		const double x = sampv[n];
+
+		energy += x * x;
+
+		for (int i = 0; i < 8; i++) {
+			const double s = x + d->coef[i] * s1[i] - s2[i];
+
+			s2[i] = s1[i];
+			s1[i] = s;
+		}
+	}
+
+	/* |X(f)|^2 is (a N / 2)^2 for a tone of amplitude a: scale it back
+	   to the tone's energy in the frame */
+	for (int i = 0; i < 8; i++) {
+		pv[i] = s1[i] * s1[i] + s2[i] * s2[i] -
+			d->coef[i] * s1[i] * s2[i];
+		pv[i] *= 2.0 / (double)sampc;
+	}
+
+	row = group_peak(pv);
+	col = group_peak(pv + 4);
+	if (row < 0 || col < 0)
+		return 0;
+
+	if (pv[row] < d->min || pv[4 + col] < d->min)
+		return 0;
+
+	if (pv[4 + col] * db_ratio(DTMF_TWIST_DB) < pv[row] ||
+	    pv[row] * db_ratio(DTMF_REVERSE_DB) < pv[4 + col])
+		return 0;
+
+	if (pv[row] + pv[4 + col] < DTMF_PURITY * energy)
+		return 0;
+
+	*tonep = pv[row] + pv[4 + col];
+
+	return keys[row][col];
+}
+
+/**
+ * Scheduler: one caller frame.  Returns the key that went down with
+ * it, or 0; levelp, if set, gets the level of its tone pair in dBFS.
+ */
+char dtmf_frame(struct dtmf *d, const int16_t *sampv, size_t sampc,
+		int *levelp)
+{
+	double tone = 0;
+	char key;
+
+	if (sampc != d->sampc)
+		return 0;
+
+	key = frame_key(d, sampv, sampc, &tone);
+
+	if (d->down) {
+		if (key == d->down) {
+			d->gaps = 0;
+			return 0;
+		}
+
+		if (++d->gaps < DTMF_GAPS)
+			return 0;
+
+		d->down = 0;
+	}
+
+	if (!key || key != d->cand) {
+		d->cand = key;
+		d->hits = key ? 1 : 0;
+	}
+	else {
+		++d->hits;
+	}
+
+	if (!key || d->hits < DTMF_HITS)
+		return 0;
+
+	d->down = key;
+	d->gaps = 0;
+	d->cand = 0;
+	d->hits = 0;
+
+	if (levelp) {
+		*levelp = (int)lround(10.0 * log10(tone / sampc /
+						   (32768.0 * 32768.0)));
+	}
+
+	return key;
+}
+
+/** Whether a key is down, i.e. the last frame was part of its tone */
+bool dtmf_held(const struct dtmf *d)
+{
+	return d && d->down;
+}
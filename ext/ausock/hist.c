@@ -0,0 +1,149 @@
+/**
+ * hist.c — lock-free latency histograms for the ausock_stats command
+ *
+ * HDR-style: values below HIST_SUB are counted exactly, above that
+ * every power of two is split into HIST_SUB linear buckets, so any
+ * recorded value is known to within 1/HIST_SUB (12.5 %) from a few
+ * hundred counters, whatever the range.  Values of 2^HIST_MSB_MAX and
+ * up share the top bucket; the exact maximum is kept on the side.
+ *
+ * One thread records (the scheduler), any thread may read or reset;
+ * counters are relaxed atomics, so a reader sees a histogram that may
+ * be a few samples behind, never a torn one.
+ */
+
+#include <re.h>
+#include <re_atomic.h>
+
+#include "ausock.h"
+
+#define HIST_SUB_BITS  3
+#define HIST_SUB       (1u << HIST_SUB_BITS)
+#define HIST_MSB_MAX   31
+#define HIST_BUCKETS   ((HIST_MSB_MAX - HIST_SUB_BITS + 2) * HIST_SUB)
+
+struct hist {
+	RE_ATOMIC uint32_t b[HIST_BUCKETS];
+	RE_ATOMIC uint64_t n;
+	RE_ATOMIC uint64_t sum;
+	RE_ATOMIC uint32_t max;
+};
+
+int hist_alloc(struct hist **hp)
+{
+	struct hist *h;
+
+	if (!hp)
+		return EINVAL;
+
+	h = mem_zalloc(sizeof(*h), NULL);
+	if (!h)
+		return ENOMEM;
+
+	*hp = h;
+	return 0;
+}
+
+void hist_reset(struct hist *h)
+{
+	if (!h)
+		return;
+
+	for (uint32_t i = 0; i < HIST_BUCKETS; i++)
+		re_atomic_rlx_set(&h->b[i], 0);
+
+	re_atomic_rlx_set(&h->n, 0);
+	re_atomic_rlx_set(&h->sum, 0);
+	re_atomic_rlx_set(&h->max, 0);
+}
+
+static uint32_t bucket(uint32_t v)
+{
+	uint32_t msb;
+
+	if (v < HIST_SUB)
+		return v;
+
+	msb = 31 - (uint32_t)__builtin_clz(v);
+
+	return (msb - HIST_SUB_BITS + 1) * HIST_SUB +
+	       ((v >> (msb - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/** Largest value that lands in bucket i */
+static uint32_t bucket_top(uint32_t i)
+{
+	const uint32_t g   = i / HIST_SUB;
+	const uint32_t sub = i % HIST_SUB;
+	uint32_t shift;
+
+	if (!g)
+		return i;
+
+	shift = g - 1;
+
+	return ((HIST_SUB + sub) << shift) + ((1u << shift) - 1);
+}
+
+void hist_record(struct hist *h, uint32_t v)
+{
+	if (!h)
+		return;
+
+	re_atomic_rlx_add(&h->b[bucket(v)], 1);
+	re_atomic_rlx_add(&h->n, 1);
+	re_atomic_rlx_add(&h->sum, v);
+
+	/* single writer: no compare-and-swap needed */
+	if (v > re_atomic_rlx(&h->max))
+		re_atomic_rlx_set(&h->max, v);
+}
+
+uint64_t hist_count(const struct hist *h)
+{
+	return h ? re_atomic_rlx(&h->n) : 0;
+}
+
+/** Value below which a fraction q of the samples lie; 0 if empty */
+uint32_t hist_quantile(const struct hist *h, double q)
+{
+	uint64_t n, rank, seen = 0;
+
+	if (!h)
+		return 0;
+
+	n = re_atomic_rlx(&h->n);
+	if (!n)
+		return 0;
+
+	rank = (uint64_t)(q * (double)n + 0.5);
+	if (rank < 1)
+		rank = 1;
+
+	for (uint32_t i = 0; i < HIST_BUCKETS; i++) {
+		seen += re_atomic_rlx(&h->b[i]);
+		if (seen >= rank) {
+			uint32_t top = bucket_top(i);
+			uint32_t max = re_atomic_rlx(&h->max);
+
+			return top < max ? top : max;
+		}
+	}
+
+	return re_atomic_rlx(&h->max);
+}
+
+/** {"n":..,"mean":..,"p50":..,"p90":..,"p99":..,"max":..} */
+int hist_print(struct re_printf *pf, const struct hist *h)
+{
+	uint64_t n = h ? re_atomic_rlx(&h->n) : 0;
+	uint64_t sum = h ? re_atomic_rlx(&h->sum) : 0;
+
+	return re_hprintf(pf, "{\"n\":%llu,\"mean\":%llu,\"p50\":%u,"
+			  "\"p90\":%u,\"p99\":%u,\"max\":%u}",
+			  (unsigned long long)n,
+			  (unsigned long long)(n ? sum / n : 0),
+			  hist_quantile(h, 0.50), hist_quantile(h, 0.90),
+			  hist_quantile(h, 0.99),
+			  h ? re_atomic_rlx(&h->max) : 0);
+}
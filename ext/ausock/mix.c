@@ -0,0 +1,782 @@
+/**
+ * mix.c — agent-side mixer: clips, ducking and comfort noise
+ *
+ * Runs on the scheduler thread in the rh() tick, once the agent frame
+ * of the tick has been dequeued (or concealed, or zero-filled), and
+ * mixes into it:
+ *
+ *   clips    short PCM files loaded once from ausock_clips — a
+ *            goodbye, filler while the LLM is thinking, hold audio —
+ *            started and stopped on one of AUSOCK_CLIP_VOICES voices
+ *            by the client's CLIP messages, each at its own gain.  A
+ *            DUCK clip drops by its duck_db while the agent talks
+ *            (filler under speech); an OVER clip drops the agent by
+ *            duck_db while it plays (a prompt over queued audio).
+ *   comfort  noise ausock_comfort_noise dB below full scale whenever
+ *   noise    neither the agent nor a clip is heard, so the line never
+ *            goes dead.
+ *
+ * Every gain moves linearly across the frame instead of stepping at
+ * its start.  Ducking sets in within a frame of the agent talking and
+ * lets go over MIX_RELEASE_MS; a stopped or replaced clip fades out
+ * over one frame.  Nothing clicks.
+ *
+ * Clips are WAV files (16-bit PCM, mono or stereo, at any rate that
+ * is a multiple of 50 Hz) named after the file.  Each is rendered to
+ * a call's rate with the resampler the first time it is asked for at
+ * that rate, on the main loop, and kept.  A CLIP therefore costs the
+ * main loop a lookup and the scheduler a few adds per sample.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include <re.h>
+
+#include "ausock.h"
+#include "ausock_proto.h"
+
+#define MIX_RELEASE_MS  300    /* ducking lets go over this */
+#define MIX_TALK_DB     -45    /* agent frames louder than this duck */
+#define MIX_CMDQ        16     /* CLIP requests waiting for the tick */
+#define CLIP_MAX_S      120    /* longest clip loaded */
+#define CLIP_BLOCK_HZ   50     /* rendered in 20 ms blocks */
+
+/** One clip at one sample rate */
+struct clip_pcm {
+	struct le le;
+	uint32_t  srate;
+	int16_t  *sampv;
+	size_t    n;
+	void     *owner;        /* holds sampv if set (phrase.c) */
+};
+
+struct clip {
+	struct le   le;
+	char        name[AUSOCK_CLIP_NAME];
+	struct list pcml;       /* struct clip_pcm; the file's rate first */
+};
+
+struct clips {
+	struct list l;          /* struct clip */
+};
+
+struct voice {
+	struct clip_pcm *pcm;   /* NULL: idle */
+	size_t   pos;
+	uint32_t seq;           /* of the CLIP that started it */
+	uint8_t  flags;
+	float    gain;          /* linear */
+	float    duck;          /* linear, while ducked */
+	float    cur;           /* gain at the end of the last frame */
+	bool     fading;        /* ends with this frame */
+	uint8_t  why;           /* enum ausock_clip_event once it has */
+	struct mix_play next;   /* starts once the fade is over */
+};
+
+struct mix {
+	uint32_t srate;
+	uint32_t sampc;
+	struct ring *cmdq;      /* struct mix_play, main loop → tick */
+	uint32_t gen;           /* client the voices belong to */
+	struct voice voice[AUSOCK_CLIP_VOICES];
+	float    step;          /* envelope release per frame */
+	float    talk;          /* agent talking envelope, 0..1 */
+	float    again;         /* agent gain at the end of the last frame */
+	float    cn_amp;        /* comfort noise, 0: off */
+	float    cn;            /* its envelope, 0..1 */
+	float    lp;            /* noise low-pass state */
+	uint32_t seed;
+	float   *acc;
+	mix_event_h *eh;
+	void    *arg;
+};
+
+
+static float db_gain(int db)
+{
+	return powf(10.0f, (float)db / 20.0f);
+}
+
+static void pcm_destructor(void *data)
+{
+	struct clip_pcm *pcm = data;
+
+	if (pcm->owner)
+		mem_deref(pcm->owner);
+	else
+		mem_deref(pcm->sampv);
+}
+
+static struct clip_pcm *pcm_alloc(uint32_t srate, size_t n)
+{
+	struct clip_pcm *pcm = mem_zalloc(sizeof(*pcm), pcm_destructor);
+
+	if (!pcm)
+		return NULL;
+
+	pcm->srate = srate;
+	pcm->n     = n;
+	pcm->sampv = mem_zalloc((n ? n : 1) * sizeof(int16_t), NULL);
+	if (!pcm->sampv)
+		return mem_deref(pcm);
+
+	return pcm;
+}
+
+/**
+ * A clip over n samples at srate that someone else keeps in memory:
+ * owner (a mem object) is referenced for as long as the clip lives.
+ */
+struct clip_pcm *clip_pcm_map(uint32_t srate, const int16_t *sampv,
+			      size_t n, void *owner)
+{
+	struct clip_pcm *pcm;
+
+	if (!srate || !sampv || !owner)
+		return NULL;
+
+	pcm = mem_zalloc(sizeof(*pcm), pcm_destructor);
+	if (!pcm)
+		return NULL;
+
+	pcm->srate = srate;
+	pcm->n     = n;
+	pcm->sampv = (int16_t *)sampv;   /* only ever read */
+	pcm->owner = mem_ref(owner);
+
+	return pcm;
+}
+
+static void clip_destructor(void *data)
+{
+	struct clip *clip = data;
+
+	list_flush(&clip->pcml);
+}
+
+static uint16_t le16(const uint8_t *p)
+{
+	return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t le32(const uint8_t *p)
+{
+	return (uint32_t)le16(p) | (uint32_t)le16(p + 2) << 16;
+}
+
+/** The samples of a 16-bit PCM WAV image, downmixed to mono */
+static int wav_parse(struct clip_pcm **pcmp, const uint8_t *buf,
+		     size_t len)
+{
+	const uint8_t *fmt = NULL, *data = NULL;
+	uint32_t fmtlen = 0, datalen = 0, srate, chans;
+	struct clip_pcm *pcm;
+	size_t off = 12;
+
+	if (len < 12 || memcmp(buf, "RIFF", 4) || memcmp(buf + 8, "WAVE", 4))
+		return EBADMSG;
+
+	while (off + 8 <= len) {
+		const uint32_t clen = le32(buf + off + 4);
+		const size_t avail = len - off - 8;
+
+		if (!memcmp(buf + off, "fmt ", 4)) {
+			fmt    = buf + off + 8;
+			fmtlen = (uint32_t)(clen < avail ? clen : avail);
+		} else if (!memcmp(buf + off, "data", 4)) {
+			data    = buf + off + 8;
+			datalen = (uint32_t)(clen < avail ? clen : avail);
+		}
+
+		if (clen > avail)
+			break;
+		off += 8 + clen + (clen & 1);
+	}
+
+	if (!fmt || fmtlen < 16 || !data)
+		return EBADMSG;
+
+	chans = le16(fmt + 2);
+	srate = le32(fmt + 4);
+
+	if (le16(fmt) != 1 || le16(fmt + 14) != 16 || chans < 1 ||
+	    chans > 2 || !srate || srate % CLIP_BLOCK_HZ)
+		return ENOTSUP;
+
+	if (datalen / (2 * chans) > (size_t)srate * CLIP_MAX_S)
+		return EFBIG;
+
+	pcm = pcm_alloc(srate, datalen / (2 * chans));
+	if (!pcm)
+		return ENOMEM;
+
+	for (size_t i = 0; i < pcm->n; i++) {
+		const uint8_t *p = data + i * 2 * chans;
+		int32_t v = (int16_t)le16(p);
+
+		if (chans == 2)
+			v = (v + (int16_t)le16(p + 2)) / 2;
+
+		pcm->sampv[i] = (int16_t)v;
+	}
+
+	*pcmp = pcm;
+	return 0;
+}
+
+static int clip_load(struct clip **clipp, const char *path,
+		     const char *name, size_t namelen)
+{
+	struct clip_pcm *pcm = NULL;
+	struct clip *clip;
+	uint8_t *buf = NULL;
+	long len;
+	FILE *f;
+	int err;
+
+	f = fopen(path, "rb");
+	if (!f)
+		return errno;
+
+	if (fseek(f, 0, SEEK_END) || (len = ftell(f)) < 0 ||
+	    fseek(f, 0, SEEK_SET)) {
+		err = errno ? errno : EIO;
+		goto out;
+	}
+
+	buf = mem_alloc((size_t)len + 1, NULL);
+	if (!buf) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	if (fread(buf, 1, (size_t)len, f) != (size_t)len) {
+		err = EIO;
+		goto out;
+	}
+
+	err = wav_parse(&pcm, buf, (size_t)len);
+	if (err)
+		goto out;
+
+	clip = mem_zalloc(sizeof(*clip), clip_destructor);
+	if (!clip) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	memcpy(clip->name, name, namelen);
+	list_append(&clip->pcml, &pcm->le, pcm);
+	pcm = NULL;
+
+	*clipp = clip;
+
+ out:
+	mem_deref(pcm);
+	mem_deref(buf);
+	fclose(f);
+
+	return err;
+}
+
+static void clips_destructor(void *data)
+{
+	struct clips *cl = data;
+
+	list_flush(&cl->l);
+}
+
+/**
+ * Every *.wav in dir.  Files that are not 16-bit PCM WAV (or whose
+ * name is too long) are skipped with a warning; ENOENT if none loads.
+ */
+int clips_load(struct clips **clp, const char *dir)
+{
+	struct clips *cl;
+	struct dirent *de;
+	DIR *d;
+
+	if (!clp || !dir)
+		return EINVAL;
+
+	d = opendir(dir);
+	if (!d)
+		return errno;
+
+	cl = mem_zalloc(sizeof(*cl), clips_destructor);
+	if (!cl) {
+		closedir(d);
+		return ENOMEM;
+	}
+
+	while ((de = readdir(d))) {
+		const size_t len = strlen(de->d_name);
+		struct clip *clip = NULL;
+		char path[512];
+		int err;
+
+		if (len <= 4 || strcasecmp(de->d_name + len - 4, ".wav"))
+			continue;
+
+		if (len - 4 >= AUSOCK_CLIP_NAME) {
+			warning("ausock: clip %s: name too long\n", de->d_name);
+			continue;
+		}
+
+		re_snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+
+		err = clip_load(&clip, path, de->d_name, len - 4);
+		if (err) {
+			warning("ausock: clip %s: not loaded (%m)\n", path, err);
+			continue;
+		}
+
+		list_append(&cl->l, &clip->le, clip);
+	}
+
+	closedir(d);
+
+	if (list_isempty(&cl->l)) {
+		mem_deref(cl);
+		return ENOENT;
+	}
+
+	*clp = cl;
+	return 0;
+}
+
+uint32_t clips_count(const struct clips *cl)
+{
+	return cl ? list_count(&cl->l) : 0;
+}
+
+/** The clip as loaded, converted to srate */
+static int pcm_render(struct clip_pcm **pcmp, const struct clip_pcm *src,
+		      uint32_t srate)
+{
+	const uint32_t in  = src->srate / CLIP_BLOCK_HZ;
+	const uint32_t out = srate / CLIP_BLOCK_HZ;
+	const size_t blocks = (src->n + in - 1) / in + 1;   /* + flush */
+	struct clip_pcm *pcm;
+	struct resamp *rs;
+	int16_t *x, *y;
+	int err;
+
+	err = resamp_alloc(&rs, src->srate, srate, in, out);
+	if (err)
+		return err;
+
+	pcm = pcm_alloc(srate, (size_t)((uint64_t)src->n * srate /
+					 src->srate));
+	x = mem_alloc(in * sizeof(int16_t), NULL);
+	y = mem_alloc(out * sizeof(int16_t), NULL);
+	if (!pcm || !x || !y) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	for (size_t b = 0, i = 0, o = 0; b < blocks; b++, i += in) {
+		const size_t take = i < src->n ?
+			(src->n - i < in ? src->n - i : in) : 0;
+
+		memset(x, 0, in * sizeof(int16_t));
+		if (take)
+			memcpy(x, src->sampv + i, take * sizeof(int16_t));
+
+		resamp_frame(rs, y, x);
+
+		for (uint32_t k = 0; k < out && o < pcm->n; k++)
+			pcm->sampv[o++] = y[k];
+	}
+
+ out:
+	mem_deref(y);
+	mem_deref(x);
+	mem_deref(rs);
+
+	if (err)
+		mem_deref(pcm);
+	else
+		*pcmp = pcm;
+
+	return err;
+}
+
+/**
+ * Main loop: clip name at srate, rendered on first use at that rate.
+ * The caller gets a reference.  ENOENT if there is no such clip.
+ */
+int clips_get(struct clips *cl, struct clip_pcm **pcmp, const char *name,
+	      uint32_t srate)
+{
+	struct clip_pcm *pcm;
+	struct clip *clip = NULL;
+	struct le *le;
+	int err;
+
+	if (!cl || !pcmp || !name || !srate)
+		return EINVAL;
+
+	for (le = list_head(&cl->l); le; le = le->next) {
+		struct clip *c = le->data;
+
+		if (!strcmp(c->name, name)) {
+			clip = c;
+			break;
+		}
+	}
+
+	if (!clip)
+		return ENOENT;
+
+	for (le = list_head(&clip->pcml); le; le = le->next) {
+		pcm = le->data;
+
+		if (pcm->srate == srate) {
+			*pcmp = mem_ref(pcm);
+			return 0;
+		}
+	}
+
+	err = pcm_render(&pcm, list_head(&clip->pcml)->data, srate);
+	if (err)
+		return err;
+
+	list_append(&clip->pcml, &pcm->le, pcm);
+
+	*pcmp = mem_ref(pcm);
+	return 0;
+}
+
+
+static void voice_clear(struct voice *v)
+{
+	v->pcm      = mem_deref(v->pcm);
+	v->next.pcm = mem_deref(v->next.pcm);
+	v->fading   = false;
+}
+
+static void mix_destructor(void *data)
+{
+	struct mix *mix = data;
+	const struct mix_play *p;
+
+	for (uint32_t i = 0; i < AUSOCK_CLIP_VOICES; i++)
+		voice_clear(&mix->voice[i]);
+
+	while (mix->cmdq && (p = ring_read_ptr(mix->cmdq))) {
+		mem_deref(p->pcm);
+		ring_read_commit(mix->cmdq);
+	}
+
+	mem_deref(mix->cmdq);
+	mem_deref(mix->acc);
+}
+
+/**
+ * Mixer for sampc-sample frames at srate.  cn_db: comfort noise level
+ * below full scale, 0 for none.  eh is called on the scheduler thread
+ * each time a voice ends.
+ */
+int mix_alloc(struct mix **mixp, uint32_t srate, uint32_t sampc,
+	      uint32_t ptime, uint32_t cn_db, mix_event_h *eh, void *arg)
+{
+	struct mix *mix;
+	int err;
+
+	if (!mixp || !srate || !sampc || !ptime)
+		return EINVAL;
+
+	mix = mem_zalloc(sizeof(*mix), mix_destructor);
+	if (!mix)
+		return ENOMEM;
+
+	mix->srate  = srate;
+	mix->sampc  = sampc;
+	mix->step   = (float)ptime / MIX_RELEASE_MS;
+	mix->again  = 1;
+	mix->cn_amp = cn_db ? 32768.0f * db_gain(-(int)cn_db) : 0;
+	mix->seed   = 0x6d2b79f5;
+	mix->eh     = eh;
+	mix->arg    = arg;
+
+	err = ring_alloc(&mix->cmdq, sizeof(struct mix_play), MIX_CMDQ);
+	if (err)
+		goto out;
+
+	mix->acc = mem_alloc(sampc * sizeof(float), NULL);
+	if (!mix->acc)
+		err = ENOMEM;
+
+ out:
+	if (err)
+		mem_deref(mix);
+	else
+		*mixp = mix;
+
+	return err;
+}
+
+/**
+ * Main loop: queue a CLIP for the next tick.  On success the mixer
+ * owns p->pcm; ENOSPC if the queue is full.
+ */
+int mix_play(struct mix *mix, const struct mix_play *p)
+{
+	struct mix_play *slot;
+
+	if (!mix || !p || p->voice >= AUSOCK_CLIP_VOICES)
+		return EINVAL;
+
+	slot = ring_write_ptr(mix->cmdq);
+	if (!slot)
+		return ENOSPC;
+
+	*slot = *p;
+	ring_write_commit(mix->cmdq);
+
+	return 0;
+}
+
+static void mix_event(struct mix *mix, uint32_t voice, uint32_t seq,
+		      uint8_t event)
+{
+	if (mix->eh)
+		mix->eh((uint8_t)voice, seq, event, mix->arg);
+}
+
+/** Gain a voice is heading for with the ducking where it ends up */
+static float voice_target(const struct mix *mix, const struct voice *v)
+{
+	if (v->fading)
+		return 0;
+
+	if (v->flags & AUSOCK_CLIP_DUCK)
+		return v->gain * (1 - mix->talk * (1 - v->duck));
+
+	return v->gain;
+}
+
+static void voice_start(struct mix *mix, struct voice *v,
+			const struct mix_play *p)
+{
+	v->pcm    = p->pcm;
+	v->pos    = 0;
+	v->seq    = p->seq;
+	v->flags  = p->flags;
+	v->gain   = db_gain(p->gain_db);
+	v->duck   = db_gain(-(int)p->duck_db);
+	v->fading = false;
+	v->cur    = voice_target(mix, v);
+}
+
+/** Fade a voice out over the next frame, and drop what was queued */
+static void voice_end(struct mix *mix, uint32_t i, uint8_t why)
+{
+	struct voice *v = &mix->voice[i];
+
+	if (v->next.pcm) {
+		mix_event(mix, i, v->next.seq, why);
+		v->next.pcm = mem_deref(v->next.pcm);
+	}
+
+	if (v->pcm && !v->fading) {
+		v->fading = true;
+		v->why    = why;
+	}
+}
+
+static void mix_cmds(struct mix *mix)
+{
+	const struct mix_play *p;
+
+	while ((p = ring_read_ptr(mix->cmdq))) {
+		struct voice *v = &mix->voice[p->voice];
+		struct mix_play cmd = *p;
+
+		ring_read_commit(mix->cmdq);
+
+		/* queued by a client that has gone since */
+		if (cmd.gen != mix->gen) {
+			mem_deref(cmd.pcm);
+			continue;
+		}
+
+		voice_end(mix, p->voice, AUSOCK_CLIP_STOPPED);
+
+		if (!cmd.pcm)
+			continue;
+
+		if (v->pcm)
+			v->next = cmd;
+		else
+			voice_start(mix, v, &cmd);
+	}
+}
+
+/** Scheduler: drop every voice whenever a new client has connected */
+void mix_sync(struct mix *mix, uint32_t gen)
+{
+	if (!mix || mix->gen == gen)
+		return;
+
+	for (uint32_t i = 0; i < AUSOCK_CLIP_VOICES; i++)
+		voice_clear(&mix->voice[i]);
+
+	mix->gen   = gen;
+	mix->talk  = 0;
+	mix->again = 1;
+}
+
+/** Scheduler: a barge-in fades out every clip not flagged KEEP */
+void mix_interrupt(struct mix *mix)
+{
+	if (!mix)
+		return;
+
+	for (uint32_t i = 0; i < AUSOCK_CLIP_VOICES; i++) {
+		const struct voice *v = &mix->voice[i];
+
+		if (v->pcm && !(v->flags & AUSOCK_CLIP_KEEP))
+			voice_end(mix, i, AUSOCK_CLIP_BARGEIN);
+	}
+}
+
+/** Add one frame of a voice to acc; true once it has run out */
+static bool voice_mix(struct mix *mix, struct voice *v, float *acc)
+{
+	const float g0 = v->cur;
+	const float g1 = voice_target(mix, v);
+	const float dg = (g1 - g0) / mix->sampc;
+	const struct clip_pcm *pcm = v->pcm;
+	bool done = false;
+
+	for (uint32_t i = 0; i < mix->sampc; i++) {
+		if (v->pos >= pcm->n) {
+			if (!(v->flags & AUSOCK_CLIP_LOOP) || !pcm->n) {
+				done = true;
+				break;
+			}
+			v->pos = 0;
+		}
+
+		acc[i] += (g0 + dg * i) * pcm->sampv[v->pos++];
+	}
+
+	v->cur = g1;
+
+	return done || (v->pos >= pcm->n && !(v->flags & AUSOCK_CLIP_LOOP));
+}
+
+static float noise(struct mix *mix)
+{
+	mix->seed = mix->seed * 1664525u + 1013904223u;
+
+	/* uniform in [-1, 1) */
+	return (float)(int32_t)mix->seed / 2147483648.0f;
+}
+
+/**
+ * Scheduler: mix the clips and comfort noise into the agent frame in
+ * sampv.  agent: sampv holds agent audio rather than zero-fill.
+ * Returns true if anything was added.
+ */
+bool mix_frame(struct mix *mix, int16_t *sampv, bool agent)
+{
+	const uint32_t n = mix->sampc;
+	float *acc = mix->acc;
+	float over = 1, a0, a1, c0, c1;
+	bool busy = false, added = false;
+
+	mix_cmds(mix);
+
+	/* the agent talking ducks DUCK clips at once, and lets go slowly */
+	if (agent && vad_level(sampv, n) > MIX_TALK_DB)
+		mix->talk = 1;
+	else if (mix->talk > mix->step)
+		mix->talk -= mix->step;
+	else
+		mix->talk = 0;
+
+	for (uint32_t i = 0; i < AUSOCK_CLIP_VOICES; i++) {
+		const struct voice *v = &mix->voice[i];
+
+		if (!v->pcm)
+			continue;
+
+		busy = true;
+		if ((v->flags & AUSOCK_CLIP_OVER) && !v->fading &&
+		    v->duck < over)
+			over = v->duck;
+	}
+
+	/* OVER clips duck the agent the same way */
+	a0 = mix->again;
+	a1 = over < a0 ? over : (a0 + mix->step < over ? a0 + mix->step :
+				 over);
+	mix->again = a1;
+
+	for (uint32_t i = 0; i < n; i++)
+		acc[i] = (a0 + (a1 - a0) * i / n) * sampv[i];
+
+	for (uint32_t i = 0; i < AUSOCK_CLIP_VOICES; i++) {
+		struct voice *v = &mix->voice[i];
+		bool done;
+
+		if (!v->pcm)
+			continue;
+
+		done = voice_mix(mix, v, acc);
+		added = true;
+
+		if (!done && !v->fading)
+			continue;
+
+		mix_event(mix, i, v->seq,
+			  v->fading ? v->why : AUSOCK_CLIP_DONE);
+		v->pcm    = mem_deref(v->pcm);
+		v->fading = false;
+
+		if (v->next.pcm) {
+			struct mix_play next = v->next;
+
+			v->next.pcm = NULL;
+			voice_start(mix, v, &next);
+		}
+	}
+
+	/* comfort noise fades in over the silence, out under anything */
+	c0 = mix->cn;
+	if (!mix->cn_amp || busy || mix->talk > 0)
+		c1 = 0;
+	else
+		c1 = c0 + mix->step < 1 ? c0 + mix->step : 1;
+	mix->cn = c1;
+
+	if (c0 > 0 || c1 > 0) {
+		for (uint32_t i = 0; i < n; i++) {
+			/* one-pole low-pass: softer than white, rms 1/3 */
+			mix->lp += 0.5f * (noise(mix) - mix->lp);
+			acc[i] += (c0 + (c1 - c0) * i / n) * 3 * mix->cn_amp *
+				  mix->lp;
+		}
+		added = true;
+	}
+
+	if (!added && a0 == 1 && a1 == 1)
+		return false;
+
+	for (uint32_t i = 0; i < n; i++) {
+		const float v = acc[i];
+
+		sampv[i] = v >= 32767 ? 32767 : v <= -32768 ? -32768 :
+			   (int16_t)lrintf(v);
+	}
+
+	return added;
+}
@@ -0,0 +1,251 @@
+/**
+ * phrase.c — pre-rendered phrases from a memory-mapped file
+ *
+ * With ausock_phrases <file>, CLIP names that are not WAV clips are
+ * looked up in a phrase cache the client renders ahead of time with
+ * its own TTS voice (bin/phrases): greetings, fillers, goodbyes.  The
+ * file (layout in ausock_proto.h) holds every phrase already at the
+ * call's rate, so a CLIP plays straight out of the mapping, with no
+ * decode, no resampling and no copy: the main loop looks the name up,
+ * and the tick mixes from the mapped pages.
+ *
+ * The client adds phrases by writing a new file and renaming it over
+ * the old one.  A name that is not in the mapping makes the main loop
+ * stat the file, and map it afresh if it is a different file now.
+ * Clips still playing keep a reference to the mapping they came from,
+ * which goes away (munmap) with the last of them.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <re.h>
+
+#include "ausock.h"
+#include "ausock_proto.h"
+
+#ifdef __APPLE__                /* macOS: st_mtimespec */
+#define st_mtim st_mtimespec
+#endif
+
+/** One mapping of the file */
+struct phrase_map {
+	void   *base;
+	size_t  size;
+	const struct ausock_phrase_ent *entv;
+	uint32_t count;
+};
+
+struct phrases {
+	char   path[256];
+	struct phrase_map *map;      /* NULL: no usable file yet */
+	dev_t  dev;                  /* of the file last looked at */
+	ino_t  ino;
+	off_t  size;
+	struct timespec mtime;
+};
+
+static void map_destructor(void *data)
+{
+	struct phrase_map *m = data;
+
+	if (m->base)
+		munmap(m->base, m->size);
+}
+
+/** Every entry must lie within the file, samples 2-byte aligned */
+static int map_check(const struct phrase_map *m)
+{
+	const struct ausock_phrase_hdr *hdr = m->base;
+	uint64_t end;
+
+	if (m->size < sizeof(*hdr) ||
+	    memcmp(hdr->magic, AUSOCK_PHRASE_MAGIC, sizeof(hdr->magic)))
+		return EBADMSG;
+
+	if (hdr->version != AUSOCK_PHRASE_VERSION)
+		return ENOTSUP;
+
+	end = sizeof(*hdr) + (uint64_t)hdr->count * sizeof(*m->entv);
+	if (end > m->size)
+		return EBADMSG;
+
+	for (uint32_t i = 0; i < hdr->count; i++) {
+		const struct ausock_phrase_ent *e = &m->entv[i];
+
+		if (!memchr(e->name, '\0', sizeof(e->name)) || !e->srate ||
+		    e->offset % sizeof(int16_t) || e->offset < end ||
+		    e->offset > m->size ||
+		    (uint64_t)e->samples * sizeof(int16_t) >
+		    m->size - e->offset)
+			return EBADMSG;
+	}
+
+	return 0;
+}
+
+static int map_open(struct phrase_map **mp, int fd, size_t size)
+{
+	struct phrase_map *m;
+	int err;
+
+	m = mem_zalloc(sizeof(*m), map_destructor);
+	if (!m)
+		return ENOMEM;
+
+	m->base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (m->base == MAP_FAILED) {
+		m->base = NULL;
+		err = errno;
+		goto out;
+	}
+
+	m->size = size;
+	m->entv = (const void *)((const uint8_t *)m->base +
+				 sizeof(struct ausock_phrase_hdr));
+	m->count = ((const struct ausock_phrase_hdr *)m->base)->count;
+
+	err = map_check(m);
+	if (err)
+		goto out;
+
+	/* the first CLIP should not wait for the disk */
+	(void)madvise(m->base, size, MADV_WILLNEED);
+
+ out:
+	if (err)
+		mem_deref(m);
+	else
+		*mp = m;
+
+	return err;
+}
+
+/** Map the file again if it has been replaced since */
+static int phrases_reload(struct phrases *ph)
+{
+	struct phrase_map *m = NULL;
+	struct stat st;
+	int fd, err;
+
+	fd = open(ph->path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return errno;
+
+	if (fstat(fd, &st)) {
+		err = errno;
+		goto out;
+	}
+
+	if (st.st_dev == ph->dev && st.st_ino == ph->ino &&
+	    st.st_size == ph->size &&
+	    st.st_mtim.tv_sec == ph->mtime.tv_sec &&
+	    st.st_mtim.tv_nsec == ph->mtime.tv_nsec) {
+		err = 0;        /* the same file: nothing new in it */
+		goto out;
+	}
+
+	ph->dev   = st.st_dev;
+	ph->ino   = st.st_ino;
+	ph->size  = st.st_size;
+	ph->mtime = st.st_mtim;
+
+	err = map_open(&m, fd, (size_t)st.st_size);
+	if (err) {
+		warning("ausock: phrases %s: not loaded (%m)\n",
+			ph->path, err);
+		goto out;
+	}
+
+	mem_deref(ph->map);
+	ph->map = m;
+
+	info("ausock: %u phrases mapped from %s\n", m->count, ph->path);
+
+ out:
+	close(fd);
+	return err;
+}
+
+static void phrases_destructor(void *data)
+{
+	struct phrases *ph = data;
+
+	mem_deref(ph->map);
+}
+
+/**
+ * Phrases from path.  A file that is missing or unusable yet is not
+ * an error: it is looked for again on the first name not found.
+ */
+int phrases_alloc(struct phrases **php, const char *path)
+{
+	struct phrases *ph;
+
+	if (!php || !path || !*path)
+		return EINVAL;
+
+	ph = mem_zalloc(sizeof(*ph), phrases_destructor);
+	if (!ph)
+		return ENOMEM;
+
+	strncpy(ph->path, path, sizeof(ph->path) - 1);
+	(void)phrases_reload(ph);
+
+	*php = ph;
+	return 0;
+}
+
+uint32_t phrases_count(const struct phrases *ph)
+{
+	return ph && ph->map ? ph->map->count : 0;
+}
+
+static const struct ausock_phrase_ent *
+map_find(const struct phrase_map *m, const char *name)
+{
+	if (!m)
+		return NULL;
+
+	for (uint32_t i = 0; i < m->count; i++) {
+		if (!strcmp(m->entv[i].name, name))
+			return &m->entv[i];
+	}
+
+	return NULL;
+}
+
+/**
+ * Main loop: phrase name at srate.  The caller gets a reference.
+ * ENOENT if there is no such phrase, or not at that rate.
+ */
+int phrases_get(struct phrases *ph, struct clip_pcm **pcmp,
+		const char *name, uint32_t srate)
+{
+	const struct ausock_phrase_ent *e;
+	struct clip_pcm *pcm;
+
+	if (!ph || !pcmp || !name || !srate)
+		return EINVAL;
+
+	e = map_find(ph->map, name);
+	if (!e && !phrases_reload(ph))
+		e = map_find(ph->map, name);
+
+	if (!e || e->srate != srate)
+		return ENOENT;
+
+	pcm = clip_pcm_map(e->srate,
+			   (const int16_t *)((const uint8_t *)ph->map->base +
+					     e->offset),
+			   e->samples, ph->map);
+	if (!pcm)
+		return ENOMEM;
+
+	*pcmp = pcm;
+	return 0;
+}
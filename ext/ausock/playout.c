@@ -0,0 +1,326 @@
+/**
+ * playout.c — adaptive playout depth and loss concealment for agent audio
+ *
+ * Runs on the scheduler thread beside rh(), over the ring of agent
+ * frames the client fills.
+ *
+ * Depth: the ring is the playout buffer, and the target is how many
+ * frames it should hold ahead of rh().  A talkspurt only starts
+ * playing once target frames are queued (or it has waited that long),
+ * so the client has that much slack.  A frame that shows up while its
+ * slot is being concealed arrived late: the target grows by the frames
+ * it missed.  The target shrinks again by one frame each PO_DECAY_MS
+ * without a late frame, and whenever the queue never dropped below
+ * target over PO_WINDOW_MS, the excess is removed by skipping silent
+ * frames (pauses between words), so latency is shed without cutting
+ * speech.
+ *
+ * Concealment: when the ring runs dry mid-talkspurt, the last pitch
+ * period of the agent audio (normalised autocorrelation over the
+ * last two longest periods) is repeated with a linear fade over
+ * PLC_FADE_MS, blending into comfort noise at the agent's own noise
+ * floor.  Audio that resumes within PLC_MAX_MS is crossfaded in over
+ * a quarter frame; after that the talkspurt is over and silence
+ * follows, as without concealment.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include <re.h>
+
+#include "ausock.h"
+
+#define PO_START         2      /* target at the start of a call, frames */
+#define PO_MIN           1
+#define PO_WINDOW_MS     1000   /* excess depth is measured over this */
+#define PO_DECAY_MS      10000  /* no late frame this long: target - 1 */
+#define PO_DROP_DB       -50    /* frames quieter than this may be skipped */
+#define PLC_MIN_PITCH_HZ 400
+#define PLC_MAX_PITCH_HZ 66
+#define PLC_FADE_MS      60     /* repetition fades out over this */
+#define PLC_MAX_MS       200    /* concealment after which the spurt is over */
+#define PLC_CN_MAX       104    /* comfort noise rms cap, ~-50 dBFS */
+
+struct playout {
+	uint32_t srate;
+	uint32_t sampc;
+	uint32_t ptime;
+
+	/* depth */
+	uint32_t target;       /* frames */
+	uint32_t max;
+	bool     active;       /* in a talkspurt (or concealing one) */
+	uint32_t waited;       /* ticks spent prebuffering */
+	uint32_t wmin;         /* lowest depth this window */
+	uint32_t wticks;
+	uint32_t excess;       /* silent frames still to skip */
+	uint32_t calm;         /* ticks since the last late frame */
+
+	/* concealment */
+	int16_t *hist;         /* last played agent audio */
+	uint32_t nhist;
+	uint32_t minlag, maxlag;
+	uint32_t pitch;        /* of the current loss, samples */
+	uint32_t lost;         /* frames concealed in a row */
+	uint64_t k;            /* samples concealed so far */
+	uint32_t fade;         /* samples the repetition fades over */
+	float    floor;        /* agent noise floor, rms */
+	uint32_t seed;
+	int16_t *tail;         /* continuation crossfaded into new audio */
+};
+
+static void playout_destructor(void *data)
+{
+	struct playout *po = data;
+
+	mem_deref(po->hist);
+	mem_deref(po->tail);
+}
+
+/** max_frames: ring capacity, the most the target can grow to */
+int playout_alloc(struct playout **pop, uint32_t srate, uint32_t sampc,
+		  uint32_t ptime, uint32_t max_frames)
+{
+	struct playout *po;
+	int err = 0;
+
+	if (!pop || !srate || !sampc || !ptime || !max_frames)
+		return EINVAL;
+
+	po = mem_zalloc(sizeof(*po), playout_destructor);
+	if (!po)
+		return ENOMEM;
+
+	po->srate  = srate;
+	po->sampc  = sampc;
+	po->ptime  = ptime;
+	po->max    = max_frames > PO_MIN ? max_frames - 1 : PO_MIN;
+	po->minlag = srate / PLC_MIN_PITCH_HZ;
+	po->maxlag = srate / PLC_MAX_PITCH_HZ;
+	po->nhist  = 2 * po->maxlag > sampc ? 2 * po->maxlag : sampc;
+	po->fade   = srate * PLC_FADE_MS / 1000;
+
+	po->hist = mem_zalloc(po->nhist * sizeof(int16_t), NULL);
+	po->tail = mem_zalloc(sampc * sizeof(int16_t), NULL);
+	if (!po->hist || !po->tail) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	playout_reset(po);
+
+ out:
+	if (err)
+		mem_deref(po);
+	else
+		*pop = po;
+
+	return err;
+}
+
+/** Back to the starting depth with no history, e.g. for a new client */
+void playout_reset(struct playout *po)
+{
+	memset(po->hist, 0, po->nhist * sizeof(int16_t));
+
+	po->target = PO_START < po->max ? PO_START : po->max;
+	po->active = false;
+	po->waited = 0;
+	po->wmin   = UINT32_MAX;
+	po->wticks = 0;
+	po->excess = 0;
+	po->calm   = 0;
+	po->lost   = 0;
+	po->floor  = 0;
+	po->seed   = 0x2545f491;
+}
+
+uint32_t playout_target(const struct playout *po)
+{
+	return po->target;
+}
+
+/** The talkspurt ended on purpose (barge-in): nothing to conceal */
+void playout_stop(struct playout *po)
+{
+	po->active = false;
+	po->waited = 0;
+	po->lost   = 0;
+}
+
+/**
+ * Before dequeuing, with depth frames queued.  false while a new
+ * talkspurt is still filling up to the target.
+ */
+bool playout_ready(struct playout *po, uint32_t depth)
+{
+	if (po->active)
+		return true;
+
+	if (!depth) {
+		po->waited = 0;
+		return false;
+	}
+
+	if (depth < po->target && ++po->waited < po->target)
+		return false;
+
+	po->active = true;
+	po->waited = 0;
+	return true;
+}
+
+/**
+ * Once per tick while playing, with depth frames queued and sampv the
+ * head frame (NULL if there is none or it cannot be skipped).  true if
+ * the head frame should be skipped to shed excess latency.
+ */
+bool playout_drop(struct playout *po, const int16_t *sampv, uint32_t depth)
+{
+	const uint32_t window = PO_WINDOW_MS / po->ptime;
+
+	if (depth < po->wmin)
+		po->wmin = depth;
+
+	if (++po->wticks >= window) {
+		/* one frame is always in flight, the rest is slack */
+		if (po->wmin != UINT32_MAX && po->wmin > po->target + 1)
+			po->excess = po->wmin - po->target - 1;
+
+		po->wmin   = UINT32_MAX;
+		po->wticks = 0;
+	}
+
+	if (++po->calm >= PO_DECAY_MS / po->ptime) {
+		if (po->target > PO_MIN)
+			--po->target;
+		po->calm = 0;
+	}
+
+	if (!sampv || !po->excess || depth <= po->target + 1 ||
+	    vad_level(sampv, po->sampc) > PO_DROP_DB)
+		return false;
+
+	--po->excess;
+	return true;
+}
+
+static float noise(struct playout *po)
+{
+	po->seed = po->seed * 1664525u + 1013904223u;
+
+	/* uniform in [-1, 1), rms 1/sqrt(3) */
+	return (float)(int32_t)po->seed / 2147483648.0f;
+}
+
+/** Next concealment sample: faded repetition plus comfort noise */
+static int16_t conceal_sample(struct playout *po)
+{
+	const int16_t *period = po->hist + po->nhist - po->pitch;
+	float g = po->k < po->fade ? 1.0f - (float)po->k / po->fade : 0;
+	float v = g * period[po->k % po->pitch] +
+		  (1 - g) * po->floor * 1.7320508f * noise(po);
+
+	++po->k;
+
+	return (int16_t)lrintf(v);
+}
+
+static uint32_t find_pitch(const struct playout *po)
+{
+	const int16_t *x = po->hist + po->nhist - po->maxlag;
+	double best = 0;
+	uint32_t pitch = po->maxlag;
+
+	for (uint32_t lag = po->minlag; lag <= po->maxlag; lag++) {
+		double xy = 0, yy = 0;
+
+		for (uint32_t i = 0; i < po->maxlag; i++) {
+			double y = x[(int32_t)i - (int32_t)lag];
+
+			xy += x[i] * y;
+			yy += y * y;
+		}
+
+		if (yy > 0 && xy / sqrt(yy) > best) {
+			best  = xy / sqrt(yy);
+			pitch = lag;
+		}
+	}
+
+	return pitch;
+}
+
+/** A real agent frame is about to go to rh() */
+void playout_played(struct playout *po, int16_t *sampv)
+{
+	const uint32_t n = po->sampc;
+	double sum = 0;
+	float rms;
+
+	po->active = true;
+
+	if (po->lost) {
+		const uint32_t ov = n / 4;
+
+		/* it came while its slot was being concealed: late */
+		po->target += po->lost;
+		if (po->target > po->max)
+			po->target = po->max;
+		po->calm = 0;
+
+		for (uint32_t i = 0; i < ov; i++)
+			po->tail[i] = conceal_sample(po);
+
+		for (uint32_t i = 0; i < ov; i++) {
+			const float w = (float)i / ov;
+
+			sampv[i] = (int16_t)lrintf((1 - w) * po->tail[i] +
+						   w * sampv[i]);
+		}
+
+		po->lost = 0;
+	}
+
+	memmove(po->hist, po->hist + n, (po->nhist - n) * sizeof(int16_t));
+	memcpy(po->hist + po->nhist - n, sampv, n * sizeof(int16_t));
+
+	for (uint32_t i = 0; i < n; i++)
+		sum += (double)sampv[i] * sampv[i];
+	rms = (float)sqrt(sum / n);
+
+	/* drops at once, rises ~0.5 dB a frame, never louder than the cap */
+	if (rms < po->floor)
+		po->floor = rms;
+	else
+		po->floor += 0.06f * po->floor + 0.5f;
+	if (po->floor > PLC_CN_MAX)
+		po->floor = PLC_CN_MAX;
+}
+
+/**
+ * The ring ran dry at the deadline.  Fills sampv and returns true
+ * while the talkspurt is being concealed, false once it is over (or
+ * none was playing) and sampv should be silence.
+ */
+bool playout_conceal(struct playout *po, int16_t *sampv)
+{
+	if (!po->active)
+		return false;
+
+	if (po->lost * po->ptime >= PLC_MAX_MS) {
+		playout_stop(po);
+		return false;
+	}
+
+	if (!po->lost++) {
+		po->pitch = find_pitch(po);
+		po->k     = 0;
+	}
+
+	for (uint32_t i = 0; i < po->sampc; i++)
+		sampv[i] = conceal_sample(po);
+
+	return true;
+}
@@ -0,0 +1,404 @@
+/**
+ * rec.c — two-leg call recorder (ausock_record)
+ *
+ * The scheduler hands every caller frame (straight out of wh(), before
+ * echo cancellation) and every agent frame (exactly as given to rh())
+ * to rec_frame(), which only copies it into a lock-free ring.  A
+ * background thread at idle priority drains that ring every
+ * REC_FLUSH_MS and writes a stereo WAV file: caller on the left,
+ * agent on the right.
+ *
+ * Frames are placed by the deadline of the tick that produced them,
+ * not by arrival order.  All ticks sit on one grid (sched.c), so the
+ * two legs line up to the sample, and a tick the scheduler skipped
+ * leaves silence where it belongs instead of shifting the rest of the
+ * recording.  That makes the file usable for measuring echo paths
+ * and round-trip latency offline.
+ *
+ * The writer keeps REC_HOLD_MS of interleaved audio staged, so both
+ * legs of a moment are in place before it goes to disk.  The WAV
+ * sizes are filled in when the recording is closed.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE 1           /* SCHED_IDLE */
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <re.h>
+#include <re_atomic.h>
+
+#include "ausock.h"
+
+#define REC_RING_MS  2000   /* frames the writer may fall behind by */
+#define REC_FLUSH_MS 100    /* writer wakeup interval */
+#define REC_HOLD_MS  200    /* staged before writing, for the slower leg */
+#define REC_STAGE_MS 1000
+#define WAV_HDR      44
+
+/** Ring slot header; the frame's samples follow */
+struct rec_hdr {
+	uint64_t ts;            /* tick deadline, us */
+	uint32_t leg;           /* enum rec_leg */
+	uint32_t reserved;
+};
+
+struct rec {
+	struct ring *ring;
+	FILE     *f;
+	uint32_t  srate;
+	uint32_t  sampc;
+
+	/* writer thread */
+	thrd_t    thread;
+	bool      thread_ok;
+	mtx_t     mtx;          /* only for the writer's sleep */
+	cnd_t     cnd;
+	RE_ATOMIC bool run;
+	int16_t  *stage;        /* interleaved caller/agent, circular */
+	uint32_t  cap;          /* stereo samples staged */
+	uint64_t  base;         /* position of the oldest staged sample */
+	uint64_t  end;          /* one past the newest */
+	uint64_t  t0;           /* deadline of position 0 */
+	bool      started;
+	uint64_t  written;      /* stereo samples on disk */
+	int       err;
+
+	RE_ATOMIC uint32_t drops;   /* frames the ring could not take */
+	RE_ATOMIC uint32_t late;    /* frames older than what was written */
+};
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+	put_le16(p, (uint16_t)v);
+	put_le16(p + 2, (uint16_t)(v >> 16));
+}
+
+/** Canonical 44-byte header of 16-bit stereo PCM */
+static int wav_header(FILE *f, uint32_t srate, uint64_t frames)
+{
+	const uint64_t max = (UINT32_MAX - WAV_HDR) / 4;
+	const uint32_t data = (uint32_t)(frames < max ? frames : max) * 4;
+	uint8_t h[WAV_HDR];
+
+	memcpy(h, "RIFF", 4);
+	put_le32(h + 4, 36 + data);
+	memcpy(h + 8, "WAVEfmt ", 8);
+	put_le32(h + 16, 16);
+	put_le16(h + 20, 1);            /* PCM */
+	put_le16(h + 22, 2);            /* caller, agent */
+	put_le32(h + 24, srate);
+	put_le32(h + 28, srate * 4);
+	put_le16(h + 32, 4);
+	put_le16(h + 34, 16);
+	memcpy(h + 36, "data", 4);
+	put_le32(h + 40, data);
+
+	if (fseek(f, 0, SEEK_SET) || fwrite(h, sizeof(h), 1, f) != 1)
+		return EIO;
+
+	return 0;
+}
+
+/** Write staged audio up to position upto and free its room */
+static void stage_flush(struct rec *rec, uint64_t upto)
+{
+	while (rec->base < upto) {
+		const uint32_t i = (uint32_t)(rec->base % rec->cap);
+		uint64_t n = upto - rec->base;
+		int16_t *p = rec->stage + 2 * i;
+
+		if (n > rec->cap - i)
+			n = rec->cap - i;
+
+		if (!rec->err && fwrite(p, 4, n, rec->f) != n)
+			rec->err = errno ? errno : EIO;
+		if (!rec->err)
+			rec->written += n;
+
+		memset(p, 0, n * 4);
+		rec->base += n;
+	}
+
+	if (rec->end < rec->base)
+		rec->end = rec->base;
+}
+
+/** Put one frame of a leg at its place on the timeline */
+static void stage_frame(struct rec *rec, const struct rec_hdr *hdr,
+			const int16_t *sampv)
+{
+	uint64_t pos, skip = 0;
+
+	if (!rec->started) {
+		rec->t0      = hdr->ts;
+		rec->started = true;
+	}
+
+	if (hdr->ts < rec->t0) {
+		re_atomic_rlx_add(&rec->late, 1);
+		return;
+	}
+
+	pos = (hdr->ts - rec->t0) * rec->srate / 1000000;
+
+	if (pos + rec->sampc <= rec->base) {
+		re_atomic_rlx_add(&rec->late, 1);
+		return;
+	}
+
+	if (pos < rec->base)
+		skip = rec->base - pos;
+
+	if (pos + rec->sampc > rec->base + rec->cap)
+		stage_flush(rec, pos + rec->sampc - rec->cap);
+
+	for (uint64_t k = skip; k < rec->sampc; k++) {
+		const uint32_t i = (uint32_t)((pos + k) % rec->cap);
+
+		rec->stage[2 * i + hdr->leg] = sampv[k];
+	}
+
+	if (pos + rec->sampc > rec->end)
+		rec->end = pos + rec->sampc;
+}
+
+static void rec_drain(struct rec *rec)
+{
+	const uint8_t *slot;
+
+	while ((slot = ring_read_ptr(rec->ring))) {
+		struct rec_hdr hdr;
+
+		memcpy(&hdr, slot, sizeof(hdr));
+		stage_frame(rec, &hdr,
+			    (const int16_t *)(const void *)(slot + sizeof(hdr)));
+		ring_read_commit(rec->ring);
+	}
+}
+
+static void deadline(struct timespec *ts, uint32_t ms)
+{
+	timespec_get(ts, TIME_UTC);
+
+	ts->tv_nsec += (long)(ms % 1000) * 1000000;
+	ts->tv_sec  += ms / 1000 + ts->tv_nsec / 1000000000;
+	ts->tv_nsec %= 1000000000;
+}
+
+static int rec_thread(void *arg)
+{
+	struct rec *rec = arg;
+	const uint64_t hold = (uint64_t)rec->srate * REC_HOLD_MS / 1000;
+
+#ifdef SCHED_IDLE
+	{
+		struct sched_param sp = {0};
+
+		/* only ever runs when the CPU has nothing better to do */
+		(void)pthread_setschedparam(pthread_self(), SCHED_IDLE, &sp);
+	}
+#endif
+
+	mtx_lock(&rec->mtx);
+	while (re_atomic_acq(&rec->run)) {
+		struct timespec ts;
+
+		mtx_unlock(&rec->mtx);
+
+		rec_drain(rec);
+		if (rec->end > rec->base + hold)
+			stage_flush(rec, rec->end - hold);
+
+		mtx_lock(&rec->mtx);
+		if (!re_atomic_acq(&rec->run))
+			break;
+
+		deadline(&ts, REC_FLUSH_MS);
+		(void)cnd_timedwait(&rec->cnd, &rec->mtx, &ts);
+	}
+	mtx_unlock(&rec->mtx);
+
+	/* whatever the scheduler committed before the stop */
+	rec_drain(rec);
+	stage_flush(rec, rec->end);
+
+	if (!rec->err)
+		rec->err = wav_header(rec->f, rec->srate, rec->written);
+
+	return thrd_success;
+}
+
+static void rec_destructor(void *data)
+{
+	struct rec *rec = data;
+
+	rec_close(rec);
+
+	if (rec->f)
+		fclose(rec->f);   /* the thread never started */
+
+	mtx_destroy(&rec->mtx);
+	cnd_destroy(&rec->cnd);
+	mem_deref(rec->stage);
+	mem_deref(rec->ring);
+}
+
+/**
+ * Start recording sampc-sample frames at srate into a new WAV file
+ * at path, and the thread that writes it.
+ */
+int rec_alloc(struct rec **recp, const char *path, uint32_t srate,
+	      uint32_t sampc, uint32_t ptime)
+{
+	struct rec *rec;
+	int err;
+
+	if (!recp || !path || !srate || !sampc || !ptime)
+		return EINVAL;
+
+	rec = mem_zalloc(sizeof(*rec), NULL);
+	if (!rec)
+		return ENOMEM;
+
+	rec->srate = srate;
+	rec->sampc = sampc;
+	rec->cap   = srate * REC_STAGE_MS / 1000;
+
+	if (rec->cap < REC_HOLD_MS * srate / 1000 + 2 * sampc)
+		rec->cap = REC_HOLD_MS * srate / 1000 + 2 * sampc;
+
+	if (mtx_init(&rec->mtx, mtx_plain) != thrd_success) {
+		mem_deref(rec);
+		return ENOMEM;
+	}
+
+	if (cnd_init(&rec->cnd) != thrd_success) {
+		mtx_destroy(&rec->mtx);
+		mem_deref(rec);
+		return ENOMEM;
+	}
+
+	/* destructor only once the sync objects exist */
+	mem_destructor(rec, rec_destructor);
+
+	/* both legs, REC_RING_MS each */
+	err = ring_alloc(&rec->ring, sizeof(struct rec_hdr) +
+			 sampc * sizeof(int16_t), 2 * REC_RING_MS / ptime);
+	if (err)
+		goto out;
+
+	rec->stage = mem_zalloc(rec->cap * 2 * sizeof(int16_t), NULL);
+	if (!rec->stage) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	rec->f = fopen(path, "wb");
+	if (!rec->f) {
+		err = errno;
+		goto out;
+	}
+
+	err = wav_header(rec->f, srate, 0);
+	if (err)
+		goto out;
+
+	re_atomic_rls_set(&rec->run, true);
+
+	err = thread_create_name(&rec->thread, "ausock_rec", rec_thread,
+				 rec);
+	if (err) {
+		re_atomic_rls_set(&rec->run, false);
+		goto out;
+	}
+
+	rec->thread_ok = true;
+
+ out:
+	if (err)
+		mem_deref(rec);
+	else
+		*recp = rec;
+
+	return err;
+}
+
+/**
+ * Scheduler: queue one frame of a leg, produced by the tick due at ts
+ * (sched_due()).  NULL sampv is silence.  Never blocks; a frame the
+ * writer has no room for is counted and dropped.
+ */
+void rec_frame(struct rec *rec, enum rec_leg leg, uint64_t ts,
+	       const int16_t *sampv, size_t sampc)
+{
+	struct rec_hdr hdr = {.ts = ts, .leg = leg};
+	uint8_t *slot;
+
+	if (!rec || sampc != rec->sampc || !re_atomic_acq(&rec->run))
+		return;
+
+	slot = ring_write_ptr(rec->ring);
+	if (!slot) {
+		re_atomic_rlx_add(&rec->drops, 1);
+		return;
+	}
+
+	memcpy(slot, &hdr, sizeof(hdr));
+	if (sampv)
+		memcpy(slot + sizeof(hdr), sampv, sampc * sizeof(int16_t));
+	else
+		memset(slot + sizeof(hdr), 0, sampc * sizeof(int16_t));
+
+	ring_write_commit(rec->ring);
+}
+
+/**
+ * Stop taking frames, write out what is queued and finish the file.
+ * Waits for the writer thread, so call it off the scheduler.  Returns
+ * the first write error, if any.
+ */
+int rec_close(struct rec *rec)
+{
+	if (!rec || !rec->thread_ok)
+		return rec ? rec->err : 0;
+
+	mtx_lock(&rec->mtx);
+	re_atomic_rls_set(&rec->run, false);
+	cnd_signal(&rec->cnd);
+	mtx_unlock(&rec->mtx);
+
+	thrd_join(rec->thread, NULL);
+	rec->thread_ok = false;
+
+	if (fclose(rec->f) && !rec->err)
+		rec->err = errno;
+	rec->f = NULL;
+
+	return rec->err;
+}
+
+/** Seconds of audio in the file; valid once rec_close() returned */
+double rec_seconds(const struct rec *rec)
+{
+	return rec ? (double)rec->written / rec->srate : 0;
+}
+
+/** Frames lost: no room in the writer's ring, or older than written */
+uint32_t rec_lost(const struct rec *rec)
+{
+	return rec ? re_atomic_rlx(&rec->drops) + re_atomic_rlx(&rec->late)
+		   : 0;
+}
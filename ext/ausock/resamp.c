@@ -0,0 +1,217 @@
+/**
+ * resamp.c — streaming polyphase resampler for agent audio (ausock_inrate)
+ *
+ * Converts whole frames of agent audio at the client's rate (24 kHz
+ * for Qwen3-TTS and Grok realtime PCM) to the call's rate on the main
+ * loop, before the frame enters the ring, so the client can write its
+ * native audio and rh() never sees anything but call-rate frames.
+ *
+ * out/in is reduced to L/M and a Kaiser-windowed sinc prototype of
+ * RESAMP_ZC zero crossings a side, cut off just below the lower of the
+ * two Nyquist rates, is split into L phases.  Output sample n of a
+ * frame sits at n*M in the L-times upsampled input, so it is a dot
+ * product of phase (n*M) % L with the input from (n*M) / L on.  With
+ * 20 ms frames on both sides in*L/M == out exactly, so every frame
+ * starts at phase 0 and only the last taps-1 input samples need to be
+ * carried across frames.
+ *
+ * Coefficients are stored per phase in input order and padded to a
+ * multiple of RESAMP_LANES, so the inner loop is a contiguous dot
+ * product; with GCC/Clang vector extensions it runs RESAMP_LANES wide
+ * (SSE on x86, NEON on ARM).
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include <re.h>
+
+#include "ausock.h"
+
+#define RESAMP_ZC      24      /* zero crossings each side */
+#define RESAMP_CUTOFF  0.92    /* of the lower Nyquist rate */
+#define RESAMP_BETA    8.0     /* Kaiser window: ~80 dB stopband */
+#define RESAMP_LANES   4
+
+#if defined(__GNUC__) || defined(__clang__)
+typedef float v4f __attribute__((vector_size(RESAMP_LANES * sizeof(float))));
+#define RESAMP_SIMD 1
+#endif
+
+struct resamp {
+	uint32_t L, M;         /* out = in * L / M */
+	uint32_t insampc;
+	uint32_t outsampc;
+	uint32_t taps;         /* per phase, multiple of RESAMP_LANES */
+	float   *coef;         /* L phases of taps */
+	float   *x;            /* taps-1 history + one input frame */
+};
+
+static void resamp_destructor(void *data)
+{
+	struct resamp *rs = data;
+
+	mem_deref(rs->coef);
+	mem_deref(rs->x);
+}
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+	while (b) {
+		uint32_t t = a % b;
+
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+/** Modified Bessel function of the first kind, order 0 */
+static double bessel_i0(double x)
+{
+	double sum = 1, term = 1;
+
+	for (int k = 1; k < 32; k++) {
+		term *= (x / (2 * k)) * (x / (2 * k));
+		sum  += term;
+	}
+
+	return sum;
+}
+
+static void design(struct resamp *rs)
+{
+	const uint32_t K  = rs->L > rs->M ? rs->L : rs->M;
+	const uint32_t n  = rs->taps * rs->L;   /* prototype length */
+	const double   fc = RESAMP_CUTOFF / (2.0 * K);
+	const double   c  = (n - 1) / 2.0;
+	const double   i0 = bessel_i0(RESAMP_BETA);
+
+	for (uint32_t m = 0; m < n; m++) {
+		const double t = m - c;
+		const double r = t / (c + 1);
+		double h = 2 * fc;
+
+		if (t != 0)
+			h = sin(2 * M_PI * fc * t) / (M_PI * t);
+
+		h *= bessel_i0(RESAMP_BETA * sqrt(1 - r * r)) / i0;
+
+		/* phase p, tap j: the input j samples after the start of
+		   the window, i.e. prototype index p + (taps-1-j)*L */
+		{
+			const uint32_t p = m % rs->L;
+			const uint32_t j = rs->taps - 1 - m / rs->L;
+
+			rs->coef[p * rs->taps + j] = (float)(h * rs->L);
+		}
+	}
+}
+
+/** Frames of insampc samples at inrate become outsampc at outrate */
+int resamp_alloc(struct resamp **rsp, uint32_t inrate, uint32_t outrate,
+		 uint32_t insampc, uint32_t outsampc)
+{
+	struct resamp *rs;
+	uint32_t g, K;
+	int err = 0;
+
+	if (!rsp || !inrate || !outrate || !insampc || !outsampc)
+		return EINVAL;
+
+	/* whole frames on both sides, or the phase would drift */
+	if ((uint64_t)insampc * outrate != (uint64_t)outsampc * inrate)
+		return EINVAL;
+
+	rs = mem_zalloc(sizeof(*rs), resamp_destructor);
+	if (!rs)
+		return ENOMEM;
+
+	g = gcd(inrate, outrate);
+	rs->L        = outrate / g;
+	rs->M        = inrate / g;
+	rs->insampc  = insampc;
+	rs->outsampc = outsampc;
+
+	K = rs->L > rs->M ? rs->L : rs->M;
+	rs->taps = (2 * RESAMP_ZC * K + rs->L - 1) / rs->L;
+	rs->taps = (rs->taps + RESAMP_LANES - 1) / RESAMP_LANES *
+		   RESAMP_LANES;
+
+	rs->coef = mem_zalloc(rs->L * rs->taps * sizeof(float), NULL);
+	rs->x    = mem_zalloc((rs->taps - 1 + insampc) * sizeof(float),
+			      NULL);
+	if (!rs->coef || !rs->x) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	design(rs);
+
+ out:
+	if (err)
+		mem_deref(rs);
+	else
+		*rsp = rs;
+
+	return err;
+}
+
+/** Forget the carried input, e.g. for a new client */
+void resamp_reset(struct resamp *rs)
+{
+	memset(rs->x, 0, (rs->taps - 1) * sizeof(float));
+}
+
+static float dot(const float *a, const float *b, uint32_t n)
+{
+#ifdef RESAMP_SIMD
+	v4f acc = {0, 0, 0, 0};
+	float sum;
+
+	for (uint32_t i = 0; i < n; i += RESAMP_LANES) {
+		v4f va, vb;
+
+		memcpy(&va, a + i, sizeof(va));
+		memcpy(&vb, b + i, sizeof(vb));
+		acc += va * vb;
+	}
+
+	sum = acc[0] + acc[1] + acc[2] + acc[3];
+	return sum;
+#else
+	float sum = 0;
+
+	for (uint32_t i = 0; i < n; i++)
+		sum += a[i] * b[i];
+
+	return sum;
+#endif
+}
+
+/** One input frame in, one output frame out; state carries over */
+void resamp_frame(struct resamp *rs, int16_t *dst, const int16_t *src)
+{
+	const uint32_t hist = rs->taps - 1;
+	float *x = rs->x;
+
+	for (uint32_t i = 0; i < rs->insampc; i++)
+		x[hist + i] = src[i];
+
+	for (uint32_t n = 0; n < rs->outsampc; n++) {
+		const uint64_t t = (uint64_t)n * rs->M;
+		const uint32_t p = (uint32_t)(t % rs->L);
+		const uint32_t i = (uint32_t)(t / rs->L);
+		float y = dot(rs->coef + p * rs->taps, x + i, rs->taps);
+
+		if (y > 32767.0f)
+			y = 32767.0f;
+		else if (y < -32768.0f)
+			y = -32768.0f;
+
+		dst[n] = (int16_t)lrintf(y);
+	}
+
+	memmove(x, x + rs->insampc, hist * sizeof(float));
+}
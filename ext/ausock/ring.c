@@ -0,0 +1,135 @@
+/**
+ * ring.c — lock-free single-producer/single-consumer frame ring
+ *
+ * A fixed number of equally sized frame slots.  One thread fills
+ * slots (ring_write_ptr → fill → ring_write_commit), another drains
+ * them (ring_read_ptr → use → ring_read_commit).  Neither side ever
+ * blocks or takes a lock; the only shared state is the two indices,
+ * published with release/acquire ordering so slot contents are
+ * visible before the index that exposes them.
+ *
+ * One slot is always left empty to tell "full" from "empty", so the
+ * ring allocates nframes + 1 slots.
+ */
+
+#include <string.h>
+
+#include <re.h>
+#include <re_atomic.h>
+
+#include "ausock.h"
+
+struct ring {
+	uint8_t  *buf;
+	size_t    frame_bytes;
+	uint32_t  size;                 /* slots allocated (nframes + 1) */
+	RE_ATOMIC uint32_t head;        /* next slot to write (producer) */
+	RE_ATOMIC uint32_t tail;        /* next slot to read  (consumer) */
+};
+
+static void ring_destructor(void *data)
+{
+	struct ring *r = data;
+
+	rt_unlock(r->buf, r->frame_bytes * r->size);
+	mem_deref(r->buf);
+}
+
+int ring_alloc(struct ring **rp, size_t frame_bytes, uint32_t nframes)
+{
+	struct ring *r;
+
+	if (!rp || !frame_bytes || !nframes)
+		return EINVAL;
+
+	r = mem_zalloc(sizeof(*r), ring_destructor);
+	if (!r)
+		return ENOMEM;
+
+	r->frame_bytes = frame_bytes;
+	r->size        = nframes + 1;
+
+	r->buf = mem_zalloc(frame_bytes * r->size, NULL);
+	if (!r->buf) {
+		mem_deref(r);
+		return ENOMEM;
+	}
+
+	rt_lock(r->buf, frame_bytes * r->size);
+
+	*rp = r;
+	return 0;
+}
+
+/** Producer: slot to fill next, or NULL if the ring is full */
+void *ring_write_ptr(struct ring *r)
+{
+	uint32_t head = re_atomic_rlx(&r->head);
+	uint32_t next = (head + 1) % r->size;
+
+	if (next == re_atomic_acq(&r->tail))
+		return NULL;
+
+	return r->buf + (size_t)head * r->frame_bytes;
+}
+
+/**
+ * Producer: up to max free slots, in the order they fill, so several
+ * frames can be read in one go; returns how many.  Each is published
+ * with ring_write_commit(), first one first.
+ */
+uint32_t ring_write_ptrs(struct ring *r, void **slotv, uint32_t max)
+{
+	uint32_t head = re_atomic_rlx(&r->head);
+	uint32_t n = (re_atomic_acq(&r->tail) + r->size - head - 1) % r->size;
+
+	if (n > max)
+		n = max;
+
+	for (uint32_t i = 0; i < n; i++)
+		slotv[i] = r->buf + (size_t)((head + i) % r->size) *
+			   r->frame_bytes;
+
+	return n;
+}
+
+/** Producer: publish the slot returned by ring_write_ptr() */
+void ring_write_commit(struct ring *r)
+{
+	uint32_t head = re_atomic_rlx(&r->head);
+
+	re_atomic_rls_set(&r->head, (head + 1) % r->size);
+}
+
+/** Consumer: oldest filled slot, or NULL if the ring is empty */
+const void *ring_read_ptr(struct ring *r)
+{
+	uint32_t tail = re_atomic_rlx(&r->tail);
+
+	if (tail == re_atomic_acq(&r->head))
+		return NULL;
+
+	return r->buf + (size_t)tail * r->frame_bytes;
+}
+
+/** Consumer: release the slot returned by ring_read_ptr() */
+void ring_read_commit(struct ring *r)
+{
+	uint32_t tail = re_atomic_rlx(&r->tail);
+
+	re_atomic_rls_set(&r->tail, (tail + 1) % r->size);
+}
+
+/** Number of filled slots; exact on either side, approximate elsewhere */
+uint32_t ring_count(struct ring *r)
+{
+	uint32_t head = re_atomic_acq(&r->head);
+	uint32_t tail = re_atomic_acq(&r->tail);
+
+	return (head + r->size - tail) % r->size;
+}
+
+uint32_t ring_capacity(const struct ring *r)
+{
+	return r->size - 1;
+}
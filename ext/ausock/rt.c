@@ -0,0 +1,288 @@
+/**
+ * rt.c — real-time priority, CPU pinning and locked buffers for the
+ *        scheduler thread (ausock_rt, ausock_cpus, ausock_mlock)
+ *
+ * The tick thread shares the machine with speech recognition and
+ * synthesis, which can keep every core busy for seconds.  With
+ * ausock_rt fifo or rr it runs under that POSIX real-time policy at
+ * ausock_rt_prio, so it preempts them the moment a deadline is due;
+ * ausock_cpus pins it to a set of CPUs (Linux), e.g. ones kept clear
+ * of the inference workers.
+ *
+ * With ausock_mlock the frame buffers the tick touches (rings, socket
+ * staging, shm) are locked into RAM as they are allocated, and the
+ * top of the thread's stack is faulted in and locked before the first
+ * tick (and unlocked as the thread ends), so a tick never waits for a
+ * page to come back from swap.
+ * Unlocking on release leaves the pages a buffer shares with its heap
+ * neighbours locked, since mlock() does not nest.
+ *
+ * Each setting that cannot be applied (no CAP_SYS_NICE or RLIMIT_RTPRIO,
+ * RLIMIT_MEMLOCK too low, a CPU that is not there) is logged once and
+ * the module carries on without it; ausock_stats shows what took.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE 1           /* pthread_setaffinity_np(), CPU_SET() */
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <re.h>
+#include <re_atomic.h>
+
+#include "ausock.h"
+
+#define RT_STACK   (64 * 1024)   /* stack faulted in and locked */
+#define RT_MAXCPU  1024
+
+static struct {
+	int       policy;            /* SCHED_FIFO, SCHED_RR, 0 for off */
+	uint32_t  prio;
+	char      cpus[64];          /* as configured, "" for any */
+	bool      mlock;
+	const void *stack;           /* locked by rt_thread(), or NULL */
+
+	RE_ATOMIC bool     rt_ok;    /* policy applied to the thread */
+	RE_ATOMIC bool     cpus_ok;  /* affinity applied */
+	RE_ATOMIC bool     lock_err; /* a buffer could not be locked */
+	RE_ATOMIC uint64_t locked;   /* bytes locked, while none failed */
+} rt;
+
+#ifdef __linux__
+/** "2,3", "0-3" or "1,4-7" as a CPU set */
+static int cpus_parse(cpu_set_t *set, const char *str)
+{
+	const char *p = str;
+
+	CPU_ZERO(set);
+
+	while (*p) {
+		char *end;
+		unsigned long lo, hi;
+
+		lo = strtoul(p, &end, 10);
+		if (end == p)
+			return EINVAL;
+
+		hi = lo;
+		if (*end == '-') {
+			p  = end + 1;
+			hi = strtoul(p, &end, 10);
+			if (end == p || hi < lo)
+				return EINVAL;
+		}
+
+		if (hi >= RT_MAXCPU || hi >= CPU_SETSIZE)
+			return EINVAL;
+
+		for (unsigned long c = lo; c <= hi; c++)
+			CPU_SET(c, set);
+
+		if (*end == ',')
+			++end;
+		else if (*end)
+			return EINVAL;
+
+		p = end;
+	}
+
+	return CPU_COUNT(set) ? 0 : EINVAL;
+}
+#endif
+
+/**
+ * Main thread, before sched_init(): check and keep the settings.
+ * policy is "off", "fifo" or "rr"; cpus may be empty.
+ */
+int rt_init(const char *policy, uint32_t prio, const char *cpus,
+	    bool lock)
+{
+	memset(&rt, 0, sizeof(rt));
+
+	if (0 == strcmp(policy, "fifo")) {
+		rt.policy = SCHED_FIFO;
+	} else if (0 == strcmp(policy, "rr")) {
+		rt.policy = SCHED_RR;
+	} else if (0 != strcmp(policy, "off")) {
+		warning("ausock: unknown ausock_rt '%s'\n", policy);
+		return EINVAL;
+	}
+
+	if (rt.policy && ((int)prio < sched_get_priority_min(rt.policy) ||
+			  (int)prio > sched_get_priority_max(rt.policy))) {
+		warning("ausock: ausock_rt_prio %u is out of range (%d-%d)\n",
+			prio, sched_get_priority_min(rt.policy),
+			sched_get_priority_max(rt.policy));
+		return EINVAL;
+	}
+	rt.prio = prio;
+
+	if (cpus && *cpus) {
+#ifdef __linux__
+		cpu_set_t set;
+
+		if (cpus_parse(&set, cpus)) {
+			warning("ausock: bad ausock_cpus '%s'\n", cpus);
+			return EINVAL;
+		}
+		strncpy(rt.cpus, cpus, sizeof(rt.cpus) - 1);
+#else
+		warning("ausock: ausock_cpus needs Linux, not pinned\n");
+#endif
+	}
+
+	rt.mlock = lock;
+
+	return 0;
+}
+
+/** mlock() len bytes at p, counting them; false if they stay unlocked */
+static bool lock_range(const void *p, size_t len)
+{
+	int err;
+
+	if (mlock(p, len) < 0) {
+		err = errno;
+
+		/* once, not once per call */
+		if (!re_atomic_rlx(&rt.lock_err)) {
+			re_atomic_rlx_set(&rt.lock_err, true);
+			warning("ausock: cannot lock frame buffers (%m);"
+				" raise RLIMIT_MEMLOCK (ulimit -l)\n", err);
+		}
+		return false;
+	}
+
+	re_atomic_rlx_add(&rt.locked, len);
+
+	return true;
+}
+
+/** Touch and lock the top RT_STACK of the calling thread's stack */
+static void __attribute__((noinline)) stack_lock(void)
+{
+	volatile uint8_t stack[RT_STACK];
+
+	memset((void *)stack, 0, sizeof(stack));
+	if (lock_range((const void *)stack, sizeof(stack)))
+		rt.stack = (const void *)stack;
+}
+
+/** Scheduler thread, first thing: apply what rt_init() kept */
+void rt_thread(void)
+{
+	int err;
+
+	if (rt.policy) {
+		struct sched_param sp = {0};
+
+		sp.sched_priority = (int)rt.prio;
+
+		err = pthread_setschedparam(pthread_self(), rt.policy, &sp);
+		if (err) {
+			warning("ausock: no real-time scheduling for the tick"
+				" thread (%m); needs CAP_SYS_NICE or an"
+				" rtprio limit of %u\n", err, rt.prio);
+		}
+		else {
+			re_atomic_rlx_set(&rt.rt_ok, true);
+		}
+	}
+
+#ifdef __linux__
+	if (rt.cpus[0]) {
+		cpu_set_t set;
+
+		(void)cpus_parse(&set, rt.cpus);
+
+		err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		if (err) {
+			warning("ausock: tick thread not pinned to CPUs %s"
+				" (%m)\n", rt.cpus, err);
+		}
+		else {
+			re_atomic_rlx_set(&rt.cpus_ok, true);
+		}
+	}
+#endif
+
+	if (rt.mlock)
+		stack_lock();
+}
+
+/**
+ * Scheduler thread, last thing: unlock the stack rt_thread() locked.
+ * The pages are all the thread's own, so they unlock whole; a thread
+ * stack the C library keeps for reuse would otherwise stay locked.
+ */
+void rt_thread_exit(void)
+{
+	const uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+	uintptr_t start, end;
+
+	if (!rt.stack)
+		return;
+
+	start = (uintptr_t)rt.stack & ~(page - 1);
+	end   = ((uintptr_t)rt.stack + RT_STACK + page - 1) & ~(page - 1);
+
+	(void)munlock((const void *)start, end - start);
+	re_atomic_rlx_sub(&rt.locked, RT_STACK);
+	rt.stack = NULL;
+}
+
+/**
+ * Lock len bytes at p into RAM if ausock_mlock is on; any thread.
+ * Pair with rt_unlock() on release.
+ */
+void rt_lock(const void *p, size_t len)
+{
+	if (!rt.mlock || !p || !len)
+		return;
+
+	(void)lock_range(p, len);
+}
+
+/** Undo rt_lock(p, len); only pages wholly inside the buffer unlock */
+void rt_unlock(const void *p, size_t len)
+{
+	const uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+	uintptr_t start, end;
+
+	if (!rt.mlock || !p || !len)
+		return;
+
+	start = ((uintptr_t)p + page - 1) & ~(page - 1);
+	end   = ((uintptr_t)p + len) & ~(page - 1);
+
+	if (end > start)
+		(void)munlock((const void *)start, end - start);
+
+	re_atomic_rlx_sub(&rt.locked, len);
+}
+
+/** "rt":{...} for ausock_stats: what was asked for and what took */
+int rt_print(struct re_printf *pf)
+{
+	const char *policy = rt.policy == SCHED_FIFO ? "fifo" :
+			     rt.policy == SCHED_RR   ? "rr"   : "off";
+	const bool lock_ok = rt.mlock && !re_atomic_rlx(&rt.lock_err);
+
+	return re_hprintf(pf, "\"rt\":{\"policy\":\"%s\",\"prio\":%u,"
+			  "\"applied\":%s,\"cpus\":\"%s\",\"pinned\":%s,"
+			  "\"mlock\":%s,\"locked_kb\":%llu}",
+			  policy, rt.policy ? rt.prio : 0,
+			  re_atomic_rlx(&rt.rt_ok) ? "true" : "false",
+			  rt.cpus,
+			  re_atomic_rlx(&rt.cpus_ok) ? "true" : "false",
+			  lock_ok ? "true" : "false",
+			  lock_ok ? (unsigned long long)(re_atomic_rlx(&rt.locked)
+							 / 1024) : 0ULL);
+}
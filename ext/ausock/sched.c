@@ -0,0 +1,226 @@
+/**
+ * sched.c — one real-time tick thread for every ausock source/player
+ *
+ * Each ausrc/auplay registers a handler and its ptime.  A single
+ * thread sleeps on an absolute CLOCK_MONOTONIC deadline
+ * (clock_nanosleep TIMER_ABSTIME where available) and runs every
+ * handler that is due, so oversleep never accumulates and the thread
+ * count stays at one however many calls are up.
+ *
+ * Deadlines sit on a grid shared by all entries (multiples of their
+ * ptime from one epoch), so every 20 ms source and player of every
+ * call is serviced in the same wakeup.
+ *
+ * The thread takes the policy, CPU set and locked stack rt.c was
+ * configured with before its first tick.
+ *
+ * Handlers run with the scheduler lock held.  Releasing an entry
+ * takes the same lock, so once mem_deref() of an entry returns its
+ * handler is guaranteed not to be running and never runs again.
+ */
+
+#include <time.h>
+#include <errno.h>
+
+#include <re.h>
+#include <re_atomic.h>
+
+#include "ausock.h"
+
+#define SCHED_IDLE_US 10000   /* wakeup interval with nothing to do */
+
+struct sched_ent {
+	struct le  le;
+	uint64_t   period_us;
+	uint64_t   next_us;        /* absolute deadline */
+	sched_h   *h;
+	void      *arg;
+	RE_ATOMIC uint32_t resyncs;  /* deadlines skipped after running late */
+};
+
+static struct {
+	struct list entl;
+	mtx_t       mtx;
+	thrd_t      thread;
+	uint64_t    epoch_us;
+	RE_ATOMIC bool run;
+} sched;
+
+
+/** CLOCK_MONOTONIC in microseconds, the time base of all deadlines */
+uint64_t sched_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void sleep_until(uint64_t t_us)
+{
+	struct timespec ts;
+
+#if defined(__linux__) && defined(TIMER_ABSTIME)
+	ts.tv_sec  = (time_t)(t_us / 1000000);
+	ts.tv_nsec = (long)(t_us % 1000000) * 1000;
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+			       &ts, NULL) == EINTR)
+		;
+#else
+	uint64_t now = sched_now();
+
+	if (t_us <= now)
+		return;
+
+	ts.tv_sec  = (time_t)((t_us - now) / 1000000);
+	ts.tv_nsec = (long)((t_us - now) % 1000000) * 1000;
+
+	while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+		;
+#endif
+}
+
+/** First grid point of the entry's period strictly after t */
+static uint64_t grid_next(const struct sched_ent *e, uint64_t t)
+{
+	uint64_t n = (t - sched.epoch_us) / e->period_us + 1;
+
+	return sched.epoch_us + n * e->period_us;
+}
+
+static int sched_thread(void *arg)
+{
+	uint64_t deadline;
+	(void)arg;
+
+	rt_thread();
+
+	deadline = sched_now();
+
+	while (re_atomic_acq(&sched.run)) {
+		uint64_t now;
+		struct le *le;
+
+		sleep_until(deadline);
+
+		mtx_lock(&sched.mtx);
+
+		now      = sched_now();
+		deadline = now + SCHED_IDLE_US;
+
+		LIST_FOREACH(&sched.entl, le) {
+			struct sched_ent *e = le->data;
+
+			if (e->next_us <= now) {
+				e->h(e->arg);
+
+				e->next_us += e->period_us;
+				if (e->next_us <= now) {
+					e->next_us = grid_next(e, now);  /* fell behind, resync */
+					re_atomic_rlx_add(&e->resyncs, 1);
+				}
+			}
+
+			if (e->next_us < deadline)
+				deadline = e->next_us;
+		}
+
+		mtx_unlock(&sched.mtx);
+	}
+
+	rt_thread_exit();
+
+	return thrd_success;
+}
+
+int sched_init(void)
+{
+	int err;
+
+	list_init(&sched.entl);
+
+	if (mtx_init(&sched.mtx, mtx_plain) != thrd_success)
+		return ENOMEM;
+
+	sched.epoch_us = sched_now();
+	re_atomic_rls_set(&sched.run, true);
+
+	err = thread_create_name(&sched.thread, "ausock_tick",
+				 sched_thread, NULL);
+	if (err) {
+		re_atomic_rls_set(&sched.run, false);
+		mtx_destroy(&sched.mtx);
+	}
+
+	return err;
+}
+
+void sched_close(void)
+{
+	if (!re_atomic_acq(&sched.run))
+		return;
+
+	re_atomic_rls_set(&sched.run, false);
+	thrd_join(sched.thread, NULL);
+
+	mtx_destroy(&sched.mtx);
+}
+
+static void ent_destructor(void *data)
+{
+	struct sched_ent *e = data;
+
+	mtx_lock(&sched.mtx);
+	list_unlink(&e->le);
+	mtx_unlock(&sched.mtx);
+}
+
+/**
+ * Call h(arg) every ptime ms on the scheduler thread, starting at the
+ * next grid point.  Release the returned entry to stop.
+ */
+int sched_add(struct sched_ent **entp, uint32_t ptime, sched_h *h,
+	      void *arg)
+{
+	struct sched_ent *e;
+
+	if (!entp || !ptime || !h)
+		return EINVAL;
+
+	e = mem_zalloc(sizeof(*e), ent_destructor);
+	if (!e)
+		return ENOMEM;
+
+	e->period_us = (uint64_t)ptime * 1000;
+	e->h         = h;
+	e->arg       = arg;
+
+	mtx_lock(&sched.mtx);
+	e->next_us = grid_next(e, sched_now());
+	list_append(&sched.entl, &e->le, e);
+	mtx_unlock(&sched.mtx);
+
+	*entp = e;
+	return 0;
+}
+
+
+/** Inside its handler: the deadline this run of the entry is for */
+uint64_t sched_due(const struct sched_ent *e)
+{
+	return e->next_us;
+}
+
+/** The entry's period in microseconds */
+uint64_t sched_period(const struct sched_ent *e)
+{
+	return e->period_us;
+}
+
+/** How often the entry fell a whole period behind and skipped ahead */
+uint32_t sched_resyncs(struct sched_ent *e)
+{
+	return e ? re_atomic_rlx(&e->resyncs) : 0;
+}
@@ -0,0 +1,276 @@
+/**
+ * shm.c — shared-memory double ring for ausock_transport shm
+ *
+ * Allocates the region described in ausock_shm.h plus its two
+ * doorbells, and hands all three fds to a connected client with
+ * SCM_RIGHTS.  The region is anonymous (memfd on Linux, an unlinked
+ * POSIX shm object elsewhere), so nothing is left behind in the
+ * filesystem when the last mapping goes away.
+ */
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#include <re.h>
+#include <re_atomic.h>
+
+#include "ausock.h"
+#include "ausock_shm.h"
+
+#define SHM_ALIGN 64
+
+struct shm {
+	struct ausock_shm *map;
+	size_t  size;
+	int     fd;
+	int     up_rfd;         /* doorbell ends; equal for eventfd */
+	int     up_wfd;
+	int     down_rfd;
+	int     down_wfd;
+};
+
+static size_t align_up(size_t n)
+{
+	return (n + SHM_ALIGN - 1) & ~(size_t)(SHM_ALIGN - 1);
+}
+
+static void bell_close(int rfd, int wfd)
+{
+	if (rfd >= 0)
+		close(rfd);
+	if (wfd >= 0 && wfd != rfd)
+		close(wfd);
+}
+
+static int bell_open(int *rfd, int *wfd)
+{
+#ifdef __linux__
+	int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if (fd < 0)
+		return errno;
+
+	*rfd = *wfd = fd;
+#else
+	int p[2];
+
+	if (pipe(p) < 0)
+		return errno;
+
+	fcntl(p[0], F_SETFL, O_NONBLOCK);
+	fcntl(p[1], F_SETFL, O_NONBLOCK);
+	fcntl(p[0], F_SETFD, FD_CLOEXEC);
+	fcntl(p[1], F_SETFD, FD_CLOEXEC);
+
+	*rfd = p[0];
+	*wfd = p[1];
+#endif
+	return 0;
+}
+
+/** Wake the client; a full pipe just means a wakeup is pending */
+static void bell_ring(int wfd)
+{
+#ifdef __linux__
+	uint64_t one = 1;
+#else
+	uint8_t one = 1;
+#endif
+	ssize_t n = write(wfd, &one, sizeof(one));
+	(void)n;
+}
+
+static int region_open(size_t size, int *fdp)
+{
+	int fd;
+
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+	fd = memfd_create("ausock", MFD_CLOEXEC);
+#else
+	static RE_ATOMIC unsigned seq;
+	char name[32];
+
+	re_snprintf(name, sizeof(name), "/ausock-%d-%u", (int)getpid(),
+		    re_atomic_rlx_add(&seq, 1));
+
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd >= 0)
+		shm_unlink(name);
+#endif
+	if (fd < 0)
+		return errno;
+
+	if (ftruncate(fd, (off_t)size) < 0) {
+		int err = errno;
+		close(fd);
+		return err;
+	}
+
+	*fdp = fd;
+	return 0;
+}
+
+static void ring_setup(struct ausock_shm_ring *r, size_t offset,
+		       size_t frame_bytes, uint32_t nframes)
+{
+	r->frame_bytes = (uint32_t)frame_bytes;
+	r->size        = nframes + 1;
+	r->offset      = (uint32_t)offset;
+}
+
+static void shm_destructor(void *data)
+{
+	struct shm *shm = data;
+
+	if (shm->map) {
+		rt_unlock(shm->map, shm->size);
+		munmap(shm->map, shm->size);
+	}
+	if (shm->fd >= 0)
+		close(shm->fd);
+
+	bell_close(shm->up_rfd, shm->up_wfd);
+	bell_close(shm->down_rfd, shm->down_wfd);
+}
+
+/**
+ * Allocate a region with an up and a down ring of nframes frames of
+ * frame_bytes each.
+ */
+int shm_alloc(struct shm **shmp, uint32_t srate, size_t frame_bytes,
+	      uint32_t nframes)
+{
+	struct shm *shm;
+	size_t ring_bytes, up_off, down_off;
+	void *map;
+	int err;
+
+	if (!shmp || !frame_bytes || !nframes)
+		return EINVAL;
+
+	shm = mem_zalloc(sizeof(*shm), shm_destructor);
+	if (!shm)
+		return ENOMEM;
+
+	shm->fd     = -1;
+	shm->up_rfd = shm->up_wfd = -1;
+	shm->down_rfd = shm->down_wfd = -1;
+
+	ring_bytes = align_up(frame_bytes * (nframes + 1));
+	up_off     = align_up(sizeof(struct ausock_shm));
+	down_off   = up_off + ring_bytes;
+	shm->size  = down_off + ring_bytes;
+
+	err = region_open(shm->size, &shm->fd);
+	if (err)
+		goto out;
+
+	map = mmap(NULL, shm->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   shm->fd, 0);
+	if (map == MAP_FAILED) {
+		err = errno;
+		goto out;
+	}
+
+	shm->map = map;
+	rt_lock(map, shm->size);
+	memset(shm->map, 0, sizeof(*shm->map));
+
+	shm->map->version = AUSOCK_SHM_VERSION;
+	shm->map->size    = (uint32_t)shm->size;
+	shm->map->srate   = srate;
+	ring_setup(&shm->map->up,   up_off,   frame_bytes, nframes);
+	ring_setup(&shm->map->down, down_off, frame_bytes, nframes);
+
+	/* magic last: a client that sees it sees a complete header */
+	__atomic_store_n(&shm->map->magic, AUSOCK_SHM_MAGIC,
+			 __ATOMIC_RELEASE);
+
+	err  = bell_open(&shm->up_rfd, &shm->up_wfd);
+	if (!err)
+		err = bell_open(&shm->down_rfd, &shm->down_wfd);
+
+ out:
+	if (err)
+		mem_deref(shm);
+	else
+		*shmp = shm;
+
+	return err;
+}
+
+static int send_fd(int sock, int fd)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} ctl;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	char byte = 0;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(&ctl, 0, sizeof(ctl));
+
+	iov.iov_base = &byte;
+	iov.iov_len  = 1;
+
+	msg.msg_iov        = &iov;
+	msg.msg_iovlen     = 1;
+	msg.msg_control    = ctl.buf;
+	msg.msg_controllen = sizeof(ctl.buf);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type  = SCM_RIGHTS;
+	cmsg->cmsg_len   = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	if (sendmsg(sock, &msg, 0) < 0)
+		return errno;
+
+	return 0;
+}
+
+/** Pass region, up doorbell and down doorbell to the client */
+int shm_send(const struct shm *shm, int sock)
+{
+	int err;
+
+	if (!shm)
+		return EINVAL;
+
+	err = send_fd(sock, shm->fd);
+	if (!err)
+		err = send_fd(sock, shm->up_rfd);
+	if (!err)
+		err = send_fd(sock, shm->down_rfd);
+
+	return err;
+}
+
+struct ausock_shm *shm_map(const struct shm *shm)
+{
+	return shm ? shm->map : NULL;
+}
+
+/** An up frame was committed */
+void shm_notify_up(struct shm *shm)
+{
+	bell_ring(shm->up_wfd);
+}
+
+/** A down slot was freed */
+void shm_notify_down(struct shm *shm)
+{
+	bell_ring(shm->down_wfd);
+}
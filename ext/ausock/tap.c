@@ -0,0 +1,277 @@
+/**
+ * tap.c — second consumer of caller audio (ausock_tap)
+ *
+ * A channel with a tap listens on a second socket, <path>.tap, for
+ * one consumer (typically a speech recogniser) that wants the
+ * caller's audio and nothing else.  It gets every caller frame as
+ * bare S16LE at the call rate, echo-cancelled, whatever format and
+ * protocol the main socket uses: no u-law, no framing, no detour
+ * through the client.  A new consumer replaces the one before it.
+ *
+ * Accept and hangup happen on the main loop; frames are sent from the
+ * scheduler without blocking.  A consumer that falls behind by more
+ * than TAP_QUEUE bytes loses whole frames (counted), never part of
+ * one, so the stream it reads stays sample-aligned.
+ */
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+
+#include <re.h>
+#include <re_atomic.h>
+
+#include "ausock.h"
+
+#ifndef MSG_NOSIGNAL            /* macOS: SO_NOSIGPIPE on the socket */
+#define MSG_NOSIGNAL 0
+#endif
+
+#define TAP_QUEUE 8192          /* bytes a consumer may lag by */
+
+struct tap {
+	char      path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+	int       listen_fd;
+	struct re_fhs *lfhs;
+	int       fd;               /* consumer, -1 if none */
+	struct re_fhs *cfhs;
+	mtx_t     mtx;              /* protects fd and the queue */
+	uint8_t   q[TAP_QUEUE];     /* bytes the socket could not take */
+	size_t    qlen;
+
+	RE_ATOMIC bool     connected;
+	RE_ATOMIC uint32_t frames;
+	RE_ATOMIC uint32_t drops;
+};
+
+/** Main loop: forget the consumer */
+static void tap_drop(struct tap *tap)
+{
+	tap->cfhs = fd_close(tap->cfhs);
+
+	mtx_lock(&tap->mtx);
+	if (tap->fd >= 0)
+		close(tap->fd);
+	tap->fd   = -1;
+	tap->qlen = 0;
+	mtx_unlock(&tap->mtx);
+
+	re_atomic_rlx_set(&tap->connected, false);
+}
+
+/** The consumer has nothing to say; reading only notices its hangup */
+static void read_handler(int flags, void *arg)
+{
+	struct tap *tap = arg;
+	uint8_t junk[256];
+	ssize_t n;
+	(void)flags;
+
+	do {
+		n = read(tap->fd, junk, sizeof(junk));
+	} while (n > 0);
+
+	if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+		info("ausock: %s: consumer left\n", tap->path);
+		tap_drop(tap);
+	}
+}
+
+static void accept_handler(int flags, void *arg)
+{
+	struct tap *tap = arg;
+	int fd;
+	(void)flags;
+
+	fd = accept(tap->listen_fd, NULL, NULL);
+	if (fd < 0)
+		return;
+
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+
+#ifdef SO_NOSIGPIPE          /* macOS */
+	{
+		int val = 1;
+		setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &val, sizeof(val));
+	}
+#endif
+
+	if (tap->fd >= 0)
+		tap_drop(tap);
+
+	mtx_lock(&tap->mtx);
+	tap->fd = fd;
+	mtx_unlock(&tap->mtx);
+
+	if (fd_listen(&tap->cfhs, fd, FD_READ, read_handler, tap)) {
+		tap_drop(tap);
+		return;
+	}
+
+	re_atomic_rlx_set(&tap->frames, 0);
+	re_atomic_rlx_set(&tap->drops, 0);
+	re_atomic_rlx_set(&tap->connected, true);
+
+	info("ausock: %s: consumer connected\n", tap->path);
+}
+
+static void tap_destructor(void *data)
+{
+	struct tap *tap = data;
+
+	tap->lfhs = fd_close(tap->lfhs);
+	tap->cfhs = fd_close(tap->cfhs);
+
+	if (tap->fd >= 0)
+		close(tap->fd);
+
+	if (tap->listen_fd >= 0) {
+		close(tap->listen_fd);
+		unlink(tap->path);
+	}
+
+	mtx_destroy(&tap->mtx);
+}
+
+/**
+ * Listen for a consumer at path; main thread.  It can connect at once,
+ * frames flow once the call's player runs.
+ */
+int tap_alloc(struct tap **tapp, const char *path)
+{
+	struct sockaddr_un addr;
+	struct tap *tap;
+	int err;
+
+	if (!tapp || !path)
+		return EINVAL;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return ENAMETOOLONG;
+
+	tap = mem_zalloc(sizeof(*tap), NULL);
+	if (!tap)
+		return ENOMEM;
+
+	tap->listen_fd = -1;
+	tap->fd        = -1;
+	strncpy(tap->path, path, sizeof(tap->path) - 1);
+
+	if (mtx_init(&tap->mtx, mtx_plain) != thrd_success) {
+		mem_deref(tap);
+		return ENOMEM;
+	}
+
+	mem_destructor(tap, tap_destructor);
+
+	unlink(path);
+
+	tap->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (tap->listen_fd < 0) {
+		err = errno;
+		goto out;
+	}
+
+	fcntl(tap->listen_fd, F_SETFL, O_NONBLOCK);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+	if (bind(tap->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(tap->listen_fd, 1) < 0) {
+		err = errno;
+		close(tap->listen_fd);
+		tap->listen_fd = -1;   /* not ours to unlink */
+		goto out;
+	}
+
+	err = fd_listen(&tap->lfhs, tap->listen_fd, FD_READ,
+			accept_handler, tap);
+
+ out:
+	if (err)
+		mem_deref(tap);
+	else
+		*tapp = tap;
+
+	return err;
+}
+
+/** Whether a consumer is connected; any thread */
+bool tap_connected(const struct tap *tap)
+{
+	return tap && re_atomic_rlx(&tap->connected);
+}
+
+/** Push out queued bytes; caller holds tap->mtx */
+static void tap_flush(struct tap *tap)
+{
+	ssize_t n;
+
+	if (!tap->qlen)
+		return;
+
+	n = send(tap->fd, tap->q, tap->qlen, MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (n <= 0)
+		return;
+
+	memmove(tap->q, tap->q + n, tap->qlen - (size_t)n);
+	tap->qlen -= (size_t)n;
+}
+
+/**
+ * Scheduler: one caller frame to the consumer, if there is one.
+ * Never blocks; a frame that would overflow the queue is dropped.
+ */
+void tap_frame(struct tap *tap, const int16_t *sampv, size_t sampc)
+{
+	const size_t len = sampc * sizeof(int16_t);
+	ssize_t n = 0;
+
+	if (!tap_connected(tap))
+		return;
+
+	mtx_lock(&tap->mtx);
+
+	if (tap->fd < 0)
+		goto out;
+
+	tap_flush(tap);
+
+	if (tap->qlen + len > sizeof(tap->q)) {
+		re_atomic_rlx_add(&tap->drops, 1);
+		goto out;
+	}
+
+	/* errors other than a full buffer surface as hangup on read */
+	if (!tap->qlen) {
+		n = send(tap->fd, sampv, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (n < 0)
+			n = 0;
+	}
+
+	memcpy(tap->q + tap->qlen, (const uint8_t *)sampv + n,
+	       len - (size_t)n);
+	tap->qlen += len - (size_t)n;
+
+	re_atomic_rlx_add(&tap->frames, 1);
+
+ out:
+	mtx_unlock(&tap->mtx);
+}
+
+/** Frames sent (or queued) to the current consumer */
+uint32_t tap_frames(const struct tap *tap)
+{
+	return tap ? re_atomic_rlx(&tap->frames) : 0;
+}
+
+/** Frames the current consumer was too slow for */
+uint32_t tap_drops(const struct tap *tap)
+{
+	return tap ? re_atomic_rlx(&tap->drops) : 0;
+}
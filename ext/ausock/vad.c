@@ -0,0 +1,131 @@
+/**
+ * vad.c — caller energy VAD (ausock_vad)
+ *
+ * An energy gate against an adaptive noise floor, not a speech
+ * classifier: anything loud enough over the line noise (a door, a
+ * cough, music) counts as voiced.  Fed every caller frame as it comes
+ * out of wh(), on the scheduler thread.  A frame is voiced when its
+ * mean power is at least VAD_MIN_DB and VAD_MARGIN_DB above the noise
+ * floor.  The floor starts at the first frame and follows the
+ * quietest recent frames: it drops to any frame below it at once and
+ * creeps up by VAD_FLOOR_RISE per frame otherwise, so steady
+ * background noise (line hiss, a fan, a car) is learnt within a few
+ * seconds and never counts as voiced.  Digital silence (call start,
+ * jitter-buffer gaps) is no noise to learn and leaves the floor
+ * alone, and the floor never sinks below VAD_FLOOR_MIN, from where
+ * climbing back to real line noise would take half a minute.
+ *
+ * A talkspurt starts after VAD_ONSET voiced frames in a row, so
+ * clicks do not open it, and ends VAD_HANGOVER_MS after the last
+ * voiced frame, so the quiet tails of words and short pauses between
+ * them stay inside it.  One pass over each frame, no allocation.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include <re.h>
+
+#include "ausock.h"
+
+#define VAD_MIN_DB       -55    /* quietest frame that can be speech */
+#define VAD_MARGIN_DB    9      /* speech is this far above the floor */
+#define VAD_FLOOR_RISE   0.03   /* dB per frame: 1.5 dB/s at 20 ms */
+#define VAD_FLOOR_MIN    (VAD_MIN_DB - VAD_MARGIN_DB)
+#define VAD_ONSET        2      /* voiced frames that open a talkspurt */
+#define VAD_HANGOVER_MS  300
+
+struct vad {
+	double   floor;        /* noise floor, dBFS */
+	bool     primed;       /* floor has seen a frame */
+	uint32_t onset;        /* consecutive voiced frames */
+	uint32_t hang;         /* frames the talkspurt has left */
+	uint32_t hangover;     /* VAD_HANGOVER_MS in frames */
+	bool     speech;
+};
+
+/** Mean power of a frame in dBFS, VAD_SILENCE_DB for digital silence */
+int vad_level(const int16_t *sampv, size_t sampc)
+{
+	double sum = 0;
+
+	for (size_t i = 0; i < sampc; i++)
+		sum += (double)sampv[i] * sampv[i];
+
+	if (!sampc || sum < 1.0)
+		return VAD_SILENCE_DB;
+
+	return (int)lround(10.0 * log10(sum / sampc / (32768.0 * 32768.0)));
+}
+
+int vad_alloc(struct vad **vadp, uint32_t ptime)
+{
+	struct vad *vad;
+
+	if (!vadp || !ptime)
+		return EINVAL;
+
+	vad = mem_zalloc(sizeof(*vad), NULL);
+	if (!vad)
+		return ENOMEM;
+
+	vad->hangover = (VAD_HANGOVER_MS + ptime - 1) / ptime;
+	vad_reset(vad);
+
+	*vadp = vad;
+	return 0;
+}
+
+/** Forget the noise floor and any talkspurt, e.g. for a new client */
+void vad_reset(struct vad *vad)
+{
+	vad->primed = false;
+	vad->onset  = 0;
+	vad->hang   = 0;
+	vad->speech = false;
+}
+
+/**
+ * Gate one caller frame on its energy.  Returns whether the caller is in a
+ * talkspurt after it, with the frame's level in dBFS in *levelp.
+ */
+bool vad_frame(struct vad *vad, const int16_t *sampv, size_t sampc,
+	       int *levelp)
+{
+	const int level = vad_level(sampv, sampc);
+	bool voiced;
+
+	if (!vad->primed && level > VAD_SILENCE_DB) {
+		vad->floor  = level;
+		vad->primed = true;
+	}
+
+	voiced = vad->primed && level >= VAD_MIN_DB &&
+		 level >= vad->floor + VAD_MARGIN_DB;
+
+	/* digital silence is no noise to learn */
+	if (level > VAD_SILENCE_DB) {
+		if (level < vad->floor)
+			vad->floor = level;
+		else
+			vad->floor += VAD_FLOOR_RISE;
+
+		if (vad->floor < VAD_FLOOR_MIN)
+			vad->floor = VAD_FLOOR_MIN;
+	}
+
+	if (voiced) {
+		vad->hang = vad->hangover;
+		if (!vad->speech && ++vad->onset >= VAD_ONSET)
+			vad->speech = true;
+	} else {
+		vad->onset = 0;
+		if (vad->speech && (!vad->hang || --vad->hang == 0))
+			vad->speech = false;
+	}
+
+	if (levelp)
+		*levelp = level;
+
+	return vad->speech;
+}
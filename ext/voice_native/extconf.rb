@@ -0,0 +1,10 @@
+# frozen_string_literal: true
+
+require 'mkmf'
+
+$CFLAGS << ' -O2 -Wall'
+
+# shared-memory transport layout lives with the baresip module
+$INCFLAGS << " -I#{File.expand_path('../ausock', __dir__)}"
+
+create_makefile('voice_native')
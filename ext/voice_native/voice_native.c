@@ -0,0 +1,763 @@
+/**
+ * voice_native.c — native audio helpers for the Ruby side
+ *
+ * VoiceNative::G711 batch-transcodes G.711 u-law <-> S16LE without
+ * creating any Ruby objects per sample.  Both directions are table
+ * lookups:
+ *
+ *   encode: 64 Ki-entry table indexed by the 16-bit sample
+ *   decode: 256-entry table indexed by the u-law byte
+ *
+ * The tables are built at load time from the same segment/bias rules
+ * as AudioBridge::ULAW_COMPRESS / ULAW_DECODE, so the output is
+ * bit-exact with the pure-Ruby codec.
+ *
+ * Both methods take an optional output String.  When given, its
+ * buffer is reused (grown only if too small) and the same object is
+ * returned, so a caller that keeps one buffer per thread allocates
+ * nothing per frame.
+ *
+ * VoiceNative::Shm maps the client end of the ausock shared-memory
+ * transport (ext/ausock/ausock_shm.h): it reads caller frames from the
+ * up ring and writes agent frames to the down ring.
+ *
+ * VoiceNative.send_packets hands a burst of packets to a
+ * SOCK_SEQPACKET socket (the ausock seqpacket transport) in one
+ * sendmmsg() on Linux.
+ *
+ * VoiceNative::TtsReader parses the record stream tts_server.py
+ * writes to stdout (lib/voice_agent/tts_reader.rb) and yields whole
+ * audio frames, utterance boundaries and status records.  Each byte
+ * is looked at once: headers are decoded where they lie and audio is
+ * cut into frames as it arrives, without searching for anything.
+ */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE 1           /* sendmmsg() */
+#endif
+
+#include <ruby.h>
+#include <ruby/encoding.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "ausock_shm.h"
+
+
+enum {
+	ULAW_BIAS = 0x84,
+	ULAW_CLIP = 32635,
+};
+
+
+static uint8_t ulaw_enc[65536];
+static int16_t ulaw_dec[256];
+
+
+static uint8_t linear_to_ulaw(int sample)
+{
+	int sign = 0;
+	int seg, v;
+
+	if (sample < 0) {
+		sign   = 0x80;
+		sample = -sample;
+	}
+	if (sample > ULAW_CLIP)
+		sample = ULAW_CLIP;
+	sample += ULAW_BIAS;
+
+	/* segment = position of the highest set bit above bit 7 */
+	v = (sample >> 7) & 0xff;
+	for (seg = 0; v > 1; v >>= 1)
+		++seg;
+
+	return (uint8_t)(~(sign | (seg << 4) |
+			   ((sample >> (seg + 3)) & 0x0f)) & 0xff);
+}
+
+
+static int16_t ulaw_to_linear(uint8_t byte)
+{
+	int v        = ~byte & 0xff;
+	int exponent = (v >> 4) & 0x07;
+	int mantissa = v & 0x0f;
+	int sample   = (((mantissa << 3) + ULAW_BIAS) << exponent) - ULAW_BIAS;
+
+	return (int16_t)((v & 0x80) ? -sample : sample);
+}
+
+
+static void tables_init(void)
+{
+	int i;
+
+	for (i = 0; i < 65536; i++)
+		ulaw_enc[i] = linear_to_ulaw((int16_t)i);
+
+	for (i = 0; i < 256; i++)
+		ulaw_dec[i] = ulaw_to_linear((uint8_t)i);
+}
+
+
+/* Prepare dst (or a new String) to receive len bytes of binary data */
+static VALUE out_buffer(VALUE dst, long len)
+{
+	if (NIL_P(dst))
+		return rb_enc_str_new(NULL, len, rb_ascii8bit_encoding());
+
+	StringValue(dst);
+	rb_str_modify_expand(dst, len - RSTRING_LEN(dst) > 0 ?
+			     len - RSTRING_LEN(dst) : 0);
+	rb_str_set_len(dst, len);
+	rb_enc_associate(dst, rb_ascii8bit_encoding());
+
+	return dst;
+}
+
+
+/*
+ * call-seq:
+ *   VoiceNative::G711.encode(s16le, out = nil) -> String
+ *
+ * Encodes S16LE samples to u-law.  A trailing odd byte is ignored.
+ */
+static VALUE g711_encode(int argc, VALUE *argv, VALUE self)
+{
+	VALUE src, dst;
+	const uint8_t *in;
+	uint8_t *out;
+	long n, i;
+	(void)self;
+
+	rb_scan_args(argc, argv, "11", &src, &dst);
+	StringValue(src);
+
+	n   = RSTRING_LEN(src) / 2;
+	dst = out_buffer(dst, n);
+	in  = (const uint8_t *)RSTRING_PTR(src);
+	out = (uint8_t *)RSTRING_PTR(dst);
+
+	for (i = 0; i < n; i++)
+		out[i] = ulaw_enc[in[2*i] | (in[2*i + 1] << 8)];
+
+	return dst;
+}
+
+
+/*
+ * call-seq:
+ *   VoiceNative::G711.decode(pcmu, out = nil) -> String
+ *
+ * Decodes u-law bytes to S16LE samples.
+ */
+static VALUE g711_decode(int argc, VALUE *argv, VALUE self)
+{
+	VALUE src, dst;
+	const uint8_t *in;
+	uint8_t *out;
+	long n, i;
+	(void)self;
+
+	rb_scan_args(argc, argv, "11", &src, &dst);
+	StringValue(src);
+
+	n   = RSTRING_LEN(src);
+	dst = out_buffer(dst, n * 2);
+	in  = (const uint8_t *)RSTRING_PTR(src);
+	out = (uint8_t *)RSTRING_PTR(dst);
+
+	for (i = 0; i < n; i++) {
+		uint16_t s = (uint16_t)ulaw_dec[in[i]];
+
+		out[2*i]     = s & 0xff;
+		out[2*i + 1] = s >> 8;
+	}
+
+	return dst;
+}
+
+
+/* ---- VoiceNative::Shm ------------------------------------------- */
+
+struct shm_map {
+	struct ausock_shm *map;
+	size_t size;
+};
+
+static void shm_unmap(struct shm_map *m)
+{
+	if (m->map) {
+		munmap(m->map, m->size);
+		m->map = NULL;
+	}
+}
+
+static void shm_free(void *ptr)
+{
+	struct shm_map *m = ptr;
+
+	shm_unmap(m);
+	xfree(m);
+}
+
+static size_t shm_memsize(const void *ptr)
+{
+	(void)ptr;
+	return sizeof(struct shm_map);
+}
+
+static const rb_data_type_t shm_type = {
+	"VoiceNative::Shm",
+	{ NULL, shm_free, shm_memsize, },
+	NULL, NULL, RUBY_TYPED_FREE_IMMEDIATELY,
+};
+
+static VALUE shm_s_alloc(VALUE klass)
+{
+	struct shm_map *m;
+
+	return TypedData_Make_Struct(klass, struct shm_map, &shm_type, m);
+}
+
+static struct shm_map *shm_get(VALUE self)
+{
+	struct shm_map *m;
+
+	TypedData_Get_Struct(self, struct shm_map, &shm_type, m);
+	if (!m->map)
+		rb_raise(rb_eIOError, "shm region is closed");
+
+	return m;
+}
+
+static int ring_valid(const struct ausock_shm_ring *r, size_t size)
+{
+	return r->size > 1 && r->frame_bytes &&
+	       (size_t)r->offset + (size_t)r->frame_bytes * r->size <= size;
+}
+
+/*
+ * call-seq:
+ *   VoiceNative::Shm.new(io) -> shm
+ *
+ * Maps the region passed by ausock.  The IO may be closed afterwards.
+ */
+static VALUE shm_initialize(VALUE self, VALUE io)
+{
+	struct shm_map *m;
+	struct stat st;
+	void *map;
+	int fd;
+
+	TypedData_Get_Struct(self, struct shm_map, &shm_type, m);
+
+	fd = NUM2INT(rb_funcall(io, rb_intern("fileno"), 0));
+	if (fstat(fd, &st) < 0)
+		rb_sys_fail("fstat");
+
+	if ((size_t)st.st_size < sizeof(struct ausock_shm))
+		rb_raise(rb_eArgError, "shm region too small");
+
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		rb_sys_fail("mmap");
+
+	m->map  = map;
+	m->size = (size_t)st.st_size;
+
+	if (__atomic_load_n(&m->map->magic, __ATOMIC_ACQUIRE) !=
+	    AUSOCK_SHM_MAGIC ||
+	    m->map->version != AUSOCK_SHM_VERSION ||
+	    !ring_valid(&m->map->up, m->size) ||
+	    !ring_valid(&m->map->down, m->size)) {
+		shm_unmap(m);
+		rb_raise(rb_eArgError, "not an ausock shm region");
+	}
+
+	return self;
+}
+
+/*
+ * call-seq:
+ *   shm.read(out = nil) -> String or nil
+ *
+ * Takes the oldest caller frame from the up ring, or returns nil if
+ * the ring is empty.
+ */
+static VALUE shm_read(int argc, VALUE *argv, VALUE self)
+{
+	struct shm_map *m = shm_get(self);
+	struct ausock_shm_ring *r = &m->map->up;
+	const uint8_t *slot;
+	VALUE dst;
+
+	rb_scan_args(argc, argv, "01", &dst);
+
+	slot = ausock_shm_read_ptr(m->map, r);
+	if (!slot)
+		return Qnil;
+
+	dst = out_buffer(dst, r->frame_bytes);
+	memcpy(RSTRING_PTR(dst), slot, r->frame_bytes);
+	ausock_shm_read_commit(r);
+
+	return dst;
+}
+
+/*
+ * call-seq:
+ *   shm.write(frame) -> true or false
+ *
+ * Appends one agent frame to the down ring; false if it is full.
+ */
+static VALUE shm_write(VALUE self, VALUE frame)
+{
+	struct shm_map *m = shm_get(self);
+	struct ausock_shm_ring *r = &m->map->down;
+	uint8_t *slot;
+
+	StringValue(frame);
+	if ((size_t)RSTRING_LEN(frame) != r->frame_bytes)
+		rb_raise(rb_eArgError, "frame must be %u bytes",
+			 r->frame_bytes);
+
+	slot = ausock_shm_write_ptr(m->map, r);
+	if (!slot)
+		return Qfalse;
+
+	memcpy(slot, RSTRING_PTR(frame), r->frame_bytes);
+	ausock_shm_write_commit(r);
+
+	return Qtrue;
+}
+
+static VALUE shm_frame_bytes(VALUE self)
+{
+	return UINT2NUM(shm_get(self)->map->down.frame_bytes);
+}
+
+/* Caller frames waiting to be read */
+static VALUE shm_up_count(VALUE self)
+{
+	return UINT2NUM(ausock_shm_count(&shm_get(self)->map->up));
+}
+
+/* Agent frames queued for playout in ausock */
+static VALUE shm_down_count(VALUE self)
+{
+	return UINT2NUM(ausock_shm_count(&shm_get(self)->map->down));
+}
+
+static VALUE shm_down_capacity(VALUE self)
+{
+	return UINT2NUM(shm_get(self)->map->down.size - 1);
+}
+
+static VALUE shm_close(VALUE self)
+{
+	struct shm_map *m;
+
+	TypedData_Get_Struct(self, struct shm_map, &shm_type, m);
+	shm_unmap(m);
+
+	return Qnil;
+}
+
+static VALUE shm_closed_p(VALUE self)
+{
+	struct shm_map *m;
+
+	TypedData_Get_Struct(self, struct shm_map, &shm_type, m);
+
+	return m->map ? Qfalse : Qtrue;
+}
+
+/* ---- VoiceNative::TtsReader ------------------------------------ */
+
+enum {
+	TTS_HDR      = 8,          /* u8 type, 3 reserved, u32 length (LE) */
+	TTS_AUDIO    = 1,
+	TTS_BOUNDARY = 2,
+	TTS_STATUS   = 3,
+	TTS_MAX      = 1 << 16,    /* largest record that is not audio */
+};
+
+struct tts_reader {
+	long     frame_bytes;
+	uint8_t *buf;              /* bytes fed and not yet consumed */
+	size_t   cap, len, pos;
+	uint8_t *part;             /* frame_bytes: audio short of a frame */
+	size_t   plen;
+	size_t   audio_left;       /* of the audio record being read */
+	int      busy;             /* inside feed, yielding */
+};
+
+static void tts_free(void *ptr)
+{
+	struct tts_reader *r = ptr;
+
+	xfree(r->buf);
+	xfree(r->part);
+	xfree(r);
+}
+
+static size_t tts_memsize(const void *ptr)
+{
+	const struct tts_reader *r = ptr;
+
+	return sizeof(*r) + r->cap + (size_t)r->frame_bytes;
+}
+
+static const rb_data_type_t tts_type = {
+	"VoiceNative::TtsReader",
+	{ NULL, tts_free, tts_memsize, },
+	NULL, NULL, RUBY_TYPED_FREE_IMMEDIATELY,
+};
+
+static VALUE tts_s_alloc(VALUE klass)
+{
+	struct tts_reader *r;
+
+	return TypedData_Make_Struct(klass, struct tts_reader, &tts_type, r);
+}
+
+static struct tts_reader *tts_get(VALUE self)
+{
+	struct tts_reader *r;
+
+	TypedData_Get_Struct(self, struct tts_reader, &tts_type, r);
+	if (!r->part)
+		rb_raise(rb_eRuntimeError, "TtsReader not initialized");
+
+	return r;
+}
+
+/*
+ * call-seq:
+ *   VoiceNative::TtsReader.new(frame_bytes) -> reader
+ *
+ * A reader that cuts audio into frames of frame_bytes.
+ */
+static VALUE tts_initialize(VALUE self, VALUE frame_bytes)
+{
+	struct tts_reader *r;
+	long fb = NUM2LONG(frame_bytes);
+
+	TypedData_Get_Struct(self, struct tts_reader, &tts_type, r);
+
+	if (r->part)
+		rb_raise(rb_eRuntimeError, "TtsReader already initialized");
+
+	if (fb <= 0 || fb > TTS_MAX)
+		rb_raise(rb_eArgError, "bad frame size %ld", fb);
+
+	r->frame_bytes = fb;
+	r->part        = ALLOC_N(uint8_t, fb);
+
+	return self;
+}
+
+static VALUE bin_str(const uint8_t *p, long len)
+{
+	return rb_enc_str_new((const char *)p, len, rb_ascii8bit_encoding());
+}
+
+static void yield_frame(struct tts_reader *r, const uint8_t *p)
+{
+	rb_yield_values(2, ID2SYM(rb_intern("audio")),
+			bin_str(p, r->frame_bytes));
+}
+
+/* Audio bytes of the current record, n of them at p */
+static void tts_audio(struct tts_reader *r, const uint8_t *p, size_t n)
+{
+	const size_t fb = (size_t)r->frame_bytes;
+
+	if (r->plen) {
+		size_t take = fb - r->plen < n ? fb - r->plen : n;
+
+		memcpy(r->part + r->plen, p, take);
+		r->plen += take;
+		p += take;
+		n -= take;
+
+		if (r->plen < fb)
+			return;
+
+		r->plen = 0;
+		yield_frame(r, r->part);
+	}
+
+	for (; n >= fb; p += fb, n -= fb)
+		yield_frame(r, p);
+
+	memcpy(r->part, p, n);
+	r->plen = n;
+}
+
+static VALUE tts_parse(VALUE self)
+{
+	struct tts_reader *r = tts_get(self);
+
+	for (;;) {
+		const uint8_t *p = r->buf + r->pos;
+		size_t avail = r->len - r->pos;
+		uint32_t len;
+		uint8_t type;
+
+		if (r->audio_left) {
+			size_t n = r->audio_left < avail ? r->audio_left : avail;
+
+			if (!n)
+				break;
+
+			/* consumed before yielding, so a raise leaves no
+			   half-read record behind */
+			r->pos        += n;
+			r->audio_left -= n;
+			tts_audio(r, p, n);
+			continue;
+		}
+
+		if (avail < TTS_HDR)
+			break;
+
+		type = p[0];
+		len  = (uint32_t)p[4] | (uint32_t)p[5] << 8 |
+		       (uint32_t)p[6] << 16 | (uint32_t)p[7] << 24;
+
+		if (type == TTS_AUDIO) {
+			r->pos       += TTS_HDR;
+			r->audio_left = len;
+			continue;
+		}
+
+		if (len > TTS_MAX)
+			rb_raise(rb_eIOError, "TTS record of %u bytes", len);
+
+		if (avail < TTS_HDR + len)
+			break;
+
+		r->pos += TTS_HDR + len;
+
+		switch (type) {
+
+		case TTS_BOUNDARY:
+			/* the server pads to a frame; whatever falls short
+			   is padded here rather than run into the next */
+			if (r->plen) {
+				memset(r->part + r->plen, 0,
+				       (size_t)r->frame_bytes - r->plen);
+				r->plen = 0;
+				yield_frame(r, r->part);
+			}
+			rb_yield_values(2, ID2SYM(rb_intern("boundary")),
+					Qnil);
+			break;
+
+		case TTS_STATUS:
+			rb_yield_values(2, ID2SYM(rb_intern("status")),
+					rb_utf8_str_new((const char *)p +
+							TTS_HDR, len));
+			break;
+
+		default:
+			break;   /* newer record types are skipped */
+		}
+	}
+
+	return Qnil;
+}
+
+static VALUE tts_parse_done(VALUE self)
+{
+	struct tts_reader *r = tts_get(self);
+
+	r->busy = 0;
+
+	return Qnil;
+}
+
+/*
+ * call-seq:
+ *   reader.feed(data) { |type, payload| ... } -> reader
+ *
+ * Takes the next bytes of the stream, in chunks of any size, and
+ * yields each record they complete: (:audio, frame) for every whole
+ * frame, (:boundary, nil) at the end of an utterance (after its last
+ * frame, padded with silence if short) and (:status, json) for a
+ * status record.
+ */
+static VALUE tts_feed(VALUE self, VALUE data)
+{
+	struct tts_reader *r = tts_get(self);
+	long n;
+
+	StringValue(data);
+	rb_need_block();
+
+	if (r->busy)
+		rb_raise(rb_eRuntimeError, "TtsReader#feed called from its block");
+
+	n = RSTRING_LEN(data);
+
+	/* drop what was consumed, then make room */
+	if (r->pos) {
+		memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+		r->len -= r->pos;
+		r->pos  = 0;
+	}
+
+	if (r->len + (size_t)n > r->cap) {
+		size_t cap = r->cap ? r->cap : 16384;
+
+		while (cap < r->len + (size_t)n)
+			cap *= 2;
+
+		REALLOC_N(r->buf, uint8_t, cap);
+		r->cap = cap;
+	}
+
+	memcpy(r->buf + r->len, RSTRING_PTR(data), (size_t)n);
+	r->len += (size_t)n;
+
+	r->busy = 1;
+	rb_ensure(tts_parse, self, tts_parse_done, self);
+
+	return self;
+}
+
+#define SEND_BATCH 16   /* packets per call */
+#define SEND_IOV   4    /* Strings per packet */
+
+#ifndef MSG_NOSIGNAL            /* macOS: Ruby ignores SIGPIPE anyway */
+#define MSG_NOSIGNAL 0
+#endif
+
+/*
+ * call-seq:
+ *   VoiceNative.send_packets(io, packets) -> Integer
+ *
+ * Sends each element of packets as one packet on the socket io,
+ * without blocking.  An element is a String, or an Array of up to
+ * four Strings sent together (say a header and its payload).  Returns
+ * how many leading packets were sent; the rest did not fit in the
+ * socket buffer and are for the caller to write once it drains.  At
+ * most 16 are taken per call.
+ */
+static VALUE send_packets(VALUE self, VALUE io, VALUE packets)
+{
+	struct iovec iov[SEND_BATCH][SEND_IOV];
+	size_t iovc[SEND_BATCH];
+	long n, i;
+	int fd;
+	(void)self;
+
+	Check_Type(packets, T_ARRAY);
+	fd = NUM2INT(rb_funcall(io, rb_intern("fileno"), 0));
+
+	n = RARRAY_LEN(packets);
+	if (n > SEND_BATCH)
+		n = SEND_BATCH;
+
+	for (i = 0; i < n; i++) {
+		VALUE pkt = RARRAY_AREF(packets, i);
+		long k, parts = 1;
+
+		if (RB_TYPE_P(pkt, T_ARRAY)) {
+			parts = RARRAY_LEN(pkt);
+			if (parts > SEND_IOV)
+				rb_raise(rb_eArgError, "at most %d Strings"
+					 " per packet", SEND_IOV);
+		}
+
+		for (k = 0; k < parts; k++) {
+			VALUE s = RB_TYPE_P(pkt, T_ARRAY) ?
+				  RARRAY_AREF(pkt, k) : pkt;
+
+			Check_Type(s, T_STRING);
+			iov[i][k].iov_base = RSTRING_PTR(s);
+			iov[i][k].iov_len  = (size_t)RSTRING_LEN(s);
+		}
+
+		iovc[i] = (size_t)parts;
+	}
+
+#ifdef __linux__
+	{
+		struct mmsghdr msgv[SEND_BATCH];
+		int r;
+
+		memset(msgv, 0, sizeof(msgv));
+		for (i = 0; i < n; i++) {
+			msgv[i].msg_hdr.msg_iov    = iov[i];
+			msgv[i].msg_hdr.msg_iovlen = iovc[i];
+		}
+
+		r = n ? sendmmsg(fd, msgv, (unsigned)n,
+				 MSG_DONTWAIT | MSG_NOSIGNAL) : 0;
+		if (r >= 0)
+			return INT2NUM(r);
+	}
+#else
+	for (i = 0; i < n; i++) {
+		struct msghdr msg;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov    = iov[i];
+		msg.msg_iovlen = (int)iovc[i];
+
+		if (sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+			break;
+	}
+
+	if (i)
+		return LONG2NUM(i);
+#endif
+
+	if (errno == EAGAIN || errno == EWOULDBLOCK)
+		return INT2NUM(0);
+
+	rb_sys_fail("sendmmsg");
+
+	return Qnil;
+}
+
+void Init_voice_native(void)
+{
+	VALUE mVoiceNative, mG711, cShm, cTts;
+
+	tables_init();
+
+	mVoiceNative = rb_define_module("VoiceNative");
+	mG711        = rb_define_module_under(mVoiceNative, "G711");
+
+	rb_define_module_function(mVoiceNative, "send_packets",
+				  send_packets, 2);
+
+	rb_define_module_function(mG711, "encode", g711_encode, -1);
+	rb_define_module_function(mG711, "decode", g711_decode, -1);
+
+	cShm = rb_define_class_under(mVoiceNative, "Shm", rb_cObject);
+	rb_define_alloc_func(cShm, shm_s_alloc);
+	rb_define_method(cShm, "initialize", shm_initialize, 1);
+	rb_define_method(cShm, "read", shm_read, -1);
+	rb_define_method(cShm, "write", shm_write, 1);
+	rb_define_method(cShm, "frame_bytes", shm_frame_bytes, 0);
+	rb_define_method(cShm, "up_count", shm_up_count, 0);
+	rb_define_method(cShm, "down_count", shm_down_count, 0);
+	rb_define_method(cShm, "down_capacity", shm_down_capacity, 0);
+	rb_define_method(cShm, "close", shm_close, 0);
+	rb_define_method(cShm, "closed?", shm_closed_p, 0);
+
+	cTts = rb_define_class_under(mVoiceNative, "TtsReader", rb_cObject);
+	rb_define_alloc_func(cTts, tts_s_alloc);
+	rb_define_method(cTts, "initialize", tts_initialize, 1);
+	rb_define_method(cTts, "feed", tts_feed, 1);
+}
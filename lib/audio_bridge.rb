@@ -1,43 +1,213 @@
 # frozen_string_literal: true
 
 require 'socket'
+require_relative 'voice_native'
 
-# Bridges baresip audio (S16LE over a Unix socket) with a VoiceAgent
-# (PCMU over WebSocket).
+# Bridges baresip audio (S16LE or PCMU over a Unix socket) with a
+# VoiceAgent (PCMU over WebSocket).
 #
-# The ausock baresip module exposes a single full-duplex Unix stream
-# socket.  This class connects to it and runs two threads:
+# sample_rate must match what ausock sees (ausrc_srate/auplay_srate in
+# the baresip config).  At 8000 (default) the agent side is G.711u.
+# At 16000 (wideband, G.722 calls) the socket must carry S16LE and the
+# agent side is S16LE at 16 kHz too, so audio passes through the
+# bridge untouched in both directions.
 #
-#   read thread  — reads S16LE from socket (caller audio),
-#                  converts to PCMU, sends to voice agent
+# output_rate is the rate the agent's own audio comes at, when that
+# is not sample_rate (24000 for Qwen3-TTS or Grok PCM).  The bridge
+# then writes it to ausock as S16LE untouched, and ausock resamples it
+# to the call rate (ausock_inrate must match).  Needs the s16le format
+# and a socket transport (:stream or :seqpacket).
+#
+# The ausock baresip module exposes a full-duplex Unix socket per
+# channel.  This class connects to one and runs two threads:
+#
+#   read thread  — reads caller audio from the socket,
+#                  converts to PCMU if needed, sends to voice agent
 #   write thread — dequeues PCMU from voice agent,
-#                  converts to S16LE, writes to socket
+#                  converts to S16LE if needed, writes to socket
+#
+# The socket format must match the module's ausock_format setting:
+# :s16le (default) or :pcmu, where ausock does the G.711 coding itself
+# and the bridge passes 160-byte frames through untouched (narrowband
+# only).
+#
+# The transport must match ausock_transport: :stream (default) moves
+# audio over the socket itself; :seqpacket does too, over a
+# SOCK_SEQPACKET socket where every packet is one whole frame or
+# message, so a short read or write can never leave the two sides
+# out of step (Linux); :shm receives a shared-memory ring pair from
+# ausock on connect (ext/ausock/ausock_shm.h) and only keeps the
+# socket to notice hangup.  :shm needs the voice_native extension.
+#
+# The protocol must match ausock_protocol: :raw (default) is bare
+# audio; :framed wraps every frame in a header with a sequence number
+# and timestamp (ext/ausock/ausock_proto.h) and adds in-band control
+# messages — #flush, #mark and #request_stats go to ausock, and its
+# answers plus underrun notices come back as #on events.  :framed
+# needs a socket transport.
+#
+# With ausock_bargein set, ausock itself notices the caller talking
+# over the agent, cuts the agent off and sends BARGEIN.  The bridge
+# then drops everything still queued, answers with FLUSH so fresh
+# audio can flow again, and fires :barge_in.
+#
+# With ausock_vad, ausock gates caller frames on their energy (over a
+# learnt noise floor, not a speech classifier) and reports the
+# talkspurts as :vad events.  In dtx mode it only sends the caller's
+# talkspurts; at the end of each the bridge hands the agent DTX_TAIL
+# of silence itself, so the agent's own end-of-speech detection still
+# sees the caller stop.
+#
+# With ausock_playout adaptive, ausock holds agent audio to a playout
+# target it adapts to how late frames arrive, and conceals gaps.  On
+# :framed each new target comes as PLAYOUT, and the write thread keeps
+# just that much audio (plus the frame in flight) ahead of real time
+# instead of the fixed WRITE_AHEAD.
+#
+# With ausock_clips, #play_clip has ausock mix one of the WAV files it
+# loaded from there over the agent audio (a goodbye, hold audio or
+# filler while the LLM is thinking), on one of CLIP_VOICES voices,
+# with its own gain and ducking.  Nothing goes through the write
+# queue; a :clip event says when the clip has ended.  :framed only.
+#
+# With ausock_dtmf, ausock listens for keypad tones in the caller
+# audio itself and reports each key as a :dtmf event; the rest of the
+# tone is muted before the agent hears it.
 #
 class AudioBridge
   SOCKET_PATH = '/tmp/ausock.sock'
   FRAME_SAMPLES = 160           # 20 ms at 8 kHz mono
   FRAME_BYTES   = FRAME_SAMPLES * 2  # 320 bytes of S16LE
   PCMU_BYTES    = FRAME_SAMPLES      # 160 bytes of G.711u
+  FRAME_MS      = 20
+  SAMPLE_RATES  = [8000, 16000].freeze
+  OUTPUT_RATES  = (8000..48000)      # agent audio ausock can resample from
   WRITE_AHEAD   = 0.1                # seconds of audio to buffer ahead in the socket
+  WRITE_AHEAD_RANGE = (0.04..0.2)    # what a PLAYOUT target may set it to
+  WRITE_BATCH   = 8                  # frames of a write-ahead burst per syscall
+  DTX_TAIL      = 50                 # silent frames fed to the agent after a dtx talkspurt (1 s)
+  FORMATS       = %i[s16le pcmu].freeze
+  TRANSPORTS    = %i[stream seqpacket shm].freeze
+  PROTOCOLS     = %i[raw framed].freeze
+  SHM_ATTACH_TIMEOUT = 5             # seconds to wait for ausock to pass the rings
+  HELLO_TIMEOUT = 5                  # seconds to wait for ausock's HELLO (framed)
 
-  attr_reader :bytes_in, :bytes_out
+  # Framed protocol, mirroring ext/ausock/ausock_proto.h
+  MSG_HEADER       = 'CCS<L<Q<'      # type, flags, len, seq, ts (monotonic us)
+  MSG_HEADER_BYTES = 16
+  MSG_CTL_MAX      = 64              # largest control payload
+  MSG_HELLO        = 1
+  MSG_AUDIO        = 2
+  MSG_FLUSH        = 3
+  MSG_MARK         = 4
+  MSG_STATS        = 5
+  MSG_UNDERRUN     = 6
+  MSG_BARGEIN      = 7
+  MSG_VAD          = 8
+  MSG_PLAYOUT      = 9
+  MSG_CLIP         = 10
+  MSG_DTMF         = 11
+  HELLO_FORMAT     = 'L<S<CCL<S<S<L<S<S<'  # magic, version, fmt, ch, srate, ptime, frame_bytes,
+                                         # in_srate, in_frame_bytes, reserved
+  HELLO_MAGIC      = 0x4b535541      # "AUSK"
+  PROTO_VERSION    = 2
+  STATS_FIELDS     = %i[up_frames up_drops down_frames underruns queued capacity
+                        target concealed].freeze
+  BARGEIN_FORMAT   = 's<S<'          # level (dBFS), speech_ms
+  VAD_FORMAT       = 'CCs<L<'        # event, dtx, level (dBFS), suppressed
+  VAD_EVENTS       = %i[stop start silence].freeze
+  PLAYOUT_FORMAT   = 'S<S<L<'        # target_ms, depth_ms, concealed
+  AUDIO_SPEECH     = 0x01            # AUDIO flag: frame is inside a talkspurt
+  CLIP_FORMAT      = 'CCcCCx3Z24'    # voice, flags, gain_db, duck_db, event, name
+  CLIP_VOICES      = 4
+  CLIP_NAME_MAX    = 23              # bytes; the name is NUL-terminated on the wire
+  CLIP_LOOP        = 0x01            # repeat until stopped
+  CLIP_DUCK        = 0x02            # drop by duck_db while the agent talks
+  CLIP_OVER        = 0x04            # drop the agent by duck_db meanwhile
+  CLIP_KEEP        = 0x08            # keep playing through a barge-in
+  CLIP_EVENTS      = %i[done stopped barge_in unknown].freeze
+  DTMF_FORMAT      = 'axs<'          # key, level of the tone pair (dBFS)
+
+  attr_reader :bytes_in, :bytes_out, :format, :transport, :protocol,
+              :suppressed_frames, :sample_rate, :output_rate,
+              :write_ahead, :concealed_frames
+
+  def initialize(voice_agent, socket_path: SOCKET_PATH, format: :s16le,
+                 transport: :stream, protocol: :raw, sample_rate: 8000,
+                 output_rate: nil, verbose: false)
+    @format = format.to_sym
+    raise ArgumentError, "Unknown socket format: #{format}" unless FORMATS.include?(@format)
+
+    @sample_rate = sample_rate.to_i
+    raise ArgumentError, "Unsupported sample rate: #{sample_rate}" unless SAMPLE_RATES.include?(@sample_rate)
+    raise ArgumentError, 'Wideband audio needs the s16le socket format' if wideband? && @format == :pcmu
+    @frame_samples = @sample_rate * FRAME_MS / 1000
+
+    @transport = transport.to_sym
+    raise ArgumentError, "Unknown socket transport: #{transport}" unless TRANSPORTS.include?(@transport)
+
+    @output_rate = (output_rate || @sample_rate).to_i
+    unless OUTPUT_RATES.cover?(@output_rate) && (@output_rate % (1000 / FRAME_MS)).zero?
+      raise ArgumentError, "Unsupported output rate: #{output_rate}"
+    end
+    if resampled? && (@format != :s16le || @transport == :shm)
+      raise ArgumentError, 'Resampled agent audio needs the s16le format and a socket transport'
+    end
+
+    @protocol = protocol.to_sym
+    raise ArgumentError, "Unknown socket protocol: #{protocol}" unless PROTOCOLS.include?(@protocol)
+    raise ArgumentError, 'The framed protocol needs a socket transport' if @protocol == :framed && @transport == :shm
 
-  def initialize(voice_agent, socket_path: SOCKET_PATH, verbose: false)
     @voice_agent = voice_agent
     @socket_path = socket_path
     @write_queue = Thread::Queue.new
     @running = false
     @socket = nil
+    @shm = nil
     @threads = []
-    @bytes_in  = 0  # PCMU bytes read from socket (caller -> agent)
-    @bytes_out = 0  # PCMU bytes written to socket (agent -> caller)
+    @bytes_in  = 0  # agent-side bytes read from socket (caller -> agent)
+    @bytes_out = 0  # agent-side bytes written to socket (agent -> caller)
+    @suppressed_frames = 0  # caller frames ausock never sent (dtx)
+    @concealed_frames = 0   # agent frames ausock concealed (adaptive playout)
+    @write_ahead = WRITE_AHEAD
     @verbose = verbose
     @last_chunk_at = nil
+    @event_callbacks = Hash.new { |h, k| h[k] = [] }
+    @tx_lock = Mutex.new
+    @tx_seq = 0
+    @playback_gen = 0  # bumped when queued agent audio is thrown away
+  end
+
+  # Register a callback for a framed-protocol event.  Each is called
+  # on the read thread with a Hash:
+  #   :mark     — seq:, sent_at:, played_at:, latency: (seconds); seq
+  #               is 0 for the first frame of an utterance from the
+  #               inject producer, sent_at its timestamp of the frame
+  #   :flush    — seq:, dropped: (agent frames discarded)
+  #   :stats    — seq:, plus STATS_FIELDS
+  #   :underrun — count:, at:
+  #   :barge_in — count:, level: (dBFS), speech_ms:, at:; the agent
+  #               audio queued so far has already been dropped
+  #   :vad      — event: (:start, :stop, or :silence once a second
+  #               between dtx talkspurts), seq:, level:, dtx:,
+  #               suppressed: (frames not sent so far), at:
+  #   :playout  — target_ms:, depth_ms:, concealed: (frames so far),
+  #               write_ahead: (seconds, now in effect), at:
+  #   :clip     — seq: (as returned by #play_clip), voice:, event:
+  #               (:done, :stopped, :barge_in or :unknown), at:
+  #   :dtmf     — digit: ('0'-'9', '*', '#', 'A'-'D'), count: (keys so
+  #               far), level: (dBFS), source: :ausock, at:
+  # Timestamps are CLOCK_MONOTONIC microseconds.
+  def on(event, &block)
+    @event_callbacks[event] << block
+    self
   end
 
   def start
     @running = true
     connect_socket
+    attach_shm if @transport == :shm
+    handshake if @protocol == :framed
     @threads << Thread.new { read_loop }
     @threads << Thread.new { write_loop }
   end
@@ -49,11 +219,14 @@ class AudioBridge
     @threads.each { |t| t.join(2) }
     @threads.each { |t| t.kill if t.alive? }
     @threads.clear
+    detach_shm
   end
 
-  # Called by the voice agent's on_audio callback to enqueue PCMU
-  # audio destined for the caller.
-  def enqueue(pcmu_data)
+  # Called by the voice agent's on_audio callback to enqueue audio
+  # destined for the caller: PCMU, or S16LE when wideband.  With mark:
+  # a MARK goes out right behind its first frame, so a :mark event
+  # says when that frame reached baresip (:framed only).
+  def enqueue(pcmu_data, mark: false)
     return unless @running
     
     if @verbose
@@ -63,18 +236,105 @@ class AudioBridge
       $stderr.puts "[bridge] enqueue: #{pcmu_data.bytesize}B  gap=#{gap}ms  queue_depth=#{@write_queue.size}"
     end
     
-    @write_queue << pcmu_data
+    # tagged, so audio from before a barge-in is never written after it
+    @write_queue << [@playback_gen, pcmu_data, mark]
   end
 
   def running?
     @running
   end
 
+  # 16 kHz: S16LE on both sides, no transcoding
+  def wideband?
+    @sample_rate > 8000
+  end
+
+  # Agent audio at its own rate, resampled by ausock
+  def resampled?
+    @output_rate != @sample_rate
+  end
+
+  # One frame or message per packet (SOCK_SEQPACKET)
+  def packet?
+    @transport == :seqpacket
+  end
+
+  # Agent audio comes as G.711u
+  def pcmu_output?
+    @output_rate == 8000
+  end
+
+  # Audio moved each way so far, in seconds
+  def seconds_in
+    @bytes_in * FRAME_MS / 1000.0 / agent_frame_bytes
+  end
+
+  def seconds_out
+    @bytes_out * FRAME_MS / 1000.0 / output_frame_bytes
+  end
+
   # Number of audio chunks waiting to be written to the socket.
   def write_queue_size
     @write_queue.closed? ? 0 : @write_queue.size
   end
 
+  # Agent frames already handed to ausock but not yet played out.
+  # Only observable with the shm transport; nil otherwise.
+  def buffered_frames
+    @shm && !@shm.closed? ? @shm.down_count : nil
+  end
+
+  # Cut the agent off, e.g. when the caller skips a prompt: drop the
+  # audio still queued here and, on :framed, what ausock holds too.
+  def stop_playback
+    return interrupt_playback if @protocol == :framed
+
+    @tx_lock.synchronize do
+      @playback_gen += 1
+      @write_queue.clear
+    end
+  end
+
+  # --- Framed protocol control (nil unless protocol: :framed) ----------
+
+  # Ask ausock to drop the agent audio already written to the socket.
+  # Answered with a :flush event once applied.
+  def flush
+    send_control(MSG_FLUSH)
+  end
+
+  # Place a mark behind the agent audio written so far.  Returns its
+  # seq; the :mark event with that seq fires when the audio before it
+  # has reached baresip, carrying the socket-to-playout latency.
+  def mark
+    send_control(MSG_MARK, [monotonic_us].pack('Q<'))
+  end
+
+  # Ask ausock for its counters; answered with a :stats event.
+  def request_stats
+    send_control(MSG_STATS)
+  end
+
+  # Have ausock play clip name (a WAV file from ausock_clips, without
+  # .wav) on voice, replacing whatever that voice plays.  loop: repeat
+  # until #stop_clip; duck: drop by duck_db while the agent talks;
+  # over: drop the agent by duck_db instead; keep: carry on through a
+  # barge-in.  Returns the seq the :clip event carries when it ends.
+  def play_clip(name, voice: 0, gain_db: 0, duck_db: 0, loop: false,
+                duck: false, over: false, keep: false)
+    name = name.to_s
+    raise ArgumentError, "Bad clip name: #{name.inspect}" if name.empty? || name.bytesize > CLIP_NAME_MAX
+
+    flags = (loop ? CLIP_LOOP : 0) | (duck ? CLIP_DUCK : 0) |
+            (over ? CLIP_OVER : 0) | (keep ? CLIP_KEEP : 0)
+    send_control(MSG_CLIP, clip_payload(voice, flags, gain_db, duck_db, name))
+  end
+
+  # Fade out whatever voice plays; its :clip event says :stopped.
+  def stop_clip(voice = 0)
+    send_control(MSG_CLIP, clip_payload(voice, 0, 0, 0, ''))
+  end
+
   # --- G.711 u-law codec -------------------------------------------------
 
   ULAW_BIAS = 0x84   # 132
@@ -128,20 +388,30 @@ class AudioBridge
     ULAW_DECODE[byte]
   end
 
-  # Batch conversions used by the bridge threads
-  def self.s16le_to_pcmu(data)
-    data.unpack('s<*').map { |s| linear_to_ulaw(s) }.pack('C*')
+  # Batch conversions used by the bridge threads.  When +out+ is given
+  # the result is written into it (and it is returned), so a caller
+  # holding one buffer per thread allocates nothing per frame.  Uses
+  # VoiceNative::G711 when built (rake compile); the pure-Ruby path
+  # produces identical bytes.
+  def self.s16le_to_pcmu(data, out = nil)
+    return VoiceNative::G711.encode(data, out) if VoiceNative.available?
+
+    pcmu = data.unpack('s<*').map { |s| linear_to_ulaw(s) }.pack('C*')
+    out ? out.replace(pcmu) : pcmu
   end
 
-  def self.pcmu_to_s16le(data)
-    data.bytes.map { |b| ulaw_to_linear(b) }.pack('s<*')
+  def self.pcmu_to_s16le(data, out = nil)
+    return VoiceNative::G711.decode(data, out) if VoiceNative.available?
+
+    s16le = data.bytes.map { |b| ulaw_to_linear(b) }.pack('s<*')
+    out ? out.replace(s16le) : s16le
   end
 
   private
 
   def connect_socket
     5.times do
-      @socket = UNIXSocket.new(@socket_path)
+      @socket = open_socket
       return
     rescue Errno::ENOENT, Errno::ECONNREFUSED
       sleep 0.5
@@ -149,28 +419,358 @@ class AudioBridge
     raise "Could not connect to audio socket at #{@socket_path}"
   end
 
-  # Read caller audio from socket (S16LE), convert to PCMU,
-  # forward to the voice agent.
+  def open_socket
+    return UNIXSocket.new(@socket_path) unless packet?
+
+    socket = Socket.new(:UNIX, :SEQPACKET)
+    socket.connect(Socket.sockaddr_un(@socket_path))
+    socket
+  rescue SystemCallError
+    socket&.close
+    raise
+  end
+
+  # shm transport: ausock passes the region, then the up and down
+  # doorbells, as soon as it accepts the connection.
+  def attach_shm
+    raise "shm transport needs the voice_native extension (rake compile)" unless VoiceNative.available?
+    unless IO.select([@socket], nil, nil, SHM_ATTACH_TIMEOUT)
+      raise "ausock did not pass shm rings on #{@socket_path}"
+    end
+
+    region     = @socket.recv_io
+    @up_bell   = @socket.recv_io
+    @down_bell = @socket.recv_io
+    @shm = VoiceNative::Shm.new(region)
+    region.close
+
+    return if @shm.frame_bytes == socket_frame_bytes
+
+    raise "ausock shm frames are #{@shm.frame_bytes} bytes, expected #{socket_frame_bytes}"
+  end
+
+  # framed protocol: ausock opens with a HELLO describing the channel;
+  # check it matches our format and answer with our own.
+  def handshake
+    unless IO.select([@socket], nil, nil, HELLO_TIMEOUT)
+      raise "ausock sent no HELLO on #{@socket_path}"
+    end
+
+    type, _seq, _ts, payload = next_message
+    raise "ausock sent no HELLO on #{@socket_path}" unless type == MSG_HELLO
+
+    magic, version, _fmt, _ch, srate, _ptime, frame_bytes, in_srate, in_frame_bytes =
+      payload.unpack(HELLO_FORMAT)
+    raise "Not an ausock framed socket: #{@socket_path}" unless magic == HELLO_MAGIC
+    raise "ausock protocol version #{version}, expected #{PROTO_VERSION}" unless version == PROTO_VERSION
+    raise "ausock runs at #{srate} Hz, expected #{@sample_rate}" unless srate == @sample_rate
+    raise "ausock takes agent audio at #{in_srate} Hz, expected #{@output_rate}" unless in_srate == @output_rate
+    unless frame_bytes == socket_frame_bytes
+      raise "ausock frames are #{frame_bytes} bytes, expected #{socket_frame_bytes}"
+    end
+    unless in_frame_bytes == socket_down_bytes
+      raise "ausock agent frames are #{in_frame_bytes} bytes, expected #{socket_down_bytes}"
+    end
+
+    hello = [HELLO_MAGIC, PROTO_VERSION, @format == :pcmu ? 1 : 0, 1, srate,
+             FRAME_MS, frame_bytes, in_srate, in_frame_bytes, 0].pack(HELLO_FORMAT)
+    send_message(MSG_HELLO, hello, seq: 0)
+  end
+
+  # Write one framed message; returns its seq.  Serialised so control
+  # messages from other threads never split an AUDIO frame.
+  def send_message(type, payload = ''.b, seq: nil)
+    return nil unless @protocol == :framed && @socket
+
+    @tx_lock.synchronize { write_message(type, payload, seq) }
+  end
+
+  # Caller of write_message holds @tx_lock.  Header and payload go out
+  # in one writev(), so on :seqpacket they are one packet.
+  def write_message(type, payload, seq)
+    seq ||= (@tx_seq += 1)
+    @socket.write(message_header(type, payload, seq), payload)
+    seq
+  end
+
+  # A burst of messages in one syscall; caller holds @tx_lock
+  def write_messages(type, payloads)
+    messages = payloads.map { |payload| [message_header(type, payload, @tx_seq += 1), payload] }
+    packet? ? write_packets(messages) : @socket.write(*messages.flatten)
+  end
+
+  def message_header(type, payload, seq)
+    [type, 0, payload.bytesize, seq, monotonic_us].pack(MSG_HEADER)
+  end
+
+  # :seqpacket: each element (a String, or the Strings of one message)
+  # as one packet, all in one sendmmsg() when voice_native is built;
+  # whatever the socket cannot take right now is written blocking.
+  def write_packets(packets)
+    sent = VoiceNative.available? ? VoiceNative.send_packets(@socket, packets) : 0
+    packets.drop(sent).each { |packet| @socket.write(*packet) }
+  end
+
+  # Frames of one write-ahead burst, in as few syscalls as the
+  # transport allows.  false, and nothing written, if a barge-in has
+  # dropped their audio since they were queued.
+  def write_frames(frames, gen)
+    return true if frames.empty?
+
+    if @protocol == :framed
+      @tx_lock.synchronize do
+        return false if gen != @playback_gen
+
+        write_messages(MSG_AUDIO, frames)
+      end
+    elsif packet?
+      write_packets(frames)
+    else
+      @socket.write(*frames)
+    end
+    true
+  ensure
+    frames.clear
+  end
+
+  # MARK behind the frames written so far, unless a barge-in has
+  # dropped their audio since it was queued
+  def write_mark(gen)
+    return unless @protocol == :framed
+
+    @tx_lock.synchronize do
+      write_message(MSG_MARK, [monotonic_us].pack('Q<'), nil) if gen == @playback_gen
+    end
+  end
+
+  # ausock has cut the agent off: drop what is still waiting here and
+  # let fresh audio through again.  Under @tx_lock, so the write
+  # thread cannot slip a frame of the old audio in behind the FLUSH.
+  def interrupt_playback
+    @tx_lock.synchronize do
+      @playback_gen += 1
+      @write_queue.clear
+      write_message(MSG_FLUSH, ''.b, nil)
+    end
+  rescue IOError, SystemCallError
+    nil
+  end
+
+  def clip_payload(voice, flags, gain_db, duck_db, name)
+    raise ArgumentError, "Bad clip voice: #{voice}" unless (0...CLIP_VOICES).cover?(voice)
+
+    [voice, flags, gain_db.to_i.clamp(-128, 127), duck_db.to_i.clamp(0, 255), 0, name].pack(CLIP_FORMAT)
+  end
+
+  def send_control(type, payload = ''.b)
+    send_message(type, payload)
+  rescue IOError, SystemCallError
+    nil  # socket gone; the read thread notices the hangup
+  end
+
+  # framed protocol: next AUDIO payload (read into buf), dispatching
+  # the control messages in between; nil once ausock hangs up.
+  def read_message(buf)
+    while @running
+      type, seq, ts, payload = next_message(buf)
+      return nil unless type
+      return payload if type == MSG_AUDIO
+
+      dispatch_message(type, seq, ts, payload)
+    end
+  end
+
+  # framed protocol: [type, seq, ts, payload] of the next message, an
+  # AUDIO payload read into buf; nil once ausock hangs up.  On
+  # :seqpacket the message is one packet, anything else is an error.
+  def next_message(buf = nil)
+    if packet?
+      # one byte over the largest valid message shows up a longer one
+      max = MSG_HEADER_BYTES + [socket_frame_bytes, MSG_CTL_MAX].max + 1
+      @rx_packet ||= String.new(capacity: max, encoding: Encoding::BINARY)
+      packet = @socket.recv(max, 0, @rx_packet)
+      return nil unless packet && packet.bytesize >= MSG_HEADER_BYTES
+
+      type, _flags, len, seq, ts = packet.unpack(MSG_HEADER)
+      return nil unless packet.bytesize == MSG_HEADER_BYTES + len
+
+      payload = packet.byteslice(MSG_HEADER_BYTES, len)
+      return [type, seq, ts, type == MSG_AUDIO && buf ? buf.replace(payload) : payload]
+    end
+
+    header = @socket.read(MSG_HEADER_BYTES)
+    return nil unless header && header.bytesize == MSG_HEADER_BYTES
+
+    type, _flags, len, seq, ts = header.unpack(MSG_HEADER)
+    payload = len.zero? ? ''.b : @socket.read(len, type == MSG_AUDIO ? buf : nil)
+    return nil unless payload && payload.bytesize == len
+
+    [type, seq, ts, payload]
+  end
+
+  def dispatch_message(type, seq, ts, payload)
+    case type
+    when MSG_MARK
+      sent_at = payload.bytesize >= 8 ? payload.unpack1('Q<') : nil
+      emit(:mark, seq: seq, sent_at: sent_at, played_at: ts,
+                  latency: sent_at && (ts - sent_at) / 1_000_000.0)
+    when MSG_FLUSH
+      emit(:flush, seq: seq, dropped: payload.unpack1('L<'))
+    when MSG_STATS
+      stats = STATS_FIELDS.zip(payload.unpack("L<#{STATS_FIELDS.size}")).to_h
+      playout_target(stats[:target] * FRAME_MS) if stats[:target].to_i.positive?
+      @concealed_frames = stats[:concealed] if stats[:concealed]
+      emit(:stats, { seq: seq }.merge(stats))
+    when MSG_UNDERRUN
+      emit(:underrun, count: seq, at: ts)
+    when MSG_BARGEIN
+      interrupt_playback
+      level, speech_ms = payload.unpack(BARGEIN_FORMAT)
+      emit(:barge_in, count: seq, level: level, speech_ms: speech_ms, at: ts)
+    when MSG_VAD
+      event, dtx, level, suppressed = payload.unpack(VAD_FORMAT)
+      event = VAD_EVENTS[event] || return
+      @suppressed_frames = suppressed
+      feed_silence(DTX_TAIL) if event == :stop && dtx == 1
+      emit(:vad, event: event, seq: seq, level: level, dtx: dtx == 1,
+                 suppressed: suppressed, at: ts)
+    when MSG_PLAYOUT
+      target_ms, depth_ms, concealed = payload.unpack(PLAYOUT_FORMAT)
+      @concealed_frames = concealed
+      playout_target(target_ms)
+      emit(:playout, target_ms: target_ms, depth_ms: depth_ms,
+                     concealed: concealed, write_ahead: @write_ahead, at: ts)
+    when MSG_CLIP
+      voice, _flags, _gain, _duck, event = payload.unpack(CLIP_FORMAT)
+      emit(:clip, seq: seq, voice: voice, event: CLIP_EVENTS[event] || event, at: ts)
+    when MSG_DTMF
+      digit, level = payload.unpack(DTMF_FORMAT)
+      emit(:dtmf, digit: digit, count: seq, level: level, source: :ausock, at: ts)
+    end
+  end
+
+  # ausock plays without gaps as long as target_ms of agent audio is
+  # queued: write that far ahead, plus the frame it is playing
+  def playout_target(target_ms)
+    ahead = (target_ms + FRAME_MS) / 1000.0
+    @write_ahead = ahead.clamp(WRITE_AHEAD_RANGE.min, WRITE_AHEAD_RANGE.max)
+  end
+
+  # Caller silence ausock did not send (dtx), made up for the agent
+  def feed_silence(frames)
+    @silence_frame ||= silence(agent_frame_bytes, pcmu: !wideband?).freeze
+    frames.times do
+      @bytes_in += @silence_frame.bytesize
+      @voice_agent.send_audio(@silence_frame)
+    end
+  end
+
+  def emit(event, msg)
+    @event_callbacks[event].each { |cb| cb.call(msg) }
+  end
+
+  def monotonic_us
+    Process.clock_gettime(Process::CLOCK_MONOTONIC, :microsecond)
+  end
+
+  def detach_shm
+    @shm&.close
+    [@up_bell, @down_bell].each { |io| io&.close rescue IOError }
+  end
+
+  # Next caller frame from the shm up ring, sleeping on the up
+  # doorbell while it is empty; nil once ausock hangs up.
+  def shm_read(buf)
+    while @running
+      frame = @shm.read(buf)
+      return frame if frame
+
+      ready, = IO.select([@up_bell, @socket], nil, nil, 0.1)
+      next unless ready
+      return nil if ready.include?(@socket) && @socket.read_nonblock(64, exception: false).nil?
+
+      @up_bell.read_nonblock(8, exception: false)
+    end
+  end
+
+  # Hand one frame to ausock through the shm down ring, sleeping on
+  # the down doorbell while the ring is full.  ausock dequeues at
+  # exactly one frame per 20 ms, so the ring depth is the write-ahead
+  # and no clock pacing is needed here.
+  def shm_write(frame)
+    until @shm.write(frame)
+      return unless @running
+
+      next unless IO.select([@down_bell], nil, nil, FRAME_MS / 1000.0)
+
+      @down_bell.read_nonblock(8, exception: false)
+    end
+  end
+
+  # Bytes per 20 ms frame on the socket
+  def socket_frame_bytes
+    @format == :pcmu ? @frame_samples : @frame_samples * 2
+  end
+
+  # Bytes per 20 ms agent frame written to the socket
+  def socket_down_bytes
+    resampled? ? output_frame_bytes : socket_frame_bytes
+  end
+
+  # Bytes per 20 ms frame of caller audio handed to the voice agent
+  def agent_frame_bytes
+    wideband? ? @frame_samples * 2 : PCMU_BYTES
+  end
+
+  # Bytes per 20 ms frame of the voice agent's own audio
+  def output_frame_bytes
+    pcmu_output? ? PCMU_BYTES : @output_rate * FRAME_MS / 1000 * 2
+  end
+
+  # Digital silence, u-law or S16LE
+  def silence(bytes, pcmu:)
+    (pcmu ? "\xFF" : "\x00").b * bytes
+  end
+
+  # Agent frame to socket format (tx is reused)
+  def to_socket(chunk, tx)
+    pcmu_output? && @format == :s16le ? self.class.pcmu_to_s16le(chunk, tx) : chunk
+  end
+
+  # Read caller audio from socket, convert to PCMU if the socket
+  # carries narrowband S16LE, forward to the voice agent.
+  #
+  # Both buffers are reused for every frame, so send_audio must not
+  # hold on to the String it is given (see VoiceAgent#send_audio).
   def read_loop
+    frame_bytes = socket_frame_bytes
+    rx   = String.new(capacity: frame_bytes, encoding: Encoding::BINARY)
+    pcmu_buf = String.new(capacity: PCMU_BYTES, encoding: Encoding::BINARY)
+
     while @running
-      data = @socket.read(FRAME_BYTES)
-      break unless data && data.bytesize == FRAME_BYTES
+      data = if @shm then shm_read(rx)
+             elsif @protocol == :framed then read_message(rx)
+             elsif packet? then @socket.recv(frame_bytes + 1, 0, rx)   # longer is an error
+             else @socket.read(frame_bytes, rx)
+             end
+      break unless data && data.bytesize == frame_bytes
 
-      pcmu = self.class.s16le_to_pcmu(data)
-      @bytes_in += pcmu.bytesize
-      @voice_agent.send_audio(pcmu)
+      audio = @format == :pcmu || wideband? ? data : self.class.s16le_to_pcmu(data, pcmu_buf)
+      @bytes_in += audio.bytesize
+      @voice_agent.send_audio(audio)
     end
   rescue IOError, Errno::ECONNRESET, Errno::EPIPE
     # socket closed
   end
 
-  # Dequeue PCMU from the voice agent, convert to S16LE,
-  # write to socket for the caller to hear.
+  # Dequeue audio from the voice agent, convert PCMU to S16LE if the
+  # socket carries S16LE, write to socket for the caller to hear.
   #
   # Grok sends audio in large bursts (4-16 KB) but the socket
-  # consumer (ausock.c src_thread) expects steady 20 ms frames.
+  # consumer (the ausock.c scheduler tick) expects steady 20 ms frames.
   # We chop each burst into FRAME_SAMPLES-sized pieces and write
-  # up to WRITE_AHEAD seconds ahead of real-time.  The kernel
+  # up to write_ahead seconds ahead of real-time (WRITE_AHEAD, or
+  # ausock's playout target once it sends one).  The kernel
   # socket buffer absorbs the early data; the C side reads at its
   # steady 20 ms monotonic-clock cadence regardless.
   #
@@ -178,32 +778,52 @@ class AudioBridge
   # scheduling jitter (e.g. when run as a subprocess alongside a
   # CPU-heavy LLM).  Without it, any sleep() overshoot causes the
   # C side to read silence — producing choppy audio.
+  #
+  # The frames of a burst that are all due within write_ahead go out
+  # together, up to WRITE_BATCH per writev() (or sendmmsg() on
+  # :seqpacket), instead of one syscall each.
   def write_loop
-    frame_duration = FRAME_SAMPLES / 8000.0  # 0.02 s
+    frame_duration = FRAME_MS / 1000.0  # 0.02 s
     next_frame_at = nil
     frame_count = 0
+    txs = Array.new(WRITE_BATCH) { String.new(capacity: FRAME_BYTES, encoding: Encoding::BINARY) }
+    batch = []
+    frame_bytes = output_frame_bytes
+    pad = silence(1, pcmu: pcmu_output?)
 
     while @running
-      pcmu = @write_queue.pop
+      gen, pcmu, mark = @write_queue.pop
       break unless pcmu
 
       @bytes_out += pcmu.bytesize
 
       offset = 0
       while offset < pcmu.bytesize
-        chunk = pcmu.byteslice(offset, PCMU_BYTES) || break
+        chunk = pcmu.byteslice(offset, frame_bytes) || break
         offset += chunk.bytesize
 
+        # shm slots, packets and framed AUDIO messages hold whole frames
+        chunk = chunk.ljust(frame_bytes, pad) if @shm || packet? || @protocol == :framed
+
+        if @shm
+          shm_write(to_socket(chunk, txs[0]))
+          next
+        end
+
         now = Process.clock_gettime(Process::CLOCK_MONOTONIC)
         next_frame_at ||= now
 
-        # Sleep only if we're more than WRITE_AHEAD ahead of schedule.
+        # Sleep only if we're more than write_ahead ahead of schedule.
         # This fills the socket buffer with ~5 frames (100 ms) of
-        # reserve that the C side can consume during Ruby stalls.
+        # reserve that the C side can consume during Ruby stalls, or
+        # with what ausock's adaptive playout target asks for.
+        write_ahead = @write_ahead
         ahead = next_frame_at - now
         sleep_duration = 0
-        if ahead > WRITE_AHEAD
-          sleep_target = ahead - WRITE_AHEAD
+        if ahead > write_ahead
+          break unless write_frames(batch, gen)  # barged in
+
+          sleep_target = ahead - write_ahead
           sleep_start = now
           sleep(sleep_target)
           sleep_duration = Process.clock_gettime(Process::CLOCK_MONOTONIC) - sleep_start
@@ -214,9 +834,15 @@ class AudioBridge
           end
         end
 
-        s16le = self.class.pcmu_to_s16le(chunk)
-        @socket.write(s16le)
-        
+        batch << to_socket(chunk, txs[batch.size])
+        if mark
+          mark = false
+          break unless write_frames(batch, gen)
+
+          write_mark(gen)
+        end
+        break if batch.size == WRITE_BATCH && !write_frames(batch, gen)
+
         frame_count += 1
         if @verbose && frame_count % 50 == 0  # log every 50 frames (1 second)
           drift = next_frame_at - now
@@ -226,6 +852,8 @@ class AudioBridge
         next_frame_at += frame_duration
         next_frame_at = now + frame_duration if next_frame_at < now
       end
+
+      write_frames(batch, gen)
     end
   rescue IOError, Errno::ECONNRESET, Errno::EPIPE, ClosedQueueError
     # socket closed or queue closed
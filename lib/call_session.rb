@@ -1,6 +1,7 @@
 # frozen_string_literal: true
 
 require_relative 'config'
+require_relative 'turn_trace'
 require 'fileutils'
 
 # Orchestrates a voice call: connects the voice agent, dials via SIP,
@@ -23,6 +24,9 @@ class CallSession
 
   SOCKET_PATH = '/tmp/ausock.sock'
   LOCK_FILE   = File.join(File.expand_path('../..', __FILE__), 'tmp', 'call.pid')
+  GOODBYE_VOICE = 0   # ausock clip voices (framed protocol, audio.clips_dir)
+  HOLD_VOICE    = 1
+  PHRASE_VOICE  = 2   # phrases from the phrase cache (audio.phrase_cache)
 
   # Plain SIP client from config — for status/hangup/calls commands.
   def self.sip_client
@@ -42,8 +46,28 @@ class CallSession
     end
   end
 
-  # Build a CallSession from config/default.yml
-  def self.build(number:, agent: nil, verbose: false, transcript_path: nil, instructions: nil)
+  # baresip, configured for the socket_path channel, started unless it
+  # is running.  bin/workers keeps it resident this way.
+  def self.start_sip(socket_path = SOCKET_PATH)
+    build_client(socket_path).status
+  end
+
+  # The TTS and STT command lines of a local agent for this profile,
+  # which bin/workers keeps warm; nil unless voice_agent.provider is local
+  def self.worker_commands(agent = nil)
+    return nil unless Config.fetch(:voice_agent, :provider) == 'local'
+
+    local = build_agent(Config.agent(agent))
+    { tts: local.tts_command, stt: local.stt_command }
+  end
+
+  # Build a CallSession from config/default.yml.
+  #
+  # socket_path selects the ausock channel for this call.  Each channel
+  # carries one call, so concurrent sessions must use different paths.
+  # trace_path, if given, gets the timeline of every turn (TurnTrace).
+  def self.build(number:, agent: nil, verbose: false, transcript_path: nil, instructions: nil,
+                 socket_path: SOCKET_PATH, trace_path: nil)
     profile   = Config.agent(agent)
     if instructions
       # Override personality while preserving agent identity. The voice
@@ -51,21 +75,77 @@ class CallSession
       # the agent name in the instructions text to stay in character.
       profile = profile.merge('personality' => "Your name is #{profile['name']}. #{instructions}")
     end
-    client    = build_client
-    voice     = build_agent(profile, verbose: verbose)
-    bridge    = build_bridge(voice, verbose: verbose)
+    client    = build_client(socket_path)
+    voice     = build_agent(profile, socket_path, verbose: verbose)
+    bridge    = build_bridge(voice, socket_path, verbose: verbose)
     assistant = build_assistant(verbose: verbose)
     triggers  = build_triggers
 
     new(
       number: number, client: client, agent: voice, bridge: bridge,
       assistant: assistant, triggers: triggers, verbose: verbose,
-      transcript_path: transcript_path
+      transcript_path: transcript_path, socket_path: socket_path, trace_path: trace_path,
+      clips: { hold: Config.fetch(:audio, :hold_clip), goodbye: Config.fetch(:audio, :goodbye_clip) },
+      phrases: cached_phrases(profile)
     )
   end
 
+  # Phrase cache file ausock plays phrases from, or nil (audio.phrase_cache)
+  def self.phrase_cache_path
+    path = Config.fetch(:audio, :phrase_cache).to_s
+    path.empty? ? nil : File.expand_path(path, File.expand_path('..', __dir__))
+  end
+
+  # kind => text of the phrases for an agent profile (phrases: in
+  # config, and the profile's own), which bin/phrases renders
+  def self.phrase_texts(profile)
+    require_relative 'phrase_cache'
+    PhraseCache.texts(Config.fetch(:phrases), profile)
+  end
+
+  # The local TTS command line for a profile at rate, which renders its
+  # phrases; nil unless voice_agent.provider is local
+  def self.phrase_tts_command(profile, rate)
+    return nil unless Config.fetch(:voice_agent, :provider) == 'local'
+
+    build_agent(profile).tts_command(rate)
+  end
+
+  # The profile's phrases that are in the cache at the call rate:
+  # kind => { name:, text: }.  Those not rendered yet are left to the
+  # agent, as without a cache.
+  def self.cached_phrases(profile)
+    require_relative 'phrase_cache'
+    path = phrase_cache_path
+    return {} unless path && File.exist?(path)
+
+    cache = PhraseCache.new(path)
+    rate = Config.fetch(:audio, :sample_rate)
+    phrase_texts(profile).each_with_object({}) do |(kind, text), out|
+      name = PhraseCache.name(profile, text, rate)
+      out[kind.to_sym] = { name: name, text: text } if cache.include?(name)
+    end
+  rescue PhraseCache::Error => e
+    warn "phrase cache: #{e.message}"
+    {}
+  end
+
+  # Lock file guarding one ausock channel. The default channel keeps the
+  # historical LOCK_FILE name; other channels get a per-socket suffix.
+  def self.lock_file_for(socket_path)
+    return LOCK_FILE if socket_path == SOCKET_PATH
+
+    LOCK_FILE.sub(/\.pid\z/, "-#{File.basename(socket_path, '.sock')}.pid")
+  end
+
+  # clips names ausock clips the session plays itself: :hold while the
+  # assistant works on a delegated request, :goodbye to end a silent call.
+  # phrases are the agent's own pre-rendered lines in ausock's phrase
+  # cache, kind => { name:, text: }: :filler as a request is delegated,
+  # :still_there and :goodbye when the caller goes quiet.
   def initialize(number:, client:, agent:, bridge:, assistant: nil, triggers: nil,
-                 verbose: false, transcript_path: nil)
+                 verbose: false, transcript_path: nil, socket_path: SOCKET_PATH, clips: {},
+                 phrases: {}, trace_path: nil)
     @number = number
     @client = client
     @agent = agent
@@ -74,7 +154,14 @@ class CallSession
     @triggers = triggers
     @verbose = verbose
     @transcript_path = transcript_path
+    @socket_path = socket_path
+    @clips = clips.transform_values(&:to_s).reject { |_, name| name.empty? }
+    @phrases = phrases.transform_keys(&:to_sym)
+    @goodbye_clip_seq = nil          # seq of the goodbye clip while it plays
+    @still_there_seq = nil           # seq of the still_there phrase while it plays
     @transcript_io = nil
+    @trace = TurnTrace.new(trace_path)
+    @ausock_vad = false              # ausock reports the caller's talkspurts
     @start_time = Time.now
     @hanging_up = false
     @goodbye_pending = nil           # :keyword or :silence once goodbye sequence starts
@@ -172,6 +259,37 @@ class CallSession
 
     @triggers.on(:hangup) { |ctx| handle_hangup_trigger(ctx) }
     @triggers.on(:delegate) { |_ctx, payload| handle_delegate(payload) } if @assistant
+    @triggers.on(:interrupt) { |_ctx, key| handle_key_interrupt(key) }
+    @triggers.on(:dtmf) { |_ctx, key| handle_key(key) }
+  end
+
+  # --- Keypad (DtmfTrigger) ---
+
+  # A key from ausock's in-band detector or baresip.  ausock reports
+  # its keys twice on :framed, in-band and as a module event; the
+  # in-band one is quicker, so the other is dropped.  Keys of other
+  # sessions' calls (another channel, another call id) are not ours.
+  def handle_dtmf(event, via:)
+    return if via == :client && event[:source] == :ausock && @bridge.protocol == :framed
+    return if event[:channel] && event[:channel] != @socket_path
+    return if event[:call_id] && @client.respond_to?(:call_id) && event[:call_id] != @client.call_id
+
+    log "DTMF: #{event[:digit]} (#{event[:source]})"
+    transcript(:system, "Key pressed: #{event[:digit]}")
+    @triggers&.check(dtmf: event[:digit], dtmf_source: event[:source])
+  end
+
+  # Skip whatever the agent is saying, as a barge-in would
+  def handle_key_interrupt(key)
+    log "key #{key}: interrupting agent"
+    @call_state[:is_speaking] = false
+    @agent.interrupt
+    @bridge.stop_playback
+  end
+
+  # Any other key goes to the agent as text, e.g. a menu choice
+  def handle_key(key)
+    @agent.send_text("[The caller pressed #{key} on the keypad]")
   end
 
   def handle_hangup_trigger(ctx)
@@ -182,11 +300,12 @@ class CallSession
     if reason == :silence && !@silence_check_pending
       # Phase 1: Ask if the caller is still there
       @silence_check_pending = true
-      log "silence detected — prompting 'are you still there?'"
-      @agent.prompt_response(
-        "The caller has been quiet for a while. " \
-        "Ask if they're still there, something brief like: 'Hey, are you still there?'"
-      )
+      if (@still_there_seq = play_clip(:still_there, voice: PHRASE_VOICE, over: true, duck_db: 40))
+        log "silence detected — playing 'are you still there?' phrase"
+      else
+        log "silence detected — prompting 'are you still there?'"
+        prompt_still_there
+      end
       # Reset silence trigger so it can fire again for phase 2
       @call_state[:last_response_at] = nil
       @triggers&.reset!
@@ -212,11 +331,10 @@ class CallSession
     log "hangup triggered (#{reason})"
     @goodbye_pending = reason
 
-    if reason == :silence
-      @agent.send_text(
-        "The caller has gone quiet. Wrap up with a brief goodbye, " \
-        "something like: 'Looks like you stepped away. Call back anytime. Goodbye!'"
-      )
+    if reason == :silence && (@goodbye_clip_seq = play_clip(:goodbye, voice: GOODBYE_VOICE, over: true, duck_db: 40))
+      log "playing goodbye clip '#{clip_name(:goodbye)}'"
+    elsif reason == :silence
+      prompt_goodbye
     end
     # For :keyword, the agent already heard the farewell through audio
     # and will respond with a natural goodbye — just wait for it.
@@ -231,6 +349,68 @@ class CallSession
     end
   end
 
+  def prompt_still_there
+    @agent.prompt_response(
+      "The caller has been quiet for a while. " \
+      "Ask if they're still there, something brief like: 'Hey, are you still there?'"
+    )
+  end
+
+  def prompt_goodbye
+    @agent.send_text(
+      "The caller has gone quiet. Wrap up with a brief goodbye, " \
+      "something like: 'Looks like you stepped away. Call back anytime. Goodbye!'"
+    )
+  end
+
+  # A WAV clip configured for kind, else the agent's cached phrase
+  def clip_name(kind)
+    @clips[kind] || @phrases.dig(kind, :name)
+  end
+
+  # Start one of @clips or @phrases in ausock; its seq, or nil if there
+  # is none for kind or the bridge cannot play clips.  A phrase is said
+  # by the agent, and goes in the transcript as such.
+  def play_clip(kind, **opts)
+    name = clip_name(kind)
+    return nil unless name && @bridge.respond_to?(:play_clip)
+
+    seq = @bridge.play_clip(name, **opts)
+    if seq && !@clips[kind] && (text = @phrases.dig(kind, :text))
+      emit(:output, "\nAgent: #{text}")
+      transcript(:agent, text)
+    end
+    seq
+  end
+
+  def handle_clip(event)
+    return handle_still_there(event) if event[:seq] == @still_there_seq
+    return unless event[:seq] == @goodbye_clip_seq
+
+    @goodbye_clip_seq = nil
+    case event[:event]
+    when :unknown
+      log "goodbye clip '#{clip_name(:goodbye)}' not loaded in ausock — asking the agent instead"
+      prompt_goodbye if @goodbye_pending
+    when :done
+      if @goodbye_pending
+        log "goodbye clip played"
+        spawn_thread { hangup_sequence }  # not on the bridge's read thread it joins
+      end
+    end
+  end
+
+  def handle_still_there(event)
+    @still_there_seq = nil
+    case event[:event]
+    when :unknown
+      log "'are you still there?' phrase not in ausock — asking the agent instead"
+      prompt_still_there if @silence_check_pending
+    when :done
+      @call_state[:last_response_at] = Time.now  # the silence timer runs from here
+    end
+  end
+
   def handle_delegate(payload)
     intent  = payload&.dig('intent') || 'unknown'
     request = payload&.dig('request') || ''
@@ -245,6 +425,9 @@ class CallSession
     end
 
     spawn_thread do
+      # a phrase to say it, then filler under the agent while the assistant thinks
+      play_clip(:filler, voice: PHRASE_VOICE, duck: true, duck_db: 20)
+      hold = play_clip(:hold, voice: HOLD_VOICE, loop: true, duck: true, duck_db: 20, gain_db: -12)
       begin
         log "delegate: sending to assistant (#{@assistant.name})"
         reply = @assistant.sessions_send(intent: intent, request: request)
@@ -266,6 +449,8 @@ class CallSession
           log "delegate: sending fallback error tool result"
           @agent.send_tool_result(call_id, "Sorry, I couldn't process that request.")
         end
+      ensure
+        @bridge.stop_clip(HOLD_VOICE) if hold
       end
     end
   end
@@ -292,7 +477,16 @@ class CallSession
       on_audio: ->(data) {
         @call_state[:is_speaking] = true
         log "audio out: +#{data.bytesize}B  total=#{@bridge.bytes_out}B"
-        @bridge.enqueue(data)
+        # the first audio of a turn carries a MARK, echoed as it plays
+        if @trace.claim(:played)
+          @bridge.enqueue(data, mark: true)
+        else
+          @bridge.enqueue(data)
+        end
+      },
+      on_trace: ->(stage, at) {
+        # ausock hears the caller stop sooner than the agent does
+        @trace.mark(stage, at) unless stage == :speech_stop && @ausock_vad
       },
       on_transcript: ->(text) {
         emit(:output, "\nAgent: #{text}")
@@ -360,12 +554,39 @@ class CallSession
     )
   end
 
+  # Events ausock raises on the framed protocol.  A barge-in (with
+  # audio.barge_in_ms) has already cut the queued audio; stop the agent
+  # generating more.
+  def wire_bridge_events
+    @bridge.on(:barge_in) do |e|
+      log "barge-in: caller at #{e[:level]} dBFS for #{e[:speech_ms]}ms — interrupting agent"
+      @call_state[:is_speaking] = false
+      @agent.interrupt
+    end
+    @bridge.on(:vad) do |e|
+      log "caller energy VAD: #{e[:event]} at #{e[:level]} dBFS  suppressed=#{e[:suppressed]}" unless e[:event] == :silence
+      @ausock_vad = true
+      @trace.mark(:speech_stop, e[:at]) if e[:event] == :stop
+    end
+    # the first agent audio of a turn (or of an injected utterance) has
+    # reached baresip
+    @bridge.on(:mark) { |e| @trace.mark(:played, e[:played_at]) }
+    @bridge.on(:playout) do |e|
+      log "playout target #{e[:target_ms]}ms (queued #{e[:depth_ms]}ms, concealed=#{e[:concealed]})  write-ahead=#{(e[:write_ahead] * 1000).round}ms"
+    end
+    @bridge.on(:clip) { |e| handle_clip(e) }
+    return unless @triggers&.find('dtmf')
+
+    @bridge.on(:dtmf) { |e| handle_dtmf(e, via: :bridge) }
+    @client.on_dtmf { |e| handle_dtmf(e, via: :client) } if @client.respond_to?(:on_dtmf)
+  end
+
   # --- Dial and run ---
 
   def dial
     emit(:output, "Calling #{@number}...")
     log "dialing #{@number}"
-    active = @client.call(@number)
+    active = @client.call(@number)  # just the call placed, by its id
 
     if active.any?
       call = active.first
@@ -373,6 +594,7 @@ class CallSession
       log "call established: #{call.inspect}"
       transcript(:system, "Call connected")
 
+      wire_bridge_events
       @bridge.start
       log "audio bridge started"
       emit(:output, "Audio bridge active -- Ctrl-C to hang up")
@@ -408,13 +630,35 @@ class CallSession
       loop do
         sleep 5
         break if @hanging_up
-        log "stats: in=#{@bridge.bytes_in}B (#{(@bridge.bytes_in / 8000.0).round(1)}s)  out=#{@bridge.bytes_out}B (#{(@bridge.bytes_out / 8000.0).round(1)}s)  queue=#{@bridge.write_queue_size}"
+        log "stats: in=#{@bridge.bytes_in}B (#{@bridge.seconds_in.round(1)}s)  out=#{@bridge.bytes_out}B (#{@bridge.seconds_out.round(1)}s)  queue=#{@bridge.write_queue_size}"
+        log_ausock_stats
       rescue => e
         break
       end
     end
   end
 
+  # One line of ausock's own view of this call's channel: how late its
+  # scheduler ticks ran (p99), deadlines they missed and skipped,
+  # silence it had to play, how deep the agent queue was and the clock
+  # drift it measured.
+  def log_ausock_stats
+    return unless @client.respond_to?(:ausock_stats)
+    channels = @client.ausock_stats or return
+    ch = channels.find { |c| c[:path] == @socket_path } || channels.first
+    return unless ch
+
+    src, play = ch[:src], ch[:play]
+    log format(
+      "ausock: late p99 src=%dus play=%dus  missed=%d/%d  resyncs=%d/%d  silence idle=%d dry=%d  depth p50=%d max=%d  txq_max=%dB",
+      src[:late_us][:p99], play[:late_us][:p99],
+      src[:missed].to_i, play[:missed].to_i,
+      src[:resyncs], play[:resyncs],
+      src[:silence_idle], src[:silence_dry],
+      src[:depth][:p50], src[:depth][:max], play[:txq_max]
+    ) + (src[:drift_ppm].to_i != 0 ? "  drift=#{src[:drift_ppm]}ppm" : '')
+  end
+
   # --- Thread management ---
 
   def spawn_thread(&block)
@@ -437,8 +681,9 @@ class CallSession
     log "hangup: disconnecting agent"
     @agent&.disconnect
     log "hangup: sending SIP hangup"
-    @client&.hangup
-    @client.shutdown if @client.respond_to?(:shutdown)
+    @client&.hangup                   # our call only, by id
+    @client.shutdown if @client.respond_to?(:shutdown)  # keeps a shared baresip up
+    @trace.close
     log_final_stats
     close_transcript
     # Clean up any lingering threads
@@ -450,7 +695,7 @@ class CallSession
 
   def drain_and_hangup
     spawn_thread do
-      while @bridge.write_queue_size > 0
+      while @bridge.write_queue_size > 0 || @bridge.buffered_frames.to_i > 0
         break unless @goodbye_pending
         sleep 0.1
       end
@@ -466,30 +711,45 @@ class CallSession
 
   def log_final_stats
     return unless @verbose
+    suppressed = @bridge.respond_to?(:suppressed_frames) ? @bridge.suppressed_frames.to_i : 0
+    concealed = @bridge.respond_to?(:concealed_frames) ? @bridge.concealed_frames.to_i : 0
     emit(:log, format(
-      "\n[%7.3f] final: in=%dB (%.1fs) out=%dB (%.1fs)",
+      "\n[%7.3f] final: in=%dB (%.1fs) out=%dB (%.1fs)%s%s",
       Time.now - @start_time,
-      @bridge&.bytes_in.to_i, @bridge&.bytes_in.to_i / 8000.0,
-      @bridge&.bytes_out.to_i, @bridge&.bytes_out.to_i / 8000.0
+      @bridge&.bytes_in.to_i, @bridge&.seconds_in.to_f,
+      @bridge&.bytes_out.to_i, @bridge&.seconds_out.to_f,
+      suppressed.positive? ? format(' dtx-suppressed=%.1fs', suppressed * 0.02) : '',
+      concealed.positive? ? format(' concealed=%.1fs', concealed * 0.02) : ''
     ))
+    return if @trace.turns.zero?
+
+    # where turn latency goes: p50/p95/p99 of each stage, and caller
+    # stopping to hearing the answer (total)
+    emit(:log, format("[%7.3f] turns: %d  %s (p50/p95/p99)",
+                      Time.now - @start_time, @trace.turns, @trace.summary))
   end
 
-  # --- Lock file (prevents multiple simultaneous calls) ---
+  # --- Lock file (prevents two calls sharing one ausock channel) ---
+
+  def lock_file
+    self.class.lock_file_for(@socket_path)
+  end
 
   def acquire_lock!
-    if File.exist?(LOCK_FILE)
-      existing_pid = File.read(LOCK_FILE).strip.to_i
+    if File.exist?(lock_file)
+      existing_pid = File.read(lock_file).strip.to_i
       if existing_pid > 0 && process_alive?(existing_pid)
-        raise Error, "Another call is already running (PID #{existing_pid}). Hang up first: bin/call hangup"
+        raise Error, "Another call is already running on #{@socket_path} (PID #{existing_pid}). " \
+                     "Hang up first: bin/call hangup, or use another --socket"
       end
       # Stale lock from a crashed session — safe to remove
     end
-    FileUtils.mkdir_p(File.dirname(LOCK_FILE))
-    File.write(LOCK_FILE, Process.pid.to_s)
+    FileUtils.mkdir_p(File.dirname(lock_file))
+    File.write(lock_file, Process.pid.to_s)
   end
 
   def release_lock
-    File.delete(LOCK_FILE) if File.exist?(LOCK_FILE)
+    File.delete(lock_file) if File.exist?(lock_file)
   rescue Errno::ENOENT
     # Already removed — fine
   end
@@ -503,7 +763,7 @@ class CallSession
 
   # --- Config-driven component builders (class methods) ---
 
-  def self.build_client
+  def self.build_client(socket_path = SOCKET_PATH)
     kind = Config.fetch(:sip, :client)
     case kind
     when 'baresip'
@@ -514,14 +774,37 @@ class CallSession
         sip_server:   Config.fetch(:sip, :server),
         module_path:  Config.fetch(:sip, :module_path),
         ctrl_port:    Config.fetch(:sip, :ctrl_port),
-        voice_socket: SOCKET_PATH
+        max_calls:    Config.fetch(:sip, :max_calls),
+        voice_socket: socket_path,
+        socket_format: Config.fetch(:audio, :socket_format),
+        socket_transport: Config.fetch(:audio, :socket_transport),
+        socket_protocol: Config.fetch(:audio, :socket_protocol),
+        barge_in_ms: Config.fetch(:audio, :barge_in_ms),
+        vad: Config.fetch(:audio, :vad),
+        aec_tail_ms: Config.fetch(:audio, :aec_tail_ms),
+        playout: Config.fetch(:audio, :playout),
+        stats_interval: Config.fetch(:audio, :stats_interval),
+        record_dir: Config.fetch(:audio, :record_dir),
+        clips_dir: Config.fetch(:audio, :clips_dir),
+        phrase_cache: phrase_cache_path,
+        comfort_noise: Config.fetch(:audio, :comfort_noise),
+        drift_ppm: Config.fetch(:audio, :drift_ppm),
+        tap: stt_tap? ? 'only' : 'off',
+        inject: tts_inject?,
+        dtmf: Config.fetch(:audio, :dtmf),
+        rt_policy: Config.fetch(:audio, :rt_policy),
+        rt_prio: Config.fetch(:audio, :rt_prio),
+        rt_cpus: Config.fetch(:audio, :rt_cpus),
+        mlock: Config.fetch(:audio, :mlock) == true,
+        sample_rate: Config.fetch(:audio, :sample_rate),
+        output_rate: output_rate
       )
     else
       raise "Unknown sip.client=#{kind}"
     end
   end
 
-  def self.build_agent(agent_profile, verbose: false)
+  def self.build_agent(agent_profile, socket_path = SOCKET_PATH, verbose: false)
     kind = Config.fetch(:voice_agent, :provider)
     case kind
     when 'grok'
@@ -531,6 +814,9 @@ class CallSession
         agent_name:   agent_profile['name'],
         instructions: agent_profile['personality'],
         tools:        [VoiceAgent::Grok::CLASSIFY_INTENT_TOOL],
+        uplink_ms:    Config.fetch(:voice_agent, :uplink_ms),
+        sample_rate:  Config.fetch(:audio, :sample_rate),
+        output_rate:  output_rate,
         verbose:      verbose
       )
     when 'local'
@@ -543,6 +829,12 @@ class CallSession
         tts_instruct: agent_profile['tts_instruct'],
         ref_audio:    agent_profile['ref_audio'],
         ref_text:     agent_profile['ref_text'],
+        stt_tap:      stt_tap? ? "#{socket_path}.tap" : nil,
+        tts_inject:   tts_inject? ? "#{socket_path}.inject" : nil,
+        tts_lookahead: Config.fetch(:voice_agent, :tts_lookahead),
+        worker_pool:  worker_pool,
+        sample_rate:  Config.fetch(:audio, :sample_rate),
+        output_rate:  output_rate,
         verbose:      verbose
       )
     else
@@ -550,9 +842,38 @@ class CallSession
     end
   end
 
-  def self.build_bridge(agent, verbose: false)
+  def self.build_bridge(agent, socket_path = SOCKET_PATH, verbose: false)
     require_relative 'audio_bridge'
-    AudioBridge.new(agent, socket_path: SOCKET_PATH, verbose: verbose)
+    AudioBridge.new(agent, socket_path: socket_path,
+                           format: Config.fetch(:audio, :socket_format),
+                           transport: Config.fetch(:audio, :socket_transport),
+                           protocol: Config.fetch(:audio, :socket_protocol),
+                           sample_rate: Config.fetch(:audio, :sample_rate),
+                           output_rate: output_rate,
+                           verbose: verbose)
+  end
+
+  # Local STT reads the caller straight from ausock's tap socket, so
+  # caller audio no longer passes through Ruby at all (audio.stt_tap)
+  def self.stt_tap?
+    Config.fetch(:audio, :stt_tap) == true && Config.fetch(:voice_agent, :provider) == 'local'
+  end
+
+  # Local TTS writes agent audio straight into ausock's inject socket,
+  # and Ruby only sees where each utterance ends (audio.tts_inject)
+  def self.tts_inject?
+    Config.fetch(:audio, :tts_inject) == true && Config.fetch(:voice_agent, :provider) == 'local'
+  end
+
+  # bin/workers' socket to lease warm STT/TTS workers from (worker_pool.socket)
+  def self.worker_pool
+    path = Config.fetch(:worker_pool, :socket).to_s
+    path.empty? ? nil : path
+  end
+
+  # Rate the agent's own audio is written at; 0 in config is the call rate
+  def self.output_rate
+    Config.fetch(:audio, :output_rate).to_i.nonzero? || Config.fetch(:audio, :sample_rate)
   end
 
   def self.build_assistant(verbose: false)
@@ -575,9 +896,11 @@ class CallSession
     triggers.add(KeywordTrigger.new(action: :hangup))
     triggers.add(SilenceTrigger.new(timeout: 30, action: :hangup))
     triggers.add(DelegationTrigger.new)
+    dtmf = Config.fetch(:audio, :dtmf)
+    triggers.add(DtmfTrigger.new) if dtmf && dtmf.to_s != 'off'  # YAML reads a bare off as false
     triggers
   end
 
   private_class_method :build_client, :build_agent, :build_bridge,
-                       :build_assistant, :build_triggers
+                       :build_assistant, :build_triggers, :cached_phrases
 end
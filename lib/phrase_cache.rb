@@ -0,0 +1,186 @@
+# frozen_string_literal: true
+
+require 'digest'
+require 'json'
+require 'open3'
+require_relative 'voice_agent/tts_reader'
+
+# Phrases rendered ahead of time in an agent's voice — the filler
+# while the assistant works, "are you still there?", the goodbye —
+# kept in one file that ausock maps and plays from (ausock_phrases,
+# ext/ausock/phrase.c).  A CLIP naming one starts it on the next tick:
+# no LLM, no TTS and no audio through Ruby on the call's path.
+#
+# A phrase is named after what it sounds like: the TTS voice settings
+# of the agent profile (voice, ref_audio, ref_text, tts_instruct,
+# trump), the sample rate and the text.  Editing any of them makes a
+# new name, which is simply not in the cache until bin/phrases renders
+# it, so a stale phrase is never played.
+#
+# File layout (ext/ausock/ausock_proto.h, little-endian):
+#   struct ausock_phrase_hdr   "AUPHRASE", version, count, reserved
+#   struct ausock_phrase_ent   name[24], srate, samples, offset; × count
+#   S16LE mono samples of each entry at its offset
+#
+# The file is written beside itself and renamed over, so ausock never
+# maps a half-written one; it picks up the new file on the first name
+# it cannot find.
+#
+# Usage:
+#   cache = PhraseCache.new('tmp/phrases.bin')
+#   name = PhraseCache.name(profile, 'One moment.', 8000)
+#   cache.render(profile, ['One moment.'], 8000, tts_argv)
+#   cache.include?(name)  # => true
+class PhraseCache
+  MAGIC   = 'AUPHRASE'
+  VERSION = 1
+  HEADER  = 'a8VVQ<'    # struct ausock_phrase_hdr
+  ENTRY   = 'Z24VVQ<'   # struct ausock_phrase_ent
+  HEADER_BYTES = 24
+  ENTRY_BYTES  = 40
+  NAME_BYTES   = 24     # AUSOCK_CLIP_NAME, NUL included
+
+  # Profile settings that change how the TTS renders a text
+  VOICE_KEYS = %w[voice ref_audio ref_text tts_instruct trump].freeze
+
+  # Phrases CallSession plays, by kind.  Texts are in config phrases:,
+  # or an agent's own phrases: over them.
+  KINDS = %w[filler still_there goodbye].freeze
+
+  class Error < StandardError; end
+
+  Entry = Struct.new(:name, :rate, :pcm)
+
+  def self.name(profile, text, rate)
+    key = VOICE_KEYS.map { |k| profile[k].to_s } << rate.to_i.to_s << text.to_s
+    "p#{Digest::SHA256.hexdigest(JSON.generate(key))[0, 16]}"
+  end
+
+  # kind => text for the profile: defaults (config phrases:) with the
+  # profile's own phrases: over them; empty texts left out
+  def self.texts(defaults, profile)
+    merged = (defaults || {}).merge(profile['phrases'] || {})
+    merged.transform_keys(&:to_s).slice(*KINDS).transform_values(&:to_s).reject { |_, t| t.strip.empty? }
+  end
+
+  attr_reader :path
+
+  def initialize(path)
+    @path = path
+    @entries = {}  # name => Entry
+    load if File.exist?(path)
+  end
+
+  def include?(name)
+    @entries.key?(name)
+  end
+
+  def names
+    @entries.keys
+  end
+
+  # S16LE samples of name, or nil
+  def [](name)
+    @entries[name]&.pcm
+  end
+
+  def add(name, rate, pcm)
+    raise ArgumentError, "phrase name #{name.inspect} too long" if name.bytesize >= NAME_BYTES
+    raise ArgumentError, 'odd PCM length' if pcm.bytesize.odd?
+
+    @entries[name] = Entry.new(name, rate.to_i, pcm.b)
+    self
+  end
+
+  def delete(name)
+    @entries.delete(name)
+    self
+  end
+
+  # Replace the file with what is in the cache now
+  def write
+    offset = HEADER_BYTES + ENTRY_BYTES * @entries.size
+    table = String.new(encoding: Encoding::BINARY)
+    @entries.each_value do |e|
+      table << [e.name, e.rate, e.pcm.bytesize / 2, offset].pack(ENTRY)
+      offset += e.pcm.bytesize
+    end
+
+    tmp = "#{@path}.#{Process.pid}.tmp"
+    File.open(tmp, 'wb') do |f|
+      f.write([MAGIC, VERSION, @entries.size, 0].pack(HEADER), table)
+      @entries.each_value { |e| f.write(e.pcm) }
+    end
+    File.rename(tmp, @path)
+    self
+  ensure
+    File.delete(tmp) if tmp && File.exist?(tmp)
+  end
+
+  # Render the texts not in the cache yet with the TTS server at argv
+  # (VoiceAgent::Local#tts_command), which must write S16LE at rate.
+  # Names of the phrases added; the file is not written.
+  def render(profile, texts, rate, argv)
+    todo = texts.uniq.reject { |t| include?(self.class.name(profile, t, rate)) }
+    return [] if todo.empty?
+
+    added = []
+    Open3.popen2(*argv) do |stdin, stdout, wait|
+      [stdin, stdout].each(&:binmode)
+      reader = VoiceAgent::TtsReader.new(rate / 50 * 2)
+      next_record(reader, stdout) { |type, data| type == :status && JSON.parse(data)['status'] == 'ready' }
+
+      todo.each do |text|
+        stdin.write(JSON.generate({ text: text }) + "\n")
+        stdin.flush
+
+        pcm = String.new(encoding: Encoding::BINARY)
+        failed = false
+        next_record(reader, stdout) do |type, data|
+          pcm << data if type == :audio
+          failed ||= type == :status && JSON.parse(data)['status'] == 'error'
+          type == :boundary
+        end
+        next if failed || pcm.empty?
+
+        name = self.class.name(profile, text, rate)
+        add(name, rate, pcm)
+        added << name
+      end
+
+      stdin.close
+      wait.join
+    end
+    added
+  end
+
+  private
+
+  def load
+    data = File.binread(@path)
+    magic, version, count = data.unpack(HEADER)
+    raise Error, "#{@path}: not a phrase cache" unless magic == MAGIC
+    raise Error, "#{@path}: version #{version}" unless version == VERSION
+
+    count.times do |i|
+      name, rate, samples, offset = data.unpack(ENTRY, offset: HEADER_BYTES + ENTRY_BYTES * i)
+      pcm = data.byteslice(offset, samples * 2)
+      raise Error, "#{@path}: #{name} is cut short" unless pcm && pcm.bytesize == samples * 2
+
+      @entries[name] = Entry.new(name, rate, pcm)
+    end
+  end
+
+  # Feed the reader from io until the block is true for a record.  All
+  # that can follow a boundary is the utterance's done status.
+  def next_record(reader, io)
+    done = false
+    until done
+      reader.feed(io.readpartial(16384)) do |type, data|
+        done = yield(type, data) unless done
+      end
+    end
+  rescue EOFError
+    raise Error, 'TTS exited while rendering'
+  end
+end
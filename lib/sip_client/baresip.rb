@@ -10,23 +10,59 @@ class SipClient
   class Baresip < SipClient
     DEFAULT_CONFIG_DIR = File.join(File.expand_path('../..', __dir__), 'tmp', 'baresip')
     DEFAULT_CTRL_PORT = 4444
+    DEFAULT_MAX_CALLS = 1
+    DIAL_TIMEOUT = 2  # seconds for a dialed call to show up in listcalls
 
-    attr_reader :config_dir, :ctrl_port
+    attr_reader :config_dir, :ctrl_port, :max_calls, :call_id
 
     def initialize(config = {})
       super
       @config_dir = @config[:config_dir] || DEFAULT_CONFIG_DIR
       @voice_socket = @config[:voice_socket]
+      @socket_format = (@config[:socket_format] || 's16le').to_s
+      @socket_transport = (@config[:socket_transport] || 'stream').to_s
+      @socket_protocol = (@config[:socket_protocol] || 'raw').to_s
+      @barge_in_ms = @config[:barge_in_ms].to_i
+      @vad = (@config[:vad] || 'none').to_s
+      @aec_tail_ms = @config[:aec_tail_ms].to_i
+      @playout = (@config[:playout] || 'fixed').to_s
+      @stats_interval = @config[:stats_interval].to_i
+      @record_dir = @config[:record_dir].to_s
+      @record_dir = File.expand_path(@record_dir) unless @record_dir.empty?
+      @clips_dir = @config[:clips_dir].to_s
+      @clips_dir = File.expand_path(@clips_dir) unless @clips_dir.empty?
+      @phrase_cache = @config[:phrase_cache].to_s
+      @phrase_cache = File.expand_path(@phrase_cache) unless @phrase_cache.empty?
+      @comfort_noise = @config[:comfort_noise].to_i
+      @drift_ppm = @config[:drift_ppm].to_i
+      @tap = (@config[:tap] || 'off').to_s
+      @inject = @config[:inject] || false
+      @dtmf = (@config[:dtmf] || 'off').to_s
+      @rt_policy = (@config[:rt_policy] || 'off').to_s
+      @rt_prio = @config[:rt_prio].to_i
+      @rt_cpus = @config[:rt_cpus].to_s
+      @mlock = @config[:mlock] || false
+      @dtmf_callbacks = []
+      @event_thread = nil
+      @sample_rate = (@config[:sample_rate] || 8000).to_i
+      @output_rate = (@config[:output_rate] || @sample_rate).to_i
       @pid = nil  # PID of baresip process we spawned (nil if pre-existing)
+      @call_id = nil  # baresip's id of the call we placed
+      @dialed = false
       load_sip_config
       ensure_config!
     end
 
-    # Cleanly shut down a baresip process we spawned.
-    # Sends the ctrl_tcp 'quit' command first (clean SIP deregister),
-    # falls back to SIGTERM if that fails.
+    # Cleanly shut down a baresip process we spawned, unless it still
+    # carries calls other than ours (another session's, on its own
+    # channel).  Sends the ctrl_tcp 'quit' command first (clean SIP
+    # deregister), falls back to SIGTERM if that fails.
     def shutdown
+      @event_thread&.kill
+      @event_thread = nil
       return unless @pid
+      return if other_calls?
+
       send_command('quit') rescue nil
       # Wait up to 2s for clean exit before sending SIGTERM
       20.times do
@@ -40,23 +76,31 @@ class SipClient
       @pid = nil
     end
 
-    # Make a call
+    # Make a call; returns the call placed ([] if it did not come up).
+    # With a voice_socket the call goes out on this channel's own
+    # account, whose audio_source/audio_player are that socket.
     def call(number, **opts)
       ensure_running!
 
-      # Guard against multiple simultaneous calls
-      active = calls
-      unless active.empty?
-        raise Error, "Call already active (#{active.size} in progress). Hang up first: bin/call hangup"
-      end
-
       sip_number = format_number(number)
       uri = "sip:#{sip_number}@#{@sip_server}"
 
-      send_command('dial', uri)
+      # One dial at a time across sessions, so the call that shows up
+      # next is ours
+      with_dial_lock do
+        # Guard against more simultaneous calls than ausock channels
+        active = calls
+        if active.size >= @max_calls
+          raise Error, "Call already active (#{active.size} in progress, max #{@max_calls}). Hang up first: bin/call hangup"
+        end
 
-      sleep 2
-      calls
+        select_channel_ua if @voice_socket
+        send_command('dial', uri)
+        @dialed = true
+        @call_id = wait_for_call(active.map { |c| c[:id] })
+      end
+
+      calls.select { |c| c[:id] && c[:id] == @call_id }
     end
 
     # Get registration status
@@ -69,8 +113,12 @@ class SipClient
       }
     end
 
-    # Hangup current call
+    # Hang up the call we placed; without one (bin/call hangup), the
+    # current call
     def hangup
+      return send_command('hangup', @call_id) if @call_id
+      return nil if @dialed  # ours never came up, leave the others be
+
       send_command('hangup')
     end
 
@@ -80,18 +128,135 @@ class SipClient
       parse_calls(response)
     end
 
+    # ausock's counters and latency histograms, one hash per channel
+    # (see docs/audio_bridge.md); nil if baresip or ausock doesn't answer
+    def ausock_stats
+      response = send_command('ausock_stats')
+      return nil unless response.is_a?(String) && response.start_with?('{')
+
+      JSON.parse(response, symbolize_names: true)[:channels]
+    rescue Error, Timeout::Error, SystemCallError, JSON::ParserError
+      nil
+    end
+
+    # Call block with { digit:, source:, channel:, call_id: } for every
+    # key the caller presses, from baresip's ctrl_tcp events on a
+    # connection of its own: :baresip for baresip's RFC 4733 / SIP INFO
+    # handling (CALL_DTMF_START; call_id is the call's id), :ausock for
+    # the in-band detector's "dtmf" module event (ausock_dtmf; channel
+    # is the ausock socket path).
+    # Called on the listener's thread, which reconnects until #shutdown.
+    def on_dtmf(&block)
+      @dtmf_callbacks << block
+      @event_thread ||= Thread.new { event_loop }
+      self
+    end
+
     private
 
+    def with_dial_lock
+      File.open(File.join(@config_dir, 'dial.lock'), File::RDWR | File::CREAT, 0o644) do |f|
+        f.flock(File::LOCK_EX)
+        yield
+      end
+    end
+
+    # The id of a call not among before, once it shows up
+    def wait_for_call(before)
+      deadline = Process.clock_gettime(Process::CLOCK_MONOTONIC) + DIAL_TIMEOUT
+      loop do
+        call = calls.find { |c| c[:id] && !before.include?(c[:id]) }
+        return call[:id] if call
+        return nil if Process.clock_gettime(Process::CLOCK_MONOTONIC) >= deadline
+
+        sleep 0.1
+      end
+    end
+
+    def other_calls?
+      calls.any? { |c| c[:id] != @call_id }
+    rescue Error, Timeout::Error, SystemCallError
+      false
+    end
+
+    # This channel's user agent: the SIP account again, its AOR told
+    # apart by a URI parameter (ignored by the server), not registering
+    # (the main account does) and with the channel's socket as its
+    # audio devices.  Created on first use; a resident baresip keeps it.
+    def channel_aor
+      "sip:#{@sip_username}@#{@sip_server};ausock=#{File.basename(@voice_socket, '.sock').gsub(/[^\w.-]/, '_')}"
+    end
+
+    def channel_account
+      device = "ausock,#{@voice_socket}"
+      "<#{channel_aor}>;auth_pass=#{@sip_password};regint=0;" \
+        "audio_source=#{device};audio_player=#{device}"
+    end
+
+    # Make the channel's user agent the current one, which 'dial' uses
+    def select_channel_ua
+      return unless send_command('uafind', channel_aor).to_s.include?('could not find')
+
+      send_command('uanew', channel_account)
+      send_command('uafind', channel_aor)
+    end
+
+    def event_loop
+      loop do
+        socket = TCPSocket.new('127.0.0.1', @ctrl_port)
+        while (message = read_netstring(socket))
+          event = JSON.parse(message) rescue next
+          dtmf = dtmf_event(event) or next
+          @dtmf_callbacks.each { |cb| cb.call(dtmf) }
+        end
+      rescue SystemCallError, IOError
+        nil
+      ensure
+        socket&.close rescue nil
+        sleep 1
+      end
+    end
+
+    # One netstring off a ctrl_tcp stream; nil once it ends
+    def read_netstring(io)
+      length = io.gets(':')
+      return nil unless length&.end_with?(':') && length.chomp(':').match?(/\A\d+\z/)
+
+      data = io.read(length.to_i)
+      io.read(1)  # trailing ','
+      data
+    end
+
+    # ctrl_tcp event hash → DTMF key, or nil for any other event.
+    # Module events carry "<module>,<event>,<text>" in param.
+    def dtmf_event(event)
+      return nil unless event.is_a?(Hash) && event['event']
+
+      case event['type']
+      when 'CALL_DTMF_START'
+        digit = event['param'].to_s[0]
+        digit && { digit: digit, source: :baresip, channel: nil, call_id: event['id'] }
+      when 'MODULE'
+        mod, name, text = event['param'].to_s.split(',', 3)
+        return nil unless mod == 'ausock' && name == 'dtmf' && text
+
+        digit, channel = text.split(',', 2)
+        { digit: digit, source: :ausock, channel: channel, call_id: nil }
+      end
+    end
+
     def load_sip_config
       @sip_username = @config[:sip_username] || raise(Error, 'sip_username not set')
       @sip_password = @config[:sip_password] || raise(Error, 'sip_password not set')
       @sip_server   = @config[:sip_server]   || raise(Error, 'sip_server not set')
       @module_path  = @config[:module_path]  || '/opt/homebrew/Cellar/baresip/4.5.0/lib/baresip/modules'
       @ctrl_port    = (@config[:ctrl_port]   || DEFAULT_CTRL_PORT).to_i
+      @max_calls    = (@config[:max_calls]   || DEFAULT_MAX_CALLS).to_i
     end
 
     def ensure_config!
       FileUtils.mkdir_p(@config_dir)
+      FileUtils.mkdir_p(@record_dir) if @voice_socket && !@record_dir.empty?
 
       # Write accounts file
       accounts = File.join(@config_dir, 'accounts')
@@ -111,12 +276,45 @@ class SipClient
       lines << "module\t\t\tstdio.so"
       lines << ""
       lines << "# Audio"
+      # Wideband: offer G.722 first and run the audio devices at 16 kHz,
+      # baresip resamples narrowband calls up to it
+      if @sample_rate > 8000
+        lines << "module\t\t\tg722.so"
+        lines << "ausrc_srate\t\t#{@sample_rate}"
+        lines << "auplay_srate\t\t#{@sample_rate}"
+      end
       lines << "module\t\t\tg711.so"
 
       if @voice_socket
         lines << "module\t\t\tausock.so"
         lines << "audio_source\t\tausock,#{@voice_socket}"
         lines << "audio_player\t\tausock,#{@voice_socket}"
+        lines << "ausock_format\t\t#{@socket_format}"
+        lines << "ausock_transport\t#{@socket_transport}"
+        lines << "ausock_protocol\t\t#{@socket_protocol}"
+        lines << "ausock_aec\t\t#{@aec_tail_ms}" if @aec_tail_ms > 0
+        lines << "ausock_inrate\t\t#{@output_rate}" if @output_rate != @sample_rate
+        lines << "ausock_playout\t\t#{@playout}" unless @playout == 'fixed'
+        lines << "ausock_stats_interval\t#{@stats_interval}" if @stats_interval > 0
+        lines << "ausock_record\t\t#{@record_dir}" unless @record_dir.empty?
+        lines << "ausock_comfort_noise\t#{@comfort_noise}" if @comfort_noise > 0
+        lines << "ausock_drift\t\t#{@drift_ppm}" if @drift_ppm > 0
+        lines << "ausock_tap\t\t#{@tap}" unless @tap == 'off'
+        lines << "ausock_inject\t\tyes" if @inject
+        lines << "ausock_dtmf\t\tyes" if @dtmf == 'ausock'
+        unless @rt_policy == 'off'
+          lines << "ausock_rt\t\t#{@rt_policy}"
+          lines << "ausock_rt_prio\t\t#{@rt_prio}" if @rt_prio > 0
+        end
+        lines << "ausock_cpus\t\t#{@rt_cpus}" unless @rt_cpus.empty?
+        lines << "ausock_mlock\t\tyes" if @mlock
+        # barge-in detection and the VAD ride on the framed protocol
+        if @socket_protocol == 'framed'
+          lines << "ausock_bargein\t\t#{@barge_in_ms}" if @barge_in_ms > 0
+          lines << "ausock_vad\t\t#{@vad}" unless @vad == 'none'
+          lines << "ausock_clips\t\t#{@clips_dir}" unless @clips_dir.empty?
+          lines << "ausock_phrases\t\t#{@phrase_cache}" unless @phrase_cache.empty?
+        end
       end
 
       lines << ""
@@ -216,12 +414,13 @@ class SipClient
       # Example: "> [line 1, id abc123]  0:00:05  ESTABLISHED  sip:15550100@server.example.com"
       calls = []
       response.each_line do |line|
-        if line =~ /\[line (\d+).*?\]\s+(\S+)\s+(\w+)\s+sip:(\S+)/
+        if line =~ /\[line (\d+)(?:, id ([^\]\s]+))?.*?\]\s+(\S+)\s+(\w+)\s+sip:(\S+)/
           calls << {
             line: $1.to_i,
-            duration: $2,
-            state: $3,
-            uri: $4
+            id: $2,
+            duration: $3,
+            state: $4,
+            uri: $5
           }
         end
       end
@@ -7,3 +7,4 @@ require_relative 'triggers/keyword_trigger'
 require_relative 'triggers/silence_trigger'
 require_relative 'triggers/request_capture'
 require_relative 'triggers/delegation_trigger'
+require_relative 'triggers/dtmf_trigger'
@@ -0,0 +1,58 @@
+# frozen_string_literal: true
+
+require_relative '../trigger'
+
+# Fires when the caller presses a key on their keypad.
+#
+# Keys are detected in-band by ausock (Goertzel filters on the caller
+# audio) or reported by baresip (RFC 4733 telephone-events, SIP INFO),
+# and arrive as context[:dtmf]. Keys listed in :keys fire their own
+# action; every other key fires the default action.
+#
+# Usage:
+#   trigger = DtmfTrigger.new(keys: { '*' => :interrupt }, action: :dtmf)
+#
+#   trigger.check(dtmf: '*')
+#   # => :interrupt
+#
+#   trigger.check(dtmf: '5')
+#   # => :dtmf
+#   trigger.payload
+#   # => "5"
+#
+class DtmfTrigger < Trigger
+  KEYS = %w[0 1 2 3 4 5 6 7 8 9 * # A B C D].freeze
+  DEFAULT_KEYS = { '*' => :interrupt }.freeze
+
+  attr_reader :keys, :payload, :source
+
+  # @param config [Hash]
+  # @option config [Hash{String => Symbol}] :keys per-key actions
+  # @option config [Symbol] :action action for any other key (:dtmf by default;
+  #   nil to ignore them)
+  def initialize(config = {})
+    super(config.merge(action: config.fetch(:action, :dtmf)))
+    @keys = (config[:keys] || DEFAULT_KEYS).transform_keys { |k| k.to_s.upcase }
+    @payload = nil
+    @source = nil
+  end
+
+  def check(context)
+    return nil unless enabled?
+
+    key = context[:dtmf].to_s.upcase
+    return nil unless KEYS.include?(key)
+
+    @payload = key
+    @source = context[:dtmf_source]
+    @keys.fetch(key, @action)
+  end
+
+  def once?
+    false  # every key press counts
+  end
+
+  def name
+    'dtmf'
+  end
+end
@@ -0,0 +1,165 @@
+# frozen_string_literal: true
+
+require 'json'
+require 'fileutils'
+
+# When each stage of a conversational turn happened, from the caller
+# going quiet to the agent's answer reaching the caller, so turn
+# latency can be pinned on the stage that owns it:
+#
+#   speech_stop  caller stopped talking (ausock VAD, else the agent's)
+#   transcript   STT had the words
+#   llm_first    first LLM token (Grok: response started)
+#   tts_first    first audio of the answer synthesized
+#   played       that audio handed to baresip in ausock's rh() (MARK)
+#
+# Every timestamp is CLOCK_MONOTONIC in microseconds, the clock ausock
+# stamps framed messages with and tts/stt_server.py report in "t", so
+# stages measured in different processes line up.
+#
+# A turn opens with the stage that comes first and is finished once it
+# is played, or when the caller's next turn starts.  Stages are kept
+# the first time they are seen, except speech_stop, which follows the
+# caller until the words are in; played with no turn open is ignored.
+# Each finished turn is one JSON line in path, if given, and its spans
+# go into the percentiles:
+#
+#   stt      speech_stop → transcript
+#   llm      transcript  → llm_first
+#   tts      llm_first   → tts_first
+#   playout  tts_first   → played
+#   total    speech_stop → played (mouth to ear)
+#
+# Usage:
+#   trace = TurnTrace.new('tmp/traces/call.jsonl')
+#   trace.mark(:speech_stop, at_us)
+#   trace.mark(:transcript)       # now
+#   trace.percentiles(:total)     # => { n: 12, p50: 910.0, p95: ..., p99: ... } (ms)
+#   trace.close
+class TurnTrace
+  STAGES = %i[speech_stop transcript llm_first tts_first played].freeze
+
+  SPANS = {
+    stt:     %i[speech_stop transcript],
+    llm:     %i[transcript llm_first],
+    tts:     %i[llm_first tts_first],
+    playout: %i[tts_first played],
+    total:   %i[speech_stop played],
+  }.freeze
+
+  def self.now_us
+    Process.clock_gettime(Process::CLOCK_MONOTONIC, :microsecond)
+  end
+
+  attr_reader :turns
+
+  def initialize(path = nil)
+    @path = path
+    @io = nil
+    @turn = nil             # stage => us, of the turn in progress
+    @claimed = []           # stages of it someone is already measuring
+    @turns = 0
+    @spans = Hash.new { |h, k| h[k] = [] }  # span => [ms]
+    @lock = Mutex.new
+  end
+
+  def mark(stage, at = nil)
+    stage = stage.to_sym
+    return unless STAGES.include?(stage)
+
+    at = (at || self.class.now_us).to_i
+    @lock.synchronize do
+      if stage == :speech_stop
+        # the caller spoke again after the words were in: a new turn
+        finish if @turn && (@turn.keys - [:speech_stop]).any?
+        (@turn ||= {})[:speech_stop] = at
+      elsif stage == :played
+        # later utterances of an answer already played
+        next unless @turn
+
+        @turn[:played] ||= at
+        finish
+      else
+        (@turn ||= {})[stage] ||= at
+      end
+    end
+  end
+
+  # True once per turn, to whoever is first to ask for a stage that is
+  # still to come: e.g. the first agent audio of a turn, which is what
+  # gets a MARK for :played
+  def claim(stage)
+    @lock.synchronize do
+      next false if @turn.nil? || @turn.key?(stage) || @claimed.include?(stage)
+
+      @claimed << stage
+      true
+    end
+  end
+
+  # ms at p50/p95/p99 over the turns that had both ends of span
+  def percentiles(span)
+    @lock.synchronize do
+      sorted = @spans[span].sort
+      next { n: 0 } if sorted.empty?
+
+      { n: sorted.size }.merge(%i[p50 p95 p99].to_h { |p| [p, rank(sorted, p.to_s[1..].to_i)] })
+    end
+  end
+
+  # One line for the call log, e.g. "stt 310/520/560ms  llm ..."
+  def summary
+    SPANS.keys.filter_map do |span|
+      pc = percentiles(span)
+      next if pc[:n].zero?
+
+      format('%s %.0f/%.0f/%.0fms', span, pc[:p50], pc[:p95], pc[:p99])
+    end.join('  ')
+  end
+
+  # Finish the turn in progress and close the file
+  def close
+    @lock.synchronize do
+      finish if @turn
+      @io&.close
+      @io = nil
+    end
+  end
+
+  private
+
+  # Under @lock
+  def finish
+    turn = @turn
+    @turn = nil
+    @claimed = []
+    @turns += 1
+
+    spans = SPANS.each_with_object({}) do |(span, (from, to)), out|
+      next unless turn[from] && turn[to] && turn[to] >= turn[from]
+
+      out[span] = (turn[to] - turn[from]) / 1000.0
+      @spans[span] << out[span]
+    end
+
+    write(turn: @turns, **turn, **spans.transform_keys { |k| :"#{k}_ms" })
+  end
+
+  def write(record)
+    return unless @path
+
+    unless @io
+      FileUtils.mkdir_p(File.dirname(@path))
+      @io = File.open(@path, 'a')
+      @io.sync = true
+    end
+    @io.puts(JSON.generate(record))
+  rescue SystemCallError, IOError
+    @path = nil  # tracing never takes the call down
+  end
+
+  # Nearest-rank percentile of sorted
+  def rank(sorted, pct)
+    sorted[[(pct / 100.0 * sorted.size).ceil - 1, 0].max]
+  end
+end
@@ -14,17 +14,32 @@ class VoiceAgent
     @codec       = config[:codec]       || self.class::CODEC
     @audio_format = config[:audio_format] || self.class::AUDIO_FORMAT
     @sample_rate = config[:sample_rate]  || self.class::SAMPLE_RATE
+    @output_rate = config[:output_rate]  || @sample_rate  # of on_audio
+  end
+
+  # 16 kHz call: audio in both directions is S16LE at @sample_rate
+  # instead of G.711u (see AudioBridge)
+  def wideband?
+    @sample_rate > 8000
+  end
+
+  # on_audio chunks are G.711u; otherwise S16LE at @output_rate, which
+  # ausock resamples to the call rate when it differs (ausock_inrate)
+  def pcmu_output?
+    @output_rate == 8000
   end
 
   # Start a voice session (WebSocket connection)
-  # @param on_audio [Proc] callback receiving audio chunks (binary G.711u)
+  # @param on_audio [Proc] callback receiving audio chunks (binary G.711u,
+  #   S16LE unless pcmu_output?)
   # @param on_text [Proc] callback receiving text transcripts
   def connect(**callbacks)
     raise Error, "#{self.class} must implement #connect"
   end
 
   # Send audio data to the agent
-  # @param data [String] binary audio (G.711u)
+  # @param data [String] binary audio (G.711u, S16LE when wideband). The caller may reuse
+  #   this buffer for the next frame, so copy it to keep it.
   def send_audio(data)
     raise Error, "#{self.class} must implement #send_audio"
   end
@@ -34,6 +49,11 @@ class VoiceAgent
     raise Error, "#{self.class} must implement #send_text"
   end
 
+  # The caller has started talking over the agent; stop speaking.
+  # The bridge has already dropped the audio it had queued.  Optional.
+  def interrupt
+  end
+
   # Disconnect the session
   def disconnect
     raise Error, "#{self.class} must implement #disconnect"
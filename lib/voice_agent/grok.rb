@@ -3,12 +3,19 @@
 require_relative '../voice_agent'
 require 'websocket-client-simple'
 require 'json'
-require 'base64'
 
 class VoiceAgent
   class Grok < VoiceAgent
     REALTIME_URL = 'wss://api.x.ai/v1/realtime'
 
+    FRAME_MS  = 20   # caller audio arrives one frame at a time
+    UPLINK_MS = 60   # batched into one append per this much (uplink_ms)
+
+    # Audio deltas are most of what comes down; they are cut out of the
+    # message text instead of going through JSON.parse
+    AUDIO_DELTA = '"type":"response.output_audio.delta"'
+    DELTA_KEY   = '"delta":"'
+
     CLASSIFY_INTENT_TOOL = {
       type: 'function',
       name: 'classify_intent',
@@ -40,10 +47,19 @@ class VoiceAgent
       @callbacks = {}
       @tools = config[:tools] || []
       @verbose = config[:verbose] || false
+      @muted = false  # dropping audio of a response cut off by #interrupt
+      @tts_traced = false  # first audio of this response traced
+      @uplink_ms = (config[:uplink_ms] || UPLINK_MS).to_i
+      @uplink = String.new(capacity: 4096, encoding: Encoding::BINARY)  # caller audio not sent yet
+      @uplink_frames = 0
+      @uplink_due = nil      # monotonic time the oldest of it must go by
+      @uplink_lock = Mutex.new
     end
 
     # Connect to Grok Realtime API
-    # Callbacks: on_ready, on_audio, on_text, on_transcript, on_error, on_close
+    # Callbacks: on_ready, on_audio, on_text, on_transcript, on_error, on_close,
+    # on_trace(stage, at) with the turn stages Grok reports (TurnTrace;
+    # response.created stands for the first LLM token), at nil for now
     def connect(**callbacks)
       @callbacks = callbacks
 
@@ -75,14 +91,20 @@ class VoiceAgent
       self
     end
 
-    # Send audio chunk (raw G.711μ bytes, will be base64 encoded)
+    # Send audio chunk (raw G.711μ bytes, will be base64 encoded).
+    # Frames are held until uplink_ms of them is in hand and go up as
+    # one append; whatever is held longer than that goes on the next
+    # flusher tick (talkspurt tails with audio.vad dtx).
     def send_audio(data)
       return unless @connected
+      return send_append(data) if @uplink_ms <= FRAME_MS
 
-      @ws.send(JSON.generate({
-        type: 'input_audio_buffer.append',
-        audio: Base64.strict_encode64(data)
-      }))
+      @uplink_lock.synchronize do
+        @uplink_due ||= monotonic + @uplink_ms / 1000.0
+        @uplink << data
+        @uplink_frames += 1
+        flush_uplink if @uplink_frames * FRAME_MS >= @uplink_ms
+      end
     end
 
     # Send text input
@@ -150,6 +172,16 @@ class VoiceAgent
       }))
     end
 
+    # The caller started talking over us (ausock barge-in): cancel the
+    # response and drop whatever audio of it is still on the way.
+    def interrupt
+      return unless @connected
+
+      @muted = true
+      @ws.send(JSON.generate({ type: 'response.cancel' }))
+      vlog "interrupt: sent response.cancel"
+    end
+
     def disconnect
       @connected = false
       @ws&.close
@@ -174,8 +206,59 @@ class VoiceAgent
       $stderr.puts "[grok] #{msg}"
     end
 
+    # Wideband calls carry 16 kHz PCM instead of G.711u; Grok's reply
+    # audio can come at its own rate for ausock to resample
+    def audio_format(rate)
+      rate > 8000 ? { type: 'audio/pcm', rate: rate } : { type: @audio_format }
+    end
+
+    # One input_audio_buffer.append.  Base64 needs no JSON escaping, so
+    # the message is built as text.
+    def send_append(audio)
+      @ws.send(%({"type":"input_audio_buffer.append","audio":"#{[audio].pack('m0')}"}))
+    end
+
+    # Under @uplink_lock
+    def flush_uplink
+      return if @uplink.empty?
+
+      send_append(@uplink)
+      @uplink.clear
+      @uplink_frames = 0
+      @uplink_due = nil
+    end
+
+    # Sends what send_audio has held past its deadline
+    def uplink_flusher
+      while @connected
+        sleep @uplink_ms / 1000.0
+        @uplink_lock.synchronize { flush_uplink if @uplink_due && monotonic >= @uplink_due }
+      end
+    rescue IOError, Errno::EPIPE
+      nil  # closed under us
+    end
+
+    def monotonic
+      Process.clock_gettime(Process::CLOCK_MONOTONIC)
+    end
+
+    # The decoded audio of a response.output_audio.delta message, or
+    # nil for any other message or one the fast path can't read (JSON
+    # escapes in the delta)
+    def audio_delta(data)
+      data.byteindex(AUDIO_DELTA) or return nil
+      key = data.byteindex(DELTA_KEY) or return nil
+      from = key + DELTA_KEY.bytesize
+      close = data.byteindex('"', from) or return nil
+
+      data.byteslice(from, close - from).unpack1('m0')
+    rescue ArgumentError
+      nil  # not strict base64 as it stands in the text
+    end
+
     def on_open
       @connected = true
+      @uplink_thread = Thread.new { uplink_flusher } if @uplink_ms > FRAME_MS
 
       # Configure session for telephony audio (format from base class config)
       session = {
@@ -184,8 +267,8 @@ class VoiceAgent
         instructions: @config[:instructions] || "You are #{@agent_name}, a helpful AI voice assistant. Be concise and conversational.",
         turn_detection: { type: 'server_vad' },
         audio: {
-          input:  { format: { type: @audio_format } },
-          output: { format: { type: @audio_format } }
+          input:  { format: audio_format(@sample_rate) },
+          output: { format: audio_format(@output_rate) }
         }
       }
       session[:tools] = @tools if @tools.any?
@@ -199,18 +282,30 @@ class VoiceAgent
     end
 
     def on_message(msg)
-      return if msg.data.nil? || msg.data.empty?
+      data = msg.data
+      return if data.nil? || data.empty?
+
+      if (audio = audio_delta(data))
+        deliver_audio(audio) unless @muted
+        return
+      end
 
       begin
-        event = JSON.parse(msg.data)
+        event = JSON.parse(data)
       rescue JSON::ParserError
         return
       end
 
       case event['type']
       when 'response.output_audio.delta'
-        audio = Base64.decode64(event['delta'])
-        @callbacks[:on_audio]&.call(audio)
+        return if @muted
+
+        deliver_audio(event['delta'].unpack1('m'))
+
+      when 'response.created'
+        @muted = false
+        @tts_traced = false
+        trace(:llm_first)
 
       when 'response.output_audio_transcript.delta'
         @callbacks[:on_text]&.call(event['delta'])
@@ -219,15 +314,18 @@ class VoiceAgent
         @callbacks[:on_transcript]&.call(event['transcript'])
 
       when 'response.done'
+        @muted = false
         @callbacks[:on_response_done]&.call(event)
 
       when 'input_audio_buffer.speech_started'
         @callbacks[:on_speech_started]&.call
 
       when 'input_audio_buffer.speech_stopped'
+        trace(:speech_stop)
         @callbacks[:on_speech_stopped]&.call
 
       when 'conversation.item.input_audio_transcription.completed'
+        trace(:transcript)
         @callbacks[:on_input_transcript]&.call(event['transcript'])
 
       when 'response.function_call_arguments.done'
@@ -247,6 +345,20 @@ class VoiceAgent
       end
     end
 
+    # A decoded audio delta to on_audio; the first of each response is
+    # the turn's first agent audio
+    def deliver_audio(audio)
+      unless @tts_traced
+        @tts_traced = true
+        trace(:tts_first)
+      end
+      @callbacks[:on_audio]&.call(audio)
+    end
+
+    def trace(stage)
+      @callbacks[:on_trace]&.call(stage, nil)
+    end
+
     def on_error_event(e)
       @callbacks[:on_error]&.call(e)
     end
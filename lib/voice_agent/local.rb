@@ -1,8 +1,12 @@
 # frozen_string_literal: true
 
 require_relative '../voice_agent'
+require_relative 'tts_reader'
+require_relative 'sse_parser'
+require_relative '../worker_pool'
 require 'json'
 require 'net/http'
+require 'openssl'
 require 'uri'
 require 'open3'
 
@@ -14,14 +18,25 @@ class VoiceAgent
   # Python subprocesses that communicate via stdin/stdout.
   #
   # Callbacks match VoiceAgent::Grok's interface so CallSession works unchanged.
+  # on_trace(stage, at) gets the stages of each turn (TurnTrace::STAGES
+  # but :played) as the STT and TTS servers stamped them, CLOCK_MONOTONIC
+  # microseconds; at is nil for "now".
   class Local < VoiceAgent
     VENV_PYTHON = File.expand_path('../../../tts/.venv/bin/python', __FILE__)
     TTS_SCRIPT  = File.expand_path('../../../tts/tts_server.py', __FILE__)
     STT_SCRIPT  = File.expand_path('../../../tts/stt_server.py', __FILE__)
 
-    # 4-byte sentinel written by Python after each utterance's audio.
-    # Must match UTTERANCE_BOUNDARY in tts_server.py.
-    BOUNDARY_SENTINEL = [0xDEADBEEF].pack('V').freeze  # "\xEF\xBE\xAD\xDE"
+    # Seconds after each response during which STT is ignored, so the
+    # tail of our own echo is not taken for the caller.  Kept with
+    # ausock_aec on too: its linear canceller takes seconds to converge
+    # and leaves a residue, and nothing tells us when it has.
+    ECHO_COOLDOWN = 1.5
+
+    LLM_URI = URI('https://api.x.ai/v1/chat/completions')
+
+    # Seconds an idle LLM connection is kept for the next turn.  Turns
+    # are seconds apart, well past Net::HTTP's default of 2.
+    LLM_KEEP_ALIVE = 60
 
     def initialize(config = {})
       super
@@ -34,6 +49,10 @@ class VoiceAgent
       @ref_audio    = config[:ref_audio]
       @ref_text     = config[:ref_text]
       @verbose      = config[:verbose] || false
+      @stt_tap      = config[:stt_tap]  # ausock_tap socket STT reads the caller from
+      @tts_inject   = config[:tts_inject]  # ausock_inject socket TTS writes the agent to
+      @tts_lookahead = config.fetch(:tts_lookahead, 2)  # sentences queued ahead in TTS
+      @worker_pool  = config[:worker_pool]  # bin/workers socket to lease warm STT/TTS from
 
       @callbacks    = {}
       @connected    = false
@@ -43,10 +62,17 @@ class VoiceAgent
       @speaking     = false
       @interrupt    = false
       @interrupt_transcript = nil
+      @interrupt_transcript_at = nil  # its "t" from STT
+      @barged_in    = false      # caller talked over us (see #interrupt)
+      @tts_traced   = false      # first audio of this response traced
       @awaiting_greeting = true  # suppress noise until caller actually speaks
       @audio_done   = Queue.new  # signaled when all audio for an utterance is delivered
+      @tts_lock     = Mutex.new  # TTS stdin, written from several threads
+      @cancel_sent  = false      # a TTS cancel is out for this response
       @utterance_queue = Queue.new  # serialized STT → LLM processing
       @cooldown_until  = 0.0       # monotonic time; ignore STT until this
+      @llm_http     = nil        # kept-alive connection to LLM_URI
+      @llm_lock     = Mutex.new  # one LLM request on it at a time
     end
 
     def connect(**callbacks)
@@ -55,6 +81,10 @@ class VoiceAgent
       start_tts
       start_stt
 
+      # DNS, TCP and TLS to the LLM while the models load, not on the
+      # first turn
+      @threads << Thread.new { warm_llm }
+
       # Wait for both subprocesses to report ready
       wait_for_ready
 
@@ -68,13 +98,16 @@ class VoiceAgent
     end
 
     # Receive PCMU audio from the caller (via AudioBridge).
-    # Decode to S16LE, pipe to STT subprocess.
+    # Decode to S16LE, pipe to STT subprocess.  Wideband audio is
+    # S16LE already.  With stt_tap the STT subprocess reads the caller
+    # straight from ausock, and whatever still arrives here is dropped.
     def send_audio(data)
-      return unless @connected && @stt_stdin
+      return unless @connected && @stt_stdin && !@stt_tap
+      return @stt_stdin.write(data) if wideband?
 
-      # PCMU → S16LE (reuse AudioBridge codec)
-      s16le = AudioBridge.pcmu_to_s16le(data)
-      @stt_stdin.write(s16le)
+      # PCMU → S16LE (reuse AudioBridge codec and one frame buffer)
+      @stt_buf ||= String.new(capacity: AudioBridge::FRAME_BYTES, encoding: Encoding::BINARY)
+      @stt_stdin.write(AudioBridge.pcmu_to_s16le(data, @stt_buf))
     rescue IOError, Errno::EPIPE
       vlog "send_audio: STT pipe broken"
     end
@@ -106,45 +139,103 @@ class VoiceAgent
       @connected
     end
 
-    private
+    # The caller started talking over us (ausock barge-in).  The bridge
+    # has already cut the queued audio; stop feeding it more and let the
+    # caller's next transcript through as the interrupt, however short.
+    def interrupt
+      return unless @speaking
 
-    def vlog(msg)
-      return unless @verbose
-      $stderr.puts "[local] #{msg}"
+      vlog "BARGE-IN: caller speech during playback"
+      @barged_in = true
+      @interrupt = true
+      cancel_tts
     end
 
-    # --- Subprocess management ---
-
-    def start_tts
+    # The TTS and STT command lines for this agent, less the per-call
+    # socket (--inject, --tap).  bin/workers warms workers running
+    # exactly these, and a lease asks for them.  bin/phrases renders at
+    # sample_rate, the rate ausock plays phrases at.
+    def tts_command(sample_rate = nil)
       cmd = [VENV_PYTHON, '-u', TTS_SCRIPT]  # -u forces unbuffered I/O
       cmd += ['--trump'] if @trump
       cmd += ['--voice', @voice] if @voice
       cmd += ['--instruct', @tts_instruct] if @tts_instruct
       cmd += ['--ref-audio', @ref_audio] if @ref_audio
       cmd += ['--ref-text', @ref_text] if @ref_text
+      if sample_rate
+        cmd += ['--sample-rate', sample_rate.to_s]
+      elsif !pcmu_output?
+        cmd += ['--sample-rate', @output_rate.to_s]
+      end
+      cmd
+    end
+
+    def stt_command
+      cmd = [VENV_PYTHON, '-u', STT_SCRIPT]  # -u forces unbuffered I/O
+      cmd += ['--sample-rate', @sample_rate.to_s] if wideband?
+      cmd
+    end
 
-      vlog "starting TTS: #{cmd.join(' ')}"
-      @tts_stdin, @tts_stdout, @tts_stderr, @tts_wait = Open3.popen3(*cmd)
+    private
+
+    def vlog(msg)
+      return unless @verbose
+      $stderr.puts "[local] #{msg}"
+    end
+
+    # A turn stage for TurnTrace, at a monotonic us stamp or now
+    def trace(stage, at = nil)
+      @callbacks[:on_trace]&.call(stage, at)
+    end
+
+    # --- Subprocess management ---
+
+    def start_tts
+      if (@tts_lease = pool_lease(:tts, tts_command, inject: @tts_inject))
+        @tts_stdin, @tts_stdout = @tts_lease.stdin, @tts_lease.stdout
+        @tts_resync = true  # until the worker's reset status
+      else
+        cmd = tts_command
+        cmd += ['--inject', @tts_inject] if @tts_inject
+        vlog "starting TTS: #{cmd.join(' ')}"
+        @tts_stdin, @tts_stdout, @tts_stderr, @tts_wait = Open3.popen3(*cmd)
+        # stderr is only the server's log now; keep the pipe drained
+        @threads << Thread.new { tts_log_reader }
+      end
 
       # Set binary mode for audio I/O
       @tts_stdin.binmode
       @tts_stdout.binmode
 
-      # Read TTS audio output → convert to PCMU → fire on_audio callback
+      # Read TTS records (audio, boundaries, status) → on_audio callback
       @threads << Thread.new { tts_audio_reader }
-      # Read TTS status from stderr
-      @threads << Thread.new { tts_status_reader }
     end
 
     def start_stt
-      cmd = [VENV_PYTHON, '-u', STT_SCRIPT]  # -u forces unbuffered I/O
-      vlog "starting STT: #{cmd.join(' ')}"
-      @stt_stdin, @stt_stdout, @stt_stderr, @stt_wait = Open3.popen3(*cmd)
+      if (@stt_lease = pool_lease(:stt, stt_command, tap: @stt_tap))
+        @stt_stdin, @stt_stdout = @stt_lease.stdin, @stt_lease.stdout
+        @stt_resync = true  # until the worker's reset line
+      else
+        cmd = stt_command
+        cmd += ['--tap', @stt_tap] if @stt_tap
+        vlog "starting STT: #{cmd.join(' ')}"
+        @stt_stdin, @stt_stdout, @stt_stderr, @stt_wait = Open3.popen3(*cmd)
+        # Read STT status from stderr
+        @threads << Thread.new { stt_status_reader }
+      end
+      @stt_stdin.binmode
 
       # Read STT transcripts from stdout
       @threads << Thread.new { stt_output_reader }
-      # Read STT status from stderr
-      @threads << Thread.new { stt_status_reader }
+    end
+
+    # A warm worker from bin/workers (worker_pool), or nil to start our own
+    def pool_lease(kind, argv, **opts)
+      return nil unless @worker_pool
+
+      lease = WorkerPool.lease(@worker_pool, kind, argv, **opts)
+      vlog(lease ? "#{kind} worker #{lease.pid} leased" : "no idle #{kind} worker in the pool")
+      lease
     end
 
     def wait_for_ready
@@ -159,6 +250,8 @@ class VoiceAgent
     end
 
     def cleanup_processes
+      @llm_lock.synchronize { llm_reset }
+      release_leases
       [@tts_stdin, @stt_stdin].each { |io| io&.close rescue nil }
       [@tts_stdout, @stt_stdout, @tts_stderr, @stt_stderr].each { |io| io&.close rescue nil }
       [@tts_wait, @stt_wait].each { |thr| thr&.value rescue nil }
@@ -167,25 +260,53 @@ class VoiceAgent
       @threads.clear
     end
 
+    # Hand pooled workers back.  TTS goes back clean only once it is
+    # idle and its stream is read up to a record boundary, which is
+    # what the reply to a cancel means; the pool replaces it otherwise.
+    def release_leases
+      if @tts_lease
+        clean = false
+        begin
+          @tts_lock.synchronize do
+            @tts_stdin.write(JSON.generate({ cancel: true }) + "\n")
+            @tts_stdin.flush
+          end
+          deadline = Process.clock_gettime(Process::CLOCK_MONOTONIC) + 5
+          until clean || (left = deadline - Process.clock_gettime(Process::CLOCK_MONOTONIC)) <= 0
+            done = @audio_done.pop(timeout: left)
+            break if done.nil?
+
+            clean = done == :cancelled
+          end
+        rescue IOError, Errno::EPIPE
+          clean = false
+        end
+        @tts_lease.release(clean: clean)
+        @tts_lease = nil
+      end
+
+      # STT output is lines; the next lessee skips to its reset itself
+      @stt_lease&.release(clean: true)
+      @stt_lease = nil
+    end
+
     # --- TTS audio reader (stdout → PCMU → callback) ---
     #
-    # Reads raw S16LE bytes from the TTS subprocess stdout. The Python side
-    # pads each utterance to a 320-byte frame boundary and writes a 4-byte
-    # sentinel (0xDEADBEEF) at the end. This reader:
-    #
-    # 1. Buffers incoming bytes
-    # 2. Extracts complete 320-byte frames → converts to PCMU → on_audio
-    # 3. Detects the sentinel → discards partial frames → signals audio_done
+    # tts_server.py writes length-prefixed records to stdout: audio
+    # (S16LE, padded to a 20 ms frame per utterance), a boundary after
+    # each utterance and status (see TtsReader).  The reader yields
+    # whole frames, which go to on_audio as PCMU (at other rates as
+    # S16LE), and each boundary signals audio_done, so on_response_done
+    # fires only after all of an utterance's audio is delivered.
+    # Status arrives in order with the audio it describes.
     #
-    # This eliminates frame misalignment between utterances and ensures the
-    # on_response_done callback fires only after all audio is delivered.
+    # With tts_inject the audio goes from TTS to ausock directly while a
+    # call is up, and stdout carries just the boundaries and status.
 
     def tts_audio_reader
-      frame_bytes = AudioBridge::FRAME_BYTES  # 320 bytes S16LE
-      sentinel = BOUNDARY_SENTINEL
-      buffer = String.new(encoding: 'BINARY', capacity: 16384)
+      frame_bytes = @output_rate / 50 * 2  # 20 ms of S16LE, 320 bytes at 8 kHz
+      reader = TtsReader.build(frame_bytes)
       frame_count = 0
-      first_sentinel = true  # skip warmup flush sentinel
 
       loop do
         begin
@@ -195,50 +316,22 @@ class VoiceAgent
           break
         end
 
-        break unless chunk && chunk.bytesize > 0
-        buffer << chunk
-
-        # Scan for boundary sentinel in the buffer
-        while (sentinel_pos = buffer.index(sentinel))
-          # Process all complete frames before the sentinel
-          audio_portion = buffer.slice!(0, sentinel_pos)
-          buffer.slice!(0, sentinel.bytesize)  # consume sentinel
-
-          # Frame and deliver the audio portion
-          offset = 0
-          while offset + frame_bytes <= audio_portion.bytesize
-            frame = audio_portion.byteslice(offset, frame_bytes)
-            pcmu = AudioBridge.s16le_to_pcmu(frame)
-            @callbacks[:on_audio]&.call(pcmu)
-            frame_count += 1
-            offset += frame_bytes
-          end
+        reader.feed(chunk) do |type, data|
+          # a leased worker: what comes before its reset was for the last call
+          next tts_status(data) if @tts_resync && type == :status
+          next if @tts_resync
 
-          # Discard any leftover bytes (should be 0 since Python pads)
-          leftover = audio_portion.bytesize - offset
-          vlog "TTS boundary: #{frame_count} frames delivered (#{leftover}B discarded)" if leftover > 0
-
-          # Signal that all audio for this utterance has been delivered.
-          # Skip the first sentinel — it's the warmup flush from tts_server.py.
-          if first_sentinel
-            first_sentinel = false
-            vlog "TTS warmup sentinel (skipped)"
-          else
+          case type
+          when :audio
+            deliver_audio(data) unless @barged_in
+            frame_count += 1
+          when :boundary
+            vlog "TTS boundary: #{frame_count} frames delivered"
+            frame_count = 0
             @audio_done.push(:complete)
+          when :status
+            tts_status(data)
           end
-          frame_count = 0
-        end
-
-        # Process complete frames from remaining buffer (between sentinels)
-        while buffer.bytesize >= frame_bytes + sentinel.bytesize || buffer.bytesize >= frame_bytes
-          # Don't consume bytes that might be the start of a sentinel
-          # Only process if we have enough bytes to confirm it's not a sentinel
-          break if buffer.bytesize < frame_bytes + sentinel.bytesize && buffer.include?(sentinel[0, [buffer.bytesize - frame_bytes, 1].max])
-
-          frame = buffer.slice!(0, frame_bytes)
-          pcmu = AudioBridge.s16le_to_pcmu(frame)
-          @callbacks[:on_audio]&.call(pcmu)
-          frame_count += 1
         end
       end
 
@@ -247,39 +340,56 @@ class VoiceAgent
       vlog "TTS audio reader stopped: #{e.class}: #{e.message}"
     end
 
-    # TTS status reader — purely informational logging.
-    # Lifecycle (@speaking, @cooldown_until, on_response_done) is managed by
-    # stream_and_speak, which waits on @audio_done directly.
-    def tts_status_reader
-      @tts_ready = false
-      while (line = @tts_stderr.gets)
-        line = line.force_encoding('UTF-8').scrub.strip
-        next if line.empty?
+    # One S16LE frame of TTS audio to on_audio, as PCMU at 8 kHz
+    def deliver_audio(frame)
+      @callbacks[:on_audio]&.call(pcmu_output? ? AudioBridge.s16le_to_pcmu(frame) : frame)
+    end
 
-        begin
-          msg = JSON.parse(line)
-        rescue JSON::ParserError
-          vlog "TTS stderr: #{line}" if @verbose
-          next
+    # A status record from the TTS stream.  Apart from ready (startup),
+    # cancelled (the reply to #cancel_tts, queued after the boundaries
+    # before it) and error they are informational; lifecycle (@speaking,
+    # @cooldown_until, on_response_done) is managed by stream_and_speak,
+    # which waits on @audio_done directly.
+    def tts_status(json)
+      msg = JSON.parse(json)
+      return if @tts_resync && msg['status'] != 'reset'
+
+      case msg['status']
+      when 'ready'
+        @tts_ready = true
+        vlog "TTS ready"
+      when 'reset'
+        @tts_resync = false
+        @tts_ready = true
+        vlog "TTS worker reset"
+      when 'generating'
+        vlog "TTS generating"
+      when 'chunk'
+        unless @tts_traced
+          @tts_traced = true
+          trace(:tts_first, msg['t'])
         end
+      when 'done'
+        vlog "TTS done: #{msg['audio_duration']}s in #{msg['gen_time']}s (#{msg['rtf']}x RT)#{' cut short' if msg['cancelled']}"
+      when 'cancelled'
+        vlog "TTS cancelled, #{msg['dropped']} queued dropped"
+        @audio_done.push(:cancelled)
+      when 'error'
+        vlog "TTS error: #{msg['message']}"
+        @callbacks[:on_error]&.call(msg['message'])
+      end
+    rescue JSON::ParserError
+      vlog "TTS status: #{json}"
+    end
 
-        case msg['status']
-        when 'ready'
-          @tts_ready = true
-          vlog "TTS ready"
-        when 'generating'
-          vlog "TTS generating"
-        when 'audio_complete'
-          vlog "TTS audio written: #{msg['bytes']}B"
-        when 'done'
-          vlog "TTS done: #{msg['audio_duration']}s in #{msg['gen_time']}s (#{msg['rtf']}x RT)"
-        when 'error'
-          vlog "TTS error: #{msg['message']}"
-          @callbacks[:on_error]&.call(msg['message'])
-        end
+    # The TTS server's stderr: tracebacks, model logs, progress bars
+    def tts_log_reader
+      while (line = @tts_stderr.gets)
+        line = line.force_encoding('UTF-8').scrub.strip
+        vlog "TTS stderr: #{line}" unless line.empty?
       end
     rescue IOError
-      vlog "TTS status reader stopped"
+      vlog "TTS log reader stopped"
     end
 
     # --- STT output reader (stdout → transcript → LLM → TTS) ---
@@ -291,10 +401,21 @@ class VoiceAgent
 
         msg = JSON.parse(line) rescue next
 
+        # a leased worker: what comes before its reset was for the last call
+        if @stt_resync
+          next unless msg['type'] == 'reset'
+
+          @stt_resync = false
+          @stt_ready = true
+          vlog "STT worker reset"
+          next
+        end
+
         case msg['type']
         when 'speech_started'
           @callbacks[:on_speech_started]&.call
         when 'speech_stopped'
+          trace(:speech_stop, msg['t'])
           @callbacks[:on_speech_stopped]&.call
         when 'transcript'
           text = msg['text']
@@ -315,12 +436,16 @@ class VoiceAgent
           # Echo suppression: discard transcripts while agent is speaking
           # or within cooldown window after speech ends (phone echo delay).
           # Exception: real speech (>= 10 chars, >= 2 words) during playback
-          # triggers barge-in so the caller can interrupt the agent.
+          # triggers barge-in so the caller can interrupt the agent; after
+          # a native barge-in (#interrupt) any transcript is the caller.
           now = Process.clock_gettime(Process::CLOCK_MONOTONIC)
           if @speaking || now < @cooldown_until
-            if @speaking && text.strip.length >= 10 && text.split.size >= 2
+            caller = @barged_in || (text.strip.length >= 10 && text.split.size >= 2)
+            if @speaking && caller
               @interrupt_transcript = text
+              @interrupt_transcript_at = msg['t']
               @interrupt = true
+              cancel_tts
               vlog "STT interrupt detected: #{text.inspect}"
             else
               vlog "STT transcript (suppressed — echo): #{text.inspect}"
@@ -329,6 +454,7 @@ class VoiceAgent
           end
 
           vlog "STT transcript: #{text.inspect} (#{msg['latency']}s)"
+          trace(:transcript, msg['t'])
           @callbacks[:on_input_transcript]&.call(text)
           @utterance_queue << text
         end
@@ -395,65 +521,61 @@ class VoiceAgent
       @speaking = false
     end
 
-    # Stream LLM tokens, split into sentences, and send each to TTS with
-    # sentence-level pacing: wait for the previous sentence's audio to finish
-    # before sending the next. This creates natural ~1s pauses (TTS startup
-    # latency) and enables barge-in — if STT detects real caller speech between
-    # sentences, we stop generating and respond to the interrupt.
+    # Stream LLM tokens, split into sentences, and send each to TTS as
+    # it completes, keeping up to tts_lookahead sentences queued in the
+    # TTS process behind the one being spoken, so sentence N+1 is
+    # generated while N plays.  With tts_lookahead 0 each sentence waits
+    # for the previous one's audio, which paces the reply with ~1s gaps
+    # (TTS startup latency).
+    #
+    # Barge-in: once STT or ausock reports the caller (@interrupt), a
+    # cancel goes to TTS, which drops the queue and cuts the sentence it
+    # is generating short; we stop sending, keep what was said, and
+    # respond to the interrupt.
     def stream_and_speak(messages:)
       @speaking = true
       @interrupt = false
       @interrupt_transcript = nil
+      @interrupt_transcript_at = nil
+      @barged_in = false
+      @cancel_sent = false
+      @tts_traced = false
 
       full_response = String.new
       sentences_sent = 0
-      sentences_completed = 0
+      pending = 0  # sentences sent without their boundary back yet
       buffer = String.new
-      interrupted = false
 
-      catch(:interrupted) do
+      interrupted = catch(:interrupted) do
         stream_grok_text_api(messages: messages) do |token|
+          trace(:llm_first) if full_response.empty? && buffer.empty?
           buffer << token
           while (sentence = extract_sentence!(buffer))
-            # Wait for previous sentence's audio before sending next
-            if sentences_sent > sentences_completed
-              @audio_done.pop(timeout: 30) rescue nil
-              sentences_completed += 1
-              if @interrupt
-                interrupted = true
-                throw :interrupted
-              end
-            end
+            pending = await_tts(pending, @tts_lookahead)
             send_to_tts(sentence)
             sentences_sent += 1
+            pending += 1
             full_response << sentence
           end
         end
 
-        # Wait for last streamed sentence before flushing remainder
-        if sentences_sent > sentences_completed
-          @audio_done.pop(timeout: 30) rescue nil
-          sentences_completed += 1
-          interrupted = @interrupt
-        end
-
         # Flush remaining buffer
-        unless interrupted || buffer.strip.empty?
+        unless buffer.strip.empty?
+          pending = await_tts(pending, @tts_lookahead)
           send_to_tts(buffer.strip)
           sentences_sent += 1
+          pending += 1
           full_response << buffer
         end
 
-        # Wait for final sentence
-        unless interrupted
-          if sentences_sent > sentences_completed
-            @audio_done.pop(timeout: 30) rescue nil
-            sentences_completed += 1
-            interrupted = @interrupt
-          end
-        end
+        # Wait for the rest of the audio
+        await_tts(pending, 0)
+        false
       end # catch(:interrupted)
 
+      # a cancel between the last boundary and here still owes its reply
+      interrupted ||= @cancel_sent
+
       if full_response.strip.empty? && !interrupted
         @speaking = false
         return nil
@@ -466,19 +588,24 @@ class VoiceAgent
       end
 
       if interrupted
-        # Drain any outstanding TTS sentinels
-        remaining = sentences_sent - sentences_completed
-        remaining.times { @audio_done.pop(timeout: 15) rescue break }
+        # Everything TTS still owes us up to the cancel's reply
+        cancel_tts
+        until [:cancelled, nil].include?(@audio_done.pop(timeout: 15)); end
 
         @speaking = false
         @cooldown_until = 0.0  # Don't suppress the interrupt
 
-        vlog "BARGE-IN: interrupted after #{sentences_completed} sentences, re-queuing: #{@interrupt_transcript.inspect}"
-        @callbacks[:on_input_transcript]&.call(@interrupt_transcript)
-        @utterance_queue << @interrupt_transcript
+        vlog "BARGE-IN: interrupted after #{sentences_sent - pending} of #{sentences_sent} sentences, re-queuing: #{@interrupt_transcript.inspect}"
+        # a native barge-in can stop us before STT has the words; they
+        # then arrive as an ordinary transcript
+        if @interrupt_transcript
+          trace(:transcript, @interrupt_transcript_at)
+          @callbacks[:on_input_transcript]&.call(@interrupt_transcript)
+          @utterance_queue << @interrupt_transcript
+        end
       else
         @speaking = false
-        @cooldown_until = Process.clock_gettime(Process::CLOCK_MONOTONIC) + 1.5
+        @cooldown_until = Process.clock_gettime(Process::CLOCK_MONOTONIC) + ECHO_COOLDOWN
         @callbacks[:on_response_done]&.call({
           'type' => 'response.done',
           'response' => { 'usage' => {} }
@@ -488,6 +615,21 @@ class VoiceAgent
       full_response
     end
 
+    # Wait for TTS boundaries until at most limit sentences are pending;
+    # returns the new count.  A timed-out wait counts as the boundary.
+    # Throws :interrupted (true) once the caller has barged in.
+    def await_tts(pending, limit)
+      while pending > limit && !@interrupt
+        done = @audio_done.pop(timeout: 30)
+        next if done == :cancelled  # reply to a previous response's cancel
+
+        pending -= 1
+      end
+
+      throw :interrupted, true if @interrupt
+      pending
+    end
+
     # Extract the first complete sentence from buffer, mutating it in place.
     # A sentence boundary is .!? followed by whitespace. Must be >= 20 chars
     # to avoid splitting on abbreviations (Dr., Mr., U.S.) or tiny fragments.
@@ -515,12 +657,7 @@ class VoiceAgent
         stream: true,
       }
 
-      uri = URI('https://api.x.ai/v1/chat/completions')
-      http = Net::HTTP.new(uri.host, uri.port)
-      http.use_ssl = true
-      http.read_timeout = 30
-
-      req = Net::HTTP::Post.new(uri.path)
+      req = Net::HTTP::Post.new(LLM_URI.path)
       req['Authorization'] = "Bearer #{@api_key}"
       req['Content-Type'] = 'application/json'
       req.body = JSON.generate(payload)
@@ -529,36 +666,34 @@ class VoiceAgent
       t0 = Process.clock_gettime(Process::CLOCK_MONOTONIC)
 
       full_text = String.new
-      line_buffer = String.new
+      parser = SseParser.new
+      retried = false
 
-      http.request(req) do |resp|
-        unless resp.is_a?(Net::HTTPSuccess)
-          body = resp.read_body
-          vlog "LLM API error: #{resp.code} #{body[0, 200]}"
-          return nil
-        end
-
-        resp.read_body do |chunk|
-          line_buffer << chunk
-          while (newline_pos = line_buffer.index("\n"))
-            line = line_buffer.slice!(0, newline_pos + 1).strip
-            next if line.empty?
-            next unless line.start_with?('data: ')
-
-            data = line[6..]
-            next if data == '[DONE]'
+      @llm_lock.synchronize do
+        begin
+          llm_http.request(req) do |resp|
+            unless resp.is_a?(Net::HTTPSuccess)
+              body = resp.read_body
+              vlog "LLM API error: #{resp.code} #{body[0, 200]}"
+              return nil
+            end
 
-            begin
-              parsed = JSON.parse(data)
-              delta = parsed.dig('choices', 0, 'delta', 'content')
-              if delta
+            resp.read_body do |chunk|
+              parser.feed(chunk) do |delta|
                 full_text << delta
                 yield delta
               end
-            rescue JSON::ParserError
-              next
             end
           end
+        rescue IOError, SystemCallError, OpenSSL::SSL::SSLError, Net::ReadTimeout => e
+          # the server may have dropped the kept-alive connection since
+          # the last turn; once, and only before anything was spoken
+          llm_reset
+          raise if retried || !full_text.empty?
+
+          vlog "LLM connection lost (#{e.class}), reconnecting"
+          retried = true
+          retry
         end
       end
 
@@ -570,17 +705,70 @@ class VoiceAgent
       nil
     end
 
+    # The kept-alive connection to LLM_URI, opened on first use.
+    # Net::HTTP reconnects by itself when the server closed it while
+    # idle.  Callers hold @llm_lock.
+    def llm_http
+      @llm_http ||= Net::HTTP.new(LLM_URI.host, LLM_URI.port).tap do |http|
+        http.use_ssl = true
+        http.read_timeout = 30
+        http.keep_alive_timeout = LLM_KEEP_ALIVE
+        http.max_retries = 0  # POST; stream_grok_text_api retries itself
+      end
+      @llm_http.start unless @llm_http.started?
+      @llm_http
+    end
+
+    def llm_reset
+      @llm_http&.finish if @llm_http&.started?
+    rescue IOError
+      nil
+    ensure
+      @llm_http = nil
+    end
+
+    def warm_llm
+      t0 = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+      @llm_lock.synchronize { llm_http }
+      vlog "LLM connection ready (#{(Process.clock_gettime(Process::CLOCK_MONOTONIC) - t0).round(2)}s)"
+    rescue IOError, SystemCallError, SocketError, OpenSSL::SSL::SSLError, Net::OpenTimeout => e
+      vlog "LLM pre-warm failed: #{e.class}: #{e.message}"  # the first turn connects
+    end
+
     # --- TTS request ---
 
     def send_to_tts(text)
-      return unless @connected && @tts_stdin
+      return unless tts_write({ text: text })
 
-      req = { text: text }
-      @tts_stdin.write(JSON.generate(req) + "\n")
-      @tts_stdin.flush
       vlog "sent to TTS: #{text[0, 100].inspect}"
+    end
+
+    # Drop what TTS has queued and cut the sentence it is generating
+    # short; it replies with a 'cancelled' status once done.  Once per
+    # response, from whichever thread sees the barge-in first.
+    def cancel_tts
+      @tts_lock.synchronize do
+        return if @cancel_sent
+
+        @cancel_sent = true
+      end
+      return vlog "TTS cancel" if tts_write({ cancel: true })
+
+      @cancel_sent = false  # no reply coming
+    end
+
+    # One JSON request line to tts_server.py; false if it is not running
+    def tts_write(req)
+      return false unless @connected && @tts_stdin
+
+      @tts_lock.synchronize do
+        @tts_stdin.write(JSON.generate(req) + "\n")
+        @tts_stdin.flush
+      end
+      true
     rescue IOError, Errno::EPIPE
-      vlog "send_to_tts: TTS pipe broken"
+      vlog "TTS pipe broken"
+      false
     end
   end
 end
@@ -0,0 +1,106 @@
+# frozen_string_literal: true
+
+require 'json'
+
+class VoiceAgent
+  # Incremental parser for an OpenAI-style chat completion stream
+  # (text/event-stream), as the Grok text API sends it:
+  #
+  #   data: {"id":"...","choices":[{"index":0,"delta":{"content":"Hi"}}]}
+  #
+  #   data: [DONE]
+  #
+  # #feed takes the body in chunks of any size and yields each
+  # choices[0].delta.content string as its line completes.  Lines are
+  # scanned where they lie in the buffer, and the content is cut
+  # straight out of the JSON text, so a token costs one string (the
+  # token) rather than a line, a Hash and its keys.  Only content with
+  # a backslash escape in it goes through JSON.parse.  Other fields
+  # (role, reasoning_content, usage), comments and event: lines are
+  # skipped.
+  #
+  # Usage:
+  #   parser = VoiceAgent::SseParser.new
+  #   resp.read_body { |chunk| parser.feed(chunk) { |delta| ... } }
+  #   parser.done?  # => true once data: [DONE] was seen
+  class SseParser
+    DATA    = 'data:'
+    DONE    = '[DONE]'
+    DELTA   = '"delta":'
+    CONTENT = '"content":"'
+
+    def initialize
+      @buf = String.new(encoding: Encoding::BINARY, capacity: 16384)
+      @pos = 0  # bytes of @buf consumed
+      @done = false
+    end
+
+    def done?
+      @done
+    end
+
+    def feed(chunk)
+      # drop what was consumed, then append
+      if @pos > 0
+        @buf = @buf.byteslice(@pos..)
+        @pos = 0
+      end
+      @buf << chunk.b
+
+      while (nl = @buf.byteindex("\n", @pos))
+        stop = nl
+        stop -= 1 if stop > @pos && @buf.getbyte(stop - 1) == 0x0D  # CRLF
+
+        if prefix?(DATA, @pos, stop)
+          start = @pos + DATA.bytesize
+          start += 1 if @buf.getbyte(start) == 0x20
+          delta = data(start, stop)
+          yield delta if delta && !delta.empty?
+        end
+
+        @pos = nl + 1
+      end
+
+      self
+    end
+
+    private
+
+    # The content of one data: payload, @buf[start...stop]
+    def data(start, stop)
+      if prefix?(DONE, start, stop) && start + DONE.bytesize == stop
+        @done = true
+        return nil
+      end
+
+      delta = @buf.byteindex(DELTA, start)
+      return nil unless delta && delta < stop
+
+      key = @buf.byteindex(CONTENT, delta)
+      return nil unless key && key < stop
+
+      from = key + CONTENT.bytesize
+      close = @buf.byteindex('"', from)
+      return nil unless close && close < stop
+
+      escaped = @buf.byteindex('\\', from)
+      return parse(start, stop) if escaped && escaped < close
+
+      @buf.byteslice(from, close - from).force_encoding(Encoding::UTF_8)
+    end
+
+    # Slow path: content with escapes (\n, \", é...)
+    def parse(start, stop)
+      JSON.parse(@buf.byteslice(start, stop - start)).dig('choices', 0, 'delta', 'content')
+    rescue JSON::ParserError
+      nil
+    end
+
+    def prefix?(str, off, stop)
+      return false if off + str.bytesize > stop
+
+      str.bytesize.times { |i| return false unless @buf.getbyte(off + i) == str.getbyte(i) }
+      true
+    end
+  end
+end
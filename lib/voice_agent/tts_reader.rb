@@ -0,0 +1,136 @@
+# frozen_string_literal: true
+
+require_relative '../voice_native'
+
+class VoiceAgent
+  # Parser for the record stream tts_server.py writes to stdout.
+  #
+  # Every record is an 8-byte header, type (u8), three reserved bytes
+  # and payload length (u32 LE), followed by the payload:
+  #
+  #   AUDIO     S16LE mono PCM at the server's --sample-rate, any length
+  #   BOUNDARY  end of an utterance; no payload
+  #   STATUS    one JSON object (UTF-8): ready, generating, done, error...
+  #
+  # Status travels with the audio, so "done" arrives after the last
+  # frame it describes.  #feed takes the stream in chunks of any size
+  # and yields what they complete: (:audio, frame) for each whole
+  # frame of frame_bytes, cut across records as needed; (:boundary,
+  # nil) once the utterance's last frame is out, padded with silence if
+  # short; and (:status, json) as the raw JSON text.  Record types it
+  # doesn't know are skipped.
+  #
+  # Usage:
+  #   reader = VoiceAgent::TtsReader.build(320)
+  #   reader.feed(io.readpartial(16384)) { |type, data| ... }
+  #
+  # .build returns VoiceNative::TtsReader when the extension is built
+  # (rake compile), which does the same in C; this class is the
+  # pure-Ruby fallback.
+  class TtsReader
+    HEADER = 'CxxxV'
+    HEADER_BYTES = 8
+
+    AUDIO    = 1
+    BOUNDARY = 2
+    STATUS   = 3
+
+    MAX_RECORD = 1 << 16  # largest record that is not audio
+
+    def self.build(frame_bytes)
+      VoiceNative.available? ? VoiceNative::TtsReader.new(frame_bytes) : new(frame_bytes)
+    end
+
+    # One record as tts_server.py writes it
+    def self.record(type, payload = ''.b)
+      [type, payload.bytesize].pack(HEADER) + payload.b
+    end
+
+    def initialize(frame_bytes)
+      raise ArgumentError, "bad frame size #{frame_bytes}" unless frame_bytes.positive? && frame_bytes <= MAX_RECORD
+
+      @frame_bytes = frame_bytes
+      @buf = String.new(encoding: Encoding::BINARY, capacity: 16384)
+      @pos = 0                         # bytes of @buf consumed
+      @part = String.new(encoding: Encoding::BINARY, capacity: frame_bytes)
+      @audio_left = 0                  # of the AUDIO record being read
+    end
+
+    def feed(data)
+      # drop what was consumed, then append
+      if @pos > 0
+        @buf = @buf.byteslice(@pos..)
+        @pos = 0
+      end
+      @buf << data.b
+
+      loop do
+        avail = @buf.bytesize - @pos
+
+        if @audio_left > 0
+          n = [@audio_left, avail].min
+          break if n.zero?
+
+          @audio_left -= n
+          audio(@pos, n) { |frame| yield :audio, frame }
+          next
+        end
+
+        break if avail < HEADER_BYTES
+
+        type, len = @buf.unpack(HEADER, offset: @pos)
+        if type == AUDIO
+          @pos += HEADER_BYTES
+          @audio_left = len
+          next
+        end
+
+        raise IOError, "TTS record of #{len} bytes" if len > MAX_RECORD
+        break if avail < HEADER_BYTES + len
+
+        payload = @buf.byteslice(@pos + HEADER_BYTES, len)
+        @pos += HEADER_BYTES + len
+
+        case type
+        when BOUNDARY
+          unless @part.empty?
+            frame = @part.ljust(@frame_bytes, "\0".b)
+            @part.clear
+            yield :audio, frame
+          end
+          yield :boundary, nil
+        when STATUS
+          yield :status, payload.force_encoding(Encoding::UTF_8)
+        end
+      end
+
+      self
+    end
+
+    private
+
+    # The n audio bytes of @buf at off, in whole frames
+    def audio(off, n)
+      @pos += n
+      stop = off + n
+
+      unless @part.empty?
+        take = [@frame_bytes - @part.bytesize, n].min
+        @part << @buf.byteslice(off, take)
+        off += take
+        return if @part.bytesize < @frame_bytes
+
+        frame = @part.dup
+        @part.clear
+        yield frame
+      end
+
+      while off + @frame_bytes <= stop
+        yield @buf.byteslice(off, @frame_bytes)
+        off += @frame_bytes
+      end
+
+      @part << @buf.byteslice(off, stop - off) if off < stop
+    end
+  end
+end
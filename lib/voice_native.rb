@@ -0,0 +1,20 @@
+# frozen_string_literal: true
+
+# Optional C extension with allocation-free audio helpers
+# (ext/voice_native, built by `rake compile`).
+#
+# Loading never fails: when the extension has not been built,
+# VoiceNative.available? is false and callers use their pure-Ruby
+# fallbacks instead.
+module VoiceNative
+  begin
+    require_relative '../ext/voice_native/voice_native'
+    AVAILABLE = true
+  rescue LoadError
+    AVAILABLE = false
+  end
+
+  def self.available?
+    AVAILABLE
+  end
+end
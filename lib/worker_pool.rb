@@ -0,0 +1,303 @@
+# frozen_string_literal: true
+
+require 'json'
+require 'socket'
+require 'fileutils'
+require_relative 'voice_agent/tts_reader'
+
+# Keeps STT and TTS workers (tts/stt_server.py, tts/tts_server.py)
+# loaded between calls and leases them to VoiceAgent::Local, so a
+# call starts on warm models instead of waiting up to two minutes for
+# them to load (bin/workers).
+#
+# A worker is known by its command line: a lease asks for one that
+# runs exactly the argv the agent would have spawned, and gets its
+# stdin and stdout over the socket (SCM_RIGHTS), so audio flows
+# between the call and the worker directly, as with a child of its
+# own.  Before handing it over the pool resets the worker for the new
+# call: TTS gets {"reset": {"inject": ...}} on stdin, STT the same with
+# "tap" on its control pipe.  Each answers with a reset marker in its
+# output, and the lessee skips everything before it.  The pool keeps
+# stderr, a log for both, and drains it.
+#
+# Protocol (one Unix socket connection per lease, JSON lines):
+#   → {"lease": "tts", "argv": [...], "inject": "/tmp/ausock.sock.inject"}
+#   → {"lease": "stt", "argv": [...], "tap": "/tmp/ausock.sock.tap"}
+#   ← the worker's stdin and stdout, then {"pid": 4242}
+#   ← {"error": "..."}, when no idle worker runs argv
+#   → "clean\n" once done with it, and close
+#
+# Closing without "clean" (the call crashed, or TTS output stopped
+# between records) retires the worker, and the pool starts a new one
+# in its place.  It keeps `count` workers per profile, leased or not.
+#
+# Usage:
+#   pool = WorkerPool.new('/tmp/voice-workers.sock', [
+#     { kind: 'tts', argv: tts_argv, count: 1 },
+#     { kind: 'stt', argv: stt_argv, count: 1 },
+#   ])
+#   pool.start
+#
+#   lease = WorkerPool.lease('/tmp/voice-workers.sock', :tts, tts_argv, inject: nil)
+#   lease.stdin.puts(...)
+#   lease.release(clean: true)
+class WorkerPool
+  KINDS = %w[tts stt].freeze
+  CONTROL_FD = 3  # STT reset pipe in the worker (--control-fd)
+
+  # One spawned worker; the pool's copies of its pipes
+  class Worker
+    attr_reader :kind, :argv, :pid, :stdin, :stdout
+    attr_accessor :leased
+
+    def initialize(kind, argv, log)
+      @kind = kind
+      @argv = argv
+      @log = log
+      @ready = false
+      @leased = false
+    end
+
+    def ready?
+      @ready
+    end
+
+    # Spawn; &on_exit runs on a thread of its own when it dies
+    def start(&on_exit)
+      in_r, @stdin = IO.pipe
+      @stdout, out_w = IO.pipe
+      @stderr, err_w = IO.pipe
+      spawn_opts = { in: in_r, out: out_w, err: err_w }
+      cmd = @argv
+
+      if @kind == 'stt'
+        ctl_r, @control = IO.pipe
+        spawn_opts[CONTROL_FD] = ctl_r
+        cmd += ['--control-fd', CONTROL_FD.to_s]
+      else
+        @control = @stdin  # TTS takes its reset with the requests
+      end
+
+      @pid = Process.spawn(*cmd, spawn_opts)
+      [in_r, out_w, err_w, ctl_r].compact.each(&:close)
+      [@stdin, @stdout].each(&:binmode)
+      @log.call("#{@kind} worker #{@pid} starting")
+
+      @threads = [Thread.new { log_reader }]
+      @threads << Thread.new { tts_ready_reader } if @kind == 'tts'
+      waiter = Process.detach(@pid)
+      @threads << Thread.new { waiter.join; on_exit&.call(self) }
+      self
+    end
+
+    # Point the worker at the next call (inject: or tap: socket path)
+    def reset(path)
+      key = @kind == 'tts' ? :inject : :tap
+      @control.write(JSON.generate({ reset: { key => path } }) + "\n")
+      @control.flush
+    end
+
+    def stop
+      Process.kill('TERM', @pid) rescue nil
+      [@stdin, @stdout, @stderr, @control].uniq.each { |io| io&.close rescue nil }
+    end
+
+    private
+
+    # stderr is a log for both kinds; STT's status lines say when it is ready
+    def log_reader
+      while (line = @stderr.gets)
+        line = line.force_encoding('UTF-8').scrub.strip
+        next if line.empty?
+
+        if @kind == 'stt' && !@ready && (JSON.parse(line)['status'] == 'ready' rescue false)
+          @ready = true
+          @log.call("stt worker #{@pid} ready")
+        end
+        @log.call("#{@kind} #{@pid}: #{line}")
+      end
+    rescue IOError
+      nil
+    end
+
+    # TTS reports ready as a record on stdout, after which it writes
+    # nothing until it is sent something: read up to there and stop
+    def tts_ready_reader
+      reader = VoiceAgent::TtsReader.new(320)
+      until @ready
+        reader.feed(@stdout.readpartial(16384)) do |type, data|
+          next unless type == :status && (JSON.parse(data)['status'] == 'ready' rescue false)
+
+          @ready = true
+          @log.call("tts worker #{@pid} ready")
+        end
+      end
+    rescue IOError, EOFError
+      nil
+    end
+  end
+
+  # The lessee's side: the worker's stdin and stdout until #release
+  class Lease
+    attr_reader :stdin, :stdout, :pid
+
+    # nil when there is no pool at socket_path or no idle worker runs argv
+    def self.open(socket_path, kind, argv, **opts)
+      return nil unless socket_path && File.socket?(socket_path)
+
+      sock = UNIXSocket.new(socket_path)
+      sock.write(JSON.generate({ lease: kind.to_s, argv: argv }.merge(opts)) + "\n")
+      stdin = sock.recv_io
+      stdout = sock.recv_io
+      pid = JSON.parse(sock.gets.to_s)['pid']
+      new(sock, stdin, stdout, pid)
+    rescue SystemCallError, SocketError, IOError, JSON::ParserError
+      sock&.close rescue nil
+      nil
+    end
+
+    def initialize(sock, stdin, stdout, pid)
+      @sock = sock
+      @stdin = stdin
+      @stdout = stdout
+      @pid = pid
+    end
+
+    # Hand the worker back; not clean retires it.  Closes our pipes.
+    def release(clean:)
+      [@stdin, @stdout].each { |io| io.close rescue nil }
+      @sock.write("clean\n") if clean
+    rescue SystemCallError, IOError
+      nil
+    ensure
+      @sock.close rescue nil
+    end
+  end
+
+  def self.lease(socket_path, kind, argv, **opts)
+    Lease.open(socket_path, kind, argv, **opts)
+  end
+
+  attr_reader :socket_path
+
+  # profiles: [{ kind: 'tts' | 'stt', argv: [...], count: n }]
+  def initialize(socket_path, profiles, verbose: false)
+    @socket_path = socket_path
+    @profiles = profiles.map { |p| p.transform_keys(&:to_sym).merge(kind: p[:kind].to_s) }
+    @profiles.each { |p| raise ArgumentError, "unknown worker kind #{p[:kind]}" unless KINDS.include?(p[:kind]) }
+    @verbose = verbose
+    @workers = []
+    @mutex = Mutex.new
+    @running = false
+    @server = nil
+    @acceptor = nil
+  end
+
+  def start
+    @running = true
+    @profiles.each { |p| p[:count].to_i.times { spawn_worker(p[:kind], p[:argv]) } }
+
+    FileUtils.rm_f(@socket_path)
+    @server = UNIXServer.new(@socket_path)
+    @acceptor = Thread.new { accept_loop }
+    log("listening on #{@socket_path}")
+    self
+  end
+
+  def stop
+    @running = false
+    @server&.close rescue nil
+    FileUtils.rm_f(@socket_path)
+    @mutex.synchronize { @workers.dup }.each(&:stop)
+  end
+
+  # Block until #stop
+  def wait
+    @acceptor&.join
+  end
+
+  # Workers by kind: { 'tts' => { ready:, leased:, total: }, ... }
+  def stats
+    @mutex.synchronize do
+      KINDS.to_h do |kind|
+        of_kind = @workers.select { |w| w.kind == kind }
+        [kind, { ready: of_kind.count(&:ready?), leased: of_kind.count(&:leased), total: of_kind.size }]
+      end
+    end
+  end
+
+  private
+
+  def log(msg)
+    $stderr.puts "[workers] #{msg}" if @verbose
+  end
+
+  def spawn_worker(kind, argv)
+    worker = Worker.new(kind, argv, method(:log)).start { |w| exited(w) }
+    @mutex.synchronize { @workers << worker }
+  rescue SystemCallError => e
+    log("cannot start #{kind} worker: #{e.message}")
+  end
+
+  # Take a dead worker out, and start its replacement
+  def exited(worker)
+    gone = @mutex.synchronize { @workers.delete(worker) }
+    return unless gone
+
+    worker.stop
+    log("#{worker.kind} worker #{worker.pid} exited")
+    spawn_worker(worker.kind, worker.argv) if @running
+  end
+
+  def accept_loop
+    while @running
+      client = @server.accept
+      Thread.new(client) { |c| serve(c) }
+    end
+  rescue IOError, SystemCallError
+    nil  # closed by #stop
+  end
+
+  def serve(client)
+    req = JSON.parse(client.gets.to_s)
+    kind = req['lease'].to_s
+    argv = Array(req['argv'])
+    worker = take(kind, argv)
+    unless worker
+      client.write(JSON.generate({ error: "no idle #{kind} worker for #{argv.last(4).join(' ')}" }) + "\n")
+      return
+    end
+
+    worker.reset(kind == 'tts' ? req['inject'] : req['tap'])
+    client.send_io(worker.stdin)
+    client.send_io(worker.stdout)
+    client.write(JSON.generate({ pid: worker.pid }) + "\n")
+    log("#{kind} worker #{worker.pid} leased")
+
+    clean = client.gets&.strip == 'clean'
+    give_back(worker, clean)
+  rescue JSON::ParserError, SystemCallError, IOError => e
+    log("lease failed: #{e.class}: #{e.message}")
+    give_back(worker, false) if worker
+  ensure
+    client.close rescue nil
+  end
+
+  def take(kind, argv)
+    @mutex.synchronize do
+      worker = @workers.find { |w| w.kind == kind && w.argv == argv && w.ready? && !w.leased }
+      worker&.leased = true
+      worker
+    end
+  end
+
+  def give_back(worker, clean)
+    if clean
+      @mutex.synchronize { worker.leased = false }
+      log("#{worker.kind} worker #{worker.pid} back")
+    else
+      log("#{worker.kind} worker #{worker.pid} retired")
+      worker.stop  # exited() starts the replacement
+    end
+  end
+end
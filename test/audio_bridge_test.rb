@@ -4,6 +4,7 @@ require_relative 'test_helper'
 require_relative '../lib/audio_bridge'
 require 'socket'
 require 'tmpdir'
+require 'tempfile'
 
 class AudioBridgeCodecTest < Minitest::Test
   # --- u-law encode/decode ---
@@ -123,6 +124,19 @@ class AudioBridgeSocketTest < Minitest::Test
     client.close
   end
 
+  def test_stop_playback_drops_queued_audio
+    @bridge.start
+    client = @server.accept
+
+    pcmu = ([0xFF] * AudioBridge::PCMU_BYTES).pack('C*')
+    50.times { @bridge.enqueue(pcmu) }
+    assert_operator @bridge.write_queue_size, :>, 0
+
+    @bridge.stop_playback
+    assert_equal 0, @bridge.write_queue_size
+    client.close
+  end
+
   def test_write_thread_sends_audio_to_socket
     @bridge.start
     client = @server.accept
@@ -137,6 +151,79 @@ class AudioBridgeSocketTest < Minitest::Test
     client.close
   end
 
+  def test_pcmu_format_reads_frames_through
+    @bridge = AudioBridge.new(@agent, socket_path: @sock_path, format: :pcmu)
+    @bridge.start
+    client = @server.accept
+
+    frame = (0..AudioBridge::PCMU_BYTES - 1).map { |i| i & 0xFF }.pack('C*')
+    client.write(frame)
+    sleep 0.1
+
+    assert_equal frame, @agent.audio_received.first
+    client.close
+  end
+
+  def test_pcmu_format_writes_frames_through
+    @bridge = AudioBridge.new(@agent, socket_path: @sock_path, format: :pcmu)
+    @bridge.start
+    client = @server.accept
+
+    pcmu = ([0x7F] * AudioBridge::PCMU_BYTES).pack('C*')
+    @bridge.enqueue(pcmu)
+    sleep 0.1
+
+    assert_equal pcmu, client.read_nonblock(AudioBridge::FRAME_BYTES)
+    client.close
+  end
+
+  def test_unknown_format_raises
+    assert_raises(ArgumentError) { AudioBridge.new(@agent, format: :opus) }
+  end
+
+  def test_wideband_passes_s16le_through_both_ways
+    @bridge = AudioBridge.new(@agent, socket_path: @sock_path, sample_rate: 16000)
+    @bridge.start
+    client = @server.accept
+
+    frame = (0...320).map { |i| i * 10 - 1600 }.pack('s<*')   # 20 ms at 16 kHz
+    client.write(frame)
+    @bridge.enqueue(frame)
+    sleep 0.1
+
+    assert_equal frame, @agent.audio_received.first
+    assert_equal frame, client.read_nonblock(640)
+    assert_in_delta 0.02, @bridge.seconds_in, 0.001
+    client.close
+  end
+
+  def test_output_rate_writes_agent_audio_untouched_for_ausock_to_resample
+    @bridge = AudioBridge.new(@agent, socket_path: @sock_path, output_rate: 24000)
+    @bridge.start
+    client = @server.accept
+
+    tts = (0...480).map { |i| i * 4 - 960 }.pack('s<*')   # 20 ms at 24 kHz
+    @bridge.enqueue(tts)
+    client.write(([1000] * AudioBridge::FRAME_SAMPLES).pack('s<*'))
+    sleep 0.1
+
+    assert_equal tts, client.read_nonblock(960)
+    assert_equal AudioBridge::PCMU_BYTES, @agent.audio_received.first.bytesize
+    assert_in_delta 0.02, @bridge.seconds_out, 0.001
+    client.close
+  end
+
+  def test_output_rate_needs_s16le_stream
+    assert_raises(ArgumentError) { AudioBridge.new(@agent, format: :pcmu, output_rate: 24000) }
+    assert_raises(ArgumentError) { AudioBridge.new(@agent, transport: :shm, output_rate: 24000) }
+    assert_raises(ArgumentError) { AudioBridge.new(@agent, output_rate: 22_222) }
+  end
+
+  def test_wideband_rejects_pcmu_and_odd_rates
+    assert_raises(ArgumentError) { AudioBridge.new(@agent, format: :pcmu, sample_rate: 16000) }
+    assert_raises(ArgumentError) { AudioBridge.new(@agent, sample_rate: 44100) }
+  end
+
   def test_stop_cleans_up
     @bridge.start
     @server.accept
@@ -154,7 +241,440 @@ class AudioBridgeSocketTest < Minitest::Test
     end
 
     def send_audio(data)
-      @audio_received << data
+      @audio_received << data.dup  # bridge reuses its frame buffer
+    end
+  end
+end
+
+# Plays ausock's side of the shm transport: builds a region laid out
+# as in ext/ausock/ausock_shm.h in a plain file and passes it, plus two
+# pipe doorbells, over the socket.
+class AudioBridgeShmTest < Minitest::Test
+  FRAME    = AudioBridge::PCMU_BYTES
+  SLOTS    = 11                       # 10 frames + the empty slot
+  UP_RING  = 64
+  DOWN_RING = 256
+  UP_DATA  = 448
+  DOWN_DATA = UP_DATA + 1792          # 64-byte aligned FRAME * SLOTS
+  SIZE     = DOWN_DATA + 1792
+
+  def setup
+    skip 'voice_native not built (rake compile)' unless VoiceNative.available?
+
+    @sock_path = File.join(Dir.tmpdir, "ausock_shm_test_#{$$}_#{rand(10000)}.sock")
+    @server = UNIXServer.new(@sock_path)
+    @region = Tempfile.new('ausock-shm')
+    @region.write(build_region)
+    @region.flush
+    @up_r, @up_w = IO.pipe
+    @down_r, @down_w = IO.pipe
+
+    @agent = AudioBridgeSocketTest::MockVoiceAgent.new
+    @bridge = AudioBridge.new(@agent, socket_path: @sock_path, format: :pcmu, transport: :shm)
+    @acceptor = Thread.new do
+      client = @server.accept
+      [@region.to_io, @up_r, @down_r].each { |io| client.send_io(io) }
+      client
+    end
+  end
+
+  def teardown
+    return unless @bridge
+
+    @bridge.stop if @bridge.running?
+    @acceptor.value&.close rescue nil
+    @server.close rescue nil
+    [@up_r, @up_w, @down_r, @down_w].each { |io| io.close rescue nil }
+    @region.close!
+    File.delete(@sock_path) rescue nil
+  end
+
+  def test_agent_audio_lands_in_down_ring
+    @bridge.start
+    pcmu = ([0x7F] * FRAME).pack('C*')
+    @bridge.enqueue(pcmu)
+    sleep 0.1
+
+    assert_equal 1, ring_index(DOWN_RING)
+    assert_equal pcmu, @region.pread(FRAME, DOWN_DATA)
+    assert_equal 1, @bridge.buffered_frames
+  end
+
+  def test_caller_audio_read_from_up_ring
+    @bridge.start
+    frame = (0...FRAME).map { |i| i & 0xFF }.pack('C*')
+    @region.pwrite(frame, UP_DATA)
+    @region.pwrite([1].pack('L<'), UP_RING)   # publish head
+    @region.flush
+    @up_w.write('x')                          # doorbell
+    sleep 0.1
+
+    assert_equal frame, @agent.audio_received.first
+    assert_equal 1, ring_index(UP_RING + 64), 'bridge should advance the up tail'
+  end
+
+  def test_frame_size_mismatch_raises
+    @bridge = AudioBridge.new(@agent, socket_path: @sock_path, format: :s16le, transport: :shm)
+    error = assert_raises(RuntimeError) { @bridge.start }
+    assert_match(/160 bytes, expected 320/, error.message)
+  end
+
+  private
+
+  def build_region
+    header = [AUSOCK_SHM_MAGIC, 1, SIZE, 8000].pack('L<4') + ("\0" * 48)
+    ring = ->(offset) { ("\0" * 128) + [FRAME, SLOTS, offset].pack('L<3') + ("\0" * 52) }
+    data = header + ring.(UP_DATA) + ring.(DOWN_DATA)
+    data.ljust(SIZE, "\0")
+  end
+
+  def ring_index(offset)
+    @region.pread(4, offset).unpack1('L<')
+  end
+
+  AUSOCK_SHM_MAGIC = 0x4d535541
+end
+
+# Plays ausock's side of the framed protocol (ext/ausock/ausock_proto.h)
+class AudioBridgeFramedTest < Minitest::Test
+  FRAME = AudioBridge::PCMU_BYTES
+
+  def setup
+    @sock_path = File.join(Dir.tmpdir, "ausock_framed_test_#{$$}_#{rand(10000)}.sock")
+    @server = UNIXServer.new(@sock_path)
+    @agent = AudioBridgeSocketTest::MockVoiceAgent.new
+    @bridge = AudioBridge.new(@agent, socket_path: @sock_path, format: :pcmu, protocol: :framed)
+    @acceptor = Thread.new do
+      client = @server.accept
+      client.write(wire_message(AudioBridge::MSG_HELLO, hello(FRAME)))
+      client
+    end
+  end
+
+  def teardown
+    @bridge.stop if @bridge.running?
+    @acceptor.kill.join unless @acceptor.join(0.5)   # bridge never connected
+    @acceptor.value&.close rescue nil
+    @server.close rescue nil
+    File.delete(@sock_path) rescue nil
+  end
+
+  def test_handshake_answers_hello
+    @bridge.start
+    type, _, len, = read_header(client)
+    assert_equal AudioBridge::MSG_HELLO, type
+    assert_equal AudioBridge::HELLO_MAGIC, client.read(len).unpack1('L<')
+  end
+
+  def test_hello_frame_size_mismatch_raises
+    @bridge = AudioBridge.new(@agent, socket_path: @sock_path, format: :s16le, protocol: :framed)
+    error = assert_raises(RuntimeError) { @bridge.start }
+    assert_match(/160 bytes, expected 320/, error.message)
+  end
+
+  def test_hello_sample_rate_mismatch_raises
+    @bridge = AudioBridge.new(@agent, socket_path: @sock_path, protocol: :framed, sample_rate: 16000)
+    error = assert_raises(RuntimeError) { @bridge.start }
+    assert_match(/8000 Hz, expected 16000/, error.message)
+  end
+
+  def test_hello_agent_rate_mismatch_raises
+    @bridge = AudioBridge.new(@agent, socket_path: @sock_path, protocol: :framed, output_rate: 24000)
+    error = assert_raises(RuntimeError) { @bridge.start }
+    assert_match(/agent audio at 8000 Hz, expected 24000/, error.message)
+  end
+
+  def test_audio_message_forwarded_to_agent
+    start_and_skip_hello
+    frame = (0...FRAME).map { |i| i & 0xFF }.pack('C*')
+    client.write(wire_message(AudioBridge::MSG_AUDIO, frame, seq: 1))
+    sleep 0.1
+
+    assert_equal [frame], @agent.audio_received
+  end
+
+  def test_enqueue_writes_audio_messages
+    start_and_skip_hello
+    @bridge.enqueue(([0x7F] * (FRAME + 10)).pack('C*'))
+    sleep 0.1
+
+    2.times do |i|
+      type, _, len, seq, = read_header(client)
+      assert_equal AudioBridge::MSG_AUDIO, type
+      assert_equal FRAME, len, 'short tail is padded to a whole frame'
+      assert_equal i + 1, seq
+      client.read(len)
+    end
+  end
+
+  def test_mark_echo_fires_event_with_latency
+    start_and_skip_hello
+    events = Queue.new
+    @bridge.on(:mark) { |m| events << m }
+
+    seq = @bridge.mark
+    type, _, len, got_seq, = read_header(client)
+    assert_equal AudioBridge::MSG_MARK, type
+    sent_at = client.read(len).unpack1('Q<')
+    client.write(wire_message(AudioBridge::MSG_MARK, [sent_at].pack('Q<'), seq: got_seq, ts: sent_at + 40_000))
+
+    mark = events.pop(timeout: 1)
+    assert_equal seq, mark[:seq]
+    assert_in_delta 0.04, mark[:latency], 1e-9
+  end
+
+  def test_enqueue_with_mark_marks_first_frame
+    start_and_skip_hello
+    @bridge.enqueue(([0x7F] * (FRAME * 3)).pack('C*'), mark: true)
+    sleep 0.1
+
+    types = 4.times.map do
+      type, _, len, = read_header(client)
+      client.read(len)
+      type
+    end
+    assert_equal [AudioBridge::MSG_AUDIO, AudioBridge::MSG_MARK,
+                  AudioBridge::MSG_AUDIO, AudioBridge::MSG_AUDIO], types
+  end
+
+  def test_stats_and_underrun_events
+    start_and_skip_hello
+    events = Queue.new
+    @bridge.on(:stats) { |s| events << s }
+    @bridge.on(:underrun) { |u| events << u }
+
+    client.write(wire_message(AudioBridge::MSG_STATS, [10, 1, 9, 2, 3, 10, 3, 5].pack('L<8'), seq: 4))
+    client.write(wire_message(AudioBridge::MSG_UNDERRUN, '', seq: 3))
+
+    stats = events.pop(timeout: 1)
+    assert_equal 9, stats[:down_frames]
+    assert_equal 2, stats[:underruns]
+    assert_equal 3, stats[:target]
+    assert_equal 5, stats[:concealed]
+    assert_equal 3, events.pop(timeout: 1)[:count]
+    assert_in_delta 0.08, @bridge.write_ahead, 1e-9
+  end
+
+  def test_playout_target_sets_write_ahead
+    start_and_skip_hello
+    events = Queue.new
+    @bridge.on(:playout) { |p| events << p }
+    assert_equal AudioBridge::WRITE_AHEAD, @bridge.write_ahead
+
+    client.write(wire_message(AudioBridge::MSG_PLAYOUT, [60, 40, 7].pack(AudioBridge::PLAYOUT_FORMAT), seq: 3))
+    playout = events.pop(timeout: 1)
+    assert_equal({ target_ms: 60, depth_ms: 40, concealed: 7, write_ahead: 0.08, at: 0 }, playout)
+    assert_equal 7, @bridge.concealed_frames
+
+    client.write(wire_message(AudioBridge::MSG_PLAYOUT, [400, 0, 7].pack(AudioBridge::PLAYOUT_FORMAT), seq: 20))
+    assert_equal AudioBridge::WRITE_AHEAD_RANGE.max, events.pop(timeout: 1)[:write_ahead]
+  end
+
+  def test_barge_in_drops_queued_audio_and_flushes
+    start_and_skip_hello
+    events = Queue.new
+    @bridge.on(:barge_in) { |b| events << b }
+    @bridge.enqueue(([0x7F] * FRAME * 50).pack('C*'))   # 1 s, written 100 ms ahead
+    sleep 0.05
+
+    client.write(wire_message(AudioBridge::MSG_BARGEIN, [-20, 60].pack(AudioBridge::BARGEIN_FORMAT), seq: 1))
+    barge_in = events.pop(timeout: 1)
+    assert_equal({ count: 1, level: -20, speech_ms: 60, at: 0 }, barge_in)
+
+    frames = 0
+    loop do
+      type, _, len, = read_header(client)
+      client.read(len)
+      break if type == AudioBridge::MSG_FLUSH
+
+      frames += 1
+    end
+    assert_operator frames, :<, 50
+    assert_equal 0, @bridge.write_queue_size
+    assert_nil IO.select([client], nil, nil, 0.2), 'no old audio after the FLUSH'
+  end
+
+  def test_dtx_talkspurt_end_feeds_silence_to_agent
+    start_and_skip_hello
+    events = Queue.new
+    @bridge.on(:vad) { |v| events << v }
+
+    vad = ->(event, suppressed) { [event, 1, -30, suppressed].pack(AudioBridge::VAD_FORMAT) }
+    client.write(wire_message(AudioBridge::MSG_VAD, vad.call(1, 40), seq: 40))
+    client.write(wire_message(AudioBridge::MSG_AUDIO, ([0x20] * FRAME).pack('C*'), seq: 41))
+    client.write(wire_message(AudioBridge::MSG_VAD, vad.call(0, 40), seq: 42))
+
+    assert_equal :start, events.pop(timeout: 1)[:event]
+    stop = events.pop(timeout: 1)
+    assert_equal :stop, stop[:event]
+    assert_equal 40, @bridge.suppressed_frames
+    assert_equal 1 + AudioBridge::DTX_TAIL, @agent.audio_received.size
+    assert_equal "\xFF".b * FRAME, @agent.audio_received.last
+  end
+
+  def test_play_clip_sends_clip_and_end_fires_event
+    start_and_skip_hello
+    events = Queue.new
+    @bridge.on(:clip) { |c| events << c }
+
+    seq = @bridge.play_clip('hold', voice: 1, gain_db: -12, duck_db: 20, loop: true, duck: true)
+    type, _, len, got_seq, = read_header(client)
+    assert_equal AudioBridge::MSG_CLIP, type
+    assert_equal seq, got_seq
+    assert_equal [1, AudioBridge::CLIP_LOOP | AudioBridge::CLIP_DUCK, -12, 20, 0, 'hold'],
+                 client.read(len).unpack(AudioBridge::CLIP_FORMAT)
+
+    @bridge.stop_clip(1)
+    type, _, len, = read_header(client)
+    assert_equal AudioBridge::MSG_CLIP, type
+    assert_equal [1, 0, 0, 0, 0, ''], client.read(len).unpack(AudioBridge::CLIP_FORMAT)
+
+    client.write(wire_message(AudioBridge::MSG_CLIP, [1, 0, 0, 0, 1, ''].pack(AudioBridge::CLIP_FORMAT), seq: seq))
+    assert_equal({ seq: seq, voice: 1, event: :stopped, at: 0 }, events.pop(timeout: 1))
+  end
+
+  def test_dtmf_fires_event
+    start_and_skip_hello
+    events = Queue.new
+    @bridge.on(:dtmf) { |d| events << d }
+
+    client.write(wire_message(AudioBridge::MSG_DTMF, ['#', -16].pack(AudioBridge::DTMF_FORMAT), seq: 3))
+    assert_equal({ digit: '#', count: 3, level: -16, source: :ausock, at: 0 }, events.pop(timeout: 1))
+  end
+
+  def test_play_clip_rejects_bad_names_and_voices
+    start_and_skip_hello
+    assert_raises(ArgumentError) { @bridge.play_clip('') }
+    assert_raises(ArgumentError) { @bridge.play_clip('x' * 24) }
+    assert_raises(ArgumentError) { @bridge.play_clip('hold', voice: AudioBridge::CLIP_VOICES) }
+  end
+
+  def test_raw_protocol_control_is_a_noop
+    bridge = AudioBridge.new(@agent, socket_path: @sock_path)
+    assert_nil bridge.flush
+  end
+
+  def test_framed_shm_rejected
+    assert_raises(ArgumentError) { AudioBridge.new(@agent, transport: :shm, protocol: :framed) }
+  end
+
+  private
+
+  def client
+    @client ||= @acceptor.value
+  end
+
+  def start_and_skip_hello
+    @bridge.start
+    _, _, len, = read_header(client)
+    client.read(len)
+  end
+
+  def read_header(io)
+    io.read(AudioBridge::MSG_HEADER_BYTES).unpack(AudioBridge::MSG_HEADER)
+  end
+
+  def wire_message(type, payload, seq: 0, ts: 0)
+    [type, 0, payload.bytesize, seq, ts].pack(AudioBridge::MSG_HEADER) + payload.b
+  end
+
+  def hello(frame_bytes, in_srate: 8000, in_frame_bytes: frame_bytes)
+    [AudioBridge::HELLO_MAGIC, AudioBridge::PROTO_VERSION, 1, 1, 8000, 20, frame_bytes,
+     in_srate, in_frame_bytes, 0].pack(AudioBridge::HELLO_FORMAT)
+  end
+end
+
+# Plays ausock's side of the seqpacket transport: every packet is one
+# whole frame (raw) or one whole message (framed).
+class AudioBridgeSeqpacketTest < Minitest::Test
+  FRAME = AudioBridge::PCMU_BYTES
+
+  def setup
+    @sock_path = File.join(Dir.tmpdir, "ausock_seqpacket_test_#{$$}_#{rand(10000)}.sock")
+    @server = Socket.new(:UNIX, :SEQPACKET)
+    @server.bind(Socket.sockaddr_un(@sock_path))
+    @server.listen(1)
+    @agent = AudioBridgeSocketTest::MockVoiceAgent.new
+  end
+
+  def teardown
+    @bridge.stop if @bridge&.running?
+    @client&.close rescue nil
+    @server.close rescue nil
+    File.delete(@sock_path) rescue nil
+  end
+
+  def test_raw_frames_are_packets_and_short_tail_is_padded
+    start(protocol: :raw)
+    @client.send(([0x20] * FRAME).pack('C*'), 0)
+    @bridge.enqueue(([0x7F] * (FRAME * 2 + 10)).pack('C*'))
+
+    3.times { assert_equal FRAME, recv_packet.bytesize }
+    assert_equal "\x7F".b * 10 + "\xFF".b * (FRAME - 10), @last
+    sleep 0.05
+    assert_equal [([0x20] * FRAME).pack('C*')], @agent.audio_received
+  end
+
+  def test_oversized_raw_packet_ends_the_call
+    start(protocol: :raw)
+    @client.send(([0x20] * (FRAME + 1)).pack('C*'), 0)
+    sleep 0.1
+
+    assert_empty @agent.audio_received
+  end
+
+  def test_framed_handshake_and_one_message_per_packet
+    start(protocol: :framed) do
+      @client.send(wire_message(AudioBridge::MSG_HELLO, hello(FRAME)), 0)
+    end
+    type, = recv_packet.unpack(AudioBridge::MSG_HEADER)
+    assert_equal AudioBridge::MSG_HELLO, type
+
+    frame = (0...FRAME).map { |i| i & 0xFF }.pack('C*')
+    @client.send(wire_message(AudioBridge::MSG_AUDIO, frame, seq: 1), 0)
+    @bridge.enqueue(([0x7F] * FRAME * 3).pack('C*'))
+
+    seqs = 3.times.map do
+      packet = recv_packet
+      type, _, len, seq, = packet.unpack(AudioBridge::MSG_HEADER)
+      assert_equal [AudioBridge::MSG_AUDIO, FRAME, AudioBridge::MSG_HEADER_BYTES + FRAME],
+                   [type, len, packet.bytesize]
+      seq
     end
+    assert_equal [1, 2, 3], seqs
+    sleep 0.05
+    assert_equal [frame], @agent.audio_received
+  end
+
+  def test_resampled_audio_allowed_on_seqpacket
+    bridge = AudioBridge.new(@agent, transport: :seqpacket, output_rate: 24000)
+    assert bridge.packet?
+  end
+
+  private
+
+  def start(protocol:)
+    @bridge = AudioBridge.new(@agent, socket_path: @sock_path, format: :pcmu,
+                                      transport: :seqpacket, protocol: protocol)
+    acceptor = Thread.new do
+      @client, = @server.accept
+      yield if block_given?
+    end
+    @bridge.start
+    acceptor.join
+  end
+
+  def recv_packet
+    assert IO.select([@client], nil, nil, 1), 'bridge sent nothing'
+    @last = @client.recv(4096)
+  end
+
+  def wire_message(type, payload, seq: 0, ts: 0)
+    [type, 0, payload.bytesize, seq, ts].pack(AudioBridge::MSG_HEADER) + payload.b
+  end
+
+  def hello(frame_bytes)
+    [AudioBridge::HELLO_MAGIC, AudioBridge::PROTO_VERSION, 1, 1, 8000, 20, frame_bytes,
+     8000, frame_bytes, 0].pack(AudioBridge::HELLO_FORMAT)
   end
 end
@@ -123,9 +123,38 @@ class CallSessionLockTest < Minitest::Test
     session.send(:release_lock)
   end
 
+  def test_lock_file_is_per_channel
+    assert_equal @lock_file, CallSession.lock_file_for(CallSession::SOCKET_PATH)
+    other = CallSession.lock_file_for('/tmp/ausock-2.sock')
+    refute_equal @lock_file, other
+    assert_equal File.dirname(@lock_file), File.dirname(other)
+    assert_match(/ausock-2\.pid\z/, other)
+  end
+
+  def test_sessions_on_different_channels_both_acquire
+    first  = build_minimal_session
+    second = build_minimal_session(socket_path: '/tmp/ausock-2.sock')
+    first.send(:acquire_lock!)
+    second.send(:acquire_lock!)  # should not raise
+    assert File.exist?(CallSession.lock_file_for('/tmp/ausock-2.sock'))
+  ensure
+    first&.send(:release_lock)
+    second&.send(:release_lock)
+  end
+
+  def test_sessions_on_same_channel_conflict
+    first  = build_minimal_session(socket_path: '/tmp/ausock-2.sock')
+    second = build_minimal_session(socket_path: '/tmp/ausock-2.sock')
+    first.send(:acquire_lock!)
+    error = assert_raises(CallSession::Error) { second.send(:acquire_lock!) }
+    assert_includes error.message, '/tmp/ausock-2.sock'
+  ensure
+    first&.send(:release_lock)
+  end
+
   private
 
-  def build_minimal_session
+  def build_minimal_session(**opts)
     # Build a CallSession with stub components — just enough to test lock logic
     stub_client = Object.new
     stub_agent = Object.new
@@ -135,7 +164,123 @@ class CallSessionLockTest < Minitest::Test
       number: '5550100',
       client: stub_client,
       agent: stub_agent,
-      bridge: stub_bridge
+      bridge: stub_bridge,
+      **opts
     )
   end
 end
+
+class CallSessionClipTest < Minitest::Test
+  class StubBridge
+    attr_reader :clips
+
+    def initialize
+      @clips = []
+    end
+
+    def play_clip(name, **opts)
+      @clips << [name, opts]
+      @clips.size
+    end
+  end
+
+  class StubAgent
+    attr_reader :texts
+
+    def initialize
+      @texts = []
+    end
+
+    def send_text(text)
+      @texts << text
+    end
+  end
+
+  def setup
+    @bridge = StubBridge.new
+    @agent = StubAgent.new
+    @session = CallSession.new(number: '5550100', client: Object.new, agent: @agent,
+                               bridge: @bridge, clips: { goodbye: 'bye', hold: '' })
+  end
+
+  def teardown
+    @session.instance_variable_get(:@threads).each(&:kill)
+  end
+
+  def test_silence_goodbye_plays_clip_instead_of_prompting_agent
+    @session.send(:begin_goodbye, :silence)
+    assert_equal [['bye', { voice: CallSession::GOODBYE_VOICE, over: true, duck_db: 40 }]], @bridge.clips
+    assert_empty @agent.texts
+  end
+
+  def test_unknown_goodbye_clip_falls_back_to_agent
+    @session.send(:begin_goodbye, :silence)
+    @session.send(:handle_clip, seq: 1, voice: 0, event: :unknown, at: 0)
+    assert_equal 1, @agent.texts.size
+  end
+
+  def test_baresip_keys_of_other_calls_are_dropped
+    client = Struct.new(:call_id).new('call-1')
+    keys = []
+    triggers = Object.new
+    triggers.define_singleton_method(:check) { |dtmf:, **| keys << dtmf }
+    session = CallSession.new(number: '5550100', client: client, agent: @agent, bridge: @bridge)
+    session.instance_variable_set(:@triggers, triggers)
+
+    session.send(:handle_dtmf, { digit: '1', source: :baresip, channel: nil, call_id: 'call-2' }, via: :client)
+    session.send(:handle_dtmf, { digit: '2', source: :baresip, channel: nil, call_id: 'call-1' }, via: :client)
+    assert_equal ['2'], keys
+  end
+
+  def test_empty_clip_names_are_not_played
+    assert_nil @session.send(:play_clip, :hold, voice: CallSession::HOLD_VOICE)
+    assert_empty @bridge.clips
+  end
+end
+
+class CallSessionPhraseTest < Minitest::Test
+  class StubAgent
+    attr_reader :prompts
+
+    def initialize
+      @prompts = []
+    end
+
+    def prompt_response(text)
+      @prompts << text
+    end
+  end
+
+  def setup
+    @bridge = CallSessionClipTest::StubBridge.new
+    @agent = StubAgent.new
+    @session = CallSession.new(number: '5550100', client: Object.new, agent: @agent, bridge: @bridge,
+                               clips: { goodbye: 'bye' },
+                               phrases: { still_there: { name: 'p1', text: 'You there?' },
+                                          goodbye: { name: 'p2', text: 'Bye now.' } })
+    @out = []
+    @session.on(:output) { |m| @out << m }
+  end
+
+  def teardown
+    @session.instance_variable_get(:@threads).each(&:kill)
+  end
+
+  def test_still_there_phrase_instead_of_prompting_agent
+    @session.send(:handle_hangup_trigger, {})
+    assert_equal [['p1', { voice: CallSession::PHRASE_VOICE, over: true, duck_db: 40 }]], @bridge.clips
+    assert_empty @agent.prompts
+    assert_equal ["\nAgent: You there?"], @out
+  end
+
+  def test_unknown_still_there_phrase_falls_back_to_agent
+    @session.send(:handle_hangup_trigger, {})
+    @session.send(:handle_clip, seq: 1, voice: CallSession::PHRASE_VOICE, event: :unknown, at: 0)
+    assert_equal 1, @agent.prompts.size
+  end
+
+  def test_wav_clip_goes_before_the_phrase
+    assert_equal 'bye', @session.send(:clip_name, :goodbye)
+    assert_nil @session.send(:clip_name, :filler)
+  end
+end
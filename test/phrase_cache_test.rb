@@ -0,0 +1,106 @@
+# frozen_string_literal: true
+
+require_relative 'test_helper'
+require_relative '../lib/phrase_cache'
+require 'rbconfig'
+require 'tmpdir'
+
+class PhraseCacheTest < Minitest::Test
+  PROTO = File.read(File.expand_path('../ext/ausock/ausock_proto.h', __dir__), encoding: 'UTF-8')
+
+  PROFILE = { 'name' => 'Ara', 'voice' => 'Ara', 'tts_instruct' => 'warm' }.freeze
+
+  # tts_server.py as far as rendering goes: ready, then 100 samples of
+  # value n and a boundary for the nth text; "fail" is an error
+  FAKE_TTS = <<~'RUBY'
+    require 'json'
+    rec = ->(type, payload = '') { $stdout.write([type, payload.bytesize].pack('CxxxV') + payload); $stdout.flush }
+    $stdout.binmode
+    rec.call(3, '{"status":"ready"}')
+    n = 0
+    while (line = $stdin.gets)
+      n += 1
+      if JSON.parse(line)['text'] == 'fail'
+        rec.call(3, '{"status":"error","message":"no"}')
+      else
+        rec.call(1, [n].pack('s<') * 100)
+      end
+      rec.call(2)
+      rec.call(3, '{"status":"done"}')
+    end
+  RUBY
+
+  def setup
+    @dir = Dir.mktmpdir('phrases')
+    @path = File.join(@dir, 'phrases.bin')
+  end
+
+  def teardown
+    FileUtils.rm_rf(@dir)
+  end
+
+  def test_layout_matches_ausock_proto
+    assert_includes PROTO, %(#define AUSOCK_PHRASE_MAGIC   "#{PhraseCache::MAGIC}")
+    assert_match(/#define AUSOCK_PHRASE_VERSION #{PhraseCache::VERSION}$/, PROTO)
+    assert_match(/#define AUSOCK_CLIP_NAME\s+#{PhraseCache::NAME_BYTES}\b/, PROTO)
+    assert_includes PROTO, "sizeof(struct ausock_phrase_hdr) == #{PhraseCache::HEADER_BYTES}"
+    assert_includes PROTO, "sizeof(struct ausock_phrase_ent) == #{PhraseCache::ENTRY_BYTES}"
+    assert_equal PhraseCache::HEADER_BYTES, ['', 0, 0, 0].pack(PhraseCache::HEADER).bytesize
+    assert_equal PhraseCache::ENTRY_BYTES, ['', 0, 0, 0].pack(PhraseCache::ENTRY).bytesize
+  end
+
+  def test_write_and_read_back
+    a = "\x01\x00\x02\x00".b
+    b = ("\xFF\x7F".b * 3)
+    PhraseCache.new(@path).add('p1', 8000, a).add('p2', 16000, b).write
+
+    data = File.binread(@path)
+    assert_equal ['AUPHRASE', 1, 2, 0], data.unpack(PhraseCache::HEADER)
+    name, rate, samples, offset = data.unpack(PhraseCache::ENTRY, offset: PhraseCache::HEADER_BYTES)
+    assert_equal ['p1', 8000, 2, 24 + 2 * 40], [name, rate, samples, offset]
+    assert_equal a, data.byteslice(offset, 4)
+
+    cache = PhraseCache.new(@path)
+    assert_equal %w[p1 p2], cache.names
+    assert_equal b, cache['p2']
+    assert_empty Dir.glob(File.join(@dir, '*.tmp'))
+  end
+
+  def test_name_follows_voice_rate_and_text
+    name = PhraseCache.name(PROFILE, 'Hello.', 8000)
+    assert_match(/\Ap\h{16}\z/, name)
+    assert_operator name.bytesize, :<, PhraseCache::NAME_BYTES
+    assert_equal name, PhraseCache.name(PROFILE.merge('personality' => 'other'), 'Hello.', 8000)
+
+    refute_equal name, PhraseCache.name(PROFILE, 'Hello!', 8000)
+    refute_equal name, PhraseCache.name(PROFILE, 'Hello.', 16000)
+    refute_equal name, PhraseCache.name(PROFILE.merge('voice' => 'Rex'), 'Hello.', 8000)
+    refute_equal name, PhraseCache.name(PROFILE.merge('ref_audio' => 'x.wav'), 'Hello.', 8000)
+  end
+
+  def test_texts_take_the_profile_over_the_defaults
+    defaults = { 'filler' => 'One moment.', 'still_there' => 'Still there?', 'goodbye' => 'Bye.', 'other' => 'x' }
+    texts = PhraseCache.texts(defaults, PROFILE.merge('phrases' => { 'goodbye' => 'Later.', 'filler' => '' }))
+    assert_equal({ 'still_there' => 'Still there?', 'goodbye' => 'Later.' }, texts)
+  end
+
+  def test_render_adds_what_is_missing
+    tts = File.join(@dir, 'tts.rb')
+    File.write(tts, FAKE_TTS)
+    cache = PhraseCache.new(@path)
+
+    added = cache.render(PROFILE, ['One.', 'fail', 'Two.'], 8000, [RbConfig.ruby, tts])
+    one = PhraseCache.name(PROFILE, 'One.', 8000)
+    two = PhraseCache.name(PROFILE, 'Two.', 8000)
+    assert_equal [one, two], added
+    assert_equal [1].pack('s<') * 100 + "\0".b * 120, cache[one], 'padded to whole 20 ms frames'
+    assert_equal [3].pack('s<') * 100 + "\0".b * 120, cache[two]
+
+    assert_empty cache.render(PROFILE, ['One.', 'Two.'], 8000, ['/nonexistent']), 'nothing to render'
+  end
+
+  def test_not_a_cache_raises
+    File.write(@path, 'hello')
+    assert_raises(PhraseCache::Error) { PhraseCache.new(@path) }
+  end
+end
@@ -83,4 +83,465 @@ class BaresipTest < Minitest::Test
     )
     assert_equal 5555, client.ctrl_port
   end
+
+  def test_default_max_calls
+    assert_equal 1, @client.max_calls
+  end
+
+  def test_max_calls_from_config
+    client = SipClient::Baresip.new(
+      sip_username: 'test_user',
+      sip_password: 'test_pass',
+      sip_server: 'sip.example.com',
+      config_dir: @config_dir,
+      max_calls: 4
+    )
+    assert_equal 4, client.max_calls
+  end
+
+  def test_voice_socket_writes_ausock_format
+    client = SipClient::Baresip.new(
+      sip_username: 'test_user',
+      sip_password: 'test_pass',
+      sip_server: 'sip.example.com',
+      config_dir: @config_dir,
+      voice_socket: '/tmp/ausock-test.sock',
+      socket_format: 'pcmu',
+      socket_transport: 'shm',
+      socket_protocol: 'framed',
+      aec_tail_ms: 32
+    )
+    content = File.read(File.join(client.config_dir, 'config'))
+    assert_match(/audio_source\s+ausock,\/tmp\/ausock-test\.sock/, content)
+    assert_match(/ausock_format\s+pcmu/, content)
+    assert_match(/ausock_transport\s+shm/, content)
+    assert_match(/ausock_protocol\s+framed/, content)
+    assert_match(/ausock_aec\s+32/, content)
+  end
+
+  def test_barge_in_and_vad_written_only_for_framed_protocol
+    framed = SipClient::Baresip.new(
+      sip_username: 'test_user',
+      sip_password: 'test_pass',
+      sip_server: 'sip.example.com',
+      config_dir: @config_dir,
+      voice_socket: '/tmp/ausock-test.sock',
+      socket_protocol: 'framed',
+      barge_in_ms: 60,
+      vad: 'dtx'
+    )
+    content = File.read(File.join(framed.config_dir, 'config'))
+    assert_match(/ausock_bargein\s+60/, content)
+    assert_match(/ausock_vad\s+dtx/, content)
+
+    raw = SipClient::Baresip.new(
+      sip_username: 'test_user',
+      sip_password: 'test_pass',
+      sip_server: 'sip.example.com',
+      config_dir: @config_dir,
+      voice_socket: '/tmp/ausock-test.sock',
+      barge_in_ms: 60
+    )
+    content = File.read(File.join(raw.config_dir, 'config'))
+    refute_match(/ausock_bargein/, content)
+    refute_match(/ausock_vad/, content)
+  end
+
+  def test_wideband_offers_g722_at_16khz
+    client = SipClient::Baresip.new(
+      sip_username: 'test_user',
+      sip_password: 'test_pass',
+      sip_server: 'sip.example.com',
+      config_dir: @config_dir,
+      voice_socket: '/tmp/ausock-test.sock',
+      sample_rate: 16000
+    )
+    content = File.read(File.join(client.config_dir, 'config'))
+    assert_match(/module\s+g722\.so\nausrc_srate\s+16000\nauplay_srate\s+16000\nmodule\s+g711\.so/, content)
+
+    narrow = SipClient::Baresip.new(
+      sip_username: 'test_user',
+      sip_password: 'test_pass',
+      sip_server: 'sip.example.com',
+      config_dir: @config_dir
+    )
+    refute_match(/g722|_srate/, File.read(File.join(narrow.config_dir, 'config')))
+  end
+
+  def test_output_rate_written_as_ausock_inrate
+    client = SipClient::Baresip.new(
+      sip_username: 'test_user',
+      sip_password: 'test_pass',
+      sip_server: 'sip.example.com',
+      config_dir: @config_dir,
+      voice_socket: '/tmp/ausock-test.sock',
+      output_rate: 24000
+    )
+    assert_match(/ausock_inrate\s+24000/, File.read(File.join(client.config_dir, 'config')))
+  end
+
+  def test_adaptive_playout_written_unless_fixed
+    client = SipClient::Baresip.new(
+      sip_username: 'test_user',
+      sip_password: 'test_pass',
+      sip_server: 'sip.example.com',
+      config_dir: @config_dir,
+      voice_socket: '/tmp/ausock-test.sock',
+      playout: 'adaptive'
+    )
+    assert_match(/ausock_playout\s+adaptive/, File.read(File.join(client.config_dir, 'config')))
+
+    fixed = SipClient::Baresip.new(
+      sip_username: 'test_user',
+      sip_password: 'test_pass',
+      sip_server: 'sip.example.com',
+      config_dir: @config_dir,
+      voice_socket: '/tmp/ausock-test.sock',
+      playout: 'fixed'
+    )
+    refute_match(/ausock_playout/, File.read(File.join(fixed.config_dir, 'config')))
+  end
+
+  def test_stats_interval_written_when_set
+    client = SipClient::Baresip.new(
+      sip_username: 'test_user',
+      sip_password: 'test_pass',
+      sip_server: 'sip.example.com',
+      config_dir: @config_dir,
+      voice_socket: '/tmp/ausock-test.sock',
+      stats_interval: 10
+    )
+    assert_match(/ausock_stats_interval\s+10/, File.read(File.join(client.config_dir, 'config')))
+  end
+
+  def test_record_dir_written_and_created_when_set
+    dir = File.join(@config_dir, 'recordings')
+    client = SipClient::Baresip.new(
+      sip_username: 'test_user',
+      sip_password: 'test_pass',
+      sip_server: 'sip.example.com',
+      config_dir: @config_dir,
+      voice_socket: '/tmp/ausock-test.sock',
+      record_dir: dir
+    )
+    assert_match(/ausock_record\s+#{Regexp.escape(dir)}$/, File.read(File.join(client.config_dir, 'config')))
+    assert File.directory?(dir)
+  end
+
+  def test_record_dir_omitted_by_default
+    client = SipClient::Baresip.new(
+      sip_username: 'test_user',
+      sip_password: 'test_pass',
+      sip_server: 'sip.example.com',
+      config_dir: @config_dir,
+      voice_socket: '/tmp/ausock-test.sock'
+    )
+    refute_match(/ausock_record/, File.read(File.join(client.config_dir, 'config')))
+  end
+
+  def test_clips_and_comfort_noise_written_when_set
+    client = SipClient::Baresip.new(
+      sip_username: 'test_user',
+      sip_password: 'test_pass',
+      sip_server: 'sip.example.com',
+      config_dir: @config_dir,
+      voice_socket: '/tmp/ausock-test.sock',
+      socket_protocol: 'framed',
+      clips_dir: '/srv/clips',
+      comfort_noise: 60
+    )
+    config = File.read(File.join(client.config_dir, 'config'))
+    assert_match(%r{ausock_clips\s+/srv/clips$}, config)
+    assert_match(/ausock_comfort_noise\s+60/, config)
+  end
+
+  def test_phrase_cache_written_for_framed_only
+    opts = {
+      sip_username: 'test_user',
+      sip_password: 'test_pass',
+      sip_server: 'sip.example.com',
+      config_dir: @config_dir,
+      voice_socket: '/tmp/ausock-test.sock',
+      phrase_cache: '/srv/phrases.bin'
+    }
+    client = SipClient::Baresip.new(**opts, socket_protocol: 'framed')
+    assert_match(%r{ausock_phrases\s+/srv/phrases\.bin$}, File.read(File.join(client.config_dir, 'config')))
+
+    client = SipClient::Baresip.new(**opts)
+    refute_match(/ausock_phrases/, File.read(File.join(client.config_dir, 'config')))
+  end
+
+  def test_drift_written_only_when_set
+    client = SipClient::Baresip.new(
+      sip_username: 'test_user',
+      sip_password: 'test_pass',
+      sip_server: 'sip.example.com',
+      config_dir: @config_dir,
+      voice_socket: '/tmp/ausock-test.sock',
+      drift_ppm: 500
+    )
+    assert_match(/ausock_drift\s+500$/, File.read(File.join(client.config_dir, 'config')))
+
+    client = SipClient::Baresip.new(
+      sip_username: 'test_user',
+      sip_password: 'test_pass',
+      sip_server: 'sip.example.com',
+      config_dir: @config_dir,
+      voice_socket: '/tmp/ausock-test.sock'
+    )
+    refute_match(/ausock_drift/, File.read(File.join(client.config_dir, 'config')))
+  end
+
+  def test_rt_written_only_when_set
+    client = SipClient::Baresip.new(
+      sip_username: 'test_user',
+      sip_password: 'test_pass',
+      sip_server: 'sip.example.com',
+      config_dir: @config_dir,
+      voice_socket: '/tmp/ausock-test.sock',
+      rt_policy: 'fifo',
+      rt_prio: 50,
+      rt_cpus: '2-3',
+      mlock: true
+    )
+    config = File.read(File.join(client.config_dir, 'config'))
+    assert_match(/ausock_rt\s+fifo$/, config)
+    assert_match(/ausock_rt_prio\s+50$/, config)
+    assert_match(/ausock_cpus\s+2-3$/, config)
+    assert_match(/ausock_mlock\s+yes$/, config)
+
+    client = SipClient::Baresip.new(
+      sip_username: 'test_user',
+      sip_password: 'test_pass',
+      sip_server: 'sip.example.com',
+      config_dir: @config_dir,
+      voice_socket: '/tmp/ausock-test.sock',
+      rt_policy: false,  # YAML's bare off
+      rt_prio: 50
+    )
+    config = File.read(File.join(client.config_dir, 'config'))
+    refute_match(/ausock_rt|ausock_cpus|ausock_mlock/, config)
+  end
+
+  def test_tap_written_only_when_set
+    client = SipClient::Baresip.new(
+      sip_username: 'test_user',
+      sip_password: 'test_pass',
+      sip_server: 'sip.example.com',
+      config_dir: @config_dir,
+      voice_socket: '/tmp/ausock-test.sock',
+      tap: 'only'
+    )
+    assert_match(/ausock_tap\s+only$/, File.read(File.join(client.config_dir, 'config')))
+
+    client = SipClient::Baresip.new(
+      sip_username: 'test_user',
+      sip_password: 'test_pass',
+      sip_server: 'sip.example.com',
+      config_dir: @config_dir,
+      voice_socket: '/tmp/ausock-test.sock'
+    )
+    refute_match(/ausock_tap/, File.read(File.join(client.config_dir, 'config')))
+  end
+
+  def test_inject_written_only_when_set
+    client = SipClient::Baresip.new(
+      sip_username: 'test_user',
+      sip_password: 'test_pass',
+      sip_server: 'sip.example.com',
+      config_dir: @config_dir,
+      voice_socket: '/tmp/ausock-test.sock',
+      inject: true
+    )
+    assert_match(/ausock_inject\s+yes$/, File.read(File.join(client.config_dir, 'config')))
+
+    client = SipClient::Baresip.new(
+      sip_username: 'test_user',
+      sip_password: 'test_pass',
+      sip_server: 'sip.example.com',
+      config_dir: @config_dir,
+      voice_socket: '/tmp/ausock-test.sock'
+    )
+    refute_match(/ausock_inject/, File.read(File.join(client.config_dir, 'config')))
+  end
+
+  def test_dtmf_written_only_for_ausock
+    client = SipClient::Baresip.new(
+      sip_username: 'test_user',
+      sip_password: 'test_pass',
+      sip_server: 'sip.example.com',
+      config_dir: @config_dir,
+      voice_socket: '/tmp/ausock-test.sock',
+      dtmf: 'ausock'
+    )
+    assert_match(/ausock_dtmf\s+yes$/, File.read(File.join(client.config_dir, 'config')))
+
+    client = SipClient::Baresip.new(
+      sip_username: 'test_user',
+      sip_password: 'test_pass',
+      sip_server: 'sip.example.com',
+      config_dir: @config_dir,
+      voice_socket: '/tmp/ausock-test.sock',
+      dtmf: 'baresip'
+    )
+    refute_match(/ausock_dtmf/, File.read(File.join(client.config_dir, 'config')))
+  end
+
+  def test_dtmf_events_from_ctrl_tcp
+    server = TCPServer.new('127.0.0.1', 0)
+    client = SipClient::Baresip.new(
+      sip_username: 'test_user',
+      sip_password: 'test_pass',
+      sip_server: 'sip.example.com',
+      config_dir: @config_dir,
+      ctrl_port: server.addr[1]
+    )
+    keys = Queue.new
+    client.on_dtmf { |k| keys << k }
+
+    conn = server.accept
+    [
+      { event: true, class: 'call', type: 'CALL_ESTABLISHED', param: '' },
+      { event: true, class: 'call', type: 'CALL_DTMF_START', param: '5', id: 'call-1' },
+      { event: true, class: 'other', type: 'MODULE', param: 'ausock,record,x.wav' },
+      { event: true, class: 'other', type: 'MODULE', param: 'ausock,dtmf,#,/tmp/ausock.sock' }
+    ].each do |ev|
+      json = ev.to_json
+      conn.write("#{json.bytesize}:#{json},")
+    end
+
+    assert_equal({ digit: '5', source: :baresip, channel: nil, call_id: 'call-1' }, keys.pop(timeout: 2))
+    assert_equal({ digit: '#', source: :ausock, channel: '/tmp/ausock.sock', call_id: nil }, keys.pop(timeout: 2))
+  ensure
+    client&.shutdown
+    conn&.close
+    server&.close
+  end
+
+  def test_ausock_stats_parses_channels
+    client = SipClient::Baresip.new(
+      sip_username: 'test_user',
+      sip_password: 'test_pass',
+      sip_server: 'sip.example.com',
+      config_dir: @config_dir
+    )
+    json = '{"channels":[{"path":"/tmp/ausock.sock","connected":true,' \
+           '"src":{"resyncs":2,"late_us":{"n":10,"p99":120}},"play":{"txq_max":0}}]}'
+    client.define_singleton_method(:send_command) { |cmd, *| cmd == 'ausock_stats' ? json : '' }
+
+    channels = client.ausock_stats
+    assert_equal 1, channels.size
+    assert_equal '/tmp/ausock.sock', channels.first[:path]
+    assert_equal 120, channels.first[:src][:late_us][:p99]
+    assert_equal 2, channels.first[:src][:resyncs]
+
+    # an older ausock without the command: ctrl_tcp answers with an error string
+    client.define_singleton_method(:send_command) { |*| 'command not found' }
+    assert_nil client.ausock_stats
+  end
+
+  # One baresip shared by sessions on different channels: ctrl_tcp
+  # commands are recorded, dial and hangup keep listcalls up to date
+  class FakeBaresip
+    attr_reader :log
+
+    def initialize
+      @log = []
+      @uas = []
+      @current = nil
+      @calls = {}
+      @next_id = 0
+    end
+
+    def command(cmd, params)
+      @log << [cmd, params]
+      case cmd
+      when 'uafind'
+        return "could not find User-Agent: #{params}" unless @uas.include?(params)
+
+        @current = params
+        ''
+      when 'uanew'
+        @uas << params[/\A<([^>]+)>/, 1]
+        ''
+      when 'dial'
+        @calls["call-#{@next_id += 1}"] = [params, @current]
+        ''
+      when 'hangup'  # bare: the current (latest) call
+        @calls.delete(params.empty? ? @calls.keys.last : params)
+        ''
+      when 'listcalls'
+        @calls.each_with_index.map do |(id, (uri, _)), i|
+          "> [line #{i + 1}, id #{id}]  0:00:01  ESTABLISHED  #{uri}\n"
+        end.join
+      else
+        ''
+      end
+    end
+
+    def ua_of(id) = @calls.fetch(id)[1]
+  end
+
+  def session_client(baresip, socket)
+    client = SipClient::Baresip.new(
+      sip_username: 'test_user',
+      sip_password: 'test_pass',
+      sip_server: 'sip.example.com',
+      config_dir: @config_dir,
+      voice_socket: socket,
+      max_calls: 2
+    )
+    client.define_singleton_method(:send_command) { |cmd, params = ''| baresip.command(cmd, params) }
+    client.define_singleton_method(:running?) { true }
+    client
+  end
+
+  def test_sessions_on_different_channels_get_own_device_and_hangup
+    baresip = FakeBaresip.new
+    first  = session_client(baresip, '/tmp/ausock.sock')
+    second = session_client(baresip, '/tmp/ausock-2.sock')
+
+    assert_equal 1, first.call('5550100').size
+    assert_equal 1, second.call('5550199').size
+    refute_equal first.call_id, second.call_id
+
+    accounts = baresip.log.select { |cmd, _| cmd == 'uanew' }.map(&:last)
+    assert_equal 2, accounts.size
+    assert_match(%r{audio_source=ausock,/tmp/ausock\.sock;audio_player=ausock,/tmp/ausock\.sock\z}, accounts[0])
+    assert_match(%r{audio_source=ausock,/tmp/ausock-2\.sock;audio_player=ausock,/tmp/ausock-2\.sock\z}, accounts[1])
+    assert_match(/regint=0/, accounts[1])
+    refute_equal baresip.ua_of(first.call_id), baresip.ua_of(second.call_id)
+
+    first.instance_variable_set(:@pid, Process.wait(spawn('true')))  # first started baresip
+    first.hangup
+    first.shutdown
+    assert_includes baresip.log, ['hangup', first.call_id]
+    refute baresip.log.any? { |cmd, _| cmd == 'quit' }, 'second call still on it'
+    assert_equal [second.call_id], second.calls.map { |c| c[:id] }
+
+    second.hangup
+    assert_includes baresip.log, ['hangup', second.call_id]
+    assert_empty second.calls
+  end
+
+  def test_channel_ua_is_created_once
+    baresip = FakeBaresip.new
+    client = session_client(baresip, '/tmp/ausock.sock')
+    client.call('5550100')
+    client.hangup
+    client.call('5550100')
+
+    assert_equal 1, baresip.log.count { |cmd, _| cmd == 'uanew' }
+  end
+
+  def test_hangup_without_own_call_leaves_others
+    baresip = FakeBaresip.new
+    other = session_client(baresip, '/tmp/ausock-2.sock')
+    other.call('5550199')
+    client = session_client(baresip, '/tmp/ausock.sock')
+    client.instance_variable_set(:@dialed, true)  # dialed, never came up
+
+    client.hangup
+    assert_equal 1, other.calls.size
+  end
 end
@@ -0,0 +1,76 @@
+# frozen_string_literal: true
+
+require_relative '../test_helper'
+require_relative '../../lib/triggers'
+
+class DtmfTriggerTest < Minitest::Test
+  def test_default_action_is_dtmf
+    trigger = DtmfTrigger.new
+    assert_equal :dtmf, trigger.action
+  end
+
+  def test_star_interrupts_by_default
+    trigger = DtmfTrigger.new
+    assert_equal :interrupt, trigger.check(dtmf: '*')
+    assert_equal '*', trigger.payload
+  end
+
+  def test_other_keys_fire_default_action_with_key
+    trigger = DtmfTrigger.new
+    assert_equal :dtmf, trigger.check(dtmf: '5', dtmf_source: :ausock)
+    assert_equal '5', trigger.payload
+    assert_equal :ausock, trigger.source
+  end
+
+  def test_custom_keys
+    trigger = DtmfTrigger.new(keys: { '#' => :skip, 0 => :hangup })
+    assert_equal :skip, trigger.check(dtmf: '#')
+    assert_equal :hangup, trigger.check(dtmf: '0')
+    assert_equal :dtmf, trigger.check(dtmf: '*')
+  end
+
+  def test_nil_action_ignores_unmapped_keys
+    trigger = DtmfTrigger.new(keys: { '#' => :skip }, action: nil)
+    assert_nil trigger.check(dtmf: '1')
+    assert_equal :skip, trigger.check(dtmf: '#')
+  end
+
+  def test_letters_are_case_insensitive
+    trigger = DtmfTrigger.new
+    trigger.check(dtmf: 'a')
+    assert_equal 'A', trigger.payload
+  end
+
+  def test_ignores_context_without_key
+    trigger = DtmfTrigger.new
+    assert_nil trigger.check(transcript: 'hello', role: :user)
+    assert_nil trigger.check(dtmf: 'x')
+  end
+
+  def test_disabled
+    trigger = DtmfTrigger.new(enabled: false)
+    assert_nil trigger.check(dtmf: '1')
+  end
+
+  def test_fires_every_press_through_manager
+    manager = TriggerManager.new
+    manager.add(DtmfTrigger.new)
+    keys = []
+    manager.on(:dtmf) { |_ctx, key| keys << key }
+
+    manager.check(dtmf: '1')
+    manager.check(dtmf: '1')
+    manager.check(dtmf: '2')
+
+    assert_equal %w[1 1 2], keys
+  end
+
+  def test_other_triggers_ignore_key_context
+    manager = TriggerManager.new
+    manager.add(KeywordTrigger.new(action: :hangup))
+    manager.add(SilenceTrigger.new(timeout: 1, action: :hangup))
+    manager.add(DtmfTrigger.new)
+
+    assert_equal [:dtmf], manager.check(dtmf: '9')
+  end
+end
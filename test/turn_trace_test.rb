@@ -0,0 +1,123 @@
+# frozen_string_literal: true
+
+require_relative 'test_helper'
+require_relative '../lib/turn_trace'
+require 'json'
+require 'tmpdir'
+
+class TurnTraceTest < Minitest::Test
+  def setup
+    @dir = Dir.mktmpdir('trace')
+    @path = File.join(@dir, 'call.trace.jsonl')
+    @trace = TurnTrace.new(@path)
+  end
+
+  def teardown
+    @trace.close
+    FileUtils.rm_rf(@dir)
+  end
+
+  # One turn at base us, each stage ms after the last
+  def turn(base, stt: 300, llm: 200, tts: 400, playout: 60)
+    at = base
+    @trace.mark(:speech_stop, at)
+    @trace.mark(:transcript, at += stt * 1000)
+    @trace.mark(:llm_first, at += llm * 1000)
+    @trace.mark(:tts_first, at += tts * 1000)
+    @trace.mark(:played, at + playout * 1000)
+  end
+
+  def records
+    File.readlines(@path).map { |line| JSON.parse(line, symbolize_names: true) }
+  end
+
+  def test_played_finishes_turn_with_spans
+    turn(1_000_000)
+
+    assert_equal 1, @trace.turns
+    rec = records.first
+    assert_equal 1, rec[:turn]
+    assert_equal 1_000_000, rec[:speech_stop]
+    assert_equal 300.0, rec[:stt_ms]
+    assert_equal 200.0, rec[:llm_ms]
+    assert_equal 400.0, rec[:tts_ms]
+    assert_equal 60.0, rec[:playout_ms]
+    assert_equal 960.0, rec[:total_ms]
+  end
+
+  def test_speech_stop_follows_caller_until_transcript
+    @trace.mark(:speech_stop, 1_000)
+    @trace.mark(:speech_stop, 5_000)
+    @trace.mark(:transcript, 9_000)
+    @trace.mark(:played, 10_000)
+
+    assert_equal 4.0, records.first[:stt_ms]
+  end
+
+  def test_next_speech_stop_finishes_unplayed_turn
+    @trace.mark(:speech_stop, 1_000)
+    @trace.mark(:transcript, 2_000)
+    @trace.mark(:speech_stop, 8_000)
+
+    assert_equal 1, @trace.turns
+    refute records.first.key?(:total_ms)
+  end
+
+  def test_stages_keep_first_stamp
+    @trace.mark(:speech_stop, 0)
+    @trace.mark(:transcript, 1_000)
+    @trace.mark(:transcript, 7_000)
+    @trace.mark(:played, 9_000)
+
+    assert_equal 1_000, records.first[:transcript]
+  end
+
+  def test_played_without_turn_is_ignored
+    turn(0)
+    @trace.mark(:played, 5_000_000)  # the next utterance of the same answer
+
+    assert_equal 1, @trace.turns
+  end
+
+  def test_claim_once_per_open_turn
+    refute @trace.claim(:played), 'no turn yet'
+
+    @trace.mark(:llm_first, 0)
+    assert @trace.claim(:played)
+    refute @trace.claim(:played)
+
+    @trace.mark(:played, 1_000)
+    @trace.mark(:llm_first, 2_000)
+    assert @trace.claim(:played), 'claims reset with the turn'
+  end
+
+  def test_percentiles_and_summary
+    (1..10).each { |i| turn(i * 10_000_000, stt: i * 100) }
+
+    pc = @trace.percentiles(:stt)
+    assert_equal 10, pc[:n]
+    assert_equal 500.0, pc[:p50]
+    assert_equal 1000.0, pc[:p95]
+    assert_equal 1000.0, pc[:p99]
+    assert_equal({ n: 0 }, TurnTrace.new.percentiles(:total))
+    assert_match(%r{\Astt 500/1000/1000ms  llm 200/200/200ms}, @trace.summary)
+  end
+
+  def test_close_finishes_turn_in_progress
+    @trace.mark(:speech_stop, 0)
+    @trace.mark(:transcript, 250_000)
+    @trace.close
+
+    assert_equal 250.0, records.first[:stt_ms]
+  end
+
+  def test_unknown_stage_and_no_path
+    trace = TurnTrace.new
+    trace.mark(:nonsense, 0)
+    trace.mark(:speech_stop, 0)
+    trace.mark(:played, 1_000)
+
+    assert_equal 1, trace.turns
+    assert_equal 1.0, trace.percentiles(:total)[:p50]
+  end
+end
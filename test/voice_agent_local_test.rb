@@ -5,6 +5,16 @@ require_relative '../lib/voice_agent/local'
 require_relative '../lib/audio_bridge'
 
 class VoiceAgentLocalTest < Minitest::Test
+  # Tests below set and delete XAI_API_KEY; later suites (GrokTest)
+  # need it as it was
+  def setup
+    @env = ENV.to_h
+  end
+
+  def teardown
+    ENV.replace(@env)
+  end
+
   def test_initialization
     agent = VoiceAgent::Local.new(
       api_key: 'test-key',
@@ -27,15 +37,11 @@ class VoiceAgentLocalTest < Minitest::Test
     ENV['XAI_API_KEY'] = 'test-key'
     agent = VoiceAgent::Local.new
     refute agent.connected?
-  ensure
-    ENV.delete('XAI_API_KEY')
   end
 
   def test_missing_api_key_raises
-    original = ENV.delete('XAI_API_KEY')
+    ENV.delete('XAI_API_KEY')
     assert_raises(RuntimeError) { VoiceAgent::Local.new }
-  ensure
-    ENV['XAI_API_KEY'] = original if original
   end
 
   def test_subprocess_paths_exist
@@ -47,11 +53,38 @@ class VoiceAgentLocalTest < Minitest::Test
            "STT script not found at #{VoiceAgent::Local::STT_SCRIPT}"
   end
 
-  def test_boundary_sentinel_matches_python
-    # The Ruby sentinel must match the Python UTTERANCE_BOUNDARY (0xDEADBEEF LE)
-    sentinel = VoiceAgent::Local::BOUNDARY_SENTINEL
-    assert_equal 4, sentinel.bytesize
-    assert_equal "\xEF\xBE\xAD\xDE".b, sentinel
+  def test_tts_record_layout_matches_python
+    # TtsReader must agree with the record header and types in tts_server.py
+    source = File.read(VoiceAgent::Local::TTS_SCRIPT)
+    assert_includes source, "RECORD_HEADER = struct.Struct('<B3xI')"
+    assert_includes source, 'REC_AUDIO, REC_BOUNDARY, REC_STATUS = 1, 2, 3'
+    assert_equal [VoiceAgent::TtsReader::AUDIO, VoiceAgent::TtsReader::BOUNDARY, VoiceAgent::TtsReader::STATUS], [1, 2, 3]
+    assert_equal 8, VoiceAgent::TtsReader.record(1).bytesize
+  end
+
+  def test_tts_reader_thread_delivers_frames_and_status
+    agent = VoiceAgent::Local.new(api_key: 'test-key', output_rate: 16000)
+    frames = []
+    errors = []
+    agent.instance_variable_set(:@callbacks, on_audio: ->(f) { frames << f }, on_error: ->(m) { errors << m })
+
+    r, w = IO.pipe
+    r.binmode
+    agent.instance_variable_set(:@tts_stdout, r)
+    rec = VoiceAgent::TtsReader
+    w.write(rec.record(rec::STATUS, '{"status":"ready"}'))
+    w.write(rec.record(rec::AUDIO, "\x01\x00".b * 480))  # a frame and a half at 16 kHz
+    w.write(rec.record(rec::STATUS, '{"status":"error","message":"boom"}'))
+    w.write(rec.record(rec::AUDIO, "\x01\x00".b * 160))
+    w.write(rec.record(rec::BOUNDARY))
+    w.close
+
+    agent.send(:tts_audio_reader)
+
+    assert agent.instance_variable_get(:@tts_ready)
+    assert_equal ['boom'], errors
+    assert_equal [640, 640], frames.map(&:bytesize)
+    assert_equal :complete, agent.instance_variable_get(:@audio_done).pop(timeout: 0)
   end
 
   def test_ref_audio_config
@@ -62,4 +95,194 @@ class VoiceAgentLocalTest < Minitest::Test
     )
     refute agent.connected?
   end
+
+  def test_stt_tap_bypasses_send_audio
+    agent = VoiceAgent::Local.new(api_key: 'test-key', stt_tap: '/tmp/ausock.sock.tap')
+    agent.instance_variable_set(:@connected, true)
+    agent.instance_variable_set(:@stt_stdin, stdin = StringIO.new)
+    agent.send_audio("\xFF".b * 160)
+    assert_empty stdin.string, 'STT reads the tap, not stdin'
+
+    agent = VoiceAgent::Local.new(api_key: 'test-key')
+    agent.instance_variable_set(:@connected, true)
+    agent.instance_variable_set(:@stt_stdin, stdin = StringIO.new)
+    agent.send_audio("\xFF".b * 160)
+    assert_equal 320, stdin.string.bytesize
+  end
+
+  def test_interrupt_only_while_speaking
+    agent = VoiceAgent::Local.new(api_key: 'test-key')
+    agent.interrupt
+    refute agent.instance_variable_get(:@interrupt)
+
+    agent.instance_variable_set(:@speaking, true)
+    agent.interrupt
+    assert agent.instance_variable_get(:@interrupt)
+    assert agent.instance_variable_get(:@barged_in), 'remaining TTS audio is dropped'
+  end
+
+  SENTENCES = [
+    'This is the first sentence. ',
+    'Here comes the second one. ',
+    'And then a third sentence. ',
+    'Finally the fourth sentence. ',
+  ].freeze
+
+  # Stands in for @audio_done: each pop runs the block with the TTS
+  # requests so far and returns what it returns
+  class FakeDone
+    def initialize(&block)
+      @block = block
+    end
+
+    def pop(timeout: nil)
+      @block.call
+    end
+
+    def push(_) = nil
+  end
+
+  def speaking_agent(lookahead, **config)
+    agent = VoiceAgent::Local.new(api_key: 'test-key', tts_lookahead: lookahead, **config)
+    agent.instance_variable_set(:@connected, true)
+    agent.instance_variable_set(:@tts_stdin, stdin = StringIO.new)
+    agent.define_singleton_method(:stream_grok_text_api) do |messages:, &block|
+      SENTENCES.each { |t| block.call(t) }
+    end
+    [agent, -> { stdin.string.lines.map { |l| JSON.parse(l) } }]
+  end
+
+  def test_lookahead_queues_sentences_ahead_of_playback
+    [[0, 1], [2, 3]].each do |lookahead, sent_before_first_wait|
+      agent, requests = speaking_agent(lookahead)
+      seen = []
+      agent.instance_variable_set(:@audio_done, FakeDone.new { seen << requests.call.size; :complete })
+
+      agent.send(:stream_and_speak, messages: [])
+
+      assert_equal sent_before_first_wait, seen.first, "lookahead #{lookahead}"
+      assert_equal SENTENCES.size, seen.size, 'one boundary per sentence'
+      assert_equal SENTENCES.map(&:strip), requests.call.map { |r| r['text'].strip }
+    end
+  end
+
+  def test_barge_in_cancels_tts_and_drains_to_its_reply
+    agent, requests = speaking_agent(1)
+    done = []
+    agent.instance_variable_set(:@callbacks, on_response_done: ->(_) { done << true })
+    pops = 0
+    agent.instance_variable_set(:@audio_done, FakeDone.new {
+      pops += 1
+      agent.interrupt if pops == 1  # caller talks over the first sentence
+      pops == 1 ? :complete : :cancelled
+    })
+
+    said = agent.send(:stream_and_speak, messages: [])
+
+    assert_equal [{ 'cancel' => true }], requests.call.select { |r| r['cancel'] }, 'one cancel'
+    assert_equal 2, requests.call.count { |r| r['text'] }, 'nothing sent after the barge-in'
+    assert_equal 2, pops, 'drained up to the cancelled reply'
+    assert_equal SENTENCES.first(2).map(&:strip).join, said
+    assert_empty done
+  end
+
+  def test_turn_stages_are_traced_with_server_stamps
+    agent, = speaking_agent(2)
+    stages = []
+    agent.instance_variable_set(:@callbacks, on_trace: ->(stage, at) { stages << [stage, at] })
+    agent.instance_variable_set(:@awaiting_greeting, false)
+    agent.instance_variable_set(:@stt_stdout, StringIO.new(
+      %({"type":"speech_stopped","t":100}\n{"type":"transcript","text":"Hello there","t":200}\n)
+    ))
+    agent.send(:stt_output_reader)
+    agent.instance_variable_set(:@audio_done, FakeDone.new { :complete })
+    agent.send(:stream_and_speak, messages: [])
+    agent.send(:tts_status, '{"status":"chunk","n":1,"t":400}')
+    agent.send(:tts_status, '{"status":"chunk","n":2,"t":500}')
+
+    assert_equal [[:speech_stop, 100], [:transcript, 200], [:llm_first, nil], [:tts_first, 400]], stages
+  end
+
+  # turning ausock_aec on must not let our echo in as the caller
+  def test_echo_is_suppressed_with_echo_cancelled
+    agent, = speaking_agent(2, echo_cancelled: true)
+    agent.instance_variable_set(:@awaiting_greeting, false)
+    agent.instance_variable_set(:@speaking, true)
+    agent.instance_variable_set(:@stt_stdout, StringIO.new(%({"type":"transcript","text":"Okay."}\n)))
+    agent.send(:stt_output_reader)
+    refute agent.instance_variable_get(:@interrupt), 'a short echo is no barge-in'
+
+    agent.instance_variable_set(:@audio_done, FakeDone.new { :complete })
+    agent.send(:stream_and_speak, messages: [])
+    assert_operator agent.instance_variable_get(:@cooldown_until),
+                    :>, Process.clock_gettime(Process::CLOCK_MONOTONIC), 'cooldown kept'
+  end
+
+  def test_cancelled_status_is_queued_for_stream_and_speak
+    agent = VoiceAgent::Local.new(api_key: 'test-key')
+    agent.send(:tts_status, '{"status":"cancelled","dropped":2}')
+    assert_equal :cancelled, agent.instance_variable_get(:@audio_done).pop(timeout: 0)
+  end
+
+  def test_tts_server_reads_cancel
+    source = File.read(VoiceAgent::Local::TTS_SCRIPT)
+    assert_includes source, 'req.get("cancel")'
+    assert_includes source, '"status": "cancelled"'
+  end
+
+  # Stands in for the kept-alive Net::HTTP: fails the first request
+  # like a connection the server closed, then streams body
+  class FakeHttp
+    attr_reader :requests
+
+    def initialize(body, fail_first: false)
+      @body = body
+      @fail = fail_first
+      @requests = 0
+    end
+
+    def started? = true
+    def finish = nil
+
+    def request(_req)
+      @requests += 1
+      if @fail
+        @fail = false
+        raise EOFError, 'end of file reached'
+      end
+
+      resp = Net::HTTPOK.new('1.1', '200', 'OK')
+      body = @body
+      resp.define_singleton_method(:read_body) { |&blk| body.each { |c| blk.call(c) } }
+      yield resp
+    end
+  end
+
+  def llm_body(*tokens)
+    tokens.map { |t| "data: #{JSON.generate(choices: [{ delta: { content: t } }])}\n\n" } + ["data: [DONE]\n\n"]
+  end
+
+  def test_llm_connection_is_kept_across_turns
+    agent = VoiceAgent::Local.new(api_key: 'test-key')
+    http = FakeHttp.new(llm_body('Hi', ' there'))
+    agent.instance_variable_set(:@llm_http, http)
+
+    2.times do
+      tokens = []
+      assert_equal 'Hi there', agent.send(:stream_grok_text_api, messages: []) { |t| tokens << t }
+      assert_equal ['Hi', ' there'], tokens
+    end
+    assert_equal 2, http.requests
+    assert_same http, agent.instance_variable_get(:@llm_http)
+  end
+
+  def test_llm_retries_once_on_a_dropped_connection
+    agent = VoiceAgent::Local.new(api_key: 'test-key')
+    http = FakeHttp.new(llm_body('Back'), fail_first: true)
+    agent.instance_variable_set(:@llm_http, http)
+    agent.define_singleton_method(:llm_reset) { nil }  # keep the fake
+
+    assert_equal 'Back', agent.send(:stream_grok_text_api, messages: []) { nil }
+    assert_equal 2, http.requests
+  end
 end
@@ -0,0 +1,64 @@
+# frozen_string_literal: true
+
+require_relative 'test_helper'
+require_relative '../lib/voice_agent'
+require_relative '../lib/voice_agent/sse_parser'
+
+class VoiceAgentSseParserTest < Minitest::Test
+  def chunk(content)
+    "data: #{JSON.generate(id: 'x', choices: [{ index: 0, delta: { content: content } }])}\n\n"
+  end
+
+  def feed_all(parser, data)
+    out = []
+    parser.feed(data) { |delta| out << delta }
+    out
+  end
+
+  def test_yields_content_deltas
+    parser = VoiceAgent::SseParser.new
+    out = feed_all(parser, chunk('Hello') + chunk(' there') + "data: [DONE]\n\n")
+    assert_equal ['Hello', ' there'], out
+    assert_equal Encoding::UTF_8, out.first.encoding
+    assert parser.done?
+  end
+
+  def test_byte_at_a_time_gives_the_same_deltas
+    data = chunk('Héllo') + ": keep-alive comment\n" + chunk('wörld') + "data: [DONE]\n"
+    parser = VoiceAgent::SseParser.new
+    out = []
+    data.b.each_char { |c| parser.feed(c) { |d| out << d } }
+    assert_equal %w[Héllo wörld], out
+  end
+
+  def test_escaped_content_is_decoded
+    out = feed_all(VoiceAgent::SseParser.new, chunk("say \"hi\"\n") + chunk('a\\b'))
+    assert_equal ["say \"hi\"\n", 'a\\b'], out
+  end
+
+  def test_crlf_lines
+    out = feed_all(VoiceAgent::SseParser.new, chunk('one').gsub("\n", "\r\n"))
+    assert_equal ['one'], out
+  end
+
+  def test_skips_other_fields
+    data = "data: #{JSON.generate(choices: [{ delta: { role: 'assistant', content: '' } }])}\n" \
+           "data: #{JSON.generate(choices: [{ delta: { reasoning_content: 'thinking' } }])}\n" \
+           "data: #{JSON.generate(choices: [{ delta: { content: nil } }], usage: { total: 3 })}\n" \
+           "event: ping\n" +
+           chunk('ok')
+    assert_equal ['ok'], feed_all(VoiceAgent::SseParser.new, data)
+  end
+
+  def test_content_key_inside_text_is_not_a_field
+    assert_equal ['"content":"x'], feed_all(VoiceAgent::SseParser.new, chunk('"content":"x'))
+  end
+
+  def test_partial_line_waits
+    parser = VoiceAgent::SseParser.new
+    line = chunk('later')
+    assert_empty feed_all(parser, line[0, 20])
+    assert_equal ['later'], feed_all(parser, line[20..])
+    refute parser.done?
+  end
+end
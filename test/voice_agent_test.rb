@@ -92,3 +92,91 @@ class GrokTest < Minitest::Test
     refute @agent.connected?
   end
 end
+
+class GrokAudioTest < Minitest::Test
+  class FakeWs
+    attr_reader :sent
+
+    def initialize
+      @sent = []
+    end
+
+    def send(msg)
+      @sent << msg
+    end
+  end
+
+  Msg = Struct.new(:data)
+
+  def agent(**opts)
+    agent = VoiceAgent::Grok.new(api_key: 'test-key', **opts)
+    @ws = FakeWs.new
+    agent.instance_variable_set(:@ws, @ws)
+    agent.instance_variable_set(:@connected, true)
+    agent
+  end
+
+  def appends
+    @ws.sent.map { |m| JSON.parse(m) }.select { |e| e['type'] == 'input_audio_buffer.append' }
+                                     .map { |e| e['audio'].unpack1('m0') }
+  end
+
+  def test_frames_go_up_in_batches
+    a = agent(uplink_ms: 60)
+    frame = String.new(capacity: 160, encoding: Encoding::BINARY)
+    5.times { |i| a.send_audio(frame.replace((i.chr * 160).b)) }  # the bridge reuses its buffer
+    assert_equal [(0.chr * 160 + 1.chr * 160 + 2.chr * 160).b], appends
+  end
+
+  def test_every_frame_at_20ms
+    a = agent(uplink_ms: 20)
+    2.times { a.send_audio("\xFF".b * 160) }
+    assert_equal 2, appends.size
+  end
+
+  def test_flusher_sends_what_is_held_too_long
+    a = agent(uplink_ms: 40, instructions: 'x')
+    a.send(:on_open)
+    a.send_audio("\x01".b * 160)
+    sleep 0.15
+    assert_equal ["\x01".b * 160], appends
+  ensure
+    a&.instance_variable_set(:@connected, false)
+  end
+
+  def test_audio_delta_decoded_without_json
+    a = agent
+    got = []
+    a.instance_variable_set(:@callbacks, { on_audio: ->(d) { got << d } })
+    audio = (0..255).map(&:chr).join.b * 4
+    msg = %({"event_id":"e1","type":"response.output_audio.delta","response_id":"r","delta":"#{[audio].pack('m0')}"})
+    JSON.stub(:parse, ->(*) { flunk 'parsed' }) { a.send(:on_message, Msg.new(msg)) }
+    assert_equal [audio], got
+  end
+
+  def test_escaped_delta_takes_the_json_path
+    a = agent
+    got = []
+    a.instance_variable_set(:@callbacks, { on_audio: ->(d) { got << d } })
+    audio = "\xFF\xFF\xFF".b
+    b64 = [audio].pack('m0').gsub('/', '\\/')
+    a.send(:on_message, Msg.new(%({"type":"response.output_audio.delta","delta":"#{b64}"})))
+    assert_equal [audio], got
+
+    a.instance_variable_set(:@muted, true)
+    a.send(:on_message, Msg.new(%({"type":"response.output_audio.delta","delta":"AAAA"})))
+    assert_equal 1, got.size, 'muted'
+  end
+
+  def test_turn_stages_are_traced
+    a = agent
+    stages = []
+    a.instance_variable_set(:@callbacks, { on_trace: ->(stage, _at) { stages << stage } })
+    delta = %({"type":"response.output_audio.delta","delta":"AAAA"})
+    [%({"type":"input_audio_buffer.speech_stopped"}),
+     %({"type":"conversation.item.input_audio_transcription.completed","transcript":"hi"}),
+     %({"type":"response.created"}), delta, delta,
+     %({"type":"response.created"}), delta].each { |m| a.send(:on_message, Msg.new(m)) }
+    assert_equal %i[speech_stop transcript llm_first tts_first llm_first tts_first], stages
+  end
+end
@@ -0,0 +1,103 @@
+# frozen_string_literal: true
+
+require_relative 'test_helper'
+require_relative '../lib/voice_agent'
+require_relative '../lib/voice_agent/tts_reader'
+
+# Shared by the pure-Ruby reader and VoiceNative::TtsReader
+module TtsReaderBehaviour
+  REC = VoiceAgent::TtsReader
+
+  def feed_all(reader, data)
+    out = []
+    reader.feed(data) { |type, payload| out << [type, payload] }
+    out
+  end
+
+  def test_cuts_audio_into_frames
+    out = feed_all(reader(4), REC.record(REC::AUDIO, 'abcdefgh'))
+    assert_equal [[:audio, 'abcd'], [:audio, 'efgh']], out
+    assert(out.all? { |_, f| f.encoding == Encoding::BINARY })
+  end
+
+  def test_frames_span_records_and_boundary_pads
+    data = REC.record(REC::AUDIO, 'abcdef') + REC.record(REC::AUDIO, 'ghi') + REC.record(REC::BOUNDARY)
+    out = feed_all(reader(4), data)
+    assert_equal [[:audio, 'abcd'], [:audio, 'efgh'], [:audio, "i\0\0\0"], [:boundary, nil]], out
+  end
+
+  def test_status_is_in_order_with_audio
+    data = REC.record(REC::AUDIO, 'abcd') +
+           REC.record(REC::STATUS, '{"status":"done"}') +
+           REC.record(REC::BOUNDARY)
+    out = feed_all(reader(4), data)
+    assert_equal [:audio, :status, :boundary], out.map(&:first)
+    assert_equal '{"status":"done"}', out[1][1]
+    assert_equal Encoding::UTF_8, out[1][1].encoding
+  end
+
+  def test_byte_at_a_time_gives_the_same_records
+    data = REC.record(REC::STATUS, '{"status":"ready"}') +
+           REC.record(REC::AUDIO, ('x' * 10).b) +
+           REC.record(REC::BOUNDARY)
+    r = reader(4)
+    out = []
+    data.each_char { |c| r.feed(c) { |type, payload| out << [type, payload] } }
+    assert_equal feed_all(reader(4), data), out
+  end
+
+  def test_sentinel_bytes_in_audio_are_just_audio
+    sentinel = [0xDEADBEEF].pack('V')
+    out = feed_all(reader(4), REC.record(REC::AUDIO, sentinel * 2) + REC.record(REC::BOUNDARY))
+    assert_equal [[:audio, sentinel], [:audio, sentinel], [:boundary, nil]], out
+  end
+
+  def test_unknown_records_are_skipped
+    data = REC.record(9, 'whatever') + REC.record(REC::AUDIO, 'abcd')
+    assert_equal [[:audio, 'abcd']], feed_all(reader(4), data)
+  end
+
+  def test_oversized_record_raises
+    assert_raises(IOError) { feed_all(reader(4), [REC::STATUS, 1 << 20].pack(REC::HEADER)) }
+  end
+
+  def test_bad_frame_size_raises
+    assert_raises(ArgumentError) { reader(0) }
+  end
+end
+
+class VoiceAgentTtsReaderTest < Minitest::Test
+  include TtsReaderBehaviour
+
+  def reader(frame_bytes)
+    VoiceAgent::TtsReader.new(frame_bytes)
+  end
+end
+
+class VoiceNativeTtsReaderTest < Minitest::Test
+  include TtsReaderBehaviour
+
+  def setup
+    skip 'voice_native not built (rake compile)' unless VoiceNative.available?
+  end
+
+  def reader(frame_bytes)
+    VoiceNative::TtsReader.new(frame_bytes)
+  end
+
+  def test_build_picks_native
+    assert_kind_of VoiceNative::TtsReader, VoiceAgent::TtsReader.build(320)
+  end
+
+  def test_feed_from_block_raises
+    r = reader(4)
+    assert_raises(RuntimeError) do
+      r.feed(REC.record(REC::AUDIO, 'abcd')) { r.feed('') { nil } }
+    end
+  end
+
+  def test_second_initialize_raises
+    r = reader(4)
+    assert_raises(RuntimeError) { r.send(:initialize, 8) }
+  end
+end
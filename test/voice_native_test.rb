@@ -0,0 +1,81 @@
+# frozen_string_literal: true
+
+require_relative 'test_helper'
+require_relative '../lib/audio_bridge'
+
+class VoiceNativeG711Test < Minitest::Test
+  def setup
+    skip 'voice_native not built (rake compile)' unless VoiceNative.available?
+  end
+
+  def test_encode_matches_ruby_tables_for_every_sample
+    samples = (-32768..32767).to_a
+    expected = samples.map { |s| AudioBridge.linear_to_ulaw(s) }.pack('C*')
+    assert_equal expected, VoiceNative::G711.encode(samples.pack('s<*'))
+  end
+
+  def test_decode_matches_ruby_tables_for_every_byte
+    expected = AudioBridge::ULAW_DECODE.pack('s<*')
+    assert_equal expected, VoiceNative::G711.decode((0..255).to_a.pack('C*'))
+  end
+
+  def test_encode_writes_into_given_buffer
+    out = String.new(capacity: AudioBridge::PCMU_BYTES)
+    frame = ([1000] * AudioBridge::FRAME_SAMPLES).pack('s<*')
+
+    result = VoiceNative::G711.encode(frame, out)
+    assert_same out, result
+    assert_equal AudioBridge::PCMU_BYTES, out.bytesize
+    assert_equal Encoding::BINARY, out.encoding
+  end
+
+  def test_decode_resizes_given_buffer
+    out = String.new('too long' * 100)
+    VoiceNative::G711.decode(([0xFF] * 10).pack('C*'), out)
+    assert_equal ([0] * 10).pack('s<*'), out
+  end
+
+  def test_encode_ignores_trailing_odd_byte
+    assert_equal 1, VoiceNative::G711.encode("\x00\x00\x01".b).bytesize
+  end
+
+  def test_encode_allocates_no_objects_with_buffer
+    frame = ([1000] * AudioBridge::FRAME_SAMPLES).pack('s<*')
+    out = String.new(capacity: AudioBridge::PCMU_BYTES)
+    VoiceNative::G711.encode(frame, out)
+
+    before = GC.stat(:total_allocated_objects)
+    100.times { VoiceNative::G711.encode(frame, out) }
+    assert_operator GC.stat(:total_allocated_objects) - before, :<, 10
+  end
+end
+
+class VoiceNativeSendPacketsTest < Minitest::Test
+  def setup
+    skip 'voice_native not built (rake compile)' unless VoiceNative.available?
+    @a, @b = Socket.pair(:UNIX, :SEQPACKET)
+  end
+
+  def teardown
+    [@a, @b].each { |s| s&.close rescue IOError }
+  end
+
+  def test_sends_one_packet_per_element
+    assert_equal 3, VoiceNative.send_packets(@a, ['one'.b, %w[hdr payload], 'three'.b])
+    assert_equal 'one', @b.recv(64)
+    assert_equal 'hdrpayload', @b.recv(64)
+    assert_equal 'three', @b.recv(64)
+  end
+
+  def test_returns_count_sent_when_socket_is_full
+    batch = ['x'.b * 4096] * 16
+    sent = 1000.times.map { VoiceNative.send_packets(@a, batch) }
+    assert_operator sent.sum, :>, 0
+    assert_equal 0, sent.last
+  end
+
+  def test_raises_once_peer_is_gone
+    @b.close
+    assert_raises(Errno::EPIPE) { VoiceNative.send_packets(@a, ['x'.b]) }
+  end
+end
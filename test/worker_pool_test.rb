@@ -0,0 +1,154 @@
+# frozen_string_literal: true
+
+require_relative 'test_helper'
+require_relative '../lib/worker_pool'
+require_relative '../lib/voice_agent/local'
+require 'rbconfig'
+require 'tmpdir'
+
+class WorkerPoolTest < Minitest::Test
+  REC = VoiceAgent::TtsReader
+
+  # Speaks the tts_server.py protocol: ready, then a reset, cancel or
+  # sentence per stdin line, each a record or two on stdout
+  FAKE_TTS = <<~'RUBY'
+    require 'json'
+    rec = ->(type, payload = '') { $stdout.write([type, payload.bytesize].pack('CxxxV') + payload); $stdout.flush }
+    $stdout.binmode
+    rec.call(3, '{"status":"ready"}')
+    while (line = $stdin.gets)
+      req = JSON.parse(line)
+      if req.key?('reset')
+        rec.call(3, JSON.generate(status: 'reset', inject: req['reset']['inject']))
+      elsif req['cancel']
+        rec.call(3, '{"status":"cancelled","dropped":0}')
+      else
+        rec.call(1, "\x01\x00" * 160)
+        rec.call(2)
+      end
+    end
+  RUBY
+
+  # Speaks the stt_server.py protocol: ready on stderr, resets from the
+  # control fd answered on stdout
+  FAKE_STT = <<~'RUBY'
+    require 'json'
+    fd = ARGV[ARGV.index('--control-fd') + 1].to_i
+    $stdout.sync = true
+    $stderr.puts '{"status":"ready"}'
+    control = IO.new(fd)
+    while (line = control.gets)
+      puts JSON.generate(type: 'reset', tap: JSON.parse(line)['reset']['tap'])
+    end
+  RUBY
+
+  def setup
+    @dir = Dir.mktmpdir('workers')
+    @socket = File.join(@dir, 'workers.sock')
+    File.write(tts_script, FAKE_TTS)
+    File.write(stt_script, FAKE_STT)
+    @pool = WorkerPool.new(@socket, [
+      { kind: 'tts', argv: tts_argv, count: 1 },
+      { kind: 'stt', argv: stt_argv, count: 1 },
+    ]).start
+    wait_for { @pool.stats.values.all? { |s| s[:ready] == 1 } }
+  end
+
+  def teardown
+    @pool.stop
+    FileUtils.rm_rf(@dir)
+  end
+
+  def tts_script = File.join(@dir, 'tts.rb')
+  def stt_script = File.join(@dir, 'stt.rb')
+  def tts_argv = [RbConfig.ruby, tts_script]
+  def stt_argv = [RbConfig.ruby, stt_script]
+
+  def wait_for(timeout = 10)
+    deadline = Time.now + timeout
+    sleep 0.02 until yield || Time.now > deadline
+    assert yield, 'timed out'
+  end
+
+  # Records from the lease's stdout until one matches the block
+  def read_until(io)
+    reader = REC.new(320)
+    out = []
+    until out.any? { |r| yield r }
+      reader.feed(io.readpartial(4096)) { |type, data| out << [type, data && (type == :status ? JSON.parse(data) : data)] }
+    end
+    out
+  end
+
+  def test_lease_resets_and_hands_over_the_pipes
+    lease = WorkerPool.lease(@socket, :tts, tts_argv, inject: '/tmp/x.inject')
+    refute_nil lease
+    assert_equal 1, @pool.stats['tts'][:leased]
+
+    status = read_until(lease.stdout) { |type, data| type == :status && data['status'] == 'reset' }.last[1]
+    assert_equal '/tmp/x.inject', status['inject']
+
+    lease.stdin.write(JSON.generate(text: 'Hello there.') + "\n")
+    lease.stdin.flush
+    out = read_until(lease.stdout) { |type, _| type == :boundary }
+    assert_equal [:audio, :boundary], out.map(&:first)
+
+    pid = lease.pid
+    lease.release(clean: true)
+    wait_for { @pool.stats['tts'][:leased].zero? }
+
+    again = WorkerPool.lease(@socket, :tts, tts_argv)
+    assert_equal pid, again.pid, 'the same warm worker'
+    again.release(clean: true)
+  end
+
+  def test_lease_without_idle_worker_is_nil
+    assert_nil WorkerPool.lease(@socket, :tts, tts_argv + ['--voice', 'eric'])
+
+    lease = WorkerPool.lease(@socket, :tts, tts_argv)
+    assert_nil WorkerPool.lease(@socket, :tts, tts_argv), 'the only one is leased'
+    lease.release(clean: true)
+  end
+
+  def test_no_pool_is_nil
+    assert_nil WorkerPool.lease(File.join(@dir, 'none.sock'), :tts, tts_argv)
+    assert_nil WorkerPool.lease(nil, :tts, tts_argv)
+  end
+
+  def test_unclean_release_replaces_the_worker
+    lease = WorkerPool.lease(@socket, :tts, tts_argv)
+    pid = lease.pid
+    lease.release(clean: false)
+
+    wait_for { @pool.stats['tts'] == { ready: 1, leased: 0, total: 1 } }
+    again = WorkerPool.lease(@socket, :tts, tts_argv)
+    refute_equal pid, again.pid
+    again.release(clean: true)
+  end
+
+  def test_stt_lease_names_the_tap
+    lease = WorkerPool.lease(@socket, :stt, stt_argv, tap: '/tmp/x.tap')
+    assert_equal({ 'type' => 'reset', 'tap' => '/tmp/x.tap' }, JSON.parse(lease.stdout.gets))
+    lease.release(clean: true)
+  end
+
+  def test_local_agent_leases_and_returns_workers
+    agent = VoiceAgent::Local.new(api_key: 'test-key', worker_pool: @socket)
+    argv = { tts: tts_argv, stt: stt_argv }
+    agent.define_singleton_method(:tts_command) { argv[:tts] }
+    agent.define_singleton_method(:stt_command) { argv[:stt] }
+
+    agent.send(:start_tts)
+    agent.send(:start_stt)
+    agent.send(:wait_for_ready)
+    assert_equal({ ready: 1, leased: 1, total: 1 }, @pool.stats['tts'])
+    assert_equal 1, @pool.stats['stt'][:leased]
+    pid = agent.instance_variable_get(:@tts_lease).pid
+
+    agent.disconnect
+    wait_for { @pool.stats.values.all? { |s| s[:leased].zero? } }
+    again = WorkerPool.lease(@socket, :tts, tts_argv)
+    assert_equal pid, again.pid, 'TTS went back clean'
+    again.release(clean: true)
+  end
+end
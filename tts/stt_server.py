@@ -3,12 +3,34 @@
 
 Protocol:
   Input (stdin, binary):
-    Raw S16LE mono 8kHz audio frames (from G.711 decoder / audio bridge)
+    Raw S16LE mono audio at --sample-rate: 8 kHz (from the G.711 decoder)
+    or 16 kHz (wideband calls, passed through by the audio bridge)
+
+  Input (--tap PATH, instead of stdin):
+    The same audio straight from ausock's tap socket (ausock_tap), at
+    the call rate.  The socket exists while a call is up, so it is
+    connected to when it appears and again after each hangup.  stdin
+    then carries nothing; its closing still ends the server.
+
+  Control (--control-fd N, JSON lines; bin/workers):
+    {"reset": {"tap": "/tmp/ausock.sock.tap"}}
+
+    Starts the server over for the next call when the worker pool
+    leases it out: the speech in progress is dropped, and audio comes
+    from the given tap socket, or from stdin without one.  Answered by
+    {"type": "reset"} on stdout; whatever comes before it belongs to
+    the previous call.  Until the first reset no audio is read at all.
 
   Output (stdout, JSON lines):
-    {"type": "transcript", "text": "Hello world", "duration": 2.1, "latency": 0.8}
-    {"type": "speech_started"}
-    {"type": "speech_stopped"}
+    {"type": "transcript", "text": "Hello world", "duration": 2.1, "latency": 0.8, "t": 81234567890}
+    {"type": "speech_started", "t": 81230012345}
+    {"type": "speech_stopped", "t": 81233456789}
+    {"type": "reset"}
+
+    "t" is CLOCK_MONOTONIC in microseconds, the clock ausock stamps its
+    messages with: when speech started, when the last voiced frame
+    before the silence that ended it came in, and when the transcript
+    was ready.  VoiceAgent::Local times turns with it (TurnTrace).
 
   Status (stderr, JSON lines):
     {"status": "ready", "model": "..."}
@@ -21,7 +43,11 @@ Designed to be spawned as a subprocess by Ruby VoiceAgent::Local.
 """
 
 import json
+import os
+import select
+import socket
 import sys
+import threading
 import time
 import struct
 import io
@@ -31,10 +57,8 @@ import numpy as np
 
 
 # VAD parameters
-SAMPLE_RATE = 8000
+WHISPER_RATE = 16000       # Whisper's input rate
 FRAME_MS = 30              # VAD frame size in ms
-FRAME_SAMPLES = int(SAMPLE_RATE * FRAME_MS / 1000)  # 240 samples per frame
-FRAME_BYTES = FRAME_SAMPLES * 2  # S16LE = 2 bytes per sample
 
 # Speech detection thresholds (tuned for 8kHz telephony audio)
 ENERGY_THRESHOLD = 150     # RMS energy threshold for speech
@@ -43,12 +67,152 @@ SILENCE_FRAMES = 30        # Consecutive silent frames to end speech (~900ms)
 MIN_SPEECH_MS = 200        # Minimum speech duration to transcribe
 MAX_SPEECH_S = 30          # Maximum speech duration before forced transcription
 
+TAP_RETRY_S = 0.2          # Interval between attempts to reach the tap socket
+
 
 def rms_energy(samples):
     """Compute RMS energy of int16 samples."""
     return np.sqrt(np.mean(samples.astype(np.float32) ** 2))
 
 
+def stdin_frames(stdin, frame_bytes):
+    """Yield frames read from stdin until it closes."""
+    while True:
+        data = stdin.read(frame_bytes)
+        if not data or len(data) < frame_bytes:
+            return
+        yield data
+
+
+def tap_frames(path, frame_bytes, stdin):
+    """Yield frames from the ausock tap socket until stdin closes.
+
+    ausock sends whole 20 ms frames; they are re-cut to frame_bytes here.
+    The partial frame left over at a hangup is dropped with the socket.
+    """
+    sock = None
+    buf = b""
+    while True:
+        if sock is None:
+            sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            try:
+                sock.connect(path)
+                status({"status": "tap_connected", "path": path})
+            except OSError:
+                sock.close()
+                sock = None
+
+        fds = [stdin] if sock is None else [stdin, sock]
+        ready, _, _ = select.select(fds, [], [],
+                                    TAP_RETRY_S if sock is None else None)
+
+        if stdin in ready and not os.read(stdin.fileno(), 4096):
+            break
+
+        if sock is not None and sock in ready:
+            chunk = sock.recv(65536)
+            if not chunk:
+                status({"status": "tap_closed", "path": path})
+                sock.close()
+                sock = None
+                buf = b""
+                continue
+
+            buf += chunk
+            while len(buf) >= frame_bytes:
+                yield buf[:frame_bytes]
+                buf = buf[frame_bytes:]
+
+    if sock is not None:
+        sock.close()
+
+
+class Control:
+    """Resets from the worker pool, read on a thread of their own.
+
+    Each reset starts a new epoch.  Output is stamped with the epoch its
+    speech began in and dropped once that is over, so a transcript of
+    the previous caller that is still being worked on when the lease
+    changes hands never reaches the next one.
+    """
+
+    def __init__(self, fd):
+        self.lock = threading.Lock()
+        self.epoch = 0
+        self.tap = None
+        self.leased = False  # until the first reset
+        threading.Thread(target=self._read, args=(fd,), daemon=True).start()
+
+    def _read(self, fd):
+        for line in os.fdopen(fd, "r"):
+            try:
+                reset = json.loads(line).get("reset")
+            except (json.JSONDecodeError, AttributeError):
+                continue
+            if reset is None:
+                continue
+
+            with self.lock:
+                self.epoch += 1
+                self.tap = reset.get("tap")
+                self.leased = True
+                write({"type": "reset"})
+
+
+def leased_frames(control, stdin, frame_bytes):
+    """Yield frames for whichever call holds the lease until stdin closes.
+
+    Audio comes from the tap socket the lease names, or from stdin when
+    it names none; stdin is read either way, to notice it closing.
+    """
+    sock = None
+    path = None
+    epoch = None
+    buf = b""
+    while True:
+        if control.epoch != epoch:  # a new lease
+            if sock is not None:
+                sock.close()
+                sock = None
+            epoch, path, buf = control.epoch, control.tap, b""
+
+        if path and sock is None:
+            sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            try:
+                sock.connect(path)
+                status({"status": "tap_connected", "path": path})
+            except OSError:
+                sock.close()
+                sock = None
+
+        fds = [stdin] if sock is None else [stdin, sock]
+        ready, _, _ = select.select(fds, [], [], TAP_RETRY_S)
+
+        if stdin in ready:
+            data = os.read(stdin.fileno(), 65536)
+            if not data:
+                break
+            if control.leased and not path:
+                buf += data
+
+        if sock is not None and sock in ready:
+            chunk = sock.recv(65536)
+            if not chunk:
+                status({"status": "tap_closed", "path": path})
+                sock.close()
+                sock = None
+                buf = b""
+                continue
+            buf += chunk
+
+        while len(buf) >= frame_bytes:
+            yield buf[:frame_bytes]
+            buf = buf[frame_bytes:]
+
+    if sock is not None:
+        sock.close()
+
+
 def main():
     import argparse
     parser = argparse.ArgumentParser(description="STT stdin/stdout server")
@@ -58,20 +222,37 @@ def main():
                         help="RMS energy threshold for VAD")
     parser.add_argument("--min-speech-ms", type=float, default=MIN_SPEECH_MS,
                         help="Minimum speech duration (ms) to transcribe")
+    parser.add_argument("--sample-rate", type=int, default=8000, choices=[8000, 16000],
+                        help="Input sample rate (16000 for wideband calls)")
+    parser.add_argument("--tap", metavar="PATH",
+                        help="Read caller audio from this ausock tap socket, not stdin")
+    parser.add_argument("--control-fd", type=int, metavar="FD",
+                        help="Take resets from the worker pool on this fd")
     args = parser.parse_args()
 
+    sample_rate = args.sample_rate
+    frame_bytes = sample_rate * FRAME_MS // 1000 * 2  # S16LE = 2 bytes per sample
+
     import mlx_whisper
 
     status({"status": "loading", "model": args.model})
 
     # Warmup whisper — first transcription is slow
     status({"status": "warming_up"})
-    silence = np.zeros(SAMPLE_RATE, dtype=np.float32)  # 1s of silence
+    silence = np.zeros(WHISPER_RATE, dtype=np.float32)  # 1s of silence
     mlx_whisper.transcribe(silence, path_or_hf_repo=args.model, language="en")
 
-    status({"status": "ready", "model": args.model, "sample_rate": SAMPLE_RATE})
+    status({"status": "ready", "model": args.model, "sample_rate": sample_rate})
 
+    global control
     stdin = sys.stdin.buffer
+    if args.control_fd is not None:
+        control = Control(args.control_fd)
+        frames = leased_frames(control, stdin, frame_bytes)
+    elif args.tap:
+        frames = tap_frames(args.tap, frame_bytes, stdin)
+    else:
+        frames = stdin_frames(stdin, frame_bytes)
     energy_threshold = args.energy_threshold
 
     # State machine
@@ -80,13 +261,19 @@ def main():
     silence_frames = 0
     audio_buffer = []  # list of int16 arrays
     speech_start_time = None
+    last_voice_us = None    # monotonic_us() of the last voiced frame
 
     frame_count = 0
+    epoch = control.epoch
 
-    while True:
-        data = stdin.read(FRAME_BYTES)
-        if not data or len(data) < FRAME_BYTES:
-            break
+    for data in frames:
+        if control.epoch != epoch:  # leased to the next call
+            epoch = control.epoch
+            in_speech = False
+            audio_buffer.clear()
+            speech_frames = 0
+            silence_frames = 0
+            speech_start_time = None
 
         frame_count += 1
         samples = np.frombuffer(data, dtype=np.int16)
@@ -103,7 +290,8 @@ def main():
                     in_speech = True
                     silence_frames = 0
                     speech_start_time = time.monotonic()
-                    output({"type": "speech_started"})
+                    last_voice_us = monotonic_us()
+                    output({"type": "speech_started", "t": last_voice_us}, epoch)
             else:
                 speech_frames = 0
                 # Keep a small rolling buffer for pre-speech context
@@ -115,6 +303,7 @@ def main():
 
             if is_voiced:
                 silence_frames = 0
+                last_voice_us = monotonic_us()
             else:
                 silence_frames += 1
 
@@ -126,14 +315,14 @@ def main():
 
             if force_end or natural_end:
                 in_speech = False
-                output({"type": "speech_stopped"})
+                output({"type": "speech_stopped", "t": last_voice_us}, epoch)
 
                 # Transcribe if long enough
                 speech_ms = speech_duration * 1000
                 if speech_ms >= args.min_speech_ms:
                     all_audio = np.concatenate(audio_buffer)
-                    transcribe_and_output(all_audio, speech_start_time,
-                                          args.model, mlx_whisper)
+                    transcribe_and_output(all_audio, sample_rate,
+                                          args.model, mlx_whisper, epoch)
 
                 # Reset
                 audio_buffer.clear()
@@ -143,23 +332,26 @@ def main():
 
     # Handle any remaining speech
     if in_speech and audio_buffer and speech_start_time:
-        output({"type": "speech_stopped"})
+        output({"type": "speech_stopped", "t": last_voice_us}, epoch)
         all_audio = np.concatenate(audio_buffer)
-        transcribe_and_output(all_audio, speech_start_time,
-                              args.model, mlx_whisper)
+        transcribe_and_output(all_audio, sample_rate,
+                              args.model, mlx_whisper, epoch)
 
 
-def transcribe_and_output(audio_s16_8k, speech_start_time, model_name, mlx_whisper):
-    """Resample to 16kHz float32, run Whisper, emit transcript."""
+def transcribe_and_output(audio_s16, sample_rate, model_name, mlx_whisper, epoch):
+    """Bring to 16kHz float32, run Whisper, emit transcript."""
     import soxr
 
     t0 = time.monotonic()
 
     # Convert S16LE int16 → float32 normalized
-    audio_f32 = audio_s16_8k.astype(np.float32) / 32768.0
+    audio_f32 = audio_s16.astype(np.float32) / 32768.0
 
-    # Resample 8kHz → 16kHz (Whisper's expected rate)
-    audio_16k = soxr.resample(audio_f32, 8000, 16000)
+    # Whisper expects 16kHz; wideband calls already are
+    if sample_rate == WHISPER_RATE:
+        audio_16k = audio_f32
+    else:
+        audio_16k = soxr.resample(audio_f32, sample_rate, WHISPER_RATE)
 
     # Transcribe
     result = mlx_whisper.transcribe(
@@ -171,7 +363,7 @@ def transcribe_and_output(audio_s16_8k, speech_start_time, model_name, mlx_whisp
 
     text = result.get("text", "").strip()
     latency = time.monotonic() - t0
-    duration = len(audio_s16_8k) / 8000.0
+    duration = len(audio_s16) / sample_rate
 
     if text:
         output({
@@ -179,11 +371,32 @@ def transcribe_and_output(audio_s16_8k, speech_start_time, model_name, mlx_whisp
             "text": text,
             "duration": round(duration, 2),
             "latency": round(latency, 2),
-        })
+            "t": monotonic_us(),
+        }, epoch)
+
+
+class Unleased:
+    """Control stand-in when the server is not in the worker pool."""
+    lock = threading.Lock()
+    epoch = 0
+
+
+control = Unleased
+
+
+def monotonic_us():
+    """CLOCK_MONOTONIC in us; time.monotonic() is another clock on macOS."""
+    return time.clock_gettime_ns(time.CLOCK_MONOTONIC) // 1000
+
+
+def output(msg, epoch):
+    """Write a JSON line to stdout, unless a reset has come since epoch."""
+    with control.lock:
+        if epoch == control.epoch:
+            write(msg)
 
 
-def output(msg):
-    """Write a JSON line to stdout."""
+def write(msg):
     sys.stdout.write(json.dumps(msg) + "\n")
     sys.stdout.flush()
 
@@ -1,36 +1,252 @@
 #!/usr/bin/env python3
-"""TTS server — reads JSON lines from stdin, writes raw audio frames to stdout.
+"""TTS server — reads JSON lines from stdin, writes audio and status records to stdout.
 
 Protocol:
   Input (stdin, JSON lines):
     {"text": "Hello world", "voice": "eric", "instruct": "confident tone"}
     {"text": "Hello", "ref_audio": "/path/to/clip.wav", "ref_text": "transcript"}
-
-  Output (stdout, binary):
-    Raw S16LE mono 8kHz audio frames (ready for G.711 conversion), padded to
-    320-byte frame boundaries. Each utterance ends with a 4-byte sentinel
-    (0xDEAD_BEEF) so the reader can flush its buffer between utterances.
-
-  Status (stderr, JSON lines):
-    {"status": "ready", "model": "...", "sample_rate": 8000}
-    {"status": "generating", "text_length": 42}
-    {"status": "chunk", "n": 1, "samples": 12000, "bytes": 24000}
-    {"status": "done", "audio_duration": 2.8, "gen_time": 2.1, "rtf": 1.33}
-    {"status": "error", "message": "..."}
+    {"cancel": true}
+    {"reset": {"inject": "/tmp/ausock.sock.inject"}}
+
+    Requests queue up: a client can send the next sentences while the
+    first is still being spoken, and each is generated as soon as the
+    one before it is done.  Every line but a cancel or reset is
+    answered by exactly one REC_BOUNDARY, after its audio (if any).  A
+    cancel stops the utterance being generated at its next chunk (it
+    still ends with its boundary), drops every request queued before
+    the cancel without a boundary, and is answered by a
+    {"status": "cancelled"} record once that is done.  stdin is read on a thread of its own, so a cancel
+    takes effect mid-utterance.
+
+    A reset starts the server over for the next call when bin/workers
+    leases it out: it cancels like a cancel does, then points the audio
+    at the given inject socket (or stdout, without one) and is answered
+    by {"status": "reset"}.  Everything before that record belongs to
+    the previous call.
+
+  Output (stdout, binary records):
+    Each record is an 8-byte header, type (u8), 3 reserved bytes and
+    payload length (u32 LE), then the payload (VoiceAgent::TtsReader):
+
+    REC_AUDIO     S16LE mono audio at --sample-rate (8 kHz, ready for
+                  G.711 conversion, 16 kHz for wideband, or the model's
+                  native 24 kHz with no resampling at all, for ausock to
+                  resample).  Each utterance is padded to a 20 ms frame
+                  boundary (320, 640 or 960 bytes).
+    REC_BOUNDARY  end of an utterance, no payload.
+    REC_STATUS    one JSON object, in order with the audio:
+      {"status": "ready", "model": "...", "sample_rate": 8000}
+      {"status": "generating", "text_length": 42}
+      {"status": "chunk", "n": 1, "samples": 12000, "bytes": 24000, "t": 81234567890}
+      {"status": "done", "audio_duration": 2.8, "gen_time": 2.1, "rtf": 1.33}
+      {"status": "error", "message": "..."}
+      {"status": "cancelled", "dropped": 2}
+      {"status": "reset", "dropped": 0}
+
+    "t" is CLOCK_MONOTONIC in microseconds, the clock ausock stamps its
+    messages with, taken once the chunk's audio was written out, so
+    VoiceAgent::Local can time turns with it (TurnTrace).
+
+    Anything else that writes to stdout (prints, progress bars, model
+    internals) is sent to stderr, which is a plain log.
+
+  Output (--inject PATH):
+    While the ausock inject socket (ausock_inject) is there, the audio
+    goes to it instead, as framed AUDIO messages with a MARK after each
+    utterance, and stdout only carries boundaries and status.  Without
+    it (no call up yet, or a call just ended) output falls back to
+    stdout.
 
 The server keeps the model loaded in memory between requests.
 Designed to be spawned as a subprocess by Ruby VoiceAgent::Local.
 """
 
 import json
+import os
+import queue
+import socket
 import sys
+import threading
 import time
 import struct
 
-# Sentinel bytes written after each utterance's audio data.
-# Ruby reader uses this to flush partial-frame buffers between utterances.
-UTTERANCE_BOUNDARY = struct.pack('<I', 0xDEADBEEF)
-FRAME_BYTES = 320  # S16LE mono 8kHz, 160 samples = 20ms
+# stdout records: type, length (see VoiceAgent::TtsReader)
+RECORD_HEADER = struct.Struct('<B3xI')
+REC_AUDIO, REC_BOUNDARY, REC_STATUS = 1, 2, 3
+MODEL_RATE = 24000  # Qwen3-TTS output rate
+
+
+class Records:
+    """The record stream on the real stdout.
+
+    Opened on a copy of fd 1, which is then pointed at stderr, so
+    nothing but records can ever reach the reader.
+    """
+
+    def __init__(self):
+        self.out = os.fdopen(os.dup(sys.stdout.fileno()), "wb", buffering=0)
+        sys.stdout.flush()
+        os.dup2(sys.stderr.fileno(), sys.stdout.fileno())
+
+    def write(self, rec_type, payload=b""):
+        self.out.write(RECORD_HEADER.pack(rec_type, len(payload)) + payload)
+
+    def audio(self, pcm):
+        if pcm:
+            self.write(REC_AUDIO, pcm)
+
+    def boundary(self):
+        self.write(REC_BOUNDARY)
+
+    def status(self, msg):
+        self.write(REC_STATUS, json.dumps(msg).encode())
+
+
+records = None
+
+
+class Requests:
+    """stdin, read on a thread of its own so a cancel gets through.
+
+    Each request is stamped with the cancel generation it arrived in;
+    a cancel starts a new one, which makes every request stamped
+    before it stale, the one being generated included.
+    """
+
+    CANCEL = object()
+    RESET = object()
+
+    def __init__(self):
+        self.queue = queue.Queue()
+        self.gen = 0
+        threading.Thread(target=self._read, daemon=True).start()
+
+    def _read(self):
+        for line in sys.stdin:
+            line = line.strip()
+            if not line:
+                continue
+
+            try:
+                req = json.loads(line)
+            except json.JSONDecodeError as e:
+                req = {"error": f"Invalid JSON: {e}"}
+
+            if isinstance(req, dict) and "reset" in req:
+                self.gen += 1
+                self.queue.put((self.RESET, req.get("reset") or {}))
+            elif isinstance(req, dict) and req.get("cancel"):
+                self.gen += 1
+                self.queue.put(self.CANCEL)
+            else:
+                self.queue.put((self.gen, req))
+
+        self.queue.put(None)  # EOF
+
+    def get(self):
+        return self.queue.get()
+
+    def stale(self, gen):
+        return gen != self.gen
+
+# ausock_proto.h: message header, the HELLO payload and message types
+MSG_HEADER = struct.Struct('<BBHIQ')        # type, flags, len, seq, ts
+MSG_HELLO_PAYLOAD = struct.Struct('<IHBBIHHIHH')
+MSG_HELLO, MSG_AUDIO, MSG_MARK = 1, 2, 4
+
+
+class Injector:
+    """Agent audio straight into ausock's inject socket.
+
+    Whole frames are sent as AUDIO messages; a partial one waits for
+    the rest.  Sends block while ausock's queue is full, which paces
+    generation to playout just as the pipe to Ruby did.
+    """
+
+    def __init__(self, path, frame_bytes):
+        self.path = path
+        self.frame_bytes = frame_bytes
+        self.sock = None
+        self.pending = b""
+        self.seq = 0
+
+    def connect(self):
+        """Reach the socket if it is there; True once connected."""
+        if self.sock:
+            return True
+
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        try:
+            sock.connect(self.path)
+            hello = self._recv(sock, MSG_HEADER.size + MSG_HELLO_PAYLOAD.size)
+        except OSError:
+            sock.close()
+            return False
+
+        msg_type = MSG_HEADER.unpack_from(hello)[0]
+        in_frame_bytes = MSG_HELLO_PAYLOAD.unpack_from(hello, MSG_HEADER.size)[8]
+        if msg_type != MSG_HELLO or in_frame_bytes != self.frame_bytes:
+            status({"status": "error",
+                    "message": f"inject socket wants {in_frame_bytes}-byte frames, "
+                               f"not {self.frame_bytes}"})
+            sock.close()
+            return False
+
+        self.sock = sock
+        status({"status": "inject_connected", "path": self.path})
+        return True
+
+    def close(self):
+        if self.sock:
+            self.sock.close()
+            self.sock = None
+        self.pending = b""
+
+    def write(self, data):
+        """Send the whole frames of data; False once the socket is gone."""
+        data = self.pending + data
+        whole = len(data) - len(data) % self.frame_bytes
+        self.pending = data[whole:]
+
+        out = bytearray()
+        for off in range(0, whole, self.frame_bytes):
+            out += self._header(MSG_AUDIO, self.frame_bytes)
+            out += data[off:off + self.frame_bytes]
+        return self._send(out)
+
+    def end(self):
+        """Pad out the last frame and mark the end of the utterance."""
+        if self.pending:
+            pad = b'\x00' * (self.frame_bytes - len(self.pending))
+            if not self.write(pad):
+                return False
+        return self._send(self._header(MSG_MARK, 0))
+
+    def _header(self, msg_type, length):
+        hdr = MSG_HEADER.pack(msg_type, 0, length, self.seq, monotonic_us())
+        self.seq = (self.seq + 1) & 0xFFFFFFFF
+        return hdr
+
+    def _send(self, data):
+        try:
+            self.sock.sendall(data)
+            return True
+        except OSError:
+            status({"status": "inject_closed", "path": self.path})
+            self.sock.close()
+            self.sock = None
+            self.pending = b""
+            return False
+
+    @staticmethod
+    def _recv(sock, n):
+        data = b""
+        while len(data) < n:
+            chunk = sock.recv(n - len(data))
+            if not chunk:
+                raise ConnectionResetError("inject socket closed")
+            data += chunk
+        return data
 
 
 def main():
@@ -42,8 +258,19 @@ def main():
     parser.add_argument("--instruct", default=None, help="Default CustomVoice instruction")
     parser.add_argument("--ref-audio", default=None, help="Default reference audio for voice cloning")
     parser.add_argument("--ref-text", default=None, help="Default reference audio transcript")
+    parser.add_argument("--sample-rate", type=int, default=8000, choices=[8000, 16000, MODEL_RATE],
+                        help="Output sample rate (16000 for wideband calls, "
+                             "24000 to leave resampling to ausock)")
+    parser.add_argument("--inject", metavar="PATH",
+                        help="Write audio to this ausock inject socket while it is there")
     args = parser.parse_args()
 
+    sample_rate = args.sample_rate
+    frame_bytes = sample_rate // 50 * 2  # S16LE mono, 20 ms
+
+    global records
+    records = Records()
+
     # Determine model
     if args.model:
         model_name = args.model
@@ -81,34 +308,48 @@ def main():
     for _ in model.generate(**warmup_kwargs):
         pass
 
-    status({"status": "ready", "model": model_name, "sample_rate": 8000})
+    status({"status": "ready", "model": model_name, "sample_rate": sample_rate})
 
-    stdout = sys.stdout.buffer
+    injector = Injector(args.inject, frame_bytes) if args.inject else None
 
-    # Flush any bytes leaked to stdout during warmup (e.g. from progress bars
-    # or model internals). Write a sentinel so the Ruby reader discards them.
-    stdout.write(UTTERANCE_BOUNDARY)
-    stdout.flush()
+    requests = Requests()
+    dropped = 0
 
     # Process requests
     while True:
-        line = sys.stdin.readline()
-        if not line:  # EOF
+        item = requests.get()
+        if item is None:  # EOF
             break
 
-        line = line.strip()
-        if not line:
+        if item is Requests.CANCEL:
+            status({"status": "cancelled", "dropped": dropped})
+            dropped = 0
             continue
 
-        try:
-            req = json.loads(line)
-        except json.JSONDecodeError as e:
-            status({"status": "error", "message": f"Invalid JSON: {e}"})
+        gen, req = item
+        if gen is Requests.RESET:
+            if injector:
+                injector.close()
+            path = req.get("inject")
+            injector = Injector(path, frame_bytes) if path else None
+            status({"status": "reset", "dropped": dropped})
+            dropped = 0
+            continue
+
+        if requests.stale(gen):
+            dropped += 1
             continue
 
-        text = req.get("text", "").strip()
+        if not isinstance(req, dict) or "error" in req:
+            message = req.get("error") if isinstance(req, dict) else "Not a JSON object"
+            status({"status": "error", "message": message})
+            records.boundary()
+            continue
+
+        text = str(req.get("text", "")).strip()
         if not text:
             status({"status": "error", "message": "Empty text"})
+            records.boundary()
             continue
 
         voice = req.get("voice", default_voice)
@@ -119,6 +360,16 @@ def main():
         status({"status": "generating", "text_length": len(text)})
         t0 = time.monotonic()
 
+        # where this utterance's audio goes; stdout if the socket fails
+        inject = injector is not None and injector.connect()
+
+        def put(pcm):
+            nonlocal inject
+            if inject and injector.write(pcm):
+                return
+            inject = False
+            records.audio(pcm)
+
         try:
             gen_kwargs = dict(
                 text=text,
@@ -137,52 +388,59 @@ def main():
                 gen_kwargs["voice"] = voice
                 gen_kwargs["instruct"] = instruct
 
-            resampler = soxr.ResampleStream(24000, 8000, num_channels=1, dtype='float32')
+            # At the model rate chunks go out as generated
+            resampler = None
+            if sample_rate != MODEL_RATE:
+                resampler = soxr.ResampleStream(MODEL_RATE, sample_rate, num_channels=1, dtype='float32')
             total_bytes = 0
             chunk_count = 0
+            cancelled = False
 
             for result in model.generate(**gen_kwargs):
+                if requests.stale(gen):
+                    cancelled = True  # barge-in: drop the rest
+                    break
+
                 chunk_24k = np.array(result.audio, dtype=np.float32)
                 chunk_count += 1
 
-                chunk_8k = resampler.resample_chunk(chunk_24k, last=False)
-                if chunk_8k.size == 0:
+                chunk_out = resampler.resample_chunk(chunk_24k, last=False) if resampler else chunk_24k
+                if chunk_out.size == 0:
                     continue
 
-                s16 = np.clip(chunk_8k * 32767, -32768, 32767).astype(np.int16)
-                stdout.write(s16.tobytes())
-                stdout.flush()
+                s16 = np.clip(chunk_out * 32767, -32768, 32767).astype(np.int16)
+                put(s16.tobytes())
                 total_bytes += len(s16) * 2
 
                 status({"status": "chunk", "n": chunk_count,
-                        "samples": len(s16), "bytes": total_bytes})
+                        "samples": len(s16), "bytes": total_bytes,
+                        "t": monotonic_us()})
 
             # Flush remaining samples buffered in the resampler
-            tail = resampler.resample_chunk(np.array([], dtype=np.float32), last=True)
+            tail = np.array([])
+            if resampler and not cancelled:
+                tail = resampler.resample_chunk(np.array([], dtype=np.float32), last=True)
             if tail.size > 0:
                 s16 = np.clip(tail * 32767, -32768, 32767).astype(np.int16)
-                stdout.write(s16.tobytes())
+                put(s16.tobytes())
                 total_bytes += len(s16) * 2
 
-            if chunk_count == 0:
+            if chunk_count == 0 and not cancelled:
                 status({"status": "error", "message": "No audio generated"})
-                stdout.write(UTTERANCE_BOUNDARY)
-                stdout.flush()
+                records.boundary()
                 continue
 
             # Pad final output to frame boundary
-            remainder = total_bytes % FRAME_BYTES
+            remainder = total_bytes % frame_bytes
             if remainder:
-                pad = b'\x00' * (FRAME_BYTES - remainder)
-                stdout.write(pad)
-                total_bytes += len(pad)
+                total_bytes += frame_bytes - remainder
+            if not (inject and injector.end()) and remainder:
+                records.audio(b'\x00' * (frame_bytes - remainder))
 
-            # End-of-utterance sentinel
-            stdout.write(UTTERANCE_BOUNDARY)
-            stdout.flush()
+            records.boundary()
 
             gen_time = time.monotonic() - t0
-            audio_duration = (total_bytes / 2) / 8000.0
+            audio_duration = (total_bytes / 2) / sample_rate
             rtf = audio_duration / gen_time if gen_time > 0 else 0
 
             status({
@@ -192,20 +450,30 @@ def main():
                 "rtf": round(rtf, 2),
                 "chunks": chunk_count,
                 "bytes": total_bytes,
+                "cancelled": cancelled,
             })
 
         except Exception as e:
             import traceback
             status({"status": "error", "message": str(e),
                     "traceback": traceback.format_exc()})
+            records.boundary()  # the reader is waiting for this utterance
 
     status({"status": "shutdown"})
 
 
+def monotonic_us():
+    """CLOCK_MONOTONIC in us; time.monotonic() is another clock on macOS."""
+    return time.clock_gettime_ns(time.CLOCK_MONOTONIC) // 1000
+
+
 def status(msg):
-    """Write a JSON status line to stderr."""
-    sys.stderr.write(json.dumps(msg) + "\n")
-    sys.stderr.flush()
+    """Send a status record, or log it to stderr before the stream is up."""
+    if records:
+        records.status(msg)
+    else:
+        sys.stderr.write(json.dumps(msg) + "\n")
+        sys.stderr.flush()
 
 
 if __name__ == "__main__":